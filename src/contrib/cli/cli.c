@@ -88,7 +88,7 @@ int parse_args(int argc, char *argv[])
 
         if (!strcmp(param, "-protocol")) {
             cli_request.protocol = val;
-            if (!strcmp(val, "modbus_tcp")) {
+            if (!strcmp(val, "modbus_tcp") || !strcmp(val, "modbus_udp")) {
                 cli_request.plc = NULL;
                 cli_request.path = "0";
             }
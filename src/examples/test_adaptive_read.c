@@ -0,0 +1,262 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Check adaptive automatic reads (auto_sync_read_max_ms) against the
+ * emulator.
+ *
+ *  - The bounds read back in both the _ms and _us forms, can be changed
+ *    and reject a minimum above the maximum.
+ *  - While the data does not change, auto_sync_read_us must double after
+ *    each read until it reaches the maximum.
+ *  - When another tag writes a new value, the next read must drop the
+ *    period back to the minimum, after which it doubles again.
+ *
+ * Usage: test_adaptive_read [gateway]
+ *
+ * Run against ab_server --plc=ControlLogix --path=1,0 --tag=TestDINT:DINT[1]
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define ADAPTIVE_TAG_ATTRIBS "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&name=TestDINT&auto_sync_read_ms=10&auto_sync_read_max_us=50000"
+#define WRITER_TAG_ATTRIBS "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&name=TestDINT"
+
+#define DEFAULT_GATEWAY "127.0.0.1"
+#define MIN_PERIOD_US (20000)
+#define MAX_PERIOD_US (320000)
+#define MAX_STEPS (16)
+#define POLL_MS (2)
+#define SETTLE_MS (2000)
+#define DATA_TIMEOUT (5000)
+
+static const char *gateway = DEFAULT_GATEWAY;
+
+static int failures = 0;
+
+
+static void check(int ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+static int32_t create_tag(const char *fmt)
+{
+    char attribs[256];
+    int32_t tag = 0;
+
+    snprintf(attribs, sizeof(attribs), fmt, gateway);
+
+    tag = plc_tag_create(attribs, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "Error %s creating tag %s!\n", plc_tag_decode_error(tag), attribs);
+        exit(1);
+    }
+
+    return tag;
+}
+
+
+static void expect_attribute(int32_t tag, const char *attrib, int expected)
+{
+    int val = plc_tag_get_int_attribute(tag, attrib, INT_MIN);
+
+    if(val != expected) {
+        fprintf(stderr, "Attribute \"%s\" is %d, expected %d.\n", attrib, val, expected);
+        check(0, "attribute has the expected value");
+    }
+}
+
+
+static void expect_set(int32_t tag, const char *attrib, int new_val, int expected_rc)
+{
+    int rc = plc_tag_set_int_attribute(tag, attrib, new_val);
+
+    if(rc != expected_rc) {
+        fprintf(stderr, "Setting \"%s\" to %d returned %s, expected %s.\n", attrib, new_val, plc_tag_decode_error(rc), plc_tag_decode_error(expected_rc));
+        check(0, "attribute set returns the expected status");
+    }
+}
+
+
+/* the creation attributes and setting the bounds afterward. */
+static void check_bounds(int32_t tag)
+{
+    /* the minimum defaults to the read period. */
+    expect_attribute(tag, "auto_sync_read_min_ms", 10);
+    expect_attribute(tag, "auto_sync_read_min_us", 10000);
+    expect_attribute(tag, "auto_sync_read_max_ms", 50);
+    expect_attribute(tag, "auto_sync_read_max_us", 50000);
+
+    expect_set(tag, "auto_sync_read_min_us", 2500, PLCTAG_STATUS_OK);
+    expect_attribute(tag, "auto_sync_read_min_us", 2500);
+
+    expect_set(tag, "auto_sync_read_max_ms", 100, PLCTAG_STATUS_OK);
+    expect_attribute(tag, "auto_sync_read_max_us", 100000);
+
+    /* the minimum cannot go above the maximum. */
+    expect_set(tag, "auto_sync_read_min_ms", 200, PLCTAG_ERR_OUT_OF_BOUNDS);
+    expect_attribute(tag, "auto_sync_read_min_us", 2500);
+
+    /* a zero maximum turns adaptive reads off at the minimum period. */
+    expect_set(tag, "auto_sync_read_max_us", 0, PLCTAG_STATUS_OK);
+    expect_attribute(tag, "auto_sync_read_us", 2500);
+    expect_attribute(tag, "auto_sync_read_max_us", 0);
+
+    /* and back on for the rest of the test. */
+    expect_set(tag, "auto_sync_read_max_us", MAX_PERIOD_US, PLCTAG_STATUS_OK);
+    expect_set(tag, "auto_sync_read_min_us", MIN_PERIOD_US, PLCTAG_STATUS_OK);
+    expect_attribute(tag, "auto_sync_read_us", MIN_PERIOD_US);
+}
+
+
+/*
+ * Watch auto_sync_read_us from the minimum until it sits at the maximum.
+ * Each new value must be twice the one before, capped at the maximum.
+ */
+
+static void check_doubling(int32_t tag, const char *pass)
+{
+    int steps[MAX_STEPS];
+    int num_steps = 0;
+    int64_t timeout = util_time_ms() + SETTLE_MS;
+
+    /* wait for the period to drop to the minimum first. */
+    while(plc_tag_get_int_attribute(tag, "auto_sync_read_us", 0) != MIN_PERIOD_US && util_time_ms() < timeout) {
+        util_sleep_ms(POLL_MS);
+    }
+
+    steps[num_steps++] = plc_tag_get_int_attribute(tag, "auto_sync_read_us", 0);
+
+    while(steps[num_steps - 1] != MAX_PERIOD_US && num_steps < MAX_STEPS && util_time_ms() < timeout) {
+        int period = plc_tag_get_int_attribute(tag, "auto_sync_read_us", 0);
+
+        if(period != steps[num_steps - 1]) {
+            steps[num_steps++] = period;
+        }
+
+        util_sleep_ms(POLL_MS);
+    }
+
+    fprintf(stderr, "%s:", pass);
+    for(int i=0; i < num_steps; i++) {
+        fprintf(stderr, " %dus", steps[i]);
+    }
+    fprintf(stderr, "\n");
+
+    check(steps[0] == MIN_PERIOD_US, "the period starts at the minimum");
+    check(steps[num_steps - 1] == MAX_PERIOD_US, "the period reaches the maximum");
+
+    for(int i=1; i < num_steps; i++) {
+        int expected = steps[i - 1] * 2;
+
+        if(expected > MAX_PERIOD_US) {
+            expected = MAX_PERIOD_US;
+        }
+
+        check(steps[i] == expected, "the period doubles after each read of unchanged data");
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    int32_t tag = 0;
+    int32_t writer = 0;
+    int32_t new_value = 0;
+    int64_t timeout = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc > 1) {
+        gateway = argv[1];
+    }
+
+    writer = create_tag(WRITER_TAG_ATTRIBS);
+    tag = create_tag(ADAPTIVE_TAG_ATTRIBS);
+
+    check_bounds(tag);
+
+    /* the data has not changed since the first read. */
+    check_doubling(tag, "unchanged");
+
+    /* a new value from another tag is seen on the next read. */
+    check(plc_tag_read(writer, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "read the old value through the other tag");
+    new_value = plc_tag_get_int32(writer, 0) + 1;
+    plc_tag_set_int32(writer, 0, new_value);
+    check(plc_tag_write(writer, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "write a new value through the other tag");
+
+    timeout = util_time_ms() + SETTLE_MS;
+    while(plc_tag_get_int_attribute(tag, "auto_sync_read_us", 0) != MIN_PERIOD_US && util_time_ms() < timeout) {
+        util_sleep_ms(POLL_MS);
+    }
+
+    check(plc_tag_get_int_attribute(tag, "auto_sync_read_us", 0) == MIN_PERIOD_US, "the period resets when the data changes");
+    check(plc_tag_get_int32(tag, 0) == new_value, "the adaptive tag read the new value");
+
+    check_doubling(tag, "changed");
+
+    plc_tag_destroy(tag);
+    plc_tag_destroy(writer);
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
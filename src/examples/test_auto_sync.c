@@ -35,6 +35,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <inttypes.h>
@@ -51,6 +52,7 @@
 #define WRITE_SLEEP_MS (300)
 
 #define READ_PERIOD_MS (200)
+#define WRITE_PERIOD_MS (20)
 
 static volatile int read_start_count = 0;
 static volatile int read_complete_count = 0;
@@ -154,8 +156,22 @@ int main(int argc, char **argv)
     int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
     int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
 
-    (void)argc;
-    (void)argv;
+    const char *tag_string = TAG_ATTRIBS;
+    int set_after_create = 0;
+
+    /*
+     * usage: test_auto_sync [--set-after-create] [tag string]
+     *
+     * With --set-after-create the tag string should not have any
+     * automatic sync attributes.  They are turned on once the tag exists.
+     */
+    for(int i=1; i < argc; i++) {
+        if(strcmp(argv[i], "--set-after-create") == 0) {
+            set_after_create = 1;
+        } else {
+            tag_string = argv[i];
+        }
+    }
 
     /* check the library version. */
     if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
@@ -168,7 +184,7 @@ int main(int argc, char **argv)
 
     plc_tag_set_debug_level(PLCTAG_DEBUG_WARN);
 
-    tag = plc_tag_create(TAG_ATTRIBS, DATA_TIMEOUT);
+    tag = plc_tag_create(tag_string, DATA_TIMEOUT);
     if(tag < 0) {
         fprintf(stderr, "Error, %s, creating tag!\n", plc_tag_decode_error(tag));
         return 1;
@@ -184,6 +200,20 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    /* an idle tag must start syncing when the attributes are changed. */
+    if(set_after_create) {
+        rc = plc_tag_set_int_attribute(tag, "auto_sync_read_ms", READ_PERIOD_MS);
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = plc_tag_set_int_attribute(tag, "auto_sync_write_ms", WRITE_PERIOD_MS);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to turn on automatic sync for tag %s!\n", plc_tag_decode_error(rc));
+            plc_tag_destroy(tag);
+            return 1;
+        }
+    }
+
     fprintf(stderr, "Ready to start threads.\n");
 
     /* create the threads. */
@@ -0,0 +1,426 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Measure the cost of detailed debug output, synchronous versus the
+ * asynchronous logging ring.
+ *
+ * A logger callback that only counts messages is registered so that the
+ * numbers show the cost inside the library rather than terminal output.
+ * System tags are used so no PLC is needed.
+ *
+ * The test fails if anything is logged with debugging off, or if the
+ * records delivered plus the records dropped in asynchronous mode do not
+ * add up to what synchronous mode logged.  Then several threads log while
+ * asynchronous mode is turned on and off over and over, and again no
+ * record may be lost.  Last, many short lived threads log asynchronously
+ * and the resident memory must not grow by more than
+ * MAX_CHURN_GROWTH_BYTES.
+ *
+ * Usage: test_debug_async [num_ops]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define TAG_ATTRIBS "make=system&family=library&name=version"
+
+#define DEFAULT_NUM_OPS (100000)
+#define DATA_TIMEOUT (1000)
+
+#define CHURN_THREADS (200)
+#define CHURN_READS (100)
+#define MAX_CHURN_GROWTH_BYTES (4 * 1024 * 1024)
+
+#define TOGGLE_THREADS (4)
+#define TOGGLE_READS (20000)
+
+static int32_t toggle_tag = 0;
+
+static volatile int64_t message_count = 0;
+
+/* messages written synchronously can come from several threads at once. */
+static pthread_mutex_t message_count_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void count_messages(int32_t tag_id, int debug_level, const char *message)
+{
+    (void)tag_id;
+    (void)debug_level;
+    (void)message;
+
+    pthread_mutex_lock(&message_count_mutex);
+    message_count++;
+    pthread_mutex_unlock(&message_count_mutex);
+}
+
+
+static int64_t get_rss_bytes(void)
+{
+    long pages_total = 0;
+    long pages_resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if(!statm) {
+        return -1;
+    }
+
+    if(fscanf(statm, "%ld %ld", &pages_total, &pages_resident) != 2) {
+        pages_resident = -1;
+    }
+
+    fclose(statm);
+
+    return (int64_t)pages_resident * (int64_t)sysconf(_SC_PAGESIZE);
+}
+
+
+static void *churn_thread(void *arg)
+{
+    int32_t tag = *(int32_t *)arg;
+
+    for(int i=0; i < CHURN_READS; i++) {
+        if(plc_tag_read(tag, DATA_TIMEOUT) != PLCTAG_STATUS_OK) {
+            return (void *)(intptr_t)1;
+        }
+    }
+
+    return NULL;
+}
+
+
+static int run_thread_churn(int32_t tag)
+{
+    int64_t rss_start = 0;
+    int64_t rss_end = 0;
+    int failures = 0;
+
+    /* one round first so that the rings all exist. */
+    for(int round=0; round < 2; round++) {
+        if(round == 1) {
+            rss_start = get_rss_bytes();
+        }
+
+        for(int i=0; i < CHURN_THREADS; i++) {
+            pthread_t thread;
+            void *thread_rc = NULL;
+
+            pthread_create(&thread, NULL, churn_thread, &tag);
+            pthread_join(thread, &thread_rc);
+
+            if(thread_rc) {
+                failures++;
+            }
+        }
+    }
+
+    rss_end = get_rss_bytes();
+
+    if(failures) {
+        fprintf(stderr, "%d threads got errors reading the tag!\n", failures);
+        return 1;
+    }
+
+    if(rss_start < 0 || rss_end < 0) {
+        fprintf(stderr, "Unable to read the resident set size, skipping the memory check.\n");
+        return 0;
+    }
+
+    fprintf(stderr, "%d threads logged asynchronously, RSS before %" PRId64 " bytes, after %" PRId64 " bytes.\n",
+                    CHURN_THREADS, rss_start, rss_end);
+
+    if(rss_end - rss_start > MAX_CHURN_GROWTH_BYTES) {
+        fprintf(stderr, "Memory grew by %" PRId64 " bytes while threads came and went!\n", rss_end - rss_start);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static volatile int toggle_done[TOGGLE_THREADS];
+
+static void *toggle_thread(void *arg)
+{
+    int index = (int)(intptr_t)arg;
+    void *result = NULL;
+
+    for(int i=0; i < TOGGLE_READS; i++) {
+        if(plc_tag_read(toggle_tag, DATA_TIMEOUT) != PLCTAG_STATUS_OK) {
+            result = (void *)(intptr_t)1;
+            break;
+        }
+    }
+
+    toggle_done[index] = 1;
+
+    return result;
+}
+
+
+static int all_toggle_threads_done(void)
+{
+    for(int i=0; i < TOGGLE_THREADS; i++) {
+        if(!toggle_done[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * Log from several threads while asynchronous logging is switched on and
+ * off.  Records in flight when it goes off must still come out, either
+ * from the debug thread or synchronously.
+ */
+
+static int run_toggle_race(int32_t tag, int64_t messages_per_read)
+{
+    pthread_t threads[TOGGLE_THREADS];
+    int64_t start_messages = message_count;
+    int64_t start_dropped = plc_tag_get_int_attribute(0, "debug_dropped", 0);
+    int64_t expected = messages_per_read * TOGGLE_THREADS * TOGGLE_READS;
+    int64_t delivered = 0;
+    int64_t dropped = 0;
+    int failures = 0;
+    int toggles = 0;
+
+    toggle_tag = tag;
+
+    for(int i=0; i < TOGGLE_THREADS; i++) {
+        toggle_done[i] = 0;
+        pthread_create(&threads[i], NULL, toggle_thread, (void *)(intptr_t)i);
+    }
+
+    while(!all_toggle_threads_done()) {
+        plc_tag_set_int_attribute(0, "debug_async", (toggles & 1) ? 0 : 1);
+        toggles++;
+        util_sleep_ms(1);
+    }
+
+    for(int i=0; i < TOGGLE_THREADS; i++) {
+        void *thread_rc = NULL;
+
+        pthread_join(threads[i], &thread_rc);
+
+        if(thread_rc) {
+            failures++;
+        }
+    }
+
+    plc_tag_set_int_attribute(0, "debug_async", 0);
+
+    delivered = message_count - start_messages;
+    dropped = plc_tag_get_int_attribute(0, "debug_dropped", 0) - start_dropped;
+
+    fprintf(stderr, "%d threads logged while async was toggled %d times, %" PRId64 " messages delivered, %" PRId64 " dropped, about %" PRId64 " expected.\n",
+                    TOGGLE_THREADS, toggles, delivered, dropped, expected);
+
+    if(failures) {
+        fprintf(stderr, "%d threads got errors reading the tag!\n", failures);
+        return 1;
+    }
+
+    /* allow a little for the tickler. */
+    if(delivered + dropped < (expected * 99) / 100) {
+        fprintf(stderr, "Records were lost while asynchronous logging was turned off!\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static int run_reads(const char *mode, int32_t tag, int num_ops, int64_t *messages)
+{
+    int64_t start = 0;
+    int64_t elapsed = 0;
+    int64_t start_messages = message_count;
+
+    start = util_time_ms();
+
+    for(int i=0; i < num_ops; i++) {
+        int rc = plc_tag_read(tag, DATA_TIMEOUT);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Error %s reading tag!\n", plc_tag_decode_error(rc));
+            return 1;
+        }
+    }
+
+    elapsed = util_time_ms() - start;
+
+    fprintf(stderr, "%-6s %9d reads in %7" PRId64 "ms, %10.0f reads/sec, %" PRId64 " messages logged so far.\n",
+                    mode,
+                    num_ops,
+                    elapsed,
+                    (elapsed > 0 ? ((double)num_ops * 1000.0) / (double)elapsed : 0.0),
+                    message_count - start_messages);
+
+    *messages = message_count - start_messages;
+
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    int rc = 0;
+    int num_ops = DEFAULT_NUM_OPS;
+    int64_t none_messages = 0;
+    int64_t sync_messages = 0;
+    int64_t async_messages = 0;
+    int64_t async_dropped = 0;
+    int32_t tag = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    fprintf(stderr, "Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    if(argc > 1) {
+        num_ops = atoi(argv[1]);
+    }
+
+    if(num_ops <= 0) {
+        fprintf(stderr, "Usage: %s [num_ops]\n", argv[0]);
+        return 1;
+    }
+
+    tag = plc_tag_create(TAG_ATTRIBS, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "Error %s creating tag!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    plc_tag_register_logger(count_messages);
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_NONE);
+    rc = run_reads("none", tag, num_ops, &none_messages);
+
+    if(!rc && none_messages != 0) {
+        fprintf(stderr, "%" PRId64 " messages were logged with debugging off!\n", none_messages);
+        rc = 1;
+    }
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_DETAIL);
+
+    if(!rc) {
+        rc = run_reads("sync", tag, num_ops, &sync_messages);
+    }
+
+    if(!rc && sync_messages <= 0) {
+        fprintf(stderr, "Nothing was logged at detail level!\n");
+        rc = 1;
+    }
+
+    if(!rc) {
+        if(plc_tag_set_int_attribute(0, "debug_async", 1) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to turn on asynchronous logging!\n");
+            rc = 1;
+        }
+    }
+
+    if(!rc) {
+        int64_t start_messages = message_count;
+
+        rc = run_reads("async", tag, num_ops, &async_messages);
+
+        /* let the logging thread catch up before turning it off. */
+        util_sleep_ms(100);
+
+        plc_tag_set_int_attribute(0, "debug_async", 0);
+
+        async_messages = message_count - start_messages;
+        async_dropped = plc_tag_get_int_attribute(0, "debug_dropped", 0);
+
+        fprintf(stderr, "%" PRId64 " messages logged in total, %" PRId64 " records dropped.\n",
+                        message_count,
+                        async_dropped);
+    }
+
+    /* every record is either delivered or counted as dropped.  Allow a little for the tickler. */
+    if(!rc && (async_messages + async_dropped) < (sync_messages * 99) / 100) {
+        fprintf(stderr, "Only %" PRId64 " of %" PRId64 " async records were delivered or counted as dropped!\n",
+                        async_messages + async_dropped,
+                        sync_messages);
+        rc = 1;
+    }
+
+    if(!rc) {
+        rc = run_toggle_race(tag, sync_messages / num_ops);
+    }
+
+    if(!rc) {
+        if(plc_tag_set_int_attribute(0, "debug_async", 1) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to turn on asynchronous logging!\n");
+            rc = 1;
+        } else {
+            rc = run_thread_churn(tag);
+
+            plc_tag_set_int_attribute(0, "debug_async", 0);
+        }
+    }
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_NONE);
+
+    if(!rc) {
+        fprintf(stderr, "All tests passed.\n");
+    }
+
+    plc_tag_destroy(tag);
+
+    plc_tag_shutdown();
+
+    return rc;
+}
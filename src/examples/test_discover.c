@@ -0,0 +1,271 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Check that the @discover tag lists the controller and every program
+ * scope and returns each UDT the tags use exactly once, with its fields.
+ *
+ * The emulator templates have (id % 7) + 2 DINT fields named M0, M1, ...
+ * at four byte offsets, and the template name is UDT_<id>.
+ *
+ * Usage: test_discover [gateway]
+ *
+ * Run against ab_server --plc=ControlLogix --path=1,0 --tag=Ctl:DINT[1]
+ *     --tag=Motor:UDT12[2] --tag=Program:Main.Speed:UDT20[1]
+ *     --tag=Program:Aux.Count:DINT[4] --tag=Program:Aux.Pump:UDT12[1]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define TAG_ATTRIBS "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&allow_packing=0&name=@discover"
+
+#define DEFAULT_GATEWAY "127.0.0.1"
+#define DATA_TIMEOUT (10000)
+#define MAX_NAME (256)
+
+#define TYPE_IS_STRUCT ((uint16_t)0x8000)
+#define TYPE_UDT_ID_MASK ((uint16_t)0x0FFF)
+#define TYPE_PROGRAM ((uint16_t)0x1068)
+#define TYPE_DINT ((uint16_t)0x00C4)
+
+/* the tags the emulator is started with, plus one entry per program. */
+static const char *expected_tags[] = {
+    "Ctl", "Motor", "Program:Main", "Program:Aux",
+    "Program:Main.Speed", "Program:Aux.Count", "Program:Aux.Pump"
+};
+#define NUM_EXPECTED_TAGS ((int)(sizeof(expected_tags)/sizeof(expected_tags[0])))
+
+static const uint16_t expected_udts[] = { 12, 20 };
+#define NUM_EXPECTED_UDTS ((int)(sizeof(expected_udts)/sizeof(expected_udts[0])))
+
+static int failures = 0;
+
+
+static void check(int ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+/* read a counted string, returns 0 if it does not fit. */
+static int get_name(int32_t tag, int *offset, char *name)
+{
+    int len = plc_tag_get_uint16(tag, *offset);
+
+    if(len >= MAX_NAME || *offset + 2 + len > plc_tag_get_size(tag)) {
+        return 0;
+    }
+
+    plc_tag_get_raw_bytes(tag, *offset + 2, (uint8_t *)name, len);
+    name[len] = 0;
+
+    *offset += 2 + len;
+
+    return 1;
+}
+
+
+static void check_tags(int32_t tag, int *offset, uint32_t num_tags)
+{
+    int found[NUM_EXPECTED_TAGS] = {0};
+    char name[MAX_NAME];
+
+    check(num_tags == NUM_EXPECTED_TAGS, "wrong number of tags");
+
+    for(uint32_t i=0; i < num_tags; i++) {
+        uint16_t type = plc_tag_get_uint16(tag, *offset + 4);
+        int known = 0;
+
+        /* instance id, type, element size and three dimensions. */
+        *offset += 4 + 2 + 2 + 12;
+
+        if(!get_name(tag, offset, name)) {
+            check(0, "tag name does not fit");
+            return;
+        }
+
+        fprintf(stderr, "Tag %s type %04x.\n", name, (unsigned int)type);
+
+        for(int j=0; j < NUM_EXPECTED_TAGS; j++) {
+            if(strcmp(name, expected_tags[j]) == 0) {
+                check(!found[j], "tag listed twice");
+                found[j] = known = 1;
+            }
+        }
+
+        check(known, "unexpected tag");
+        check((type == TYPE_PROGRAM) == (strncmp(name, "Program:", 8) == 0 && !strchr(name, '.')), "program entry has the wrong type");
+    }
+}
+
+
+static void check_udts(int32_t tag, int *offset, uint32_t num_udts)
+{
+    int found[NUM_EXPECTED_UDTS] = {0};
+    char name[MAX_NAME];
+    char expected[MAX_NAME];
+
+    check(num_udts == NUM_EXPECTED_UDTS, "wrong number of UDTs");
+
+    for(uint32_t i=0; i < num_udts; i++) {
+        uint16_t id = plc_tag_get_uint16(tag, *offset) & TYPE_UDT_ID_MASK;
+        uint32_t instance_size = plc_tag_get_uint32(tag, *offset + 4);
+        uint16_t num_fields = plc_tag_get_uint16(tag, *offset + 8);
+        int known = 0;
+
+        /* id, struct handle, instance size and field count. */
+        *offset += 2 + 2 + 4 + 2;
+
+        if(!get_name(tag, offset, name)) {
+            check(0, "UDT name does not fit");
+            return;
+        }
+
+        fprintf(stderr, "UDT %s id %u with %u fields, %u bytes.\n", name, (unsigned int)id, (unsigned int)num_fields, (unsigned int)instance_size);
+
+        for(int j=0; j < NUM_EXPECTED_UDTS; j++) {
+            if(id == expected_udts[j]) {
+                check(!found[j], "UDT listed twice");
+                found[j] = known = 1;
+            }
+        }
+
+        check(known, "unexpected UDT");
+
+        snprintf(expected, sizeof(expected), "UDT_%u", (unsigned int)id);
+        check(strcmp(name, expected) == 0, "wrong UDT name");
+        check(num_fields == (id % 7) + 2, "wrong UDT field count");
+        check(instance_size == (uint32_t)num_fields * 4, "wrong UDT size");
+
+        for(uint16_t f=0; f < num_fields; f++) {
+            uint16_t type = plc_tag_get_uint16(tag, *offset + 2);
+            uint32_t field_offset = plc_tag_get_uint32(tag, *offset + 4);
+
+            /* metadata, type and offset. */
+            *offset += 2 + 2 + 4;
+
+            if(!get_name(tag, offset, name)) {
+                check(0, "field name does not fit");
+                return;
+            }
+
+            snprintf(expected, sizeof(expected), "M%u", (unsigned int)f);
+            check(strcmp(name, expected) == 0, "wrong field name");
+            check(type == TYPE_DINT, "wrong field type");
+            check(field_offset == (uint32_t)f * 4, "wrong field offset");
+        }
+    }
+
+    for(int j=0; j < NUM_EXPECTED_UDTS; j++) {
+        check(found[j], "UDT missing");
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *gateway = DEFAULT_GATEWAY;
+    char tag_attribs[256];
+    int32_t tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int offset = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc > 1) {
+        gateway = argv[1];
+    }
+
+    snprintf(tag_attribs, sizeof(tag_attribs), TAG_ATTRIBS, gateway);
+
+    tag = plc_tag_create(tag_attribs, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "Error %s creating the discovery tag!\n", plc_tag_decode_error(tag));
+        plc_tag_shutdown();
+        return 1;
+    }
+
+    rc = plc_tag_read(tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Error %s reading the discovery tag!\n", plc_tag_decode_error(rc));
+        failures++;
+    } else {
+        uint32_t num_tags = plc_tag_get_uint32(tag, 0);
+        uint32_t num_udts = plc_tag_get_uint32(tag, 4);
+
+        offset = 8;
+
+        check_tags(tag, &offset, num_tags);
+        check_udts(tag, &offset, num_udts);
+
+        check(offset == plc_tag_get_size(tag), "discovery data has the wrong size");
+
+        /* a second read must give the same result. */
+        rc = plc_tag_read(tag, DATA_TIMEOUT);
+        check(rc == PLCTAG_STATUS_OK && plc_tag_get_size(tag) == offset, "second discovery read differs");
+    }
+
+    plc_tag_destroy(tag);
+
+    plc_tag_shutdown();
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,253 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Check a streamed tag listing (@tags with listing_stream=1).
+ *
+ * The listing is walked twice.  Each pass must:
+ *  - come back in more than one batch and end with an empty batch,
+ *  - return every tag once with rising instance IDs,
+ *  - decode the type, element size and dimensions of each record,
+ *  - send the request for the next batch while the test still holds the
+ *    current one.  The emulator delays each response, so a batch that was
+ *    not requested ahead of time takes at least that long to read.
+ *
+ * Usage: test_listing_stream [number of TagN tags [gateway]]
+ *
+ * Run against ab_server --plc=ControlLogix --path=1,0 --delay=50 --tag=Grid:DINT[4,5] --tag=Program:Main.Speed:REAL[3]
+ * with --tag=Tag<n>:DINT[1] for every n from 1 to the number of TagN tags.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define TAG_ATTRIBS "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&listing_stream=1&name=@tags"
+
+/* the batch and record layout, see setup_tag_listing_tag(). */
+#define BATCH_HEADER_SIZE (4)
+#define RECORD_SIZE (128)
+#define RECORD_INSTANCE_ID (0)
+#define RECORD_SYMBOL_TYPE (4)
+#define RECORD_ELEMENT_LENGTH (6)
+#define RECORD_ARRAY_DIMS (8)
+#define RECORD_NUM_DIMS (20)
+#define RECORD_NAME (22)
+
+#define TYPE_DINT (0xC4)
+#define TYPE_MASK (0x0FFF)
+
+#define DEFAULT_NUM_TAGS (300)
+#define DEFAULT_GATEWAY "127.0.0.1"
+#define MAX_TAGS (4000)
+#define MAX_BATCHES (1000)
+#define EMULATOR_DELAY_MS (50)
+#define PREFETCH_WAIT_MS (200)
+#define DATA_TIMEOUT (5000)
+
+static const char *gateway = DEFAULT_GATEWAY;
+static int num_tags = DEFAULT_NUM_TAGS;
+static int seen[MAX_TAGS + 1];
+
+static int failures = 0;
+
+
+static void check(int ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+static void check_record(int32_t tag, int offset, int *found_grid, int *found_program)
+{
+    char name[128] = {0};
+    int tag_num = 0;
+    uint16_t symbol_type = plc_tag_get_uint16(tag, offset + RECORD_SYMBOL_TYPE);
+    int element_length = plc_tag_get_uint16(tag, offset + RECORD_ELEMENT_LENGTH);
+    int num_dims = plc_tag_get_uint16(tag, offset + RECORD_NUM_DIMS);
+    uint32_t dims[3];
+
+    for(int i=0; i < 3; i++) {
+        dims[i] = plc_tag_get_uint32(tag, offset + RECORD_ARRAY_DIMS + (i * 4));
+    }
+
+    if(plc_tag_get_string(tag, offset + RECORD_NAME, name, (int)sizeof(name)) != PLCTAG_STATUS_OK) {
+        check(0, "record name can be read");
+        return;
+    }
+
+    if(strcmp(name, "Grid") == 0) {
+        (*found_grid)++;
+        check((symbol_type & TYPE_MASK) == TYPE_DINT && element_length == 4, "Grid is a DINT array");
+        check(num_dims == 2 && dims[0] == 4 && dims[1] == 5, "Grid has dimensions 4,5");
+    } else if(strcmp(name, "Program:Main") == 0) {
+        (*found_program)++;
+    } else if(sscanf(name, "Tag%d", &tag_num) == 1 && tag_num >= 1 && tag_num <= num_tags) {
+        seen[tag_num]++;
+        check((symbol_type & TYPE_MASK) == TYPE_DINT && element_length == 4, "TagN is a DINT");
+        check(num_dims == 1 && dims[0] == 1, "TagN has one dimension of one element");
+    } else {
+        fprintf(stderr, "Unexpected tag %s in the listing!\n", name);
+        check(0, "only known tags are listed");
+    }
+}
+
+
+static void walk_listing(int32_t tag, int pass)
+{
+    int batches = 0;
+    int records = 0;
+    int found_grid = 0;
+    int found_program = 0;
+    int prefetched = 0;
+    int64_t last_id = -1;
+
+    memset(seen, 0, sizeof(seen));
+
+    for(batches = 0; batches < MAX_BATCHES; batches++) {
+        int64_t start = util_time_ms();
+        int rc = plc_tag_read(tag, DATA_TIMEOUT);
+        int64_t read_time = util_time_ms() - start;
+        int count = 0;
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Read of batch %d failed with %s!\n", batches, plc_tag_decode_error(rc));
+            check(0, "listing batch read");
+            return;
+        }
+
+        count = (int)plc_tag_get_uint32(tag, 0);
+        check(plc_tag_get_size(tag) == BATCH_HEADER_SIZE + (count * RECORD_SIZE), "batch size matches the record count");
+
+        if(count == 0) {
+            break;
+        }
+
+        /* a batch that was requested while we held the last one is already here. */
+        if(batches > 0 && read_time < EMULATOR_DELAY_MS / 2) {
+            prefetched++;
+        }
+
+        /* give the request for the next batch time to complete. */
+        util_sleep_ms(PREFETCH_WAIT_MS);
+
+        for(int i=0; i < count; i++) {
+            int offset = BATCH_HEADER_SIZE + (i * RECORD_SIZE);
+            int64_t id = plc_tag_get_uint32(tag, offset + RECORD_INSTANCE_ID);
+
+            check(id > last_id, "instance IDs rise through the listing");
+            last_id = id;
+
+            check_record(tag, offset, &found_grid, &found_program);
+        }
+
+        records += count;
+    }
+
+    fprintf(stderr, "Pass %d: %d records in %d batches, %d batches prefetched.\n", pass, records, batches, prefetched);
+
+    check(batches > 1, "the listing comes in more than one batch");
+    check(prefetched == batches - 1, "every batch after the first was requested while the test held the one before");
+    check(records == num_tags + 2, "every tag is listed");
+    check(found_grid == 1 && found_program == 1, "Grid and Program:Main are listed once");
+
+    for(int i=1; i <= num_tags; i++) {
+        if(seen[i] != 1) {
+            fprintf(stderr, "Tag%d was listed %d times!\n", i, seen[i]);
+            check(0, "every TagN is listed once");
+            break;
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    char attribs[256];
+    int32_t tag = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc > 1) {
+        num_tags = atoi(argv[1]);
+        if(num_tags < 1 || num_tags > MAX_TAGS) {
+            fprintf(stderr, "The number of tags must be between 1 and %d!\n", MAX_TAGS);
+            exit(1);
+        }
+    }
+
+    if(argc > 2) {
+        gateway = argv[2];
+    }
+
+    snprintf(attribs, sizeof(attribs), TAG_ATTRIBS, gateway);
+
+    tag = plc_tag_create(attribs, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "Error %s creating the listing tag!\n", plc_tag_decode_error(tag));
+        exit(1);
+    }
+
+    /* the second pass checks that the listing starts over after the empty batch. */
+    walk_listing(tag, 1);
+    walk_listing(tag, 2);
+
+    plc_tag_destroy(tag);
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
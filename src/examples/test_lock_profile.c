@@ -0,0 +1,316 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Run several threads reading tags with the lock profiler on, then print
+ * the ranked lock report.
+ *
+ * The threads all share the library locks, so every create and read must
+ * succeed.  When the report goes to a file, it is read back and must show
+ * every read taking the tag API mutex.
+ *
+ * The profiler is then turned off and on many times with a read between.
+ * Each restart must reuse the per-thread blocks, so the process must not
+ * grow, and the last report must only count the reads since the last
+ * restart.  The program exits with a non-zero status if any check fails.
+ *
+ * Usage: test_lock_profile <tag string> [num_threads] [num_reads]
+ *
+ * Set PLCTAG_LOCK_PROFILE_FILE to write the report to a file instead of
+ * stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define DEFAULT_NUM_THREADS (8)
+#define DEFAULT_NUM_READS (200)
+#define MAX_THREADS (64)
+#define NUM_RESTARTS (500)
+#define MAX_RESTART_GROWTH_KB (4096)
+#define DATA_TIMEOUT (5000)
+
+#define LOCK_PROFILE_FILE_ENV_VAR "PLCTAG_LOCK_PROFILE_FILE"
+#define API_MUTEX_NAME "&tag->api_mutex"
+
+static const char *tag_string = NULL;
+static int num_reads = DEFAULT_NUM_READS;
+
+
+static void *reader_thread(void *arg)
+{
+    int32_t tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    (void)arg;
+
+    tag = plc_tag_create(tag_string, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "Error %s creating tag!\n", plc_tag_decode_error(tag));
+        return (void *)(intptr_t)1;
+    }
+
+    for(int i=0; i < num_reads && rc == PLCTAG_STATUS_OK; i++) {
+        rc = plc_tag_read(tag, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Error %s reading tag!\n", plc_tag_decode_error(rc));
+        }
+    }
+
+    plc_tag_destroy(tag);
+
+    return (void *)(intptr_t)(rc == PLCTAG_STATUS_OK ? 0 : 1);
+}
+
+
+/*
+ * Read the report back and make sure it has the tag API mutex with at
+ * least min_acquired and at most max_acquired acquisitions.
+ */
+
+static int check_report(const char *file_name, int64_t min_acquired, int64_t max_acquired)
+{
+    FILE *report = fopen(file_name, "r");
+    char line[512];
+    int num_mutexes = 0;
+    int num_sites = 0;
+    int64_t acquired = -1;
+
+    if(!report) {
+        fprintf(stderr, "Unable to open lock profile report %s!\n", file_name);
+        return 1;
+    }
+
+    if(!fgets(line, (int)sizeof(line), report) || sscanf(line, "Lock profile, %d mutexes and %d call sites", &num_mutexes, &num_sites) != 2) {
+        fprintf(stderr, "Lock profile report has no header line!\n");
+        fclose(report);
+        return 1;
+    }
+
+    /* the mutex table comes first, so the first match is the mutex total. */
+    while(fgets(line, (int)sizeof(line), report)) {
+        if(strncmp(line, API_MUTEX_NAME " ", strlen(API_MUTEX_NAME " ")) == 0) {
+            if(sscanf(line + strlen(API_MUTEX_NAME), "%" SCNd64, &acquired) != 1) {
+                acquired = -1;
+            }
+
+            break;
+        }
+    }
+
+    fclose(report);
+
+    fprintf(stderr, "Report has %d mutexes and %d call sites, %s was acquired %" PRId64 " times.\n", num_mutexes, num_sites, API_MUTEX_NAME, acquired);
+
+    if(num_mutexes <= 0 || num_sites <= 0) {
+        fprintf(stderr, "Lock profile report is empty!\n");
+        return 1;
+    }
+
+    if(acquired < min_acquired) {
+        fprintf(stderr, "Expected %s to be acquired at least %" PRId64 " times!\n", API_MUTEX_NAME, min_acquired);
+        return 1;
+    }
+
+    if(acquired > max_acquired) {
+        fprintf(stderr, "Expected %s to be acquired at most %" PRId64 " times!\n", API_MUTEX_NAME, max_acquired);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static long max_rss_kb(void)
+{
+    struct rusage usage;
+
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+
+    return usage.ru_maxrss;
+}
+
+
+/*
+ * Restart the profiler many times with a read on this thread between.  The
+ * process must not grow with the number of restarts.
+ */
+
+static int check_restarts(void)
+{
+    int32_t tag = plc_tag_create(tag_string, DATA_TIMEOUT);
+    long rss_before = 0;
+    long rss_growth = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(tag < 0) {
+        fprintf(stderr, "Error %s creating tag!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    rss_before = max_rss_kb();
+
+    for(int i=0; i < NUM_RESTARTS && rc == PLCTAG_STATUS_OK; i++) {
+        plc_tag_set_int_attribute(0, "lock_profile", 0);
+        plc_tag_set_int_attribute(0, "lock_profile", 1);
+
+        rc = plc_tag_read(tag, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Error %s reading tag!\n", plc_tag_decode_error(rc));
+        }
+    }
+
+    rss_growth = max_rss_kb() - rss_before;
+
+    plc_tag_destroy(tag);
+
+    fprintf(stderr, "The process grew by %ldkB over %d profiler restarts.\n", rss_growth, NUM_RESTARTS);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    if(rss_before < 0 || rss_growth > MAX_RESTART_GROWTH_KB) {
+        fprintf(stderr, "Expected the process to grow by at most %dkB!\n", MAX_RESTART_GROWTH_KB);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    int num_threads = DEFAULT_NUM_THREADS;
+    int failures = 0;
+    const char *report_file = getenv(LOCK_PROFILE_FILE_ENV_VAR);
+    pthread_t threads[MAX_THREADS];
+    int64_t start = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <tag string> [num_threads] [num_reads]\n", argv[0]);
+        return 1;
+    }
+
+    tag_string = argv[1];
+
+    if(argc > 2) {
+        num_threads = atoi(argv[2]);
+    }
+
+    if(argc > 3) {
+        num_reads = atoi(argv[3]);
+    }
+
+    if(num_threads <= 0 || num_threads > MAX_THREADS || num_reads <= 0) {
+        fprintf(stderr, "Usage: %s <tag string> [num_threads (1-%d)] [num_reads]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    if(plc_tag_set_int_attribute(0, "lock_profile", 1) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to turn on the lock profiler!\n");
+        return 1;
+    }
+
+    start = util_time_ms();
+
+    for(int i=0; i < num_threads; i++) {
+        pthread_create(&threads[i], NULL, reader_thread, NULL);
+    }
+
+    for(int i=0; i < num_threads; i++) {
+        void *thread_rc = NULL;
+
+        pthread_join(threads[i], &thread_rc);
+
+        if(thread_rc) {
+            failures++;
+        }
+    }
+
+    fprintf(stderr, "%d threads did %d reads each in %" PRId64 "ms.\n\n", num_threads, num_reads, util_time_ms() - start);
+
+    if(plc_tag_set_int_attribute(0, "lock_profile_dump", 1) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to write the lock profile report!\n");
+        failures++;
+    } else if(report_file && *report_file) {
+        failures += check_report(report_file, (int64_t)num_threads * num_reads, INT64_MAX);
+    }
+
+    failures += check_restarts();
+
+    /* only the read since the last restart is counted, not the threads' reads. */
+    if(plc_tag_set_int_attribute(0, "lock_profile_dump", 1) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to write the lock profile report after the restarts!\n");
+        failures++;
+    } else if(report_file && *report_file) {
+        failures += check_report(report_file, 1, ((int64_t)num_threads * num_reads) - 1);
+    }
+
+    plc_tag_set_int_attribute(0, "lock_profile", 0);
+
+    plc_tag_shutdown();
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
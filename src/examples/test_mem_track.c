@@ -0,0 +1,225 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Turn on memory accounting, create a number of tags and print what the
+ * library is holding by subsystem through the "memory" system tag.  The
+ * tags are then destroyed and the figures printed again, followed by the
+ * per call site report.
+ *
+ * With the tags open the tag subsystem must hold one object per tag plus
+ * the memory tag itself.  Once they are destroyed, only the memory tag
+ * may be left.  The program exits with a non-zero status if either check
+ * fails.
+ *
+ * Usage: test_mem_track <tag string> [num_tags]
+ *
+ * Set PLCTAG_MEM_TRACK_FILE to write the call site report to a file
+ * instead of stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define MEMORY_TAG "protocol=system&name=memory"
+
+#define DEFAULT_NUM_TAGS (20)
+#define MAX_TAGS (1000)
+#define DATA_TIMEOUT (5000)
+
+/* in the order the library returns them. */
+static const char *subsystem_names[] = { "other", "tags", "sessions", "requests", "attrs", "modbus plcs", "intern" };
+
+#define MAX_SUBSYSTEMS (16)
+#define SUB_TAGS (1)
+#define VALUE_LIVE_BYTES (0)
+#define VALUE_LIVE_OBJS (1)
+
+static int64_t live[MAX_SUBSYSTEMS][2];
+static int num_subsystems = 0;
+
+
+static int read_memory(const char *when)
+{
+    int32_t mem = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int num_values = 0;
+    int num_names = (int)(sizeof(subsystem_names)/sizeof(subsystem_names[0]));
+
+    mem = plc_tag_create(MEMORY_TAG, DATA_TIMEOUT);
+    if(mem < 0) {
+        fprintf(stderr, "Error %s creating memory tag!\n", plc_tag_decode_error(mem));
+        return 1;
+    }
+
+    rc = plc_tag_read(mem, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Error %s reading memory tag!\n", plc_tag_decode_error(rc));
+        plc_tag_destroy(mem);
+        return 1;
+    }
+
+    num_subsystems = (int)plc_tag_get_int64(mem, 0);
+    num_values = (int)plc_tag_get_int64(mem, 8);
+
+    if(num_subsystems <= SUB_TAGS || num_subsystems > MAX_SUBSYSTEMS || num_values < 2) {
+        fprintf(stderr, "Memory tag has %d subsystems with %d values each!\n", num_subsystems, num_values);
+        plc_tag_destroy(mem);
+        return 1;
+    }
+
+    fprintf(stderr, "\nMemory %s:\n", when);
+    fprintf(stderr, "%-14s %12s %10s %12s %10s %10s\n", "subsystem", "live bytes", "live objs", "peak bytes", "peak objs", "allocs");
+
+    for(int sub=0; sub < num_subsystems; sub++) {
+        int offset = (2 + (sub * num_values)) * 8;
+
+        fprintf(stderr, "%-14s", (sub < num_names ? subsystem_names[sub] : "unknown"));
+
+        for(int i=0; i < num_values && i < 5; i++) {
+            fprintf(stderr, " %*" PRId64, (i % 2 ? 10 : 12), plc_tag_get_int64(mem, offset + (i * 8)));
+        }
+
+        fprintf(stderr, "\n");
+
+        live[sub][VALUE_LIVE_BYTES] = plc_tag_get_int64(mem, offset + (VALUE_LIVE_BYTES * 8));
+        live[sub][VALUE_LIVE_OBJS] = plc_tag_get_int64(mem, offset + (VALUE_LIVE_OBJS * 8));
+    }
+
+    plc_tag_destroy(mem);
+
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    int num_tags = DEFAULT_NUM_TAGS;
+    int failures = 0;
+    static int32_t tags[MAX_TAGS];
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <tag string> [num_tags]\n", argv[0]);
+        return 1;
+    }
+
+    if(argc > 2) {
+        num_tags = atoi(argv[2]);
+    }
+
+    if(num_tags <= 0 || num_tags > MAX_TAGS) {
+        fprintf(stderr, "Usage: %s <tag string> [num_tags (1-%d)]\n", argv[0], MAX_TAGS);
+        return 1;
+    }
+
+    if(plc_tag_set_int_attribute(0, "mem_track", 1) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to turn on memory accounting!\n");
+        return 1;
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        tags[i] = plc_tag_create(argv[1], DATA_TIMEOUT);
+        if(tags[i] < 0) {
+            fprintf(stderr, "Error %s creating tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            failures++;
+        }
+    }
+
+    if(read_memory("with tags open")) {
+        failures++;
+    } else {
+        /* the memory tag counts as well. */
+        if(live[SUB_TAGS][VALUE_LIVE_OBJS] != num_tags + 1 || live[SUB_TAGS][VALUE_LIVE_BYTES] <= 0) {
+            fprintf(stderr, "Expected %d live tags, got %" PRId64 " using %" PRId64 " bytes!\n",
+                            num_tags + 1, live[SUB_TAGS][VALUE_LIVE_OBJS], live[SUB_TAGS][VALUE_LIVE_BYTES]);
+            failures++;
+        }
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        if(tags[i] > 0) {
+            plc_tag_destroy(tags[i]);
+        }
+    }
+
+    /* sessions are closed by a background thread. */
+    util_sleep_ms(2000);
+
+    if(read_memory("after destroying tags")) {
+        failures++;
+    } else {
+        /* only the memory tag itself may be left. */
+        for(int sub=0; sub < num_subsystems; sub++) {
+            int64_t expected = (sub == SUB_TAGS ? 1 : 0);
+
+            if(live[sub][VALUE_LIVE_OBJS] != expected || (!expected && live[sub][VALUE_LIVE_BYTES] != 0)) {
+                fprintf(stderr, "Subsystem %d still holds %" PRId64 " objects using %" PRId64 " bytes!\n",
+                                sub, live[sub][VALUE_LIVE_OBJS], live[sub][VALUE_LIVE_BYTES]);
+                failures++;
+            }
+        }
+    }
+
+    fprintf(stderr, "\n");
+    plc_tag_set_int_attribute(0, "mem_track_dump", 1);
+
+    plc_tag_shutdown();
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,600 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Check how many requests the Modbus code sends and that errors stay
+ * with the tag that caused them.  The request counts come from the
+ * "stats" system tag.
+ *
+ * Usage: test_modbus_requests <reads|writes|window|busy|idle|large|units>
+ *
+ * Run against the Modbus emulator, src/tests/modbus_server.py.  It has
+ * 1000 holding registers, so reading past register 999 gets an illegal
+ * address exception.  Run "busy" against modbus_server.py --busy=4, which
+ * answers each request after a short delay and any request past four in
+ * flight with a server busy exception.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define GATEWAY "protocol=modbus-tcp&gateway=127.0.0.1:5020"
+#define STATS_TAG "protocol=system&name=stats"
+
+/* entry indexes in the stats tag, see test_stats.c. */
+#define STATS_LIVE_SESSIONS (2)
+#define STATS_REQUESTS_SENT (7)
+#define STATS_MB_COALESCED_READS (26)
+#define STATS_MB_COALESCED_WRITES (27)
+
+/* the first tag sets up the connection, so all tags of a test use the same options. */
+#define READ_OPTIONS "&coalesce_reads=1&coalesce_gap=10"
+#define WRITE_OPTIONS "&coalesce_writes=1&combine_read_write=1"
+
+#define MAX_TAGS (20)
+#define ITERATIONS (20)
+#define BUSY_LIMIT (4)
+#define MAX_WINDOW_STEPS (1000)
+#define DATA_TIMEOUT (5000)
+
+static int failures = 0;
+
+
+static void check(int ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+static int64_t get_stat(int entry)
+{
+    int64_t result = -1;
+    int32_t stats = plc_tag_create(STATS_TAG, DATA_TIMEOUT);
+
+    if(stats < 0) {
+        fprintf(stderr, "Error %s creating stats tag!\n", plc_tag_decode_error(stats));
+        return -1;
+    }
+
+    if(plc_tag_read(stats, DATA_TIMEOUT) == PLCTAG_STATUS_OK) {
+        result = plc_tag_get_int64(stats, entry * 8);
+    }
+
+    plc_tag_destroy(stats);
+
+    return result;
+}
+
+
+/* create a tag, do not wait for tags that are expected to fail. */
+static int32_t create_tag(const char *options, int unit, int reg, int count, int wait)
+{
+    char attribs[256];
+    int32_t tag = 0;
+
+    snprintf(attribs, sizeof(attribs), GATEWAY "&path=%d&elem_count=%d&name=hr%d%s", unit, count, reg, options);
+
+    tag = plc_tag_create(attribs, (wait ? DATA_TIMEOUT : 0));
+    if(tag < 0) {
+        fprintf(stderr, "Error %s creating tag hr%d!\n", plc_tag_decode_error(tag), reg);
+        exit(1);
+    }
+
+    /* let the initial read finish. */
+    while(plc_tag_status(tag) == PLCTAG_STATUS_PENDING) {
+        util_sleep_ms(1);
+    }
+
+    return tag;
+}
+
+
+/* start the operation on all the tags at once and wait for all of them. */
+static void run_all(int32_t *tags, int num_tags, int write)
+{
+    int64_t timeout = util_time_ms() + DATA_TIMEOUT;
+    int pending = 0;
+
+    for(int i=0; i < num_tags; i++) {
+        int rc = (write ? plc_tag_write(tags[i], 0) : plc_tag_read(tags[i], 0));
+
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+            fprintf(stderr, "Error %s starting operation on tag %d!\n", plc_tag_decode_error(rc), i);
+            failures++;
+        }
+    }
+
+    do {
+        pending = 0;
+
+        for(int i=0; i < num_tags; i++) {
+            if(plc_tag_status(tags[i]) == PLCTAG_STATUS_PENDING) {
+                pending++;
+            }
+        }
+
+        if(pending) {
+            util_sleep_ms(1);
+        }
+    } while(pending && timeout > util_time_ms());
+
+    check(!pending, "operations finished in time");
+}
+
+
+/* write each tag on its own with a value we can check later. */
+static void write_values(int32_t *tags, int num_tags, int base_value)
+{
+    for(int i=0; i < num_tags; i++) {
+        int elems = plc_tag_get_int_attribute(tags[i], "elem_count", 1);
+
+        for(int j=0; j < elems; j++) {
+            plc_tag_set_int16(tags[i], j * 2, (int16_t)(base_value + (i * 10) + j));
+        }
+
+        check(plc_tag_write(tags[i], DATA_TIMEOUT) == PLCTAG_STATUS_OK, "write of test value");
+    }
+}
+
+
+static int values_match(int32_t tag, int value)
+{
+    int elems = plc_tag_get_int_attribute(tag, "elem_count", 1);
+
+    for(int j=0; j < elems; j++) {
+        if(plc_tag_get_int16(tag, j * 2) != (int16_t)(value + j)) {
+            fprintf(stderr, "Element %d is %d, expected %d.\n", j, plc_tag_get_int16(tag, j * 2), value + j);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * Reads of neighbouring registers go out together, and an exception on
+ * a shared read only fails the tag with the bad address.
+ */
+static void test_reads(void)
+{
+    int32_t tags[MAX_TAGS];
+    int num_tags = 10;
+    int32_t good = 0;
+    int32_t bad = 0;
+    int64_t requests = 0;
+    int64_t coalesced = 0;
+
+    for(int i=0; i < num_tags; i++) {
+        tags[i] = create_tag(READ_OPTIONS, 0, 200 + (i * 2), 2, 1);
+    }
+
+    write_values(tags, num_tags, 2000);
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_set_int32(tags[i], 0, 0);
+    }
+
+    requests = get_stat(STATS_REQUESTS_SENT);
+    run_all(tags, num_tags, 0);
+    requests = get_stat(STATS_REQUESTS_SENT) - requests;
+
+    fprintf(stderr, "%d coalesced reads took %" PRId64 " requests.\n", num_tags, requests);
+    check(requests > 0 && requests < num_tags, "coalesced reads use fewer requests than tags");
+
+    for(int i=0; i < num_tags; i++) {
+        check(plc_tag_status(tags[i]) == PLCTAG_STATUS_OK, "coalesced read status");
+        check(values_match(tags[i], 2000 + (i * 10)), "coalesced read data");
+    }
+
+    /* hr998 with four registers runs off the end of the emulator's registers. */
+    good = create_tag(READ_OPTIONS, 0, 990, 2, 1);
+    bad = create_tag(READ_OPTIONS, 0, 998, 4, 0);
+
+    coalesced = get_stat(STATS_MB_COALESCED_READS);
+
+    for(int i=0; i < ITERATIONS; i++) {
+        int32_t pair[2] = { good, bad };
+
+        run_all(pair, 2, 0);
+
+        check(plc_tag_status(good) == PLCTAG_STATUS_OK, "good tag read with a bad tag");
+        check(plc_tag_status(bad) != PLCTAG_STATUS_OK, "bad tag read fails");
+    }
+
+    coalesced = get_stat(STATS_MB_COALESCED_READS) - coalesced;
+
+    fprintf(stderr, "%" PRId64 " reads shared a request with the bad tag.\n", coalesced);
+    check(coalesced > 0, "good and bad reads were coalesced");
+
+    plc_tag_destroy(good);
+    plc_tag_destroy(bad);
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+}
+
+
+/*
+ * Writes of adjacent registers go out together, and an exception on a
+ * read attached to a write with function 0x17 does not fail the write.
+ */
+static void test_writes(void)
+{
+    int32_t tags[MAX_TAGS];
+    int num_tags = 10;
+    int32_t writer = 0;
+    int32_t bad = 0;
+    int64_t requests = 0;
+    int64_t coalesced = 0;
+
+    for(int i=0; i < num_tags; i++) {
+        tags[i] = create_tag(WRITE_OPTIONS, 0, 300 + (i * 2), 2, 1);
+
+        plc_tag_set_int16(tags[i], 0, (int16_t)(3000 + (i * 10)));
+        plc_tag_set_int16(tags[i], 2, (int16_t)(3000 + (i * 10) + 1));
+    }
+
+    requests = get_stat(STATS_REQUESTS_SENT);
+    run_all(tags, num_tags, 1);
+    requests = get_stat(STATS_REQUESTS_SENT) - requests;
+
+    fprintf(stderr, "%d merged writes took %" PRId64 " requests.\n", num_tags, requests);
+    check(requests > 0 && requests < num_tags, "merged writes use fewer requests than tags");
+
+    for(int i=0; i < num_tags; i++) {
+        check(plc_tag_status(tags[i]) == PLCTAG_STATUS_OK, "merged write status");
+
+        plc_tag_set_int32(tags[i], 0, 0);
+        check(plc_tag_read(tags[i], DATA_TIMEOUT) == PLCTAG_STATUS_OK, "read back of merged write");
+        check(values_match(tags[i], 3000 + (i * 10)), "merged write data");
+    }
+
+    /* the write goes first so that the read is attached to it. */
+    writer = create_tag(WRITE_OPTIONS, 0, 10, 2, 1);
+    bad = create_tag(WRITE_OPTIONS, 0, 998, 4, 0);
+
+    coalesced = get_stat(STATS_MB_COALESCED_READS);
+
+    for(int i=0; i < ITERATIONS; i++) {
+        plc_tag_set_int16(writer, 0, (int16_t)(100 + i));
+        plc_tag_set_int16(writer, 2, (int16_t)(100 + i + 1));
+
+        check(plc_tag_write(writer, 0) == PLCTAG_STATUS_PENDING, "start write");
+        check(plc_tag_read(bad, 0) == PLCTAG_STATUS_PENDING, "start read");
+
+        while(plc_tag_status(writer) == PLCTAG_STATUS_PENDING || plc_tag_status(bad) == PLCTAG_STATUS_PENDING) {
+            util_sleep_ms(1);
+        }
+
+        check(plc_tag_status(writer) == PLCTAG_STATUS_OK, "write with a bad attached read");
+        check(plc_tag_status(bad) != PLCTAG_STATUS_OK, "bad attached read fails");
+
+        plc_tag_set_int32(writer, 0, 0);
+        check(plc_tag_read(writer, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "read back of write");
+        check(values_match(writer, 100 + i), "write data with a bad attached read");
+    }
+
+    coalesced = get_stat(STATS_MB_COALESCED_READS) - coalesced;
+
+    fprintf(stderr, "%" PRId64 " reads were attached to writes.\n", coalesced);
+    check(coalesced > 0, "reads were attached to writes");
+
+    plc_tag_destroy(writer);
+    plc_tag_destroy(bad);
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+}
+
+
+/* many reads at once with the adaptive window all complete, one request each. */
+static void test_window(void)
+{
+    int32_t tags[MAX_TAGS];
+    int num_tags = MAX_TAGS;
+    int64_t requests = 0;
+
+    for(int i=0; i < num_tags; i++) {
+        tags[i] = create_tag("&adaptive_window=1", 0, 500 + (i * 4), 2, 1);
+    }
+
+    write_values(tags, num_tags, 5000);
+
+    for(int iteration=0; iteration < ITERATIONS; iteration++) {
+        for(int i=0; i < num_tags; i++) {
+            plc_tag_set_int32(tags[i], 0, 0);
+        }
+
+        requests = get_stat(STATS_REQUESTS_SENT);
+        run_all(tags, num_tags, 0);
+        requests = get_stat(STATS_REQUESTS_SENT) - requests;
+
+        check(requests == num_tags, "one request per read");
+
+        for(int i=0; i < num_tags; i++) {
+            check(plc_tag_status(tags[i]) == PLCTAG_STATUS_OK, "windowed read status");
+            check(values_match(tags[i], 5000 + (i * 10)), "windowed read data");
+        }
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+}
+
+
+/*
+ * Follow the adaptive window against a server that takes BUSY_LIMIT
+ * requests at once.  The latency is flat up to the limit, so the window
+ * must grow until it passes the limit.  The server answers the extra
+ * requests with exception 0x06, which must cut the window back within the
+ * limit.  The window must never get far past the limit and every read
+ * must still complete with the right data.
+ *
+ * The window is sampled while the reads run, so a short lived step can be
+ * missed.  The checks only rely on the direction of each change.
+ */
+static void test_busy(void)
+{
+    int32_t tags[MAX_TAGS];
+    int num_tags = MAX_TAGS;
+    int steps[MAX_WINDOW_STEPS];
+    int num_steps = 0;
+    int peak = 0;
+    int grew_to_limit = 0;
+    int cuts = 0;
+
+    for(int i=0; i < num_tags; i++) {
+        tags[i] = create_tag("&adaptive_window=1", 0, 500 + (i * 4), 2, 1);
+    }
+
+    write_values(tags, num_tags, 6000);
+
+    steps[num_steps++] = plc_tag_get_int_attribute(tags[0], "request_window", 0);
+
+    for(int iteration=0; iteration < ITERATIONS; iteration++) {
+        int64_t timeout = util_time_ms() + DATA_TIMEOUT;
+        int pending = 0;
+
+        for(int i=0; i < num_tags; i++) {
+            plc_tag_set_int32(tags[i], 0, 0);
+            plc_tag_read(tags[i], 0);
+        }
+
+        /* note each change of the window while the reads run. */
+        do {
+            int window = plc_tag_get_int_attribute(tags[0], "request_window", 0);
+
+            if(window != steps[num_steps - 1] && num_steps < MAX_WINDOW_STEPS) {
+                steps[num_steps++] = window;
+            }
+
+            pending = 0;
+
+            for(int i=0; i < num_tags; i++) {
+                if(plc_tag_status(tags[i]) == PLCTAG_STATUS_PENDING) {
+                    pending++;
+                }
+            }
+        } while(pending && timeout > util_time_ms());
+
+        check(!pending, "operations finished in time");
+
+        for(int i=0; i < num_tags; i++) {
+            check(plc_tag_status(tags[i]) == PLCTAG_STATUS_OK, "read status with a busy server");
+            check(values_match(tags[i], 6000 + (i * 10)), "read data with a busy server");
+        }
+    }
+
+    fprintf(stderr, "Request window:");
+    for(int i=0; i < num_steps; i++) {
+        fprintf(stderr, " %d", steps[i]);
+    }
+    fprintf(stderr, "\n");
+
+    check(steps[0] < BUSY_LIMIT, "the window starts below the server's limit");
+
+    for(int i=1; i < num_steps; i++) {
+        if(steps[i] < steps[i - 1]) {
+            /* the latency stays flat, so only a busy server cuts the window. */
+            check(steps[i - 1] > BUSY_LIMIT, "the window is only cut past the server's limit");
+            check(steps[i] <= BUSY_LIMIT, "a busy server cuts the window back within its limit");
+            cuts++;
+        }
+
+        if(steps[i] >= BUSY_LIMIT && cuts == 0) {
+            grew_to_limit = 1;
+        }
+
+        peak = (steps[i] > peak ? steps[i] : peak);
+    }
+
+    check(grew_to_limit, "the window grows to the server's limit while the latency is flat");
+    check(cuts > 0, "the window is cut when the server is busy");
+    check(peak <= 2 * BUSY_LIMIT, "the window does not grow far past the server's limit");
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+}
+
+
+/* idle tags do not cause any requests. */
+static void test_idle(void)
+{
+    int32_t tags[MAX_TAGS];
+    int num_tags = MAX_TAGS;
+    int64_t requests = 0;
+
+    for(int i=0; i < num_tags; i++) {
+        tags[i] = create_tag("", 0, 600 + (i * 2), 2, 1);
+    }
+
+    requests = get_stat(STATS_REQUESTS_SENT);
+    util_sleep_ms(500);
+    requests = get_stat(STATS_REQUESTS_SENT) - requests;
+
+    fprintf(stderr, "%d idle tags sent %" PRId64 " requests.\n", num_tags, requests);
+    check(requests == 0, "idle tags send nothing");
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+}
+
+
+/* a large tag is read in one request per chunk. */
+static void test_large(void)
+{
+    int32_t tag = create_tag("&max_requests_in_flight=4", 0, 100, 500, 1);
+    int64_t requests = 0;
+
+    for(int i=0; i < 500; i++) {
+        plc_tag_set_int16(tag, i * 2, (int16_t)(i * 3));
+    }
+
+    check(plc_tag_write(tag, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "large write");
+
+    for(int i=0; i < 500; i++) {
+        plc_tag_set_int16(tag, i * 2, 0);
+    }
+
+    requests = get_stat(STATS_REQUESTS_SENT);
+    check(plc_tag_read(tag, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "large read");
+    requests = get_stat(STATS_REQUESTS_SENT) - requests;
+
+    fprintf(stderr, "Large read took %" PRId64 " requests.\n", requests);
+
+    /* 125 registers fit in one response. */
+    check(requests == 4, "large read uses one request per chunk");
+
+    for(int i=0; i < 500; i++) {
+        if(plc_tag_get_int16(tag, i * 2) != (int16_t)(i * 3)) {
+            fprintf(stderr, "Register %d is %d, expected %d.\n", 100 + i, plc_tag_get_int16(tag, i * 2), i * 3);
+            check(0, "large read data");
+            break;
+        }
+    }
+
+    plc_tag_destroy(tag);
+}
+
+
+/* unit IDs on the same gateway share one connection but not requests. */
+static void test_units(void)
+{
+    int32_t tags[2];
+    int64_t sessions = get_stat(STATS_LIVE_SESSIONS);
+    int64_t requests = 0;
+
+    tags[0] = create_tag(READ_OPTIONS, 1, 700, 2, 1);
+    tags[1] = create_tag(READ_OPTIONS, 2, 702, 2, 1);
+
+    sessions = get_stat(STATS_LIVE_SESSIONS) - sessions;
+
+    fprintf(stderr, "Two unit IDs opened %" PRId64 " connections.\n", sessions);
+    check(sessions == 1, "unit IDs share a connection");
+
+    for(int i=0; i < ITERATIONS; i++) {
+        requests = get_stat(STATS_REQUESTS_SENT);
+        run_all(tags, 2, 0);
+        requests = get_stat(STATS_REQUESTS_SENT) - requests;
+
+        check(requests == 2, "reads of different units are not merged");
+        check(plc_tag_status(tags[0]) == PLCTAG_STATUS_OK && plc_tag_status(tags[1]) == PLCTAG_STATUS_OK, "unit reads status");
+    }
+
+    plc_tag_destroy(tags[0]);
+    plc_tag_destroy(tags[1]);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *mode = (argc > 1 ? argv[1] : "");
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(strcmp(mode, "reads") == 0) {
+        test_reads();
+    } else if(strcmp(mode, "writes") == 0) {
+        test_writes();
+    } else if(strcmp(mode, "window") == 0) {
+        test_window();
+    } else if(strcmp(mode, "busy") == 0) {
+        test_busy();
+    } else if(strcmp(mode, "idle") == 0) {
+        test_idle();
+    } else if(strcmp(mode, "large") == 0) {
+        test_large();
+    } else if(strcmp(mode, "units") == 0) {
+        test_units();
+    } else {
+        fprintf(stderr, "Usage: test_modbus_requests <reads|writes|window|busy|idle|large|units>\n");
+        return 1;
+    }
+
+    plc_tag_shutdown();
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
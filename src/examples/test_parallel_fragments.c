@@ -0,0 +1,255 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Check reads and writes of a large tag with parallel_fragments on.
+ *
+ *  - A pattern written through the fragment window must read back the same
+ *    through the window and through a plain sequential tag.
+ *  - Several fragments must be queued in the session at once.
+ *  - The short last fragment must be packed with a read of another tag
+ *    queued behind it, so the stats tag shows more requests than packets.
+ *
+ * Usage: test_parallel_fragments [gateway]
+ *
+ * Run against ab_server --plc=ControlLogix --path=1,0 --delay=10 --tag=TestBigArray:DINT[2000] --tag=TestDINT:DINT[1]
+ * The delay keeps the short fragment queued until the small read is behind it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define BIG_TAG_ATTRIBS "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&elem_count=2000&name=TestBigArray&parallel_fragments=%d"
+#define SMALL_TAG_ATTRIBS "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&name=TestDINT"
+#define STATS_TAG "protocol=system&name=stats"
+
+/* entry indexes in the stats tag. */
+#define STATS_PACKETS_SENT_ENTRY (5)
+#define STATS_REQUESTS_SENT_ENTRY (7)
+
+#define DEFAULT_GATEWAY "127.0.0.1"
+#define ELEM_COUNT (2000)
+#define WINDOW (8)
+#define DATA_TIMEOUT (5000)
+
+static const char *gateway = DEFAULT_GATEWAY;
+
+static int failures = 0;
+
+
+static void check(int ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+static int32_t create_tag(const char *fmt, int window)
+{
+    char attribs[256];
+    int32_t tag = 0;
+
+    snprintf(attribs, sizeof(attribs), fmt, gateway, window);
+
+    tag = plc_tag_create(attribs, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "Error %s creating tag %s!\n", plc_tag_decode_error(tag), attribs);
+        exit(1);
+    }
+
+    return tag;
+}
+
+
+static int read_stats(int64_t *packets, int64_t *requests)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int32_t stats = plc_tag_create(STATS_TAG, DATA_TIMEOUT);
+
+    if(stats < 0) {
+        fprintf(stderr, "Error %s creating stats tag!\n", plc_tag_decode_error(stats));
+        return stats;
+    }
+
+    rc = plc_tag_read(stats, DATA_TIMEOUT);
+    if(rc == PLCTAG_STATUS_OK) {
+        *packets = plc_tag_get_int64(stats, STATS_PACKETS_SENT_ENTRY * 8);
+        *requests = plc_tag_get_int64(stats, STATS_REQUESTS_SENT_ENTRY * 8);
+    }
+
+    plc_tag_destroy(stats);
+
+    return rc;
+}
+
+
+static int pattern_matches(int32_t tag, int32_t seed)
+{
+    for(int i=0; i < ELEM_COUNT; i++) {
+        if(plc_tag_get_int32(tag, i * 4) != seed + (i * 7)) {
+            fprintf(stderr, "Element %d of tag %d is %d, expected %d.\n", i, tag, plc_tag_get_int32(tag, i * 4), seed + (i * 7));
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+static void clear_tag(int32_t tag)
+{
+    for(int i=0; i < ELEM_COUNT; i++) {
+        plc_tag_set_int32(tag, i * 4, 0);
+    }
+}
+
+
+static int wait_for_reads(int32_t *tags, int num_tags)
+{
+    int64_t timeout = util_time_ms() + DATA_TIMEOUT;
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int i=0; i < num_tags; i++) {
+        while((rc = plc_tag_status(tags[i])) == PLCTAG_STATUS_PENDING && util_time_ms() < timeout) {
+            util_sleep_ms(1);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Read of tag %d finished with %s!\n", tags[i], plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int main(int argc, char **argv)
+{
+    int32_t big = 0;
+    int32_t plain = 0;
+    int32_t small = 0;
+    int32_t reads[2];
+    int64_t packets_before = 0, requests_before = 0;
+    int64_t packets_after = 0, requests_after = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc > 1) {
+        gateway = argv[1];
+    }
+
+    big = create_tag(BIG_TAG_ATTRIBS, WINDOW);
+    plain = create_tag(BIG_TAG_ATTRIBS, 1);
+    small = create_tag(SMALL_TAG_ATTRIBS, 0);
+
+    /* the first read finds the type and size, it is always sequential. */
+    check(plc_tag_read(big, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "first read of the big tag");
+    check(plc_tag_read(plain, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "first read of the plain tag");
+    check(plc_tag_read(small, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "first read of the small tag");
+
+    /* write through the window and read back both ways. */
+    for(int i=0; i < ELEM_COUNT; i++) {
+        plc_tag_set_int32(big, i * 4, 1000 + (i * 7));
+    }
+
+    check(plc_tag_write(big, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "parallel write of the big tag");
+
+    clear_tag(plain);
+    check(plc_tag_read(plain, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "sequential read of the big tag");
+    check(pattern_matches(plain, 1000), "sequential read returns the data written in parallel");
+
+    clear_tag(big);
+    check(plc_tag_read(big, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "parallel read of the big tag");
+    check(pattern_matches(big, 1000), "parallel read returns the data written in parallel");
+
+    /* and the other way around. */
+    for(int i=0; i < ELEM_COUNT; i++) {
+        plc_tag_set_int32(plain, i * 4, 5000 + (i * 7));
+    }
+
+    check(plc_tag_write(plain, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "sequential write of the big tag");
+
+    clear_tag(big);
+    check(plc_tag_read(big, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "parallel read of the big tag");
+    check(pattern_matches(big, 5000), "parallel read returns the data written sequentially");
+
+    check(plc_tag_get_int_attribute(big, "session_max_queue_depth", 0) > 1, "several fragments were queued at once");
+
+    /* the short last fragment packs with the small read queued right behind it. */
+    check(read_stats(&packets_before, &requests_before) == PLCTAG_STATUS_OK, "read the stats before");
+
+    reads[0] = big;
+    reads[1] = small;
+    clear_tag(big);
+    plc_tag_read(big, 0);
+    plc_tag_read(small, 0);
+    check(wait_for_reads(reads, 2) == PLCTAG_STATUS_OK, "parallel read together with the small tag");
+    check(pattern_matches(big, 5000), "packed parallel read returns the right data");
+
+    check(read_stats(&packets_after, &requests_after) == PLCTAG_STATUS_OK, "read the stats after");
+
+    fprintf(stderr, "Sent %d requests in %d packets.\n", (int)(requests_after - requests_before), (int)(packets_after - packets_before));
+    check(requests_after - requests_before > 2, "the big tag was read in several fragments");
+    check(requests_after - requests_before > packets_after - packets_before, "the last fragment was packed with the small read");
+
+    plc_tag_destroy(big);
+    plc_tag_destroy(plain);
+    plc_tag_destroy(small);
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Check that merged PCCC reads give each tag its own data and status.
+ *
+ * Several N7 elements are read at the same time so that the reads are
+ * merged.  One of them is past the end of the data file, so the merged
+ * read fails and the library must read each tag on its own.  Only the
+ * bad tag may report an error, and once its own read has failed it must
+ * not be merged again.  Then every merge saves a packet and no merged read
+ * has to be sent again.
+ *
+ * Run against ab_server --plc=SLC500 --tag=N7[10]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define TAG_ATTRIBS "protocol=ab-eip&gateway=127.0.0.1&plc=slc500&elem_count=1&pccc_merge_reads=1&name=N7:%d"
+#define STATS_TAG "protocol=system&name=stats"
+
+/* entry indexes in the stats tag. */
+#define STATS_PACKETS_SENT_ENTRY (5)
+#define STATS_PCCC_MERGED_READS_ENTRY (29)
+
+#define NUM_TAGS (4)
+#define BAD_TAG (NUM_TAGS - 1)
+#define ITERATIONS (10)
+#define DATA_TIMEOUT (5000)
+
+static const int elements[NUM_TAGS] = { 0, 1, 2, 20 };
+
+
+static int64_t read_stat(int32_t stats, int entry)
+{
+    if(stats < 0 || plc_tag_read(stats, DATA_TIMEOUT) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to read the stats tag!\n");
+        return -1;
+    }
+
+    return plc_tag_get_int64(stats, entry * 8);
+}
+
+
+static int read_all(int32_t *tags)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t timeout = util_time_ms() + DATA_TIMEOUT;
+    int pending = 0;
+
+    /* start all the reads together so that they get merged. */
+    for(int i=0; i < NUM_TAGS; i++) {
+        rc = plc_tag_read(tags[i], 0);
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+            fprintf(stderr, "Error %s starting read of N7:%d!\n", plc_tag_decode_error(rc), elements[i]);
+            return rc;
+        }
+    }
+
+    do {
+        pending = 0;
+
+        for(int i=0; i < NUM_TAGS; i++) {
+            if(plc_tag_status(tags[i]) == PLCTAG_STATUS_PENDING) {
+                pending++;
+            }
+        }
+
+        if(pending) {
+            util_sleep_ms(1);
+        }
+    } while(pending && timeout > util_time_ms());
+
+    if(pending) {
+        fprintf(stderr, "Timed out waiting for %d reads!\n", pending);
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int main(int argc, char **argv)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int32_t tags[NUM_TAGS] = {0};
+    int32_t stats = 0;
+    int64_t merged_reads = 0;
+    int64_t merged_before = 0;
+    int64_t packets_before = 0;
+    int64_t packets = 0;
+    char tag_attribs[128];
+    int failures = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    (void)argc;
+    (void)argv;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        snprintf(tag_attribs, sizeof(tag_attribs), TAG_ATTRIBS, elements[i]);
+
+        /* the initial read of the bad tag fails, so do not wait for it. */
+        tags[i] = plc_tag_create(tag_attribs, (i == BAD_TAG ? 0 : DATA_TIMEOUT));
+        if(tags[i] < 0) {
+            fprintf(stderr, "Error %s creating tag N7:%d!\n", plc_tag_decode_error(tags[i]), elements[i]);
+            return 1;
+        }
+
+        /* give the good tags values we can check. */
+        if(i != BAD_TAG) {
+            plc_tag_set_int16(tags[i], 0, (int16_t)(100 + elements[i]));
+
+            rc = plc_tag_write(tags[i], DATA_TIMEOUT);
+            if(rc != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Error %s writing tag N7:%d!\n", plc_tag_decode_error(rc), elements[i]);
+                return 1;
+            }
+
+            plc_tag_set_int16(tags[i], 0, 0);
+        }
+    }
+
+    /* wait for the initial read of the bad tag to finish, then read it on its own. */
+    do {
+        rc = plc_tag_read(tags[BAD_TAG], DATA_TIMEOUT);
+        if(rc == PLCTAG_ERR_BUSY) {
+            util_sleep_ms(1);
+        }
+    } while(rc == PLCTAG_ERR_BUSY);
+
+    if(rc == PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Read of N7:%d should have failed!  Is the emulator running with --tag=N7[10]?\n", elements[BAD_TAG]);
+        failures++;
+    }
+
+    stats = plc_tag_create(STATS_TAG, DATA_TIMEOUT);
+    merged_before = read_stat(stats, STATS_PCCC_MERGED_READS_ENTRY);
+    packets_before = read_stat(stats, STATS_PACKETS_SENT_ENTRY);
+    if(merged_before < 0 || packets_before < 0) {
+        failures++;
+    }
+
+    for(int iteration=0; iteration < ITERATIONS && !failures; iteration++) {
+        rc = read_all(tags);
+        if(rc != PLCTAG_STATUS_OK) {
+            failures++;
+            break;
+        }
+
+        for(int i=0; i < NUM_TAGS; i++) {
+            rc = plc_tag_status(tags[i]);
+
+            if(i == BAD_TAG) {
+                if(rc == PLCTAG_STATUS_OK) {
+                    fprintf(stderr, "Read of N7:%d should have failed!\n", elements[i]);
+                    failures++;
+                }
+            } else if(rc != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Read of N7:%d failed with %s!\n", elements[i], plc_tag_decode_error(rc));
+                failures++;
+            } else if(plc_tag_get_int16(tags[i], 0) != 100 + elements[i]) {
+                fprintf(stderr, "Read of N7:%d returned %d, expected %d!\n", elements[i], plc_tag_get_int16(tags[i], 0), 100 + elements[i]);
+                failures++;
+            }
+        }
+    }
+
+    /* make sure the reads really were merged, but never with the bad tag. */
+    merged_reads = read_stat(stats, STATS_PCCC_MERGED_READS_ENTRY) - merged_before;
+    packets = read_stat(stats, STATS_PACKETS_SENT_ENTRY) - packets_before;
+    if(merged_reads < 0 || packets < 0) {
+        failures++;
+    } else {
+        fprintf(stderr, "%" PRId64 " reads were merged, %" PRId64 " packets were sent.\n", merged_reads, packets);
+
+        if(merged_reads <= 0) {
+            fprintf(stderr, "No reads were merged!\n");
+            failures++;
+        }
+
+        if(merged_reads > ITERATIONS * (NUM_TAGS - 2)) {
+            fprintf(stderr, "The bad tag was merged with the others!\n");
+            failures++;
+        }
+
+        if(packets > (ITERATIONS * NUM_TAGS) - merged_reads) {
+            fprintf(stderr, "Too many packets, the merged reads failed and were sent again!\n");
+            failures++;
+        }
+    }
+
+    if(stats > 0) {
+        plc_tag_destroy(stats);
+    }
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    plc_tag_shutdown();
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Check that tags with the same automatic read period on one connection
+ * read together.
+ *
+ * Each rate group reads on a fixed grid of its period, so all of its tags
+ * come due in the same tickler pass and the session packs their requests.
+ * The test creates several tags with the same auto_sync_read_ms, lets them
+ * run for a number of periods and compares the stats counters: every tag
+ * must be read each period, but in fewer packets than there are tags.
+ *
+ * Usage: test_rate_group [number of tags [gateway]]
+ *
+ * Run against ab_server --plc=ControlLogix --path=1,0 --delay=10 --tag=RateDINT:DINT[20]
+ * The delay keeps the rest of the burst queued while the first read is
+ * out, as the latency of a real PLC would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define TAG_ATTRIBS "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&name=RateDINT[%d]&auto_sync_read_ms=%d"
+#define STATS_TAG "protocol=system&name=stats"
+
+/* entry indexes in the stats tag. */
+#define STATS_PACKETS_SENT_ENTRY (5)
+#define STATS_REQUESTS_SENT_ENTRY (7)
+
+#define DEFAULT_NUM_TAGS (10)
+#define DEFAULT_GATEWAY "127.0.0.1"
+#define MAX_TAGS (20)
+#define READ_PERIOD_MS (100)
+#define RUN_PERIODS (10)
+#define DATA_TIMEOUT (5000)
+
+static const char *gateway = DEFAULT_GATEWAY;
+static int num_tags = DEFAULT_NUM_TAGS;
+
+static int failures = 0;
+
+
+static void check(int ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+static int read_stats(int64_t *packets, int64_t *requests)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int32_t stats = plc_tag_create(STATS_TAG, DATA_TIMEOUT);
+
+    if(stats < 0) {
+        fprintf(stderr, "Error %s creating stats tag!\n", plc_tag_decode_error(stats));
+        return stats;
+    }
+
+    rc = plc_tag_read(stats, DATA_TIMEOUT);
+    if(rc == PLCTAG_STATUS_OK) {
+        *packets = plc_tag_get_int64(stats, STATS_PACKETS_SENT_ENTRY * 8);
+        *requests = plc_tag_get_int64(stats, STATS_REQUESTS_SENT_ENTRY * 8);
+    }
+
+    plc_tag_destroy(stats);
+
+    return rc;
+}
+
+
+int main(int argc, char **argv)
+{
+    char attribs[256];
+    int32_t tags[MAX_TAGS];
+    int64_t packets_before = 0, requests_before = 0;
+    int64_t packets_after = 0, requests_after = 0;
+    int64_t packets = 0, requests = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc > 1) {
+        num_tags = atoi(argv[1]);
+        if(num_tags < 2 || num_tags > MAX_TAGS) {
+            fprintf(stderr, "The number of tags must be between 2 and %d!\n", MAX_TAGS);
+            exit(1);
+        }
+    }
+
+    if(argc > 2) {
+        gateway = argv[2];
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        snprintf(attribs, sizeof(attribs), TAG_ATTRIBS, gateway, i, READ_PERIOD_MS);
+
+        tags[i] = plc_tag_create(attribs, DATA_TIMEOUT);
+        if(tags[i] < 0) {
+            fprintf(stderr, "Error %s creating tag %s!\n", plc_tag_decode_error(tags[i]), attribs);
+            exit(1);
+        }
+    }
+
+    /* let the tags settle onto the grid of their rate group. */
+    util_sleep_ms(2 * READ_PERIOD_MS);
+
+    check(read_stats(&packets_before, &requests_before) == PLCTAG_STATUS_OK, "read the stats before");
+    util_sleep_ms(RUN_PERIODS * READ_PERIOD_MS);
+    check(read_stats(&packets_after, &requests_after) == PLCTAG_STATUS_OK, "read the stats after");
+
+    packets = packets_after - packets_before;
+    requests = requests_after - requests_before;
+
+    fprintf(stderr, "%d tags sent %d requests in %d packets over %d periods.\n", num_tags, (int)requests, (int)packets, RUN_PERIODS);
+
+    /* a period can fall at either end of the run. */
+    check(requests >= (int64_t)num_tags * (RUN_PERIODS - 1), "every tag is read each period");
+    check(packets < requests, "the reads of a rate group are packed");
+    check(packets <= (int64_t)(RUN_PERIODS + 1) * 2, "each period sends a burst of a packet or two, not one packet per tag");
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
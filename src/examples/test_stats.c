@@ -0,0 +1,346 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Read the library performance counters through the "stats" system tag.
+ *
+ * If a tag string is given, the tag is read repeatedly first so that
+ * there is some traffic to count.  The counters are then checked against
+ * that traffic and the program exits with a non-zero status if any check
+ * fails.  The tag's session queue depth attributes are checked too.
+ *
+ * Then many short lived threads each create a tag and exit.  Their
+ * counters must still be in the totals after they are gone, and the
+ * memory used must not grow with the number of threads.
+ *
+ * Usage: test_stats [tag string] [num_reads]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define STATS_TAG "protocol=system&name=stats"
+
+#define DEFAULT_NUM_READS (100)
+
+#define SYSTEM_TAG "protocol=system&name=version"
+#define CHURN_THREADS (5000)
+#define MAX_CHURN_GROWTH_BYTES (512 * 1024)
+#define DATA_TIMEOUT (5000)
+
+/* entry indexes used in the checks. */
+#define STAT_ENTRIES (0)
+#define STAT_LIVE_TAGS (1)
+#define STAT_LIVE_SESSIONS (2)
+#define STAT_QUEUED_REQUESTS (3)
+#define STAT_PACKETS_SENT (5)
+#define STAT_PACKETS_RECEIVED (6)
+#define STAT_REQUESTS_SENT (7)
+#define STAT_BYTES_SENT (8)
+#define STAT_BYTES_RECEIVED (9)
+#define STAT_RTT_FIRST (11)
+#define STAT_RTT_LAST (20)
+
+/* in the order the library returns them. */
+static const char *field_names[] = {
+    "entries",
+    "live tags",
+    "live sessions",
+    "queued requests",
+    "max queue depth",
+    "packets sent",
+    "packets received",
+    "requests sent",
+    "bytes sent",
+    "bytes received",
+    "reconnects",
+    "rtt < 1ms",
+    "rtt < 2ms",
+    "rtt < 5ms",
+    "rtt < 10ms",
+    "rtt < 20ms",
+    "rtt < 50ms",
+    "rtt < 100ms",
+    "rtt < 250ms",
+    "rtt < 1000ms",
+    "rtt >= 1000ms",
+    "tickler passes",
+    "tickler total us",
+    "tickler max pass us",
+    "modbus slots in use",
+    "modbus slots total",
+    "modbus coalesced reads",
+    "modbus coalesced writes",
+    "modbus retransmits",
+    "pccc merged reads"
+};
+
+
+static int failures = 0;
+
+
+static void check(int ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+static int64_t get_stat(int32_t stats, int entry)
+{
+    return plc_tag_get_int64(stats, entry * 8);
+}
+
+
+static int64_t read_stat(int field)
+{
+    int64_t result = -1;
+    int32_t stats = plc_tag_create(STATS_TAG, DATA_TIMEOUT);
+
+    if(stats < 0) {
+        return -1;
+    }
+
+    if(plc_tag_read(stats, DATA_TIMEOUT) == PLCTAG_STATUS_OK) {
+        result = get_stat(stats, field);
+    }
+
+    plc_tag_destroy(stats);
+
+    return result;
+}
+
+
+static int64_t get_rss_bytes(void)
+{
+    long pages_total = 0;
+    long pages_resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if(!statm) {
+        return -1;
+    }
+
+    if(fscanf(statm, "%ld %ld", &pages_total, &pages_resident) != 2) {
+        pages_resident = -1;
+    }
+
+    fclose(statm);
+
+    return (int64_t)pages_resident * (int64_t)sysconf(_SC_PAGESIZE);
+}
+
+
+/* create a tag and leave it for the main thread to destroy. */
+static void *churn_thread(void *arg)
+{
+    int32_t *tag = (int32_t *)arg;
+
+    *tag = plc_tag_create(SYSTEM_TAG, DATA_TIMEOUT);
+
+    return NULL;
+}
+
+
+static void run_thread_churn(void)
+{
+    static int32_t tags[CHURN_THREADS];
+    int64_t start_tags = read_stat(STAT_LIVE_TAGS);
+    int64_t rss_start = 0;
+    int64_t rss_end = 0;
+    int created = 0;
+
+    /* one round first so that memory pools are warmed up. */
+    for(int round=0; round < 2; round++) {
+        created = 0;
+
+        if(round == 1) {
+            rss_start = get_rss_bytes();
+        }
+
+        for(int i=0; i < CHURN_THREADS; i++) {
+            pthread_t thread;
+
+            tags[i] = PLCTAG_ERR_CREATE;
+
+            pthread_create(&thread, NULL, churn_thread, &tags[i]);
+            pthread_join(thread, NULL);
+
+            if(tags[i] > 0) {
+                created++;
+            }
+        }
+
+        check(created == CHURN_THREADS, "threads could not create their tags");
+
+        /* the threads are gone, their increments must not be. */
+        check(read_stat(STAT_LIVE_TAGS) == start_tags + created, "live tag count lost the counts of exited threads");
+
+        for(int i=0; i < CHURN_THREADS; i++) {
+            if(tags[i] > 0) {
+                plc_tag_destroy(tags[i]);
+            }
+        }
+
+        check(read_stat(STAT_LIVE_TAGS) == start_tags, "live tag count wrong after destroying the threads' tags");
+    }
+
+    rss_end = get_rss_bytes();
+
+    if(rss_start < 0 || rss_end < 0) {
+        fprintf(stderr, "Unable to read the resident set size, skipping the memory check.\n");
+        return;
+    }
+
+    fprintf(stderr, "%d threads updated counters and exited, RSS before %" PRId64 " bytes, after %" PRId64 " bytes.\n",
+                    CHURN_THREADS, rss_start, rss_end);
+
+    check(rss_end - rss_start <= MAX_CHURN_GROWTH_BYTES, "memory grew with the number of threads");
+}
+
+
+int main(int argc, char **argv)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int num_reads = DEFAULT_NUM_READS;
+    int32_t tag = 0;
+    int32_t stats = 0;
+    int num_entries = 0;
+    int num_names = (int)(sizeof(field_names)/sizeof(field_names[0]));
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc > 2) {
+        num_reads = atoi(argv[2]);
+    }
+
+    if(argc > 1) {
+        tag = plc_tag_create(argv[1], DATA_TIMEOUT);
+        if(tag < 0) {
+            fprintf(stderr, "Error %s creating tag!\n", plc_tag_decode_error(tag));
+            return 1;
+        }
+
+        for(int i=0; i < num_reads && rc == PLCTAG_STATUS_OK; i++) {
+            rc = plc_tag_read(tag, DATA_TIMEOUT);
+            if(rc != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Error %s reading tag!\n", plc_tag_decode_error(rc));
+            }
+        }
+    }
+
+    stats = plc_tag_create(STATS_TAG, DATA_TIMEOUT);
+    if(stats < 0) {
+        fprintf(stderr, "Error %s creating stats tag!\n", plc_tag_decode_error(stats));
+        return 1;
+    }
+
+    rc = plc_tag_read(stats, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Error %s reading stats tag!\n", plc_tag_decode_error(rc));
+    } else {
+        num_entries = (int)plc_tag_get_int64(stats, 0);
+
+        for(int i=0; i < num_entries; i++) {
+            fprintf(stderr, "%-22s %" PRId64 "\n", (i < num_names ? field_names[i] : "unknown"), plc_tag_get_int64(stats, i * 8));
+        }
+
+        check(num_entries == num_names, "number of entries does not match the known counters");
+        check(plc_tag_get_size(stats) >= num_entries * 8, "stats tag is too small for its entries");
+        check(get_stat(stats, STAT_LIVE_TAGS) == (tag > 0 ? 2 : 1), "live tag count is wrong");
+
+        if(tag > 0 && rc == PLCTAG_STATUS_OK) {
+            int64_t rtt_total = 0;
+
+            for(int i=STAT_RTT_FIRST; i <= STAT_RTT_LAST; i++) {
+                rtt_total += get_stat(stats, i);
+            }
+
+            check(get_stat(stats, STAT_LIVE_SESSIONS) >= 1, "no live session");
+            check(get_stat(stats, STAT_QUEUED_REQUESTS) == 0, "requests still queued after the reads finished");
+            check(get_stat(stats, STAT_PACKETS_SENT) > 0, "no packets sent");
+            check(get_stat(stats, STAT_PACKETS_RECEIVED) > 0, "no packets received");
+            check(get_stat(stats, STAT_REQUESTS_SENT) >= num_reads, "fewer requests sent than reads");
+            check(get_stat(stats, STAT_BYTES_SENT) > 0, "no bytes sent");
+            check(get_stat(stats, STAT_BYTES_RECEIVED) > 0, "no bytes received");
+            check(rtt_total >= num_reads, "fewer round trip times than reads");
+
+            check(plc_tag_get_int_attribute(tag, "session_queue_depth", -1) == 0, "session queue not empty after the reads finished");
+            check(plc_tag_get_int_attribute(tag, "session_max_queue_depth", -1) >= 1, "session queue depth high water mark not set");
+        }
+    }
+
+    plc_tag_destroy(stats);
+
+    run_thread_churn();
+
+    if(tag > 0) {
+        plc_tag_destroy(tag);
+    }
+
+    plc_tag_shutdown();
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,232 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Check reads by symbol instance (use_symbol_instance=1) against the
+ * emulator.
+ *
+ * The emulator numbers its tags as symbol instances in list order.  SIGUSR1
+ * makes it move the first tag to the end, as if the program had been
+ * downloaded again, and SIGUSR2 makes it drop the connection.  With the
+ * tags below the instances start out as SymA=1, SymB=2 and SymC=3.
+ *
+ *  1. Both DINT tags resolve to an instance and read the values written by
+ *     name.
+ *  2. After one download SymB (a REAL) has instance 1.  The read of SymA
+ *     sees the wrong type, falls back to the name and returns the right
+ *     value.  Both tags then resolve against a fresh listing.
+ *  3. After another download SymA (a DINT) has the instance SymC used, which
+ *     no read can detect.  The connection drops at the same time, so SymC
+ *     must list again on reconnect and still read its own value.
+ *
+ * Usage: test_symbol_instance <emulator PID>
+ *
+ * Run against ab_server --plc=ControlLogix --path=1,0 --tag=SymC:DINT[10] --tag=SymB:REAL[10] --tag=SymA:DINT[10]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/types.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define TAG_ATTRIBS "protocol=ab-eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&allow_packing=0&use_symbol_instance=1&name=%s"
+
+#define SYM_A_VALUE (1111)
+#define SYM_C_VALUE (3333)
+#define MAX_TRIES (20)
+#define DATA_TIMEOUT (5000)
+
+static int failures = 0;
+
+
+static void check(int ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+static int32_t create_tag(const char *name)
+{
+    char attribs[256];
+    int32_t tag = 0;
+
+    snprintf(attribs, sizeof(attribs), TAG_ATTRIBS, name);
+
+    tag = plc_tag_create(attribs, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "Error %s creating tag %s!\n", plc_tag_decode_error(tag), name);
+        exit(1);
+    }
+
+    return tag;
+}
+
+
+/* read the tag, retrying across a dropped connection, and return its value or -1. */
+static int32_t read_value(int32_t tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int i=0; i < MAX_TRIES; i++) {
+        /* make sure the value comes from the PLC. */
+        plc_tag_set_int32(tag, 0, -1);
+
+        rc = plc_tag_read(tag, DATA_TIMEOUT);
+        if(rc == PLCTAG_STATUS_OK) {
+            return plc_tag_get_int32(tag, 0);
+        }
+
+        fprintf(stderr, "Read of tag %d failed with %s, retrying.\n", tag, plc_tag_decode_error(rc));
+        util_sleep_ms(100);
+    }
+
+    return -1;
+}
+
+
+/* read until the tag reads by instance again and return the instance or 0. */
+static int resolved_instance(int32_t tag, int32_t value)
+{
+    for(int i=0; i < MAX_TRIES; i++) {
+        int instance = plc_tag_get_int_attribute(tag, "symbol_instance", -1);
+
+        if(instance > 0) {
+            return instance;
+        }
+
+        check(read_value(tag) == value, "tag reads its own value while it resolves");
+    }
+
+    return 0;
+}
+
+
+static void signal_emulator(pid_t emulator, int sig)
+{
+    if(kill(emulator, sig) != 0) {
+        fprintf(stderr, "Unable to signal the emulator process %d!\n", (int)emulator);
+        exit(1);
+    }
+
+    /* the emulator acts on the signal when the next request comes in. */
+    util_sleep_ms(100);
+}
+
+
+int main(int argc, char **argv)
+{
+    pid_t emulator = 0;
+    int32_t sym_a = 0;
+    int32_t sym_c = 0;
+    int a_instance = 0;
+    int c_instance = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc != 2 || (emulator = (pid_t)atoi(argv[1])) <= 0) {
+        fprintf(stderr, "Usage: test_symbol_instance <emulator PID>\n");
+        exit(1);
+    }
+
+    sym_a = create_tag("SymA[0]");
+    sym_c = create_tag("SymC[0]");
+
+    /* writes always go by name. */
+    plc_tag_set_int32(sym_a, 0, SYM_A_VALUE);
+    check(plc_tag_write(sym_a, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "write SymA by name");
+    plc_tag_set_int32(sym_c, 0, SYM_C_VALUE);
+    check(plc_tag_write(sym_c, DATA_TIMEOUT) == PLCTAG_STATUS_OK, "write SymC by name");
+
+    /* 1. read by instance. */
+    a_instance = resolved_instance(sym_a, SYM_A_VALUE);
+    c_instance = resolved_instance(sym_c, SYM_C_VALUE);
+    fprintf(stderr, "SymA is instance %d and SymC is instance %d.\n", a_instance, c_instance);
+    check(a_instance > 0 && c_instance > 0 && a_instance != c_instance, "tags resolve to separate instances");
+    check(read_value(sym_a) == SYM_A_VALUE, "SymA reads its value by instance");
+    check(read_value(sym_c) == SYM_C_VALUE, "SymC reads its value by instance");
+
+    /* 2. the program changes, SymA's old instance is now a REAL. */
+    signal_emulator(emulator, SIGUSR1);
+
+    check(read_value(sym_a) == SYM_A_VALUE, "SymA falls back to its name after the type changed");
+    check(read_value(sym_c) == SYM_C_VALUE, "SymC reads its value after the cache was dropped");
+
+    a_instance = resolved_instance(sym_a, SYM_A_VALUE);
+    c_instance = resolved_instance(sym_c, SYM_C_VALUE);
+    fprintf(stderr, "After the download SymA is instance %d and SymC is instance %d.\n", a_instance, c_instance);
+    check(a_instance > 0 && c_instance > 0 && a_instance != c_instance, "tags resolve again after the download");
+    check(read_value(sym_a) == SYM_A_VALUE, "SymA reads its value by its new instance");
+    check(read_value(sym_c) == SYM_C_VALUE, "SymC reads its value by its new instance");
+
+    /* 3. the program changes while the connection drops, SymC's old instance is now SymA. */
+    signal_emulator(emulator, SIGUSR1);
+    signal_emulator(emulator, SIGUSR2);
+
+    check(read_value(sym_c) == SYM_C_VALUE, "SymC reads its own value after the reconnect");
+
+    c_instance = resolved_instance(sym_c, SYM_C_VALUE);
+    a_instance = resolved_instance(sym_a, SYM_A_VALUE);
+    fprintf(stderr, "After the reconnect SymA is instance %d and SymC is instance %d.\n", a_instance, c_instance);
+    check(a_instance > 0 && c_instance > 0 && a_instance != c_instance, "tags resolve again after the reconnect");
+    check(read_value(sym_c) == SYM_C_VALUE, "SymC reads its value by instance after the reconnect");
+    check(read_value(sym_a) == SYM_A_VALUE, "SymA reads its value by instance after the reconnect");
+
+    plc_tag_destroy(sym_a);
+    plc_tag_destroy(sym_c);
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
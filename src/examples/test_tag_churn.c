@@ -0,0 +1,251 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Measure tag create/destroy churn with a large number of live tags.
+ *
+ * System tags are used so that no PLC is needed and the numbers are
+ * dominated by the tag table and ID allocation in the library core.
+ *
+ * The IDs of live tags must all be different and a destroyed tag's ID
+ * must never find another tag.  The program exits with a non-zero status
+ * if either check fails.
+ *
+ * Usage: test_tag_churn [num_tags [churn_ops]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define TAG_ATTRIBS "make=system&family=library&name=version"
+
+#define DEFAULT_NUM_TAGS (1000000)
+#define DEFAULT_CHURN_OPS (1000000)
+
+
+static int compare_ids(const void *a, const void *b)
+{
+    int32_t id_a = *(const int32_t *)a;
+    int32_t id_b = *(const int32_t *)b;
+
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+
+static int check_unique(const int32_t *tags, int num_tags)
+{
+    int32_t *sorted = (int32_t *)calloc(sizeof(int32_t), (size_t)(unsigned int)num_tags);
+    int rc = 0;
+
+    if(!sorted) {
+        fprintf(stderr, "Unable to allocate sorted tag ID array!\n");
+        return 1;
+    }
+
+    memcpy(sorted, tags, sizeof(int32_t) * (size_t)(unsigned int)num_tags);
+    qsort(sorted, (size_t)(unsigned int)num_tags, sizeof(int32_t), compare_ids);
+
+    for(int i=1; i < num_tags; i++) {
+        if(sorted[i] == sorted[i - 1]) {
+            fprintf(stderr, "Tag ID %" PRId32 " is used by two live tags!\n", sorted[i]);
+            rc = 1;
+            break;
+        }
+    }
+
+    free(sorted);
+
+    return rc;
+}
+
+
+static void report(const char *phase, int ops, int64_t elapsed_ms)
+{
+    double rate = (elapsed_ms > 0 ? ((double)ops * 1000.0) / (double)elapsed_ms : 0.0);
+
+    fprintf(stderr, "%-10s %9d ops in %7" PRId64 "ms, %10.0f ops/sec.\n", phase, ops, elapsed_ms, rate);
+}
+
+
+int main(int argc, char **argv)
+{
+    int rc = 0;
+    int num_tags = DEFAULT_NUM_TAGS;
+    int churn_ops = DEFAULT_CHURN_OPS;
+    int32_t *tags = NULL;
+    int32_t first_stale_tag = 0;
+    int64_t start = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    fprintf(stderr, "Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_NONE);
+
+    if(argc > 1) {
+        num_tags = atoi(argv[1]);
+    }
+
+    if(argc > 2) {
+        churn_ops = atoi(argv[2]);
+    }
+
+    if(num_tags <= 0 || churn_ops < 0) {
+        fprintf(stderr, "Usage: %s [num_tags [churn_ops]]\n", argv[0]);
+        return 1;
+    }
+
+    tags = (int32_t *)calloc(sizeof(int32_t), (size_t)(unsigned int)num_tags);
+    if(!tags) {
+        fprintf(stderr, "Unable to allocate tag ID array!\n");
+        return 1;
+    }
+
+    srand((unsigned int)(int)(util_time_ms()));
+
+    fprintf(stderr, "Creating %d tags then doing %d destroy/create pairs.\n", num_tags, churn_ops);
+
+    /* fill the table. */
+    start = util_time_ms();
+
+    for(int i=0; i < num_tags; i++) {
+        tags[i] = plc_tag_create(TAG_ATTRIBS, 0);
+        if(tags[i] < 0) {
+            fprintf(stderr, "Error %s creating tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            num_tags = i;
+            rc = 1;
+            goto done;
+        }
+    }
+
+    report("create", num_tags, util_time_ms() - start);
+
+    if(check_unique(tags, num_tags)) {
+        rc = 1;
+        goto done;
+    }
+
+    /* look up random tags. */
+    start = util_time_ms();
+
+    for(int i=0; i < churn_ops; i++) {
+        int32_t tag = tags[rand() % num_tags];
+
+        if(plc_tag_status(tag) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Tag %" PRId32 " has unexpected status %s!\n", tag, plc_tag_decode_error(plc_tag_status(tag)));
+            rc = 1;
+            goto done;
+        }
+    }
+
+    report("lookup", churn_ops, util_time_ms() - start);
+
+    /* destroy random tags and replace them. */
+    start = util_time_ms();
+
+    for(int i=0; i < churn_ops; i++) {
+        int index = rand() % num_tags;
+        int32_t old_tag = tags[index];
+
+        plc_tag_destroy(old_tag);
+
+        if(!first_stale_tag) {
+            first_stale_tag = old_tag;
+        }
+
+        tags[index] = plc_tag_create(TAG_ATTRIBS, 0);
+        if(tags[index] < 0) {
+            fprintf(stderr, "Error %s recreating tag %d!\n", plc_tag_decode_error(tags[index]), index);
+            rc = 1;
+            goto done;
+        }
+
+        /* a stale ID must not find the tag that replaced it. */
+        if(plc_tag_status(old_tag) != PLCTAG_ERR_NOT_FOUND) {
+            fprintf(stderr, "Destroyed tag ID %" PRId32 " still resolves!\n", old_tag);
+            rc = 1;
+            goto done;
+        }
+    }
+
+    report("churn", churn_ops, util_time_ms() - start);
+
+    if(check_unique(tags, num_tags)) {
+        rc = 1;
+        goto done;
+    }
+
+    /* the oldest stale ID must still not resolve after all the slot reuse. */
+    if(first_stale_tag && plc_tag_status(first_stale_tag) != PLCTAG_ERR_NOT_FOUND) {
+        fprintf(stderr, "Destroyed tag ID %" PRId32 " resolves again after churn!\n", first_stale_tag);
+        rc = 1;
+    }
+
+    if(!rc) {
+        fprintf(stderr, "All tests passed.\n");
+    }
+
+done:
+    start = util_time_ms();
+
+    for(int i=0; i < num_tags; i++) {
+        if(tags[i] > 0) {
+            plc_tag_destroy(tags[i]);
+        }
+    }
+
+    report("destroy", num_tags, util_time_ms() - start);
+
+    free(tags);
+
+    plc_tag_shutdown();
+
+    return rc;
+}
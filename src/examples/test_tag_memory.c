@@ -0,0 +1,246 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Report the resident memory used per tag.
+ *
+ * Creates a number of Logix tags against a PLC (or the ab_server
+ * simulator) and compares the resident set size before and after.
+ * Only Linux is supported since this reads /proc/self/statm.
+ *
+ * The test fails if any tag does not come up with the right size or if
+ * the tags use more than max_bytes_per_tag on average.
+ *
+ * Usage: test_tag_memory [num_tags [gateway [max_bytes_per_tag]]]
+ *
+ * Run the simulator with at least num_tags elements:
+ *    ab_server --plc=ControlLogix --path=1,0 --tag=TestBigArray:DINT[100000]
+ *
+ * Packing is turned off because the simulator does not support the
+ * multiple service request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+    #include <malloc.h>
+#endif
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define TAG_ATTRIBS "protocol=ab_eip&gateway=%s&path=1,0&plc=ControlLogix&elem_count=1&allow_packing=0&name=TestBigArray[%d]"
+
+#define DEFAULT_NUM_TAGS (10000)
+#define DEFAULT_GATEWAY "127.0.0.1"
+#define DEFAULT_MAX_BYTES_PER_TAG (8192)
+#define ELEM_SIZE (4)
+
+#define CREATE_TIMEOUT_MS (30000)
+
+
+static int64_t get_rss_bytes(void)
+{
+    long pages_total = 0;
+    long pages_resident = 0;
+    FILE *statm = NULL;
+
+#ifdef __GLIBC__
+    /* give back freed heap memory, such as request buffers, so only live memory is counted. */
+    malloc_trim(0);
+#endif
+
+    statm = fopen("/proc/self/statm", "r");
+
+    if(!statm) {
+        return -1;
+    }
+
+    if(fscanf(statm, "%ld %ld", &pages_total, &pages_resident) != 2) {
+        pages_resident = -1;
+    }
+
+    fclose(statm);
+
+    return (int64_t)pages_resident * (int64_t)sysconf(_SC_PAGESIZE);
+}
+
+
+int main(int argc, char **argv)
+{
+    int rc = 0;
+    int num_tags = DEFAULT_NUM_TAGS;
+    const char *gateway = DEFAULT_GATEWAY;
+    int64_t max_bytes_per_tag = DEFAULT_MAX_BYTES_PER_TAG;
+    int64_t bytes_per_tag = 0;
+    int32_t *tags = NULL;
+    char buf[256] = {0};
+    int64_t rss_start = 0;
+    int64_t rss_end = 0;
+    int64_t timeout_time = 0;
+    int pending = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    fprintf(stderr, "Starting with library version %d.%d.%d.\n", version_major, version_minor, version_patch);
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_WARN);
+
+    if(argc > 1) {
+        num_tags = atoi(argv[1]);
+    }
+
+    if(argc > 2) {
+        gateway = argv[2];
+    }
+
+    if(argc > 3) {
+        max_bytes_per_tag = atoi(argv[3]);
+    }
+
+    if(num_tags <= 0 || max_bytes_per_tag <= 0) {
+        fprintf(stderr, "Usage: %s [num_tags [gateway [max_bytes_per_tag]]]\n", argv[0]);
+        return 1;
+    }
+
+    tags = (int32_t *)calloc(sizeof(int32_t), (size_t)(unsigned int)num_tags);
+    if(!tags) {
+        fprintf(stderr, "Unable to allocate tag ID array!\n");
+        return 1;
+    }
+
+    /* create one tag first so that the session and library threads exist. */
+    snprintf_platform(buf, sizeof(buf), TAG_ATTRIBS, gateway, 0);
+    tags[0] = plc_tag_create(buf, CREATE_TIMEOUT_MS);
+    if(tags[0] < 0 || plc_tag_status(tags[0]) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to create first tag, error %s!\n", plc_tag_decode_error(tags[0] < 0 ? tags[0] : plc_tag_status(tags[0])));
+        free(tags);
+        return 1;
+    }
+
+    rss_start = get_rss_bytes();
+
+    for(int i=1; i < num_tags; i++) {
+        snprintf_platform(buf, sizeof(buf), TAG_ATTRIBS, gateway, i);
+
+        tags[i] = plc_tag_create(buf, 0);
+        if(tags[i] < 0) {
+            fprintf(stderr, "Error %s creating tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            rc = 1;
+            goto done;
+        }
+    }
+
+    /* wait for all the tags to finish creation, which includes the first read. */
+    timeout_time = util_time_ms() + CREATE_TIMEOUT_MS;
+
+    do {
+        pending = 0;
+
+        for(int i=0; i < num_tags; i++) {
+            int status = plc_tag_status(tags[i]);
+
+            if(status == PLCTAG_STATUS_PENDING) {
+                pending++;
+            } else if(status != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Error %s creating tag %d!\n", plc_tag_decode_error(status), i);
+                rc = 1;
+                goto done;
+            }
+        }
+
+        if(pending) {
+            util_sleep_ms(10);
+        }
+    } while(pending && timeout_time > util_time_ms());
+
+    if(pending) {
+        fprintf(stderr, "Timed out with %d tags still being created!\n", pending);
+        rc = 1;
+        goto done;
+    }
+
+    rss_end = get_rss_bytes();
+    bytes_per_tag = (rss_end - rss_start) / (num_tags > 1 ? num_tags - 1 : 1);
+
+    fprintf(stderr, "%d tags, RSS before %" PRId64 " bytes, after %" PRId64 " bytes, %" PRId64 " bytes per tag.\n",
+                    num_tags, rss_start, rss_end, bytes_per_tag);
+
+    /* the type information is shared, make sure every tag still got the right size. */
+    for(int i=0; i < num_tags; i++) {
+        int size = plc_tag_get_size(tags[i]);
+
+        if(size != ELEM_SIZE) {
+            fprintf(stderr, "Tag %d has size %d, expected %d!\n", i, size, ELEM_SIZE);
+            rc = 1;
+            goto done;
+        }
+    }
+
+    if(rss_start < 0 || rss_end < 0) {
+        fprintf(stderr, "Unable to read the resident set size!\n");
+        rc = 1;
+    } else if(bytes_per_tag > max_bytes_per_tag) {
+        fprintf(stderr, "Tags use %" PRId64 " bytes each, more than the limit of %" PRId64 " bytes!\n", bytes_per_tag, max_bytes_per_tag);
+        rc = 1;
+    } else {
+        fprintf(stderr, "All tests passed.\n");
+    }
+
+done:
+    for(int i=0; i < num_tags; i++) {
+        if(tags[i] > 0) {
+            plc_tag_destroy(tags[i]);
+        }
+    }
+
+    free(tags);
+
+    plc_tag_shutdown();
+
+    return rc;
+}
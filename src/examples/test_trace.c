@@ -0,0 +1,254 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Record a request lifecycle trace for a set of tags and write it out as
+ * Chrome trace event JSON.  Load the output file into chrome://tracing or
+ * ui.perfetto.dev to see where each read spends its time.
+ *
+ * Each tag is read through the callback interface so that callback time
+ * shows up in the trace as well.
+ *
+ * The test fails if any read fails or is not reported to the callback, or
+ * if the trace file is missing request or callback spans.
+ *
+ * Usage: test_trace <tag string> [num_tags] [num_reads]
+ *
+ * The trace is written to libplctag_trace.json unless PLCTAG_TRACE_FILE
+ * is set in the environment.
+ *
+ * Example tag string:
+ *   protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_count=1&name=TestBigArray[0]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define DEFAULT_NUM_TAGS (10)
+#define DEFAULT_NUM_READS (100)
+#define DATA_TIMEOUT (5000)
+#define DEFAULT_TRACE_FILE "libplctag_trace.json"
+
+static volatile int reads_done = 0;
+
+
+static void tag_callback(int32_t tag_id, int event, int status, void *userdata)
+{
+    (void)tag_id;
+    (void)status;
+    (void)userdata;
+
+    if(event == PLCTAG_EVENT_READ_COMPLETED) {
+        reads_done++;
+    }
+}
+
+
+/* the library writes one event per line. */
+static int count_spans(const char *file_name, const char *span_name)
+{
+    FILE *trace = fopen(file_name, "r");
+    char line[1024];
+    char pattern[64];
+    int count = 0;
+
+    if(!trace) {
+        fprintf(stderr, "Unable to open trace file %s!\n", file_name);
+        return 0;
+    }
+
+    snprintf(pattern, sizeof(pattern), "\"name\":\"%s\"", span_name);
+
+    while(fgets(line, (int)sizeof(line), trace)) {
+        if(strstr(line, pattern)) {
+            count++;
+        }
+    }
+
+    fclose(trace);
+
+    return count;
+}
+
+
+int main(int argc, char **argv)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int num_tags = DEFAULT_NUM_TAGS;
+    int num_reads = DEFAULT_NUM_READS;
+    const char *trace_file = getenv("PLCTAG_TRACE_FILE");
+    int32_t *tags = NULL;
+    int64_t start = 0;
+    int64_t elapsed = 0;
+    int request_spans = 0;
+    int callback_spans = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <tag string> [num_tags] [num_reads]\n", argv[0]);
+        return 1;
+    }
+
+    if(argc > 2) {
+        num_tags = atoi(argv[2]);
+    }
+
+    if(argc > 3) {
+        num_reads = atoi(argv[3]);
+    }
+
+    if(!trace_file || !*trace_file) {
+        trace_file = DEFAULT_TRACE_FILE;
+    }
+
+    if(num_tags <= 0 || num_reads <= 0) {
+        fprintf(stderr, "Usage: %s <tag string> [num_tags] [num_reads]\n", argv[0]);
+        return 1;
+    }
+
+    tags = (int32_t *)calloc((size_t)num_tags, sizeof(int32_t));
+    if(!tags) {
+        fprintf(stderr, "Unable to allocate tag array!\n");
+        return 1;
+    }
+
+    if(plc_tag_set_int_attribute(0, "trace", 1) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to turn on tracing!\n");
+        free(tags);
+        return 1;
+    }
+
+    for(int i=0; i < num_tags && rc == PLCTAG_STATUS_OK; i++) {
+        tags[i] = plc_tag_create_ex(argv[1], tag_callback, NULL, DATA_TIMEOUT);
+        if(tags[i] < 0) {
+            fprintf(stderr, "Error %s creating tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            rc = tags[i];
+            tags[i] = 0;
+        }
+    }
+
+    start = util_time_ms();
+
+    /* start all the reads at once so that they overlap in the trace. */
+    for(int r=0; r < num_reads && rc == PLCTAG_STATUS_OK; r++) {
+        for(int i=0; i < num_tags; i++) {
+            rc = plc_tag_read(tags[i], 0);
+            if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Error %s starting read on tag %d!\n", plc_tag_decode_error(rc), i);
+                break;
+            }
+
+            rc = PLCTAG_STATUS_OK;
+        }
+
+        for(int i=0; i < num_tags && rc == PLCTAG_STATUS_OK; i++) {
+            int64_t timeout_time = util_time_ms() + DATA_TIMEOUT;
+
+            while((rc = plc_tag_status(tags[i])) == PLCTAG_STATUS_PENDING && util_time_ms() < timeout_time) {
+                util_sleep_ms(1);
+            }
+
+            if(rc != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Error %s waiting for read on tag %d!\n", plc_tag_decode_error(rc), i);
+            }
+        }
+    }
+
+    elapsed = util_time_ms() - start;
+
+    fprintf(stderr, "%d reads completed in %" PRId64 "ms.\n", reads_done, elapsed);
+
+    if(rc == PLCTAG_STATUS_OK && reads_done < num_tags * num_reads) {
+        fprintf(stderr, "Only %d of %d reads were reported to the callback!\n", reads_done, num_tags * num_reads);
+        rc = PLCTAG_ERR_BAD_STATUS;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = plc_tag_set_int_attribute(0, "trace_dump", 1);
+        if(rc == PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Trace written to %s.\n", trace_file);
+        } else {
+            fprintf(stderr, "Error %s writing trace!\n", plc_tag_decode_error(rc));
+        }
+    }
+
+    /* the trace buffer wraps, so only expect the spans of the last round. */
+    if(rc == PLCTAG_STATUS_OK) {
+        request_spans = count_spans(trace_file, "request");
+        callback_spans = count_spans(trace_file, "callback");
+
+        fprintf(stderr, "Trace has %d request spans and %d callback spans.\n", request_spans, callback_spans);
+
+        if(request_spans < num_tags || callback_spans < num_tags) {
+            fprintf(stderr, "Trace is missing spans, expected at least %d of each!\n", num_tags);
+            rc = PLCTAG_ERR_BAD_DATA;
+        }
+    }
+
+    plc_tag_set_int_attribute(0, "trace", 0);
+
+    for(int i=0; i < num_tags; i++) {
+        if(tags[i] > 0) {
+            plc_tag_destroy(tags[i]);
+        }
+    }
+
+    free(tags);
+
+    plc_tag_shutdown();
+
+    if(rc == PLCTAG_STATUS_OK) {
+        fprintf(stderr, "All tests passed.\n");
+    }
+
+    return (rc == PLCTAG_STATUS_OK ? 0 : 1);
+}
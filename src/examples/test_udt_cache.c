@@ -0,0 +1,300 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Check that the UDT template cache serves templates without reading them
+ * again and that templates loaded from the cache file are checked.
+ *
+ * Each template is first read with the cache off to get the reference
+ * data, then twice with the cache on.  The first cached read reads the
+ * controller identity with one request and then:
+ *  - in "fresh" mode, which starts without a cache file, reads the whole
+ *    templates,
+ *  - in "file" mode, which loads the file written by an earlier run against
+ *    the same controller, checks the handle of each template with one
+ *    request.  The checks go out together and must be packed,
+ *  - in "other" mode, which loads the same file against a controller with
+ *    another serial number, reads the attributes of each template with one
+ *    request but takes the field definitions from the cache.
+ * The second cached read must send no requests at all.  Every read must
+ * return the reference data.  A plain tag stays open the whole time so
+ * that all passes use the same connection.
+ *
+ * Usage: test_udt_cache <fresh|file|other> [cache file [num_udts [gateway]]]
+ *
+ * Run against ab_server --plc=ControlLogix --path=1,0 --delay=10 --tag=TestDINTArray:DINT[10]
+ * The delay keeps the checks queued so that they are packed.  Use
+ * --serial=<n> to give the emulator another serial number for "other" mode.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define REQUIRED_VERSION 2,5,0
+
+#define TAG_ATTRIBS "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&udt_cache=%d&udt_cache_file=%s&name=@udt/%d"
+#define KEEPER_TAG_ATTRIBS "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&name=TestDINTArray[0]"
+#define STATS_TAG "protocol=system&name=stats"
+
+/* entry indexes in the stats tag. */
+#define STATS_PACKETS_SENT_ENTRY (5)
+#define STATS_REQUESTS_SENT_ENTRY (7)
+
+#define DEFAULT_CACHE_FILE "test_udt_cache.bin"
+#define DEFAULT_NUM_UDTS (10)
+#define DEFAULT_GATEWAY "127.0.0.1"
+#define MAX_UDTS (100)
+#define MAX_TEMPLATE_SIZE (4096)
+#define FIRST_UDT_ID (100)
+#define DATA_TIMEOUT (5000)
+
+static const char CACHE_FILE_MAGIC[] = "libplctag UDT cache";
+
+static const char *cache_file = DEFAULT_CACHE_FILE;
+static const char *gateway = DEFAULT_GATEWAY;
+static int num_udts = DEFAULT_NUM_UDTS;
+
+static uint8_t templates[MAX_UDTS][MAX_TEMPLATE_SIZE];
+static int template_sizes[MAX_UDTS];
+
+static int failures = 0;
+
+
+static void check(int ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+static int64_t get_stat(int entry)
+{
+    int64_t result = -1;
+    int32_t stats = plc_tag_create(STATS_TAG, DATA_TIMEOUT);
+
+    if(stats < 0) {
+        fprintf(stderr, "Error %s creating stats tag!\n", plc_tag_decode_error(stats));
+        return -1;
+    }
+
+    if(plc_tag_read(stats, DATA_TIMEOUT) == PLCTAG_STATUS_OK) {
+        result = plc_tag_get_int64(stats, entry * 8);
+    }
+
+    plc_tag_destroy(stats);
+
+    return result;
+}
+
+
+/*
+ * Read every template.  The uncached pass saves the data, the others
+ * compare against it.  Returns the number of requests sent and sets the
+ * number of packets they went in.
+ */
+
+static int64_t read_templates(const char *pass, int use_cache, int64_t *packets)
+{
+    char tag_attribs[1200];
+    int64_t start_packets = get_stat(STATS_PACKETS_SENT_ENTRY);
+    int64_t start_requests = get_stat(STATS_REQUESTS_SENT_ENTRY);
+    int64_t requests = 0;
+
+    for(int i=0; i < num_udts; i++) {
+        int32_t tag = 0;
+        int rc = PLCTAG_STATUS_OK;
+        int size = 0;
+
+        snprintf(tag_attribs, sizeof(tag_attribs), TAG_ATTRIBS, gateway, use_cache, cache_file, FIRST_UDT_ID + i);
+
+        tag = plc_tag_create(tag_attribs, DATA_TIMEOUT);
+        if(tag < 0) {
+            fprintf(stderr, "Error %s creating @udt/%d!\n", plc_tag_decode_error(tag), FIRST_UDT_ID + i);
+            failures++;
+            continue;
+        }
+
+        rc = plc_tag_read(tag, DATA_TIMEOUT);
+        size = plc_tag_get_size(tag);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Error %s reading @udt/%d!\n", plc_tag_decode_error(rc), FIRST_UDT_ID + i);
+            failures++;
+        } else if(size <= 0 || size > MAX_TEMPLATE_SIZE) {
+            fprintf(stderr, "Template @udt/%d has bad size %d!\n", FIRST_UDT_ID + i, size);
+            failures++;
+        } else if(!use_cache) {
+            template_sizes[i] = size;
+            plc_tag_get_raw_bytes(tag, 0, templates[i], size);
+        } else {
+            uint8_t data[MAX_TEMPLATE_SIZE];
+
+            plc_tag_get_raw_bytes(tag, 0, data, size);
+
+            if(size != template_sizes[i] || memcmp(data, templates[i], (size_t)(unsigned int)size) != 0) {
+                fprintf(stderr, "Template @udt/%d differs from the uncached read!\n", FIRST_UDT_ID + i);
+                failures++;
+            }
+        }
+
+        plc_tag_destroy(tag);
+    }
+
+    requests = get_stat(STATS_REQUESTS_SENT_ENTRY) - start_requests;
+    *packets = get_stat(STATS_PACKETS_SENT_ENTRY) - start_packets;
+
+    fprintf(stderr, "%-9s %d templates, %" PRId64 " requests in %" PRId64 " packets.\n", pass, num_udts, requests, *packets);
+
+    return requests;
+}
+
+
+static int check_cache_file(void)
+{
+    FILE *in = fopen(cache_file, "rb");
+    char magic[sizeof(CACHE_FILE_MAGIC)] = {0};
+    int ok = 0;
+
+    if(!in) {
+        fprintf(stderr, "Unable to open cache file %s!\n", cache_file);
+        return 0;
+    }
+
+    ok = (fread(magic, 1, sizeof(magic) - 1, in) == sizeof(magic) - 1 && strcmp(magic, CACHE_FILE_MAGIC) == 0);
+
+    fclose(in);
+
+    return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *mode = NULL;
+    int from_file = 0;
+    int32_t keeper = 0;
+    char keeper_attribs[256];
+    int64_t requests = 0;
+    int64_t packets = 0;
+    int version_major = plc_tag_get_int_attribute(0, "version_major", 0);
+    int version_minor = plc_tag_get_int_attribute(0, "version_minor", 0);
+    int version_patch = plc_tag_get_int_attribute(0, "version_patch", 0);
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        fprintf(stderr, "Available library version is %d.%d.%d.\n", version_major, version_minor, version_patch);
+        exit(1);
+    }
+
+    if(argc < 2 || (strcmp(argv[1], "fresh") != 0 && strcmp(argv[1], "file") != 0 && strcmp(argv[1], "other") != 0)) {
+        fprintf(stderr, "Usage: %s <fresh|file|other> [cache file [num_udts (1-%d) [gateway]]]\n", argv[0], MAX_UDTS);
+        return 1;
+    }
+
+    mode = argv[1];
+    from_file = (strcmp(mode, "fresh") != 0);
+
+    if(argc > 2) {
+        cache_file = argv[2];
+    }
+
+    if(argc > 3) {
+        num_udts = atoi(argv[3]);
+    }
+
+    if(argc > 4) {
+        gateway = argv[4];
+    }
+
+    if(num_udts <= 0 || num_udts > MAX_UDTS) {
+        fprintf(stderr, "Usage: %s <fresh|file|other> [cache file [num_udts (1-%d) [gateway]]]\n", argv[0], MAX_UDTS);
+        return 1;
+    }
+
+    if(from_file) {
+        check(check_cache_file(), "no cache file from an earlier run");
+    } else {
+        remove(cache_file);
+    }
+
+    /* hold the connection open, a new connection makes the cache check every template again. */
+    snprintf(keeper_attribs, sizeof(keeper_attribs), KEEPER_TAG_ATTRIBS, gateway);
+    keeper = plc_tag_create(keeper_attribs, DATA_TIMEOUT);
+    if(keeper < 0 || plc_tag_status(keeper) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to create the connection tag, error %s!\n", plc_tag_decode_error(keeper < 0 ? keeper : plc_tag_status(keeper)));
+        plc_tag_shutdown();
+        return 1;
+    }
+
+    requests = read_templates("uncached", 0, &packets);
+    check(requests > num_udts, "uncached reads did not read the whole templates");
+
+    /* one more request for the controller identity. */
+    requests = read_templates("first", 1, &packets);
+    if(strcmp(mode, "file") == 0) {
+        check(requests == num_udts + 1, "templates from the file were not checked with one request each");
+        check(packets * 2 < requests, "template checks were not packed");
+    } else if(strcmp(mode, "other") == 0) {
+        check(requests == num_udts + 1, "templates of another controller did not take the fields from the cache");
+    } else {
+        check(requests > num_udts + 1, "first cached reads did not read the whole templates");
+    }
+
+    requests = read_templates("cached", 1, &packets);
+    check(requests == 0, "cached reads sent requests");
+
+    check(check_cache_file(), "cache file was not written");
+
+    plc_tag_destroy(keeper);
+
+    plc_tag_shutdown();
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -37,6 +37,9 @@
 #include <platform.h>
 #include <util/attr.h>
 #include <util/debug.h>
+#include <util/lock_profile.h>
+#include <util/stats.h>
+#include <util/trace.h>
 #include <ab/ab.h>
 #include <mb/modbus.h>
 #include <system/system.h>
@@ -59,16 +62,18 @@ struct {
 } tag_type_map[] = {
     /* System tags */
     {NULL, "system", "library", NULL, system_tag_create},
+    {"system", NULL, NULL, NULL, system_tag_create},
     /* Allen-Bradley PLCs */
     {"ab-eip", NULL, NULL, NULL, ab_tag_create},
     {"ab_eip", NULL, NULL, NULL, ab_tag_create},
     {"modbus-tcp", NULL, NULL, NULL, mb_tag_create},
-    {"modbus_tcp", NULL, NULL, NULL, mb_tag_create}
+    {"modbus_tcp", NULL, NULL, NULL, mb_tag_create},
+    {"modbus-udp", NULL, NULL, NULL, mb_tag_create},
+    {"modbus_udp", NULL, NULL, NULL, mb_tag_create}
 };
 
-static lock_t library_initialization_lock = LOCK_INIT;
 static volatile int library_initialized = 0;
-static volatile mutex_p lib_mutex = NULL;
+static lw_mutex_t lib_mutex = LW_MUTEX_INIT;
 
 
 /*
@@ -148,13 +153,15 @@ void destroy_modules(void)
 
     lib_teardown();
 
-    spin_block(&library_initialization_lock) {
-        if(lib_mutex != NULL) {
-            /* FIXME casting to get rid of volatile is WRONG */
-            mutex_destroy((mutex_p *)&lib_mutex);
-            lib_mutex = NULL;
-        }
-    }
+    /* write out any collected trace spans and lock profile report. */
+    trace_teardown();
+
+    lock_profile_teardown();
+
+    stats_teardown();
+
+    /* flush any queued debug output before the logger goes away. */
+    debug_teardown();
 
     plc_tag_unregister_logger();
 
@@ -177,54 +184,41 @@ int initialize_modules(void)
     pdebug(DEBUG_INFO, "Starting.");
 
     /*
-     * Try to keep busy waiting to a minimum.
-     * If there is no mutex set up, then create one.
-     * Only one thread allowed at a time through this gate.
+     * guard library initialization with a mutex.
+     *
+     * The mutex is statically initialized so there is nothing to set up
+     * first.  This prevents busy waiting as would happen with just a spin lock.
      */
-    spin_block(&library_initialization_lock) {
-        if(lib_mutex == NULL) {
-            pdebug(DEBUG_INFO, "Creating library mutex.");
-            /* FIXME - casting to get rid of volatile is WRONG */
-            rc = mutex_create((mutex_p *)&lib_mutex);
-        }
-    }
-
-    /* check the status outside the lock. */
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to initialize library mutex!  Error %s!", plc_tag_decode_error(rc));
-        return rc;
-    } else {
-        /*
-        * guard library initialization with a mutex.
-        *
-        * This prevents busy waiting as would happen with just a spin lock.
-        */
-        critical_block(lib_mutex) {
-            if(!library_initialized) {
-                /* initialize a random seed value. */
-                srand((unsigned int)time_ms());
-
-                pdebug(DEBUG_INFO,"Initializing library modules.");
-                rc = lib_init();
-
-                pdebug(DEBUG_INFO,"Initializing AB module.");
-                if(rc == PLCTAG_STATUS_OK) {
-                    rc = ab_init();
-                }
+    critical_block(&lib_mutex) {
+        if(!library_initialized) {
+            /*
+             * initialize a random seed value.  This seeds the CIP connection
+             * IDs and serial numbers, so it must differ between runs and
+             * reboots.  The monotonic clock restarts at boot, so use the
+             * wall clock mixed with the process ID.
+             */
+            srand((unsigned int)((uint64_t)time_epoch_ms() ^ ((uint64_t)(unsigned int)process_id() << 16)));
+
+            pdebug(DEBUG_INFO,"Initializing library modules.");
+            rc = lib_init();
+
+            pdebug(DEBUG_INFO,"Initializing AB module.");
+            if(rc == PLCTAG_STATUS_OK) {
+                rc = ab_init();
+            }
 
-                pdebug(DEBUG_INFO,"Initializing Modbus module.");
-                if(rc == PLCTAG_STATUS_OK) {
-                    rc = mb_init();
-                }
+            pdebug(DEBUG_INFO,"Initializing Modbus module.");
+            if(rc == PLCTAG_STATUS_OK) {
+                rc = mb_init();
+            }
 
-                /* hook the destructor */
-                atexit(plc_tag_shutdown);
+            /* hook the destructor */
+            atexit(plc_tag_shutdown);
 
-                /* do this last */
-                library_initialized = 1;
+            /* do this last */
+            library_initialized = 1;
 
-                pdebug(DEBUG_INFO,"Done initializing library modules.");
-            }
+            pdebug(DEBUG_INFO,"Done initializing library modules.");
         }
     }
 
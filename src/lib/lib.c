@@ -47,30 +47,27 @@
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/hash.h>
-#include <util/hashtable.h>
+#include <util/idtable.h>
+#include <util/lock_profile.h>
+#include <util/mem_track.h>
 #include <util/rc.h>
+#include <util/stats.h>
+#include <util/trace.h>
 #include <util/vector.h>
 #include <ab/ab.h>
 #include <mb/modbus.h>
 
 
-#define INITIAL_TAG_TABLE_SIZE (201)
-
-#define TAG_ID_MASK (0xFFFFFFF)
-
-#define MAX_TAG_MAP_ATTEMPTS (50)
-
 /* these are only internal to the file */
 
-static volatile int32_t next_tag_id = 10; /* MAGIC */
-static volatile hashtable_p tags = NULL;
-static mutex_p tag_lookup_mutex = NULL;
+static volatile idtable_p tags = NULL;
+static lw_mutex_t tag_lookup_mutex = LW_MUTEX_INIT;
 
 static atomic_int library_terminating = {0};
 static thread_p tag_tickler_thread = NULL;
-static cond_p tag_tickler_wait = NULL;
-#define TAG_TICKLER_TIMEOUT_MS  (100)
-#define TAG_TICKLER_TIMEOUT_MIN_MS (10)
+static lw_event_t tag_tickler_wait = LW_EVENT_INIT;
+#define TAG_TICKLER_TIMEOUT_NS  ((int64_t)100000000)
+#define TAG_TICKLER_TIMEOUT_MIN_NS ((int64_t)10000000)
 static int64_t tag_tickler_wait_timeout_end = 0;
 
 //static mutex_p global_library_mutex = NULL;
@@ -80,10 +77,14 @@ static int64_t tag_tickler_wait_timeout_end = 0;
 /* helper functions. */
 static plc_tag_p lookup_tag(int32_t id);
 static int add_tag_lookup(plc_tag_p tag);
-static int tag_id_inc(int id);
 static THREAD_FUNC(tag_tickler_func);
 static int set_tag_byte_order(plc_tag_p tag, attr attribs);
 static int check_byte_order_str(const char *byte_order, int length);
+static uint32_t auto_sync_group_key(plc_tag_p tag, attr attribs);
+static int64_t auto_sync_first_read(plc_tag_p tag, int64_t now);
+static void auto_sync_adapt_read(plc_tag_p tag);
+static void auto_sync_adapt_reset(plc_tag_p tag);
+static int auto_sync_set_read_bounds(plc_tag_p tag, int64_t min_ns, int64_t max_ns);
 // static int get_string_count_size_unsafe(plc_tag_p tag, int offset);
 static int get_string_length_unsafe(plc_tag_p tag, int offset);
 // static int get_string_capacity_unsafe(plc_tag_p tag, int offset);
@@ -139,23 +140,15 @@ int lib_init(void)
 
     pdebug(DEBUG_INFO,"Setting up global library data.");
 
-    pdebug(DEBUG_INFO,"Creating tag hashtable.");
-    if((tags = hashtable_create(INITIAL_TAG_TABLE_SIZE)) == NULL) { /* MAGIC */
-        pdebug(DEBUG_ERROR, "Unable to create tag hashtable!");
+    pdebug(DEBUG_INFO,"Creating tag table.");
+    if((tags = idtable_create()) == NULL) {
+        pdebug(DEBUG_ERROR, "Unable to create tag table!");
         return PLCTAG_ERR_NO_MEM;
     }
 
-    pdebug(DEBUG_INFO,"Creating tag hashtable mutex.");
-    rc = mutex_create((mutex_p *)&tag_lookup_mutex);
-    if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to create tag hashtable mutex!");
-    }
-
-    pdebug(DEBUG_INFO,"Creating tag condition variable.");
-    rc = cond_create((cond_p *)&tag_tickler_wait);
-    if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to create tag condition var!");
-    }
+    pdebug(DEBUG_INFO,"Setting up tag table mutex and tickler event.");
+    lw_mutex_init(&tag_lookup_mutex);
+    lw_event_init(&tag_tickler_wait);
 
     pdebug(DEBUG_INFO,"Creating tag tickler thread.");
     rc = thread_create(&tag_tickler_thread, tag_tickler_func, 32*1024, NULL);
@@ -177,10 +170,8 @@ void lib_teardown(void)
 
     atomic_set(&library_terminating, 1);
 
-    if(tag_tickler_wait) {
-        pdebug(DEBUG_INFO, "Signaling tag tickler condition var.");
-        cond_signal(tag_tickler_wait);
-    }
+    pdebug(DEBUG_INFO, "Signaling tag tickler event.");
+    lw_event_signal(&tag_tickler_wait);
 
     if(tag_tickler_thread) {
         pdebug(DEBUG_INFO,"Tearing down tag tickler thread.");
@@ -189,21 +180,12 @@ void lib_teardown(void)
         tag_tickler_thread = NULL;
     }
 
-    if(tag_tickler_wait) {
-        pdebug(DEBUG_INFO, "Tearing down tag tickler condition var.");
-        cond_destroy(&tag_tickler_wait);
-        tag_tickler_wait = NULL;
-    }
-
-    if(tag_lookup_mutex) {
-        pdebug(DEBUG_INFO,"Tearing down tag lookup mutex.");
-        mutex_destroy(&tag_lookup_mutex);
-        tag_lookup_mutex = NULL;
-    }
+    pdebug(DEBUG_INFO, "Tearing down tag tickler event.");
+    lw_event_destroy(&tag_tickler_wait);
 
     if(tags) {
-        pdebug(DEBUG_INFO, "Destroying tag hashtable.");
-        hashtable_destroy(tags);
+        pdebug(DEBUG_INFO, "Destroying tag table.");
+        idtable_destroy(tags);
         tags = NULL;
     }
 
@@ -219,12 +201,7 @@ int plc_tag_tickler_wake_impl(const char *func, int line_num)
 
     pdebug(DEBUG_DETAIL, "Starting. Called from %s:%d.", func, line_num);
 
-    if(!tag_tickler_wait) {
-        pdebug(DEBUG_WARN, "Called from %s:%d when tag tickler condition var is NULL!", func, line_num);
-        return PLCTAG_ERR_NULL_PTR;
-    }
-
-    rc = cond_signal(tag_tickler_wait);
+    rc = lw_event_signal(&tag_tickler_wait);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Error %s trying to signal condition variable in call from %s:%d", plc_tag_decode_error(rc), func, line_num);
         return rc;
@@ -248,12 +225,7 @@ int plc_tag_generic_wake_tag_impl(const char *func, int line_num, plc_tag_p tag)
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    if(!tag->tag_cond_wait) {
-        pdebug(DEBUG_WARN, "Called from %s:%d when tag condition var is NULL!", func, line_num);
-        return PLCTAG_ERR_NULL_PTR;
-    }
-
-    rc = cond_signal(tag->tag_cond_wait);
+    rc = lw_event_signal(&tag->tag_cond_wait);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Error %s trying to signal condition variable in call from %s:%d", plc_tag_decode_error(rc), func, line_num);
         return rc;
@@ -281,7 +253,7 @@ void plc_tag_generic_tickler(plc_tag_p tag)
         pdebug(DEBUG_DETAIL, "Tickling tag %d.", tag->tag_id);
 
         /* if this tag has automatic writes, then there are many things we should check */
-        if(tag->auto_sync_write_ms > 0) {
+        if(tag->auto_sync_write_ns > 0) {
             /* has the tag been written to? */
             if(tag->tag_is_dirty) {
                 /* abort any in flight read if the tag is dirty. */
@@ -303,10 +275,10 @@ void plc_tag_generic_tickler(plc_tag_p tag)
                 /* have we already done something about automatic reads? */
                 if(!tag->auto_sync_next_write) {
                     /* we need to queue up a new write. */
-                    tag->auto_sync_next_write = time_ms() + tag->auto_sync_write_ms;
+                    tag->auto_sync_next_write = time_ns() + tag->auto_sync_write_ns;
 
-                    pdebug(DEBUG_DETAIL, "Queueing up automatic write in %dms.", tag->auto_sync_write_ms);
-                } else if(!tag->write_in_flight && tag->auto_sync_next_write <= time_ms()) {
+                    pdebug(DEBUG_DETAIL, "Queueing up automatic write in %" PRId64 "us.", tag->auto_sync_write_ns / 1000);
+                } else if(!tag->write_in_flight && tag->auto_sync_next_write <= time_ns()) {
                     pdebug(DEBUG_DETAIL, "Triggering automatic write start.");
 
                     /* clear out any outstanding reads. */
@@ -319,6 +291,9 @@ void plc_tag_generic_tickler(plc_tag_p tag)
                     tag->write_in_flight = 1;
                     tag->auto_sync_next_write = 0;
 
+                    /* the application changed the data. */
+                    auto_sync_adapt_reset(tag);
+
                     if(tag->vtable->write) {
                         tag->status = (int8_t)tag->vtable->write(tag);
                     }
@@ -330,12 +305,12 @@ void plc_tag_generic_tickler(plc_tag_p tag)
         }
 
         /* if this tag has automatic reads, we need to check that state too. */
-        if(tag->auto_sync_read_ms > 0) {
-            int64_t current_time = time_ms();
+        if(tag->auto_sync_read_ns > 0) {
+            int64_t current_time = time_ns();
 
             // /* spread these out randomly to avoid too much clustering. */
             // if(tag->auto_sync_next_read == 0) {
-            //     tag->auto_sync_next_read = current_time - (rand() % tag->auto_sync_read_ms);
+            //     tag->auto_sync_next_read = current_time - (rand() % tag->auto_sync_read_ns);
             // }
 
             /* do we need to read? */
@@ -365,14 +340,14 @@ void plc_tag_generic_tickler(plc_tag_p tag)
                     *
                     * Round up to the next period.
                     */
-                    periods = (current_time - tag->auto_sync_next_read + (tag->auto_sync_read_ms - 1))/tag->auto_sync_read_ms;
+                    periods = (current_time - tag->auto_sync_next_read + (tag->auto_sync_read_ns - 1))/tag->auto_sync_read_ns;
 
                     /* warn if we need to skip more than one period. */
                     if(periods > 1) {
-                        pdebug(DEBUG_WARN, "Skipping %" PRId64 " periods of %" PRId32 "ms.", periods, tag->auto_sync_read_ms);
+                        pdebug(DEBUG_WARN, "Skipping %" PRId64 " periods of %" PRId64 "us.", periods, tag->auto_sync_read_ns / 1000);
                     }
 
-                    tag->auto_sync_next_read += (periods * tag->auto_sync_read_ms);
+                    tag->auto_sync_next_read += (periods * tag->auto_sync_read_ns);
                     pdebug(DEBUG_DETAIL, "Scheduling next read at time %" PRId64 ".", tag->auto_sync_next_read);
                 } else {
                     pdebug(DEBUG_SPEW, "Unable to start read tag->read_in_flight=%d, tag->tag_is_dirty=%d, tag->write_in_flight=%d!", tag->read_in_flight, tag->tag_is_dirty, tag->write_in_flight);
@@ -390,9 +365,34 @@ void plc_tag_generic_tickler(plc_tag_p tag)
 
 
 
+/*
+ * call_tag_callback
+ *
+ * Run the user callback for one event.  When tracing is on, the time
+ * spent in the callback is recorded against the tag.
+ */
+
+static void call_tag_callback(plc_tag_p tag, int event, int status)
+{
+    int64_t start_time = 0;
+
+    if(!trace_enabled()) {
+        tag->callback(tag->tag_id, event, status, tag->userdata);
+        return;
+    }
+
+    start_time = time_us();
+
+    tag->callback(tag->tag_id, event, status, tag->userdata);
+
+    trace_span("callback", "callback", tag->tag_id, (int64_t)event, start_time, time_us());
+}
+
+
+
 void plc_tag_generic_handle_event_callbacks(plc_tag_p tag)
 {
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         /* call the callbacks outside the API mutex. */
         if(tag && tag->callback) {
             debug_set_tag_id(tag->tag_id);
@@ -400,7 +400,7 @@ void plc_tag_generic_handle_event_callbacks(plc_tag_p tag)
             /* trigger this if there is any other event. Only once. */
             if(tag->event_creation_complete) {
                 pdebug(DEBUG_DETAIL, "Tag creation complete with status %s.", plc_tag_decode_error(tag->event_creation_complete_status));
-                tag->callback(tag->tag_id, PLCTAG_EVENT_CREATED, tag->event_creation_complete_status, tag->userdata);
+                call_tag_callback(tag, PLCTAG_EVENT_CREATED, tag->event_creation_complete_status);
                 tag->event_creation_complete = 0;
                 tag->event_creation_complete_status = PLCTAG_STATUS_OK;
             }
@@ -408,7 +408,7 @@ void plc_tag_generic_handle_event_callbacks(plc_tag_p tag)
             /* was there a read start? */
             if(tag->event_read_started) {
                 pdebug(DEBUG_DETAIL, "Tag read started with status %s.", plc_tag_decode_error(tag->event_read_started_status));
-                tag->callback(tag->tag_id, PLCTAG_EVENT_READ_STARTED, tag->event_read_started_status, tag->userdata);
+                call_tag_callback(tag, PLCTAG_EVENT_READ_STARTED, tag->event_read_started_status);
                 tag->event_read_started = 0;
                 tag->event_read_started_status = PLCTAG_STATUS_OK;
             }
@@ -416,7 +416,7 @@ void plc_tag_generic_handle_event_callbacks(plc_tag_p tag)
             /* was there a write start? */
             if(tag->event_write_started) {
                 pdebug(DEBUG_DETAIL, "Tag write started with status %s.", plc_tag_decode_error(tag->event_write_started_status));
-                tag->callback(tag->tag_id, PLCTAG_EVENT_WRITE_STARTED, tag->event_write_started_status, tag->userdata);
+                call_tag_callback(tag, PLCTAG_EVENT_WRITE_STARTED, tag->event_write_started_status);
                 tag->event_write_started = 0;
                 tag->event_write_started_status = PLCTAG_STATUS_OK;
             }
@@ -424,7 +424,7 @@ void plc_tag_generic_handle_event_callbacks(plc_tag_p tag)
             /* was there an abort? */
             if(tag->event_operation_aborted) {
                 pdebug(DEBUG_DETAIL, "Tag operation aborted with status %s.", plc_tag_decode_error(tag->event_operation_aborted_status));
-                tag->callback(tag->tag_id, PLCTAG_EVENT_ABORTED, tag->event_operation_aborted_status, tag->userdata);
+                call_tag_callback(tag, PLCTAG_EVENT_ABORTED, tag->event_operation_aborted_status);
                 tag->event_operation_aborted = 0;
                 tag->event_operation_aborted_status = PLCTAG_STATUS_OK;
             }
@@ -432,7 +432,7 @@ void plc_tag_generic_handle_event_callbacks(plc_tag_p tag)
             /* was there a read completion? */
             if(tag->event_read_complete) {
                 pdebug(DEBUG_DETAIL, "Tag read completed with status %s.", plc_tag_decode_error(tag->event_read_complete_status));
-                tag->callback(tag->tag_id, PLCTAG_EVENT_READ_COMPLETED, tag->event_read_complete_status, tag->userdata);
+                call_tag_callback(tag, PLCTAG_EVENT_READ_COMPLETED, tag->event_read_complete_status);
                 tag->event_read_complete = 0;
                 tag->event_read_complete_status = PLCTAG_STATUS_OK;
             }
@@ -440,7 +440,7 @@ void plc_tag_generic_handle_event_callbacks(plc_tag_p tag)
             /* was there a write completion? */
             if(tag->event_write_complete) {
                 pdebug(DEBUG_DETAIL, "Tag write completed with status %s.", plc_tag_decode_error(tag->event_write_complete_status));
-                tag->callback(tag->tag_id, PLCTAG_EVENT_WRITE_COMPLETED, tag->event_write_complete_status, tag->userdata);
+                call_tag_callback(tag, PLCTAG_EVENT_WRITE_COMPLETED, tag->event_write_complete_status);
                 tag->event_write_complete = 0;
                 tag->event_write_complete_status = PLCTAG_STATUS_OK;
             }
@@ -448,7 +448,7 @@ void plc_tag_generic_handle_event_callbacks(plc_tag_p tag)
             /* do this last so that we raise all other events first. we only start deletion events. */
             if(tag->event_deletion_started) {
                 pdebug(DEBUG_DETAIL, "Tag deletion started with status %s.", plc_tag_decode_error(tag->event_creation_complete_status));
-                tag->callback(tag->tag_id, PLCTAG_EVENT_DESTROYED, tag->event_deletion_started_status, tag->userdata);
+                call_tag_callback(tag, PLCTAG_EVENT_DESTROYED, tag->event_deletion_started_status);
                 tag->event_deletion_started = 0;
                 tag->event_deletion_started_status = PLCTAG_STATUS_OK;
             }
@@ -473,23 +473,13 @@ int plc_tag_generic_init_tag(plc_tag_p tag, attr attribs, void (*tag_callback_fu
         return PLCTAG_ERR_OUT_OF_BOUNDS;
     }
 
-    rc = mutex_create(&(tag->ext_mutex));
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN,"Unable to create tag external mutex!");
-        return PLCTAG_ERR_CREATE;
-    }
+    /* tags that share a connection and read period are read together. */
+    tag->auto_sync_group = auto_sync_group_key(tag, attribs);
 
-    rc = mutex_create(&(tag->api_mutex));
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN,"Unable to create tag API mutex!");
-        return PLCTAG_ERR_CREATE;
-    }
-
-    rc = cond_create(&(tag->tag_cond_wait));
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN,"Unable to create tag condition variable!");
-        return PLCTAG_ERR_CREATE;
-    }
+    /* these are embedded in the tag, nothing to allocate. */
+    lw_mutex_init(&(tag->ext_mutex));
+    lw_mutex_init(&(tag->api_mutex));
+    lw_event_init(&(tag->tag_cond_wait));
 
     /* do this early so that events can be raised early. */
     tag->callback = tag_callback_func;
@@ -502,6 +492,28 @@ int plc_tag_generic_init_tag(plc_tag_p tag, attr attribs, void (*tag_callback_fu
 
 
 
+/*
+ * tickler_wake_at
+ *
+ * Pull in the tickler wake up time if the deadline is sooner.  A deadline
+ * that has already passed belongs to an operation that could not start
+ * because another one is still in flight.  Those are rechecked after a
+ * short delay rather than spinning until the other operation finishes.
+ */
+
+static void tickler_wake_at(int64_t deadline)
+{
+    int64_t now = time_ns();
+
+    if(deadline <= now) {
+        deadline = now + TAG_TICKLER_TIMEOUT_MIN_NS;
+    }
+
+    if(deadline < tag_tickler_wait_timeout_end) {
+        tag_tickler_wait_timeout_end = deadline;
+    }
+}
+
 
 
 THREAD_FUNC(tag_tickler_func)
@@ -514,24 +526,24 @@ THREAD_FUNC(tag_tickler_func)
 
     while(!atomic_get(&library_terminating)) {
         int max_index = 0;
-        int64_t timeout_wait_ms = TAG_TICKLER_TIMEOUT_MS;
+        int64_t pass_start_us = time_us();
 
         /* what is the maximum time we will wait until */
-        tag_tickler_wait_timeout_end = time_ms() + timeout_wait_ms;
+        tag_tickler_wait_timeout_end = time_ns() + TAG_TICKLER_TIMEOUT_NS;
 
-        critical_block(tag_lookup_mutex) {
-            max_index = hashtable_capacity(tags);
+        critical_block(&tag_lookup_mutex) {
+            max_index = idtable_capacity(tags);
         }
 
         for(int i=0; i < max_index; i++) {
             plc_tag_p tag = NULL;
 
-            critical_block(tag_lookup_mutex) {
+            critical_block(&tag_lookup_mutex) {
                 /* look up the max index again. it may have changed. */
-                max_index = hashtable_capacity(tags);
+                max_index = idtable_capacity(tags);
 
                 if(i < max_index) {
-                    tag = hashtable_get_index(tags, i);
+                    tag = idtable_get_index(tags, i);
 
                     if(tag) {
                         debug_set_tag_id(tag->tag_id);
@@ -550,7 +562,7 @@ THREAD_FUNC(tag_tickler_func)
                     pdebug(DEBUG_DETAIL, "Tickling tag %d.", tag->tag_id);
 
                     /* try to hold the tag API mutex while all this goes on. */
-                    if(mutex_try_lock(tag->api_mutex) == PLCTAG_STATUS_OK) {
+                    if(lw_mutex_try_lock(&tag->api_mutex) == PLCTAG_STATUS_OK) {
                         plc_tag_generic_tickler(tag);
 
                         /* call the tickler function if we can. */
@@ -562,12 +574,16 @@ THREAD_FUNC(tag_tickler_func)
                                 tag->read_complete = 0;
                                 tag->read_in_flight = 0;
 
+                                if(tag->auto_sync_read_max_ns) {
+                                    auto_sync_adapt_read(tag);
+                                }
+
                                 //tag->event_read_complete = 1;
                                 tag_raise_event(tag, PLCTAG_EVENT_READ_COMPLETED, tag->status);
 
                                 /* wake immediately */
                                 plc_tag_tickler_wake();
-                                cond_signal(tag->tag_cond_wait);
+                                lw_event_signal(&tag->tag_cond_wait);
                             }
 
                             if(tag->write_complete) {
@@ -580,22 +596,22 @@ THREAD_FUNC(tag_tickler_func)
 
                                 /* wake immediately */
                                 plc_tag_tickler_wake();
-                                cond_signal(tag->tag_cond_wait);
+                                lw_event_signal(&tag->tag_cond_wait);
                             }
                         }
 
                         /* wake up earlier if the time until the next write wake up is sooner. */
-                        if(tag->auto_sync_next_write && tag->auto_sync_next_write < tag_tickler_wait_timeout_end) {
-                            tag_tickler_wait_timeout_end = tag->auto_sync_next_write;
+                        if(tag->auto_sync_next_write) {
+                            tickler_wake_at(tag->auto_sync_next_write);
                         }
 
                         /* wake up earlier if the time until the next read wake up is sooner. */
-                        if(tag->auto_sync_next_read && tag->auto_sync_next_read < tag_tickler_wait_timeout_end) {
-                            tag_tickler_wait_timeout_end = tag->auto_sync_next_read;
+                        if(tag->auto_sync_next_read) {
+                            tickler_wake_at(tag->auto_sync_next_read);
                         }
 
                         /* we are done with the tag API mutex now. */
-                        mutex_unlock(tag->api_mutex);
+                        lw_mutex_unlock(&tag->api_mutex);
 
                         /* call callbacks */
                         plc_tag_generic_handle_event_callbacks(tag);
@@ -622,16 +638,21 @@ THREAD_FUNC(tag_tickler_func)
             debug_set_tag_id(0);
         }
 
-        if(tag_tickler_wait) {
-            int64_t time_to_wait = tag_tickler_wait_timeout_end - time_ms();
-            int wait_rc = PLCTAG_STATUS_OK;
+        /* track how long a full pass over the tags takes. */
+        {
+            int64_t pass_us = time_us() - pass_start_us;
 
-            if(time_to_wait < TAG_TICKLER_TIMEOUT_MIN_MS) {
-                time_to_wait = TAG_TICKLER_TIMEOUT_MIN_MS;
-            }
+            stats_add(STATS_TICKLER_PASSES, 1);
+            stats_add(STATS_TICKLER_TOTAL_US, pass_us);
+            stats_max(STATS_MAX_TICKLER_PASS_US, pass_us);
+        }
+
+        {
+            int64_t time_to_wait = tag_tickler_wait_timeout_end - time_ns();
+            int wait_rc = PLCTAG_STATUS_OK;
 
             if(time_to_wait > 0) {
-                wait_rc = cond_wait(tag_tickler_wait, (int)time_to_wait);
+                wait_rc = lw_event_wait_ns(&tag_tickler_wait, time_to_wait);
                 if(wait_rc == PLCTAG_ERR_TIMEOUT) {
                     pdebug(DEBUG_DETAIL, "Tag tickler thread timed out waiting for something to do.");
                 }
@@ -917,23 +938,58 @@ LIB_EXPORT int32_t plc_tag_create_ex(const char *attrib_str, void (*tag_callback
     tag->read_cache_ms = (int64_t)read_cache_ms;
 
     /* set up any automatic read/write */
-    tag->auto_sync_read_ms = attr_get_int(attribs, "auto_sync_read_ms", 0);
-    if(tag->auto_sync_read_ms < 0) {
-        pdebug(DEBUG_WARN, "auto_sync_read_ms value must be positive!");
+    /* the periods can be given in microseconds for sub-millisecond sync. */
+    tag->auto_sync_read_ns = (int64_t)attr_get_int(attribs, "auto_sync_read_ms", 0) * 1000000;
+    if(attr_get_str(attribs, "auto_sync_read_us", NULL)) {
+        tag->auto_sync_read_ns = (int64_t)attr_get_int(attribs, "auto_sync_read_us", 0) * 1000;
+    }
+
+    /*
+     * adaptive reads stretch the period toward the maximum while the data
+     * does not change.  The minimum defaults to the normal read period.
+     */
+    tag->auto_sync_read_max_ns = (int64_t)attr_get_int(attribs, "auto_sync_read_max_ms", 0) * 1000000;
+    if(attr_get_str(attribs, "auto_sync_read_max_us", NULL)) {
+        tag->auto_sync_read_max_ns = (int64_t)attr_get_int(attribs, "auto_sync_read_max_us", 0) * 1000;
+    }
+
+    if(tag->auto_sync_read_max_ns) {
+        tag->auto_sync_read_min_ns = tag->auto_sync_read_ns;
+        if(attr_get_str(attribs, "auto_sync_read_min_ms", NULL)) {
+            tag->auto_sync_read_min_ns = (int64_t)attr_get_int(attribs, "auto_sync_read_min_ms", 0) * 1000000;
+        }
+
+        if(attr_get_str(attribs, "auto_sync_read_min_us", NULL)) {
+            tag->auto_sync_read_min_ns = (int64_t)attr_get_int(attribs, "auto_sync_read_min_us", 0) * 1000;
+        }
+
+        if(tag->auto_sync_read_min_ns <= 0 || tag->auto_sync_read_max_ns < tag->auto_sync_read_min_ns) {
+            pdebug(DEBUG_WARN, "auto_sync_read_min_ms/auto_sync_read_min_us must be positive and not more than auto_sync_read_max_ms/auto_sync_read_max_us!");
+            attr_destroy(attribs);
+            rc_dec(tag);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        tag->auto_sync_read_ns = tag->auto_sync_read_min_ns;
+    }
+
+    if(tag->auto_sync_read_ns < 0) {
+        pdebug(DEBUG_WARN, "auto_sync_read_ms/auto_sync_read_us value must be positive!");
         attr_destroy(attribs);
         rc_dec(tag);
         return PLCTAG_ERR_BAD_PARAM;
-    } else if(tag->auto_sync_read_ms > 0) {
-        /* how many periods did we already pass? */
-        // int64_t periods = (time_ms() / tag->auto_sync_read_ms);
-        // tag->auto_sync_next_read = (periods + 1) * tag->auto_sync_read_ms;
-        /* start some time in the future, but with random jitter. */
-        tag->auto_sync_next_read = time_ms() + (rand() % tag->auto_sync_read_ms);
+    } else if(tag->auto_sync_read_ns > 0) {
+        /* start on the next read of this tag's rate group. */
+        tag->auto_sync_next_read = auto_sync_first_read(tag, time_ns());
     }
 
-    tag->auto_sync_write_ms = attr_get_int(attribs, "auto_sync_write_ms", 0);
-    if(tag->auto_sync_write_ms < 0) {
-        pdebug(DEBUG_WARN, "auto_sync_write_ms value must be positive!");
+    tag->auto_sync_write_ns = (int64_t)attr_get_int(attribs, "auto_sync_write_ms", 0) * 1000000;
+    if(attr_get_str(attribs, "auto_sync_write_us", NULL)) {
+        tag->auto_sync_write_ns = (int64_t)attr_get_int(attribs, "auto_sync_write_us", 0) * 1000;
+    }
+
+    if(tag->auto_sync_write_ns < 0) {
+        pdebug(DEBUG_WARN, "auto_sync_write_ms/auto_sync_write_us value must be positive!");
         attr_destroy(attribs);
         rc_dec(tag);
         return PLCTAG_ERR_BAD_PARAM;
@@ -987,9 +1043,11 @@ LIB_EXPORT int32_t plc_tag_create_ex(const char *attrib_str, void (*tag_callback
             tag->vtable->abort(tag);
         }
 
-        /* remove the tag from the hashtable. */
-        critical_block(tag_lookup_mutex) {
-            hashtable_remove(tags, (int64_t)tag->tag_id);
+        /* remove the tag from the tag table. */
+        critical_block(&tag_lookup_mutex) {
+            if(idtable_remove(tags, tag->tag_id)) {
+                stats_add(STATS_LIVE_TAGS, -1);
+            }
         }
 
         rc_dec(tag);
@@ -1023,16 +1081,18 @@ LIB_EXPORT int32_t plc_tag_create_ex(const char *attrib_str, void (*tag_callback
             }
 
             /* wait for something to happen */
-            rc = cond_wait(tag->tag_cond_wait, (int)timeout_left);
+            rc = lw_event_wait(&tag->tag_cond_wait, (int)timeout_left);
             if(rc != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Error %s while waiting for tag creation to complete!", plc_tag_decode_error(rc));
                 if(tag->vtable->abort) {
                     tag->vtable->abort(tag);
                 }
 
-                /* remove the tag from the hashtable. */
-                critical_block(tag_lookup_mutex) {
-                    hashtable_remove(tags, (int64_t)tag->tag_id);
+                /* remove the tag from the tag table. */
+                critical_block(&tag_lookup_mutex) {
+                    if(idtable_remove(tags, tag->tag_id)) {
+                        stats_add(STATS_LIVE_TAGS, -1);
+                    }
                 }
 
                 rc_dec(tag);
@@ -1049,9 +1109,11 @@ LIB_EXPORT int32_t plc_tag_create_ex(const char *attrib_str, void (*tag_callback
                     tag->vtable->abort(tag);
                 }
 
-                /* remove the tag from the hashtable. */
-                critical_block(tag_lookup_mutex) {
-                    hashtable_remove(tags, (int64_t)tag->tag_id);
+                /* remove the tag from the tag table. */
+                critical_block(&tag_lookup_mutex) {
+                    if(idtable_remove(tags, tag->tag_id)) {
+                        stats_add(STATS_LIVE_TAGS, -1);
+                    }
                 }
 
                 rc_dec(tag);
@@ -1100,18 +1162,18 @@ LIB_EXPORT void plc_tag_shutdown(void)
     /* close all tags. */
     pdebug(DEBUG_DETAIL, "Closing all tags.");
 
-    critical_block(tag_lookup_mutex) {
-        tag_table_entries = hashtable_capacity(tags);
+    critical_block(&tag_lookup_mutex) {
+        tag_table_entries = idtable_capacity(tags);
     }
 
     for(int i=0; i<tag_table_entries; i++) {
         plc_tag_p tag = NULL;
 
-        critical_block(tag_lookup_mutex) {
-            tag_table_entries = hashtable_capacity(tags);
+        critical_block(&tag_lookup_mutex) {
+            tag_table_entries = idtable_capacity(tags);
 
             if(i<tag_table_entries && tag_table_entries >= 0) {
-                tag = hashtable_get_index(tags, i);
+                tag = idtable_get_index(tags, i);
 
                 /* make sure the tag does not go away while we are using the pointer. */
                 if(tag) {
@@ -1249,7 +1311,7 @@ LIB_EXPORT int plc_tag_register_callback_ex(int32_t tag_id, tag_extended_callbac
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         if(tag->callback) {
             rc = PLCTAG_ERR_DUPLICATE;
         } else {
@@ -1295,7 +1357,7 @@ LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         if(tag->callback) {
             rc = PLCTAG_STATUS_OK;
             tag->callback = NULL;
@@ -1403,8 +1465,8 @@ LIB_EXPORT int plc_tag_lock(int32_t id)
 
     /* we cannot nest the mutexes otherwise we will deadlock. */
     do {
-        critical_block(tag->api_mutex) {
-            rc = mutex_try_lock(tag->ext_mutex);
+        critical_block(&tag->api_mutex) {
+            rc = lw_mutex_try_lock(&tag->ext_mutex);
         }
 
         /* if the mutex is already locked then we get a mutex lock error. */
@@ -1450,8 +1512,8 @@ LIB_EXPORT int plc_tag_unlock(int32_t id)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    critical_block(tag->api_mutex) {
-        rc = mutex_unlock(tag->ext_mutex);
+    critical_block(&tag->api_mutex) {
+        rc = lw_mutex_unlock(&tag->ext_mutex);
     }
 
     rc_dec(tag);
@@ -1488,7 +1550,7 @@ LIB_EXPORT int plc_tag_abort(int32_t id)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         /* who knows what state the tag data is in.  */
         tag->read_cache_expire = (uint64_t)0;
 
@@ -1540,13 +1602,17 @@ LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    if(tag_id <= 0 || tag_id >= TAG_ID_MASK) {
+    if(tag_id <= 0) {
         pdebug(DEBUG_WARN, "Called with zero or invalid tag!");
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    critical_block(tag_lookup_mutex) {
-        tag = hashtable_remove(tags, tag_id);
+    critical_block(&tag_lookup_mutex) {
+        tag = idtable_remove(tags, tag_id);
+    }
+
+    if(tag) {
+        stats_add(STATS_LIVE_TAGS, -1);
     }
 
     if(!tag) {
@@ -1557,7 +1623,7 @@ LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
     /* abort anything in flight */
     pdebug(DEBUG_DETAIL, "Aborting any in-flight operations.");
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         if(!tag->vtable || !tag->vtable->abort) {
             pdebug(DEBUG_WARN,"Tag does not have a abort function!");
         } else {
@@ -1617,7 +1683,10 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
         return PLCTAG_ERR_BAD_PARAM;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
+        /* an explicit read means the application cares about this tag now. */
+        auto_sync_adapt_reset(tag);
+
         tag_raise_event(tag, PLCTAG_EVENT_READ_STARTED, PLCTAG_STATUS_OK);
         plc_tag_generic_handle_event_callbacks(tag);
 
@@ -1647,7 +1716,7 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
         tag->status = PLCTAG_STATUS_PENDING;
 
         /* clear the condition var */
-        cond_clear(tag->tag_cond_wait);
+        lw_event_clear(&tag->tag_cond_wait);
 
         /* the protocol implementation does not do the timeout. */
         rc = tag->vtable->read(tag);
@@ -1695,7 +1764,7 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
             }
 
             /* wait for something to happen */
-            rc = cond_wait(tag->tag_cond_wait, (int)timeout_left);
+            rc = lw_event_wait(&tag->tag_cond_wait, (int)timeout_left);
             if(rc != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Error %s while waiting for tag read to complete!", plc_tag_decode_error(rc));
                 plc_tag_abort(id);
@@ -1714,7 +1783,7 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
         } while(rc == PLCTAG_STATUS_PENDING && time_ms() < end_time);
 
         /* the read is not in flight anymore. */
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             tag->read_in_flight = 0;
             tag->read_complete = 0;
             is_done = 1;
@@ -1771,7 +1840,7 @@ LIB_EXPORT int plc_tag_status(int32_t id)
         }
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         if(tag && tag->vtable->tickler) {
             tag->vtable->tickler(tag);
         }
@@ -1826,7 +1895,10 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
         return PLCTAG_ERR_BAD_PARAM;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
+        /* as with reads, go back to the fastest period. */
+        auto_sync_adapt_reset(tag);
+
         if(tag->read_in_flight || tag->write_in_flight) {
             pdebug(DEBUG_WARN, "Tag already has an operation in flight!");
             is_done = 1;
@@ -1844,7 +1916,7 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
          * variable will be set by the abort.   So we have to clear it here and then see
          * if it gets raised afterward.
          */
-        cond_clear(tag->tag_cond_wait);
+        lw_event_clear(&tag->tag_cond_wait);
 
         /*
          * This must be raised _before_ we start the write to enable
@@ -1900,7 +1972,7 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
             }
 
             /* wait for something to happen */
-            rc = cond_wait(tag->tag_cond_wait, (int)timeout_left);
+            rc = lw_event_wait(&tag->tag_cond_wait, (int)timeout_left);
             if(rc != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Error %s while waiting for tag write to complete!", plc_tag_decode_error(rc));
                 plc_tag_abort(id);
@@ -1919,7 +1991,7 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
         } while(rc == PLCTAG_STATUS_PENDING && time_ms() < end_time);
 
         /* the write is not in flight anymore. */
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             tag->write_in_flight = 0;
             tag->write_complete = 0;
             is_done = 1;
@@ -1929,7 +2001,7 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
     }
 
     if(is_done) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             tag_raise_event(tag, PLCTAG_EVENT_WRITE_COMPLETED, (int8_t)rc);
         }
     }
@@ -1981,6 +2053,16 @@ LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, in
         } else if(str_cmp_i(attrib_name, "debug_level") == 0) {
             pdebug(DEBUG_WARN, "Deprecated attribute \"debug_level\" used, use \"debug\" instead.");
             res = (int)get_debug_level();
+        } else if(str_cmp_i(attrib_name, "debug_async") == 0) {
+            res = debug_get_async();
+        } else if(str_cmp_i(attrib_name, "debug_dropped") == 0) {
+            res = debug_get_dropped_records();
+        } else if(str_cmp_i(attrib_name, "trace") == 0) {
+            res = trace_enabled();
+        } else if(str_cmp_i(attrib_name, "lock_profile") == 0) {
+            res = lock_profile_active;
+        } else if(str_cmp_i(attrib_name, "mem_track") == 0) {
+            res = mem_track_active;
         } else {
             pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported at the library level!");
             res = default_value;
@@ -1993,7 +2075,7 @@ LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, in
             return default_value;
         }
 
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             /* match the generic ones first. */
             if(str_cmp_i(attrib_name, "size") == 0) {
                 tag->status = PLCTAG_STATUS_OK;
@@ -2004,10 +2086,28 @@ LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, in
                 res = (int)tag->read_cache_ms;
             } else if(str_cmp_i(attrib_name, "auto_sync_read_ms") == 0) {
                 tag->status = PLCTAG_STATUS_OK;
-                res = (int)tag->auto_sync_read_ms;
+                res = (int)(tag->auto_sync_read_ns / 1000000);
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_us") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)(tag->auto_sync_read_ns / 1000);
             } else if(str_cmp_i(attrib_name, "auto_sync_write_ms") == 0) {
                 tag->status = PLCTAG_STATUS_OK;
-                res = (int)tag->auto_sync_write_ms;
+                res = (int)(tag->auto_sync_write_ns / 1000000);
+            } else if(str_cmp_i(attrib_name, "auto_sync_write_us") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)(tag->auto_sync_write_ns / 1000);
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_min_ms") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)(tag->auto_sync_read_min_ns / 1000000);
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_min_us") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)(tag->auto_sync_read_min_ns / 1000);
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_max_ms") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)(tag->auto_sync_read_max_ns / 1000000);
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_max_us") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)(tag->auto_sync_read_max_ns / 1000);
             } else if(str_cmp_i(attrib_name, "bit_num") == 0) {
                 tag->status = PLCTAG_STATUS_OK;
                 res = (int)(unsigned int)(tag->bit);
@@ -2036,6 +2136,7 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, in
 {
     int res = PLCTAG_ERR_NOT_FOUND;
     plc_tag_p tag = NULL;
+    int auto_sync_changed = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2061,6 +2162,23 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, in
             } else {
                 res = PLCTAG_ERR_OUT_OF_BOUNDS;
             }
+        } else if(str_cmp_i(attrib_name, "debug_async") == 0) {
+            res = debug_set_async(new_value);
+        } else if(str_cmp_i(attrib_name, "trace") == 0) {
+            res = trace_set_enabled(new_value);
+        } else if(str_cmp_i(attrib_name, "trace_dump") == 0) {
+            /* write out what has been collected so far. */
+            res = (new_value ? trace_dump(NULL) : PLCTAG_STATUS_OK);
+        } else if(str_cmp_i(attrib_name, "lock_profile") == 0) {
+            res = lock_profile_set_enabled(new_value);
+        } else if(str_cmp_i(attrib_name, "lock_profile_dump") == 0) {
+            /* write the ranked report, to stderr unless a file is set. */
+            res = (new_value ? lock_profile_dump(NULL) : PLCTAG_STATUS_OK);
+        } else if(str_cmp_i(attrib_name, "mem_track") == 0) {
+            res = mem_track_set_enabled(new_value);
+        } else if(str_cmp_i(attrib_name, "mem_track_dump") == 0) {
+            /* write the per subsystem and call site report. */
+            res = (new_value ? mem_track_dump(NULL) : PLCTAG_STATUS_OK);
         } else {
             pdebug(DEBUG_WARN, "Attribute \"%s\" is not support at the library level!", attrib_name);
             return PLCTAG_ERR_UNSUPPORTED;
@@ -2073,7 +2191,7 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, in
             return PLCTAG_ERR_NOT_FOUND;
         }
 
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             /* match the generic ones first. */
             if(str_cmp_i(attrib_name, "read_cache_ms") == 0) {
                 if(new_value >= 0) {
@@ -2086,32 +2204,68 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, in
                     tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
                     res = PLCTAG_ERR_OUT_OF_BOUNDS;
                 }
-            } else if(str_cmp_i(attrib_name, "auto_sync_read_ms") == 0) {
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_ms") == 0 || str_cmp_i(attrib_name, "auto_sync_read_us") == 0) {
                 if(new_value >= 0) {
-                    tag->auto_sync_read_ms = new_value;
+                    tag->auto_sync_read_ns = (int64_t)new_value * (str_cmp_i(attrib_name, "auto_sync_read_us") == 0 ? 1000 : 1000000);
+
+                    /* the tag moves to the rate group for the new period. */
+                    tag->auto_sync_next_read = (tag->auto_sync_read_ns > 0 ? auto_sync_first_read(tag, time_ns()) : 0);
                     tag->status = PLCTAG_STATUS_OK;
                     res = PLCTAG_STATUS_OK;
+                    auto_sync_changed = 1;
                 } else {
-                    pdebug(DEBUG_WARN, "auto_sync_read_ms must be greater than or equal to zero!");
+                    pdebug(DEBUG_WARN, "%s must be greater than or equal to zero!", attrib_name);
                     tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
                     res = PLCTAG_ERR_OUT_OF_BOUNDS;
                 }
-            } else if(str_cmp_i(attrib_name, "auto_sync_write_ms") == 0) {
+            } else if(str_cmp_i(attrib_name, "auto_sync_write_ms") == 0 || str_cmp_i(attrib_name, "auto_sync_write_us") == 0) {
                 if(new_value >= 0) {
-                    tag->auto_sync_write_ms = new_value;
+                    tag->auto_sync_write_ns = (int64_t)new_value * (str_cmp_i(attrib_name, "auto_sync_write_us") == 0 ? 1000 : 1000000);
                     tag->status = PLCTAG_STATUS_OK;
                     res = PLCTAG_STATUS_OK;
+                    auto_sync_changed = 1;
                 } else {
-                    pdebug(DEBUG_WARN, "auto_sync_write_ms must be greater than or equal to zero!");
+                    pdebug(DEBUG_WARN, "%s must be greater than or equal to zero!", attrib_name);
                     tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
                     res = PLCTAG_ERR_OUT_OF_BOUNDS;
                 }
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_min_ms") == 0 || str_cmp_i(attrib_name, "auto_sync_read_min_us") == 0) {
+                int64_t min_ns = (int64_t)new_value * (str_cmp_i(attrib_name, "auto_sync_read_min_us") == 0 ? 1000 : 1000000);
+
+                res = auto_sync_set_read_bounds(tag, min_ns, tag->auto_sync_read_max_ns);
+                if(res != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "%s must be positive and not more than the maximum read period!", attrib_name);
+                } else {
+                    auto_sync_changed = 1;
+                }
+
+                tag->status = (int8_t)res;
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_max_ms") == 0 || str_cmp_i(attrib_name, "auto_sync_read_max_us") == 0) {
+                int64_t max_ns = (int64_t)new_value * (str_cmp_i(attrib_name, "auto_sync_read_max_us") == 0 ? 1000 : 1000000);
+                int64_t min_ns = (tag->auto_sync_read_max_ns ? tag->auto_sync_read_min_ns : tag->auto_sync_read_ns);
+
+                res = auto_sync_set_read_bounds(tag, min_ns, max_ns);
+                if(res != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "%s must be zero or not less than the minimum read period!", attrib_name);
+                } else {
+                    auto_sync_changed = 1;
+                }
+
+                tag->status = (int8_t)res;
             } else {
                 if(tag->vtable->set_int_attrib) {
                     res = tag->vtable->set_int_attrib(tag, attrib_name, new_value);
                     tag->status = (int8_t)res;
                 }
             }
+
+            /*
+             * protocols that only look at busy tags need to be told that
+             * this one has automatic reads or writes to do now.
+             */
+            if(auto_sync_changed && tag->vtable->wake_plc) {
+                tag->vtable->wake_plc(tag);
+            }
         }
     }
 
@@ -2137,7 +2291,7 @@ LIB_EXPORT int plc_tag_get_size(int32_t id)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         result = tag->size;
         tag->status = PLCTAG_STATUS_OK;
     }
@@ -2169,7 +2323,7 @@ LIB_EXPORT int plc_tag_set_size(int32_t id, int new_size)
         return PLCTAG_ERR_BAD_PARAM;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         uint8_t *new_data = mem_realloc(tag->data, new_size);
 
         if(new_data) {
@@ -2229,7 +2383,7 @@ LIB_EXPORT int plc_tag_get_bit(int32_t id, int offset_bit)
 
     pdebug(DEBUG_SPEW, "selecting bit %d with offset %d in byte %d (%x).", real_offset, (real_offset % 8), (real_offset / 8), tag->data[real_offset / 8]);
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         if((real_offset >= 0) && ((real_offset / 8) < tag->size)) {
             res = !!(((1 << (real_offset % 8)) & 0xFF) & (tag->data[real_offset / 8]));
             tag->status = PLCTAG_STATUS_OK;
@@ -2276,9 +2430,9 @@ LIB_EXPORT int plc_tag_set_bit(int32_t id, int offset_bit, int val)
 
     pdebug(DEBUG_SPEW, "Setting bit %d with offset %d in byte %d (%x).", real_offset, (real_offset % 8), (real_offset / 8), tag->data[real_offset / 8]);
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         if((real_offset >= 0) && ((real_offset / 8) < tag->size)) {
-            if(tag->auto_sync_write_ms > 0) {
+            if(tag->auto_sync_write_ns > 0) {
                 tag->tag_is_dirty = 1;
             }
 
@@ -2324,7 +2478,7 @@ LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(uint64_t)) <= tag->size)) {
                 res =   ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[0]]) << 0 ) +
                         ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[1]]) << 8 ) +
@@ -2378,9 +2532,9 @@ LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(uint64_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
+                if(tag->auto_sync_write_ns > 0) {
                     tag->tag_is_dirty = 1;
                 }
 
@@ -2437,7 +2591,7 @@ LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(int64_t)) <= tag->size)) {
                 res = (int64_t)(((uint64_t)(tag->data[offset + tag->byte_order->int64_order[0]]) << 0 ) +
                                 ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[1]]) << 8 ) +
@@ -2492,9 +2646,9 @@ LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t ival)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(int64_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
+                if(tag->auto_sync_write_ns > 0) {
                     tag->tag_is_dirty = 1;
                 }
 
@@ -2548,7 +2702,7 @@ LIB_EXPORT uint32_t plc_tag_get_uint32(int32_t id, int offset)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(uint32_t)) <= tag->size)) {
                 res =   ((uint32_t)(tag->data[offset + tag->byte_order->int32_order[0]]) << 0 ) +
                         ((uint32_t)(tag->data[offset + tag->byte_order->int32_order[1]]) << 8 ) +
@@ -2598,9 +2752,9 @@ LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(uint32_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
+                if(tag->auto_sync_write_ns > 0) {
                     tag->tag_is_dirty = 1;
                 }
 
@@ -2653,7 +2807,7 @@ LIB_EXPORT int32_t  plc_tag_get_int32(int32_t id, int offset)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(int32_t)) <= tag->size)) {
                 res = (int32_t)(((uint32_t)(tag->data[offset + tag->byte_order->int32_order[0]]) << 0 ) +
                                 ((uint32_t)(tag->data[offset + tag->byte_order->int32_order[1]]) << 8 ) +
@@ -2704,9 +2858,9 @@ LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t ival)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(int32_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
+                if(tag->auto_sync_write_ns > 0) {
                     tag->tag_is_dirty = 1;
                 }
 
@@ -2762,7 +2916,7 @@ LIB_EXPORT uint16_t plc_tag_get_uint16(int32_t id, int offset)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(uint16_t)) <= tag->size)) {
                 res =   (uint16_t)(((uint16_t)(tag->data[offset + tag->byte_order->int16_order[0]]) << 0 ) +
                                    ((uint16_t)(tag->data[offset + tag->byte_order->int16_order[1]]) << 8 ));
@@ -2811,9 +2965,9 @@ LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(uint16_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
+                if(tag->auto_sync_write_ns > 0) {
                     tag->tag_is_dirty = 1;
                 }
 
@@ -2868,7 +3022,7 @@ LIB_EXPORT int16_t  plc_tag_get_int16(int32_t id, int offset)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(int16_t)) <= tag->size)) {
                 res =   (int16_t)(uint16_t)(((uint16_t)(tag->data[offset + tag->byte_order->int16_order[0]]) << 0 ) +
                                             ((uint16_t)(tag->data[offset + tag->byte_order->int16_order[1]]) << 8 ));
@@ -2917,9 +3071,9 @@ LIB_EXPORT int plc_tag_set_int16(int32_t id, int offset, int16_t ival)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(int16_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
+                if(tag->auto_sync_write_ns > 0) {
                     tag->tag_is_dirty = 1;
                 }
 
@@ -2974,7 +3128,7 @@ LIB_EXPORT uint8_t plc_tag_get_uint8(int32_t id, int offset)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(uint8_t)) <= tag->size)) {
                 res = tag->data[offset];
                 tag->status = PLCTAG_STATUS_OK;
@@ -3021,9 +3175,9 @@ LIB_EXPORT int plc_tag_set_uint8(int32_t id, int offset, uint8_t val)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(uint8_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
+                if(tag->auto_sync_write_ns > 0) {
                     tag->tag_is_dirty = 1;
                 }
 
@@ -3074,7 +3228,7 @@ LIB_EXPORT int8_t plc_tag_get_int8(int32_t id, int offset)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(uint8_t)) <= tag->size)) {
                 res =   (int8_t)tag->data[offset];
                 tag->status = PLCTAG_STATUS_OK;
@@ -3122,9 +3276,9 @@ LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t ival)
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && (offset + ((int)sizeof(int8_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
+                if(tag->auto_sync_write_ns > 0) {
                     tag->tag_is_dirty = 1;
                 }
 
@@ -3184,7 +3338,7 @@ LIB_EXPORT double plc_tag_get_float64(int32_t id, int offset)
         return res;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         if((offset >= 0) && (offset + ((int)sizeof(double)) <= tag->size)) {
             ures =  ((uint64_t)(tag->data[offset + tag->byte_order->float64_order[0]]) << 0 ) +
                     ((uint64_t)(tag->data[offset + tag->byte_order->float64_order[1]]) << 8 ) +
@@ -3250,9 +3404,9 @@ LIB_EXPORT int plc_tag_set_float64(int32_t id, int offset, double fval)
     /* copy the data into the uint64 value */
     mem_copy(&val, &fval, sizeof(val));
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         if((offset >= 0) && (offset + ((int)sizeof(uint64_t)) <= tag->size)) {
-            if(tag->auto_sync_write_ms > 0) {
+            if(tag->auto_sync_write_ns > 0) {
                 tag->tag_is_dirty = 1;
             }
 
@@ -3309,7 +3463,7 @@ LIB_EXPORT float plc_tag_get_float32(int32_t id, int offset)
         return res;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         if((offset >= 0) && (offset + ((int)sizeof(float)) <= tag->size)) {
             ures =  (uint32_t)(((uint32_t)(tag->data[offset + tag->byte_order->float32_order[0]]) << 0 ) +
                                ((uint32_t)(tag->data[offset + tag->byte_order->float32_order[1]]) << 8 ) +
@@ -3371,9 +3525,9 @@ LIB_EXPORT int plc_tag_set_float32(int32_t id, int offset, float fval)
     /* copy the data into the uint64 value */
     mem_copy(&val, &fval, sizeof(val));
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         if((offset >= 0) && (offset + ((int)sizeof(float)) <= tag->size)) {
-            if(tag->auto_sync_write_ms > 0) {
+            if(tag->auto_sync_write_ns > 0) {
                 tag->tag_is_dirty = 1;
             }
 
@@ -3435,7 +3589,7 @@ LIB_EXPORT int plc_tag_get_string(int32_t tag_id, int string_start_offset, char
     /* set all buffer bytes to zero. */
     mem_set(buffer, 0, buffer_length);
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         int string_length = get_string_length_unsafe(tag, string_start_offset);
 
         /* determine the maximum number of characters/bytes to copy. */
@@ -3519,7 +3673,7 @@ LIB_EXPORT int plc_tag_set_string(int32_t tag_id, int string_start_offset, const
 
     string_length = str_length(string_val);
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         int string_capacity = (tag->byte_order->str_max_capacity ? (int)(tag->byte_order->str_max_capacity) : get_string_length_unsafe(tag, string_start_offset));
         int string_last_offset = string_start_offset + (int)(tag->byte_order->str_count_word_bytes) + string_capacity + (tag->byte_order->str_is_zero_terminated ? 1 : 0);
 
@@ -3627,7 +3781,7 @@ pdebug(DEBUG_WARN, "string_capacity=%d, string_last_offset=%d, tag_size=%d.", st
         }
 
         /* if this is an auto-write tag, set the dirty flag to eventually trigger a write */
-        if(rc == PLCTAG_STATUS_OK && tag->auto_sync_write_ms > 0) {
+        if(rc == PLCTAG_STATUS_OK && tag->auto_sync_write_ns > 0) {
             tag->tag_is_dirty = 1;
         }
 
@@ -3681,7 +3835,7 @@ LIB_EXPORT int plc_tag_get_string_capacity(int32_t id, int string_start_offset)
         return PLCTAG_ERR_UNSUPPORTED;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         string_capacity = (tag->byte_order->str_max_capacity ? (int)(tag->byte_order->str_max_capacity) : get_string_length_unsafe(tag, string_start_offset));
     }
 
@@ -3729,7 +3883,7 @@ LIB_EXPORT int plc_tag_get_string_length(int32_t id, int string_start_offset)
         return PLCTAG_ERR_UNSUPPORTED;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         string_length = get_string_length_unsafe(tag, string_start_offset);
     }
 
@@ -3778,7 +3932,7 @@ LIB_EXPORT int plc_tag_get_string_total_length(int32_t id, int string_start_offs
         return PLCTAG_ERR_UNSUPPORTED;
     }
 
-    critical_block(tag->api_mutex) {
+    critical_block(&tag->api_mutex) {
         total_length = (int)(tag->byte_order->str_count_word_bytes)
                      + (tag->byte_order->str_is_fixed_length ? (int)(tag->byte_order->str_max_capacity) : get_string_length_unsafe(tag, string_start_offset))
                      + (tag->byte_order->str_is_zero_terminated ? (int)1 : (int)0)
@@ -3825,9 +3979,9 @@ LIB_EXPORT int plc_tag_set_raw_bytes(int32_t id, int offset, uint8_t *buffer, in
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && ((offset + buffer_size) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
+                if(tag->auto_sync_write_ns > 0) {
                     tag->tag_is_dirty = 1;
                 }
 
@@ -3886,7 +4040,7 @@ LIB_EXPORT int plc_tag_get_raw_bytes(int32_t id, int offset, uint8_t *buffer, in
     }
 
     if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
+        critical_block(&tag->api_mutex) {
             if((offset >= 0) && ((offset + buffer_size) <= tag->size)) {
                 int i;
                 for (i=0;i<buffer_size;i++) {
@@ -4279,8 +4433,8 @@ plc_tag_p lookup_tag(int32_t tag_id)
 {
     plc_tag_p tag = NULL;
 
-    critical_block(tag_lookup_mutex) {
-        tag = hashtable_get(tags, (int64_t)tag_id);
+    critical_block(&tag_lookup_mutex) {
+        tag = idtable_get(tags, tag_id);
 
         if(tag) {
             debug_set_tag_id(tag->tag_id);
@@ -4303,68 +4457,29 @@ plc_tag_p lookup_tag(int32_t tag_id)
 
 
 
-int tag_id_inc(int id)
-{
-    if(id <= 0) {
-        pdebug(DEBUG_ERROR, "Incoming ID is not valid! Got %d",id);
-        /* try to correct. */
-        id = (TAG_ID_MASK/2);
-    }
-
-    id = (id + 1) & TAG_ID_MASK;
-
-    if(id == 0) {
-        id = 1; /* skip zero intentionally! Can't return an ID of zero because it looks like a NULL pointer */
-    }
-
-    return id;
-}
-
-
+/*
+ * add_tag_lookup
+ *
+ * Allocate an ID for the tag and enter it into the tag table.  IDs come
+ * from the free list of the table, so this is O(1) no matter how many tags
+ * exist.  Returns the new ID or an error code.
+ */
 
 int add_tag_lookup(plc_tag_p tag)
 {
-    int rc = PLCTAG_ERR_NOT_FOUND;
-    int new_id = 0;
+    int32_t new_id = 0;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
-    critical_block(tag_lookup_mutex) {
-        int attempts = 0;
-
-        /* only get this when we hold the mutex. */
-        new_id = next_tag_id;
-
-        do {
-            new_id = tag_id_inc(new_id);
-
-            if(new_id <=0) {
-                pdebug(DEBUG_WARN,"ID %d is illegal!", new_id);
-                attempts = MAX_TAG_MAP_ATTEMPTS;
-                break;
-            }
-
-            pdebug(DEBUG_SPEW,"Trying new ID %d.", new_id);
-
-            if(!hashtable_get(tags,(int64_t)new_id)) {
-                pdebug(DEBUG_DETAIL,"Found unused ID %d", new_id);
-                break;
-            }
-
-            attempts++;
-        } while(attempts < MAX_TAG_MAP_ATTEMPTS);
-
-        if(attempts < MAX_TAG_MAP_ATTEMPTS) {
-            rc = hashtable_put(tags, (int64_t)new_id, tag);
-        } else {
-            rc = PLCTAG_ERR_NO_RESOURCES;
-        }
-
-        next_tag_id = new_id;
+    critical_block(&tag_lookup_mutex) {
+        new_id = idtable_put(tags, tag);
     }
 
-    if(rc != PLCTAG_STATUS_OK) {
-        new_id = rc;
+    if(new_id <= 0) {
+        pdebug(DEBUG_WARN, "Unable to allocate a tag ID, error %s!", plc_tag_decode_error(new_id));
+    } else {
+        pdebug(DEBUG_DETAIL,"Found unused ID %d", new_id);
+        stats_add(STATS_LIVE_TAGS, 1);
     }
 
     pdebug(DEBUG_DETAIL, "Done.");
@@ -4444,3 +4559,150 @@ int get_string_length_unsafe(plc_tag_p tag, int offset)
 
 
 
+
+
+
+/*
+ * auto_sync_group_key
+ *
+ * Tags that go to the same PLC connection and have the same automatic
+ * read period form a rate group.  This key identifies the connection
+ * part from the attributes that select a session.
+ */
+
+uint32_t auto_sync_group_key(plc_tag_p tag, attr attribs)
+{
+    const char *key_attribs[] = { "protocol", "gateway", "path", "plc", NULL };
+    uint32_t key = (uint32_t)tag->connection_group_id;
+
+    for(int i=0; key_attribs[i]; i++) {
+        const char *val = attr_get_str(attribs, key_attribs[i], "");
+
+        key = hash((uint8_t *)(uintptr_t)val, (size_t)(unsigned int)str_length(val), key);
+    }
+
+    return key;
+}
+
+
+
+/*
+ * auto_sync_first_read
+ *
+ * Return the next read time of the tag's rate group after now.
+ *
+ * Each rate group reads on a fixed grid of its period so all of its tags
+ * come due in the same tickler pass and their requests are queued as one
+ * burst for the packer.  The grid is offset by a phase taken from the
+ * group key and the period so that different rate groups are staggered
+ * across the period instead of all firing at once.
+ *
+ * The tickler advances the read time by whole periods, so the tag stays
+ * on the grid.
+ */
+
+int64_t auto_sync_first_read(plc_tag_p tag, int64_t now)
+{
+    int64_t period = tag->auto_sync_read_ns;
+    uint32_t group = tag->auto_sync_group;
+    int64_t phase = 0;
+
+    group = hash((uint8_t *)&period, sizeof(period), group);
+    phase = (int64_t)(group % (uint64_t)period);
+
+    return (((now - phase) / period) + 1) * period + phase;
+}
+
+
+
+/*
+ * auto_sync_adapt_read
+ *
+ * Called when a read completes on a tag with adaptive automatic reads.
+ * If the data is the same as the last read, the read period is doubled up
+ * to the maximum.  If it changed, the period drops back to the minimum.
+ *
+ * The tag moves to the rate group of its new period.  Tags that have been
+ * quiet for the same time share a period, so they still read together.
+ */
+
+void auto_sync_adapt_read(plc_tag_p tag)
+{
+    uint32_t data_hash = 0;
+    int64_t new_period = tag->auto_sync_read_ns;
+
+    if(tag->status != PLCTAG_STATUS_OK || !tag->data || tag->size <= 0) {
+        return;
+    }
+
+    data_hash = hash(tag->data, (size_t)(unsigned int)tag->size, 0);
+
+    if(data_hash != tag->auto_sync_data_hash) {
+        tag->auto_sync_data_hash = data_hash;
+        new_period = tag->auto_sync_read_min_ns;
+    } else if(new_period < tag->auto_sync_read_max_ns) {
+        new_period *= 2;
+
+        if(new_period > tag->auto_sync_read_max_ns) {
+            new_period = tag->auto_sync_read_max_ns;
+        }
+    }
+
+    if(new_period != tag->auto_sync_read_ns) {
+        pdebug(DEBUG_DETAIL, "Changing automatic read period from %" PRId64 "ms to %" PRId64 "ms.", tag->auto_sync_read_ns / 1000000, new_period / 1000000);
+
+        tag->auto_sync_read_ns = new_period;
+        tag->auto_sync_next_read = auto_sync_first_read(tag, time_ns());
+    }
+}
+
+
+
+/*
+ * auto_sync_adapt_reset
+ *
+ * Drop an adaptive tag back to its minimum read period.  Must be called
+ * with the tag API mutex held.
+ */
+
+void auto_sync_adapt_reset(plc_tag_p tag)
+{
+    if(tag->auto_sync_read_max_ns && tag->auto_sync_read_ns != tag->auto_sync_read_min_ns) {
+        pdebug(DEBUG_DETAIL, "Resetting automatic read period to %" PRId64 "ms.", tag->auto_sync_read_min_ns / 1000000);
+
+        tag->auto_sync_read_ns = tag->auto_sync_read_min_ns;
+        tag->auto_sync_next_read = auto_sync_first_read(tag, time_ns());
+    }
+}
+
+
+
+/*
+ * auto_sync_set_read_bounds
+ *
+ * Change the adaptive read period bounds of a tag after creation.  A zero
+ * maximum turns adaptive reads off.  The tag restarts at the minimum
+ * period, which is also its period once adaptive reads are off.  Must be
+ * called with the tag API mutex held.
+ */
+
+int auto_sync_set_read_bounds(plc_tag_p tag, int64_t min_ns, int64_t max_ns)
+{
+    int was_adaptive = (tag->auto_sync_read_max_ns != 0);
+
+    if(min_ns < 0 || max_ns < 0 || (max_ns && (min_ns <= 0 || max_ns < min_ns))) {
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    tag->auto_sync_read_min_ns = min_ns;
+    tag->auto_sync_read_max_ns = max_ns;
+
+    if((max_ns || was_adaptive) && min_ns > 0) {
+        pdebug(DEBUG_DETAIL, "Automatic read period now %" PRId64 "us to %" PRId64 "us.", min_ns / 1000, max_ns / 1000);
+
+        tag->auto_sync_read_ns = min_ns;
+        tag->auto_sync_next_read = auto_sync_first_read(tag, time_ns());
+    }
+
+    return PLCTAG_STATUS_OK;
+}
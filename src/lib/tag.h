@@ -137,18 +137,22 @@ typedef void (*tag_extended_callback_func)(int32_t tag_id, int event, int status
                         int connection_group_id; \
                         int32_t size; \
                         int32_t tag_id; \
-                        int32_t auto_sync_read_ms; \
-                        int32_t auto_sync_write_ms; \
                         uint8_t *data; \
                         tag_byte_order_t *byte_order; \
-                        mutex_p ext_mutex; \
-                        mutex_p api_mutex; \
-                        cond_p tag_cond_wait; \
+                        lw_mutex_t ext_mutex; \
+                        lw_mutex_t api_mutex; \
+                        lw_event_t tag_cond_wait; \
                         tag_vtable_p vtable; \
                         tag_extended_callback_func callback; \
                         void *userdata; \
                         int64_t read_cache_expire; \
                         int64_t read_cache_ms; \
+                        uint32_t auto_sync_group; \
+                        int64_t auto_sync_read_ns; \
+                        int64_t auto_sync_write_ns; \
+                        int64_t auto_sync_read_min_ns; \
+                        int64_t auto_sync_read_max_ns; \
+                        uint32_t auto_sync_data_hash; \
                         int64_t auto_sync_next_read; \
                         int64_t auto_sync_next_write
 
@@ -55,8 +55,14 @@
 #include <time.h>
 #include <inttypes.h>
 
+#if defined(__linux__)
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+#endif
+
 #include <lib/libplctag.h>
 #include <util/debug.h>
+#include <util/lock_profile.h>
 
 
 
@@ -158,7 +164,7 @@ extern void mem_set(void *dest, int c, int size)
  *
  * copy memory from one pointer to another for the passed number of bytes.
  */
-extern void mem_copy(void *dest, void *src, int size)
+extern void mem_copy(void *dest, const void *src, int size)
 {
     if(!dest) {
         pdebug(DEBUG_WARN, "Destination pointer is NULL!");
@@ -190,7 +196,7 @@ extern void mem_copy(void *dest, void *src, int size)
  *
  * move memory from one pointer to another for the passed number of bytes.
  */
-extern void mem_move(void *dest, void *src, int size)
+extern void mem_move(void *dest, const void *src, int size)
 {
     if(!dest) {
         pdebug(DEBUG_WARN, "Destination pointer is NULL!");
@@ -219,7 +225,7 @@ extern void mem_move(void *dest, void *src, int size)
 
 
 
-int mem_cmp(void *src1, int src1_size, void *src2, int src2_size)
+int mem_cmp(const void *src1, int src1_size, const void *src2, int src2_size)
 {
     if(!src1 || src1_size <= 0) {
         if(!src2 || src2_size <= 0) {
@@ -928,6 +934,75 @@ extern int thread_destroy(thread_p *t)
 
 
 
+struct thread_exit_hook_t {
+    pthread_key_t key;
+};
+
+
+/*
+ * thread_exit_hook_create
+ *
+ * The function is called with the value a thread set when that thread
+ * exits.  Threads that never set a value are skipped.
+ */
+extern int thread_exit_hook_create(thread_exit_hook_p *hook, thread_exit_func_t func)
+{
+    if(!hook || !func) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *hook = (thread_exit_hook_p)mem_alloc((int)sizeof(**hook));
+    if(!*hook) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if(pthread_key_create(&((*hook)->key), func)) {
+        pdebug(DEBUG_WARN, "Unable to create thread key!");
+        mem_free(*hook);
+        *hook = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int thread_exit_hook_set(thread_exit_hook_p hook, void *data)
+{
+    if(!hook) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(pthread_setspecific(hook->key, data)) {
+        pdebug(DEBUG_WARN, "Unable to set thread key value!");
+        return PLCTAG_ERR_CREATE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * thread_exit_hook_destroy
+ *
+ * Threads that exit after this do not call the function.
+ */
+extern int thread_exit_hook_destroy(thread_exit_hook_p *hook)
+{
+    if(!hook || !*hook) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    pthread_key_delete((*hook)->key);
+
+    mem_free(*hook);
+    *hook = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 
 
@@ -973,16 +1048,37 @@ extern void lock_release(lock_t *lock)
 }
 
 
+void memory_barrier(void)
+{
+    __sync_synchronize();
+}
+
+
 /***************************************************************************
  ************************* Condition Variables *****************************
  ***************************************************************************/
 
+/*
+ * Timed waits use absolute deadlines.  Where we can, the condition vars
+ * measure them against the monotonic clock so that they do not jump when
+ * the system clock is stepped.  macOS has no pthread_condattr_setclock().
+ */
+
+#if defined(__APPLE__)
+    #define COND_CLOCK CLOCK_REALTIME
+#else
+    #define COND_CLOCK CLOCK_MONOTONIC
+#endif
+
 struct cond_t {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     int flag;
 };
 
+static int cond_init_clock(pthread_cond_t *cond);
+static void cond_deadline(struct timespec *deadline, int64_t timeout_ns);
+
 int cond_create(cond_p *c)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -1014,7 +1110,7 @@ int cond_create(cond_p *c)
         return PLCTAG_ERR_CREATE;
     }
 
-    if(pthread_cond_init(&(tmp_cond->cond), NULL)) {
+    if(cond_init_clock(&(tmp_cond->cond))) {
         pdebug(DEBUG_WARN, "Unable to initialize pthread condition var!");
         pthread_mutex_destroy(&(tmp_cond->mutex));
         mem_free(tmp_cond);
@@ -1034,8 +1130,7 @@ int cond_create(cond_p *c)
 int cond_wait_impl(const char *func, int line_num, cond_p c, int timeout_ms)
 {
     int rc = PLCTAG_STATUS_OK;
-    int64_t start_time = time_ms();
-    int64_t end_time = start_time + timeout_ms;
+    int64_t end_time = time_ns() + ((int64_t)timeout_ms * 1000000);
     struct timespec timeout;
 
     pdebug(DEBUG_SPEW, "Starting. Called from %s:%d.", func, line_num);
@@ -1055,22 +1150,17 @@ int cond_wait_impl(const char *func, int line_num, cond_p c, int timeout_ms)
         return PLCTAG_ERR_MUTEX_LOCK;
     }
 
-    /*
-     * set up timeout.
-     *
-     * NOTE: the time is _ABSOLUTE_!  This is not a relative delay.
-     */
-    timeout.tv_sec = (time_t)(end_time / 1000);
-    timeout.tv_nsec = (long)1000000 * (long)(end_time % 1000);
-
     while(!c->flag) {
-        int64_t time_left = (int64_t)timeout_ms - (time_ms() - start_time);
+        int64_t time_left = end_time - time_ns();
 
-        pdebug(DEBUG_SPEW, "Waiting for %" PRId64 "ms.", time_left);
+        pdebug(DEBUG_SPEW, "Waiting for %" PRId64 "ns.", time_left);
 
         if(time_left > 0) {
             int wait_rc = 0;
 
+            /* NOTE: the time is _ABSOLUTE_!  This is not a relative delay. */
+            cond_deadline(&timeout, time_left);
+
             wait_rc = pthread_cond_timedwait(&(c->cond), &(c->mutex), &timeout);
             if(wait_rc == ETIMEDOUT) {
                 pdebug(DEBUG_SPEW, "Timeout response from condition var wait.");
@@ -1200,6 +1290,446 @@ int cond_destroy(cond_p *c)
 
 
 
+/*
+ * Set up a condition var to use the same clock as cond_deadline().
+ */
+
+int cond_init_clock(pthread_cond_t *cond)
+{
+#if defined(__APPLE__)
+    return pthread_cond_init(cond, NULL);
+#else
+    pthread_condattr_t attr;
+    int rc = 0;
+
+    if(pthread_condattr_init(&attr)) {
+        return -1;
+    }
+
+    rc = pthread_condattr_setclock(&attr, COND_CLOCK);
+    if(!rc) {
+        rc = pthread_cond_init(cond, &attr);
+    }
+
+    pthread_condattr_destroy(&attr);
+
+    return rc;
+#endif
+}
+
+
+/*
+ * Convert a relative timeout into an absolute deadline for
+ * pthread_cond_timedwait().
+ */
+
+void cond_deadline(struct timespec *deadline, int64_t timeout_ns)
+{
+    int64_t total_ns = 0;
+
+    clock_gettime(COND_CLOCK, deadline);
+
+    total_ns = (int64_t)deadline->tv_nsec + timeout_ns;
+
+    deadline->tv_sec += (time_t)(total_ns / 1000000000);
+    deadline->tv_nsec = (long)(total_ns % 1000000000);
+}
+
+
+
+/***************************************************************************
+ ******************** Lightweight Mutexes and Events ***********************
+ ***************************************************************************/
+
+/*
+ * The lightweight mutex is a three state lock word: 0 is unlocked, 1 is
+ * locked and 2 is locked with possible sleepers.  Uncontended lock and
+ * unlock are a single atomic operation each.  Under contention we spin a
+ * short while and then sleep on the lock word.
+ *
+ * On Linux sleeping is done with a private futex.  Elsewhere we hash the
+ * address into a small table of pthread mutex/condition var pairs.
+ */
+
+#define LW_MUTEX_UNLOCKED (0)
+#define LW_MUTEX_LOCKED (1)
+#define LW_MUTEX_CONTENDED (2)
+
+#define LW_MUTEX_SPIN_COUNT (100)
+
+#if defined(__linux__)
+
+static void lw_futex_wait(volatile int *addr, int expected, int64_t timeout_ns)
+{
+    struct timespec timeout;
+
+    /* the futex timeout is relative and measured on the monotonic clock. */
+    if(timeout_ns >= 0) {
+        timeout.tv_sec = (time_t)(timeout_ns / 1000000000);
+        timeout.tv_nsec = (long)(timeout_ns % 1000000000);
+    }
+
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, (timeout_ns >= 0 ? &timeout : NULL), NULL, 0);
+}
+
+
+static void lw_futex_wake(volatile int *addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+#else
+
+#define LW_PARK_BUCKETS (64)
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} lw_park_table[LW_PARK_BUCKETS];
+
+static pthread_once_t lw_park_once = PTHREAD_ONCE_INIT;
+
+static void lw_park_init(void)
+{
+    for(int i=0; i < LW_PARK_BUCKETS; i++) {
+        pthread_mutex_init(&(lw_park_table[i].mutex), NULL);
+        cond_init_clock(&(lw_park_table[i].cond));
+    }
+}
+
+static int lw_park_index(volatile int *addr)
+{
+    uintptr_t val = (uintptr_t)addr;
+
+    return (int)((val >> 4) ^ (val >> 10)) & (LW_PARK_BUCKETS - 1);
+}
+
+static void lw_futex_wait(volatile int *addr, int expected, int64_t timeout_ns)
+{
+    int index = lw_park_index(addr);
+
+    pthread_once(&lw_park_once, lw_park_init);
+
+    pthread_mutex_lock(&(lw_park_table[index].mutex));
+
+    if(*addr == expected) {
+        if(timeout_ns >= 0) {
+            struct timespec timeout;
+
+            cond_deadline(&timeout, timeout_ns);
+
+            pthread_cond_timedwait(&(lw_park_table[index].cond), &(lw_park_table[index].mutex), &timeout);
+        } else {
+            pthread_cond_wait(&(lw_park_table[index].cond), &(lw_park_table[index].mutex));
+        }
+    }
+
+    pthread_mutex_unlock(&(lw_park_table[index].mutex));
+}
+
+
+static void lw_futex_wake(volatile int *addr, int count)
+{
+    int index = lw_park_index(addr);
+
+    (void)count;
+
+    pthread_once(&lw_park_once, lw_park_init);
+
+    /* other addresses may share the bucket, so wake everyone. */
+    pthread_mutex_lock(&(lw_park_table[index].mutex));
+    pthread_cond_broadcast(&(lw_park_table[index].cond));
+    pthread_mutex_unlock(&(lw_park_table[index].mutex));
+}
+
+#endif
+
+
+/*
+ * Each thread gets a small non-zero key the first time it takes a
+ * lightweight mutex.  This is used to track ownership for recursive locking.
+ */
+static THREAD_LOCAL int lw_thread_key = 0;
+static volatile int lw_next_thread_key = 0;
+
+static int get_lw_thread_key(void)
+{
+    while(!lw_thread_key) {
+        lw_thread_key = __sync_add_and_fetch(&lw_next_thread_key, 1);
+    }
+
+    return lw_thread_key;
+}
+
+
+int lw_mutex_init(lw_mutex_t *m)
+{
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    m->state = LW_MUTEX_UNLOCKED;
+    m->owner = 0;
+    m->depth = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_mutex_try_lock_impl(const char *func, int line_num, const char *name, lw_mutex_t *m)
+{
+    int self = get_lw_thread_key();
+
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* only this thread can have stored its own key. */
+    if(m->owner == self) {
+        m->depth++;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(__sync_val_compare_and_swap(&(m->state), LW_MUTEX_UNLOCKED, LW_MUTEX_LOCKED) != LW_MUTEX_UNLOCKED) {
+        if(lock_profile_active) {
+            lock_profile_try_failed(func, line_num, name);
+        }
+
+        return PLCTAG_ERR_MUTEX_LOCK;
+    }
+
+    m->owner = self;
+    m->depth = 1;
+
+    if(lock_profile_active) {
+        lock_profile_acquired(func, line_num, name, m, 0, 0);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_mutex_lock_impl(const char *func, int line_num, const char *name, lw_mutex_t *m)
+{
+    int self = get_lw_thread_key();
+    int state = LW_MUTEX_UNLOCKED;
+    int contended = 0;
+    int64_t start_time = 0;
+
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(m->owner == self) {
+        m->depth++;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(lock_profile_active) {
+        start_time = time_ns();
+    }
+
+    state = __sync_val_compare_and_swap(&(m->state), LW_MUTEX_UNLOCKED, LW_MUTEX_LOCKED);
+    contended = (state != LW_MUTEX_UNLOCKED);
+
+    /* spin a little while, critical sections are short. */
+    for(int i=0; state != LW_MUTEX_UNLOCKED && i < LW_MUTEX_SPIN_COUNT; i++) {
+        if(m->state == LW_MUTEX_UNLOCKED) {
+            state = __sync_val_compare_and_swap(&(m->state), LW_MUTEX_UNLOCKED, LW_MUTEX_LOCKED);
+        }
+    }
+
+    /* still held, mark it contended and sleep until it is released. */
+    if(state != LW_MUTEX_UNLOCKED) {
+        while(__sync_lock_test_and_set(&(m->state), LW_MUTEX_CONTENDED) != LW_MUTEX_UNLOCKED) {
+            lw_futex_wait(&(m->state), LW_MUTEX_CONTENDED, -1);
+        }
+    }
+
+    m->owner = self;
+    m->depth = 1;
+
+    if(start_time) {
+        lock_profile_acquired(func, line_num, name, m, contended, time_ns() - start_time);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_mutex_unlock(lw_mutex_t *m)
+{
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(m->owner != get_lw_thread_key()) {
+        pdebug(DEBUG_WARN, "Mutex %p is not held by this thread!", m);
+        return PLCTAG_ERR_MUTEX_UNLOCK;
+    }
+
+    m->depth--;
+
+    if(m->depth > 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(lock_profile_active) {
+        lock_profile_released(m);
+    }
+
+    m->owner = 0;
+
+    if(__sync_fetch_and_and(&(m->state), LW_MUTEX_UNLOCKED) == LW_MUTEX_CONTENDED) {
+        lw_futex_wake(&(m->state), 1);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_mutex_destroy(lw_mutex_t *m)
+{
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(m->state != LW_MUTEX_UNLOCKED) {
+        pdebug(DEBUG_WARN, "Destroying mutex %p while it is locked!", m);
+    }
+
+    m->state = LW_MUTEX_UNLOCKED;
+    m->owner = 0;
+    m->depth = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Events have the same semantics as cond_p.  Signaling sets the flag and a
+ * successful wait clears it again.   The waiter count lets signal skip the
+ * wake up system call when no one is waiting.
+ */
+
+int lw_event_init(lw_event_t *e)
+{
+    if(!e) {
+        pdebug(DEBUG_WARN, "null event pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    e->flag = 0;
+    e->waiters = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_event_wait_impl(const char *func, int line_num, lw_event_t *e, int timeout_ms)
+{
+    if(timeout_ms <= 0) {
+        pdebug(DEBUG_WARN, "Timeout must be a positive value but was %d in call from %s:%d!", timeout_ms, func, line_num);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return lw_event_wait_ns_impl(func, line_num, e, (int64_t)timeout_ms * 1000000);
+}
+
+
+int lw_event_wait_ns_impl(const char *func, int line_num, lw_event_t *e, int64_t timeout_ns)
+{
+    int64_t end_time = time_ns() + timeout_ns;
+    int rc = PLCTAG_ERR_TIMEOUT;
+
+    if(!e) {
+        pdebug(DEBUG_WARN, "Event pointer is null in call from %s:%d!", func, line_num);
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(timeout_ns <= 0) {
+        pdebug(DEBUG_WARN, "Timeout must be a positive value but was %" PRId64 "ns in call from %s:%d!", timeout_ns, func, line_num);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    __sync_fetch_and_add(&(e->waiters), 1);
+
+    do {
+        int64_t time_left = 0;
+
+        if(__sync_bool_compare_and_swap(&(e->flag), 1, 0)) {
+            rc = PLCTAG_STATUS_OK;
+            break;
+        }
+
+        time_left = end_time - time_ns();
+
+        if(time_left <= 0) {
+            break;
+        }
+
+        lw_futex_wait(&(e->flag), 0, time_left);
+    } while(1);
+
+    __sync_fetch_and_sub(&(e->waiters), 1);
+
+    return rc;
+}
+
+
+int lw_event_signal(lw_event_t *e)
+{
+    if(!e) {
+        pdebug(DEBUG_WARN, "null event pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* full barrier, must be ordered before reading the waiter count. */
+    __sync_lock_test_and_set(&(e->flag), 1);
+    __sync_synchronize();
+
+    if(e->waiters > 0) {
+        lw_futex_wake(&(e->flag), 1);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_event_clear(lw_event_t *e)
+{
+    if(!e) {
+        pdebug(DEBUG_WARN, "null event pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    __sync_lock_release(&(e->flag));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_event_destroy(lw_event_t *e)
+{
+    if(!e) {
+        pdebug(DEBUG_WARN, "null event pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    e->flag = 0;
+    e->waiters = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 /***************************************************************************
  ******************************* Sockets ***********************************
  **************************************************************************/
@@ -1561,6 +2091,136 @@ int socket_connect_tcp_check(sock_p sock, int timeout_ms)
 
 
 
+/*
+ * socket_connect_udp
+ *
+ * Open a UDP socket and connect it to the host.  Connecting a datagram
+ * socket only sets the default peer so it finishes at once.  Each
+ * socket_write() sends one datagram and each socket_read() returns at most
+ * one, so the read buffer must be large enough for a whole packet.
+ */
+
+int socket_connect_udp(sock_p s, const char *host, int port)
+{
+    int rc = PLCTAG_STATUS_OK;
+    struct in_addr ips[MAX_IPS];
+    int num_ips = 0;
+    struct sockaddr_in gw_addr;
+    int i = 0;
+    int fd;
+    int flags;
+
+    pdebug(DEBUG_DETAIL,"Starting.");
+
+    /* Open a socket for communication with the gateway. */
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    /* check for errors */
+    if(fd < 0) {
+        pdebug(DEBUG_ERROR,"Socket creation failed, errno: %d",errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* make the socket non-blocking. */
+    flags=fcntl(fd,F_GETFL,0);
+    if(flags<0) {
+        pdebug(DEBUG_ERROR, "Error getting socket options, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* set the non-blocking flag. */
+    flags |= O_NONBLOCK;
+
+    if(fcntl(fd,F_SETFL,flags)<0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET,host,(struct in_addr *)ips) > 0) {
+        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s",host);
+        num_ips = 1;
+    } else {
+        struct addrinfo hints;
+        struct addrinfo *res_head = NULL;
+        struct addrinfo *res=NULL;
+        int rc = 0;
+
+        mem_set(&ips, 0, sizeof(ips));
+        mem_set(&hints, 0, sizeof(hints));
+
+        hints.ai_socktype = SOCK_DGRAM; /* UDP */
+        hints.ai_family = AF_INET; /* IP V4 only */
+
+        if ((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0) {
+            pdebug(DEBUG_WARN,"Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+            if(res_head) {
+                freeaddrinfo(res_head);
+            }
+
+            close(fd);
+            return PLCTAG_ERR_BAD_GATEWAY;
+        }
+
+        res = res_head;
+        for(num_ips = 0; res && num_ips < MAX_IPS; num_ips++) {
+            ips[num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
+            res = res->ai_next;
+        }
+
+        freeaddrinfo(res_head);
+    }
+
+    pdebug(DEBUG_DETAIL, "Setting up wake pipe.");
+    rc = sock_create_event_wakeup_channel(s);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create wake pipe, error %s!", plc_tag_decode_error(rc));
+        close(fd);
+        return rc;
+    }
+
+    memset((void *)&gw_addr,0, sizeof(gw_addr));
+    gw_addr.sin_family = AF_INET ;
+    gw_addr.sin_port = htons((uint16_t)port);
+
+    /* use the first address that takes. */
+    for(i=0; i < num_ips; i++) {
+        gw_addr.sin_addr.s_addr = ips[i].s_addr;
+
+        do {
+            rc = connect(fd,(struct sockaddr *)&gw_addr,sizeof(gw_addr));
+        } while(rc < 0 && errno == EINTR);
+
+        if(rc == 0) {
+            pdebug(DEBUG_DETAIL, "Using %s:%d.", inet_ntoa(*((struct in_addr *)&ips[i])), port);
+            break;
+        }
+
+        pdebug(DEBUG_DETAIL, "Unable to use %s:%d, errno: %d", inet_ntoa(*((struct in_addr *)&ips[i])), port, errno);
+    }
+
+    if(i >= num_ips) {
+        close(fd);
+        pdebug(DEBUG_ERROR, "Unable to connect to any gateway host IP address!");
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* save the values */
+    s->fd = fd;
+    s->port = port;
+
+    s->is_open = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int socket_wait_event(sock_p sock, int events, int timeout_ms)
 {
     int result = SOCK_EVENT_NONE;
@@ -2279,9 +2939,38 @@ int sleep_ms(int ms)
 /*
  * time_ms
  *
- * Return the current epoch time in milliseconds.
+ * Return a monotonic time stamp in milliseconds.  All deadlines and
+ * timeouts use this or time_ns() so that they do not jump when the
+ * system clock is changed.  Use time_epoch_ms() for the time of day.
  */
 int64_t time_ms(void)
+{
+    return time_ns() / 1000000;
+}
+
+
+
+/*
+ * time_us
+ *
+ * Return a monotonic time stamp in microseconds.  Used for fine grained
+ * time stamps such as request tracing.
+ */
+int64_t time_us(void)
+{
+    return time_ns() / 1000;
+}
+
+
+
+/*
+ * time_epoch_ms
+ *
+ * Return the current epoch time in milliseconds.  This follows the system
+ * clock and is only for things like log time stamps and seeding rand(),
+ * never for deadlines.
+ */
+int64_t time_epoch_ms(void)
 {
     struct timeval tv;
 
@@ -2289,3 +2978,32 @@ int64_t time_ms(void)
 
     return  ((int64_t)tv.tv_sec*1000)+ ((int64_t)tv.tv_usec/1000);
 }
+
+
+
+/*
+ * process_id
+ *
+ * Return the ID of the calling process.
+ */
+int process_id(void)
+{
+    return (int)getpid();
+}
+
+
+
+/*
+ * time_ns
+ *
+ * Return a monotonic time stamp in nanoseconds.  The starting point is
+ * arbitrary so only differences between values are meaningful.
+ */
+int64_t time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t)ts.tv_sec * (int64_t)1000000000) + (int64_t)ts.tv_nsec;
+}
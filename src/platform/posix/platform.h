@@ -85,9 +85,9 @@ extern void *mem_alloc(int size);
 extern void *mem_realloc(void *orig, int size);
 extern void mem_free(const void *mem);
 extern void mem_set(void *dest, int c, int size);
-extern void mem_copy(void *dest, void *src, int size);
-extern void mem_move(void *dest, void *src, int size);
-extern int mem_cmp(void *src1, int src1_size, void *src2, int src2_size);
+extern void mem_copy(void *dest, const void *src, int size);
+extern void mem_move(void *dest, const void *src, int size);
+extern int mem_cmp(const void *src1, int src1_size, const void *src2, int src2_size);
 
 /* string functions/defs */
 extern int str_cmp(const char *first, const char *second);
@@ -129,7 +129,7 @@ extern int mutex_unlock_impl(const char *func, int line_num, mutex_p m);
 /*
  * Use this one like this:
  *
- *     critical_block(my_mutex) {
+ *     critical_block(&my_lw_mutex) {
  *         locked_data++;
  *         foo(locked_data);
  *     }
@@ -144,7 +144,7 @@ extern int mutex_unlock_impl(const char *func, int line_num, mutex_p m);
  * synchronized block.
  */
 #define critical_block(lock) \
-for(int __sync_flag_nargle_##__LINE__ = 1; __sync_flag_nargle_##__LINE__ ; __sync_flag_nargle_##__LINE__ = 0, mutex_unlock(lock))  for(int __sync_rc_nargle_##__LINE__ = mutex_lock(lock); __sync_rc_nargle_##__LINE__ == PLCTAG_STATUS_OK && __sync_flag_nargle_##__LINE__ ; __sync_flag_nargle_##__LINE__ = 0)
+for(int __sync_flag_nargle_##__LINE__ = 1; __sync_flag_nargle_##__LINE__ ; __sync_flag_nargle_##__LINE__ = 0, lw_mutex_unlock(lock))  for(int __sync_rc_nargle_##__LINE__ = lw_mutex_lock_impl(__func__, __LINE__, #lock, lock); __sync_rc_nargle_##__LINE__ == PLCTAG_STATUS_OK && __sync_flag_nargle_##__LINE__ ; __sync_flag_nargle_##__LINE__ = 0)
 
 /* thread functions/defs */
 typedef struct thread_t *thread_p;
@@ -161,6 +161,19 @@ extern int thread_destroy(thread_p *t);
 
 #define THREAD_LOCAL __thread
 
+/*
+ * Thread exit hooks call a function with a per-thread value when a thread
+ * that set a value exits.  This works for any thread, not only the ones
+ * made with thread_create().  Define the function with THREAD_EXIT_FUNC().
+ */
+typedef struct thread_exit_hook_t *thread_exit_hook_p;
+typedef void (*thread_exit_func_t)(void *data);
+extern int thread_exit_hook_create(thread_exit_hook_p *hook, thread_exit_func_t func);
+extern int thread_exit_hook_set(thread_exit_hook_p hook, void *data);
+extern int thread_exit_hook_destroy(thread_exit_hook_p *hook);
+
+#define THREAD_EXIT_FUNC(func) void func(void *data)
+
 /* atomic operations */
 #define spin_block(lock) \
 for(int __sync_flag_nargle_lock_##__LINE__ = 1; __sync_flag_nargle_lock_##__LINE__ ; __sync_flag_nargle_lock_##__LINE__ = 0, lock_release(lock))  for(int __sync_rc_nargle_lock_##__LINE__ = lock_acquire(lock); __sync_rc_nargle_lock_##__LINE__ && __sync_flag_nargle_lock_##__LINE__ ; __sync_flag_nargle_lock_##__LINE__ = 0)
@@ -174,6 +187,9 @@ extern int lock_acquire_try(lock_t *lock);
 extern int lock_acquire(lock_t *lock);
 extern void lock_release(lock_t *lock);
 
+/* full memory fence, for lock free single producer/single consumer queues. */
+extern void memory_barrier(void);
+
 
 /* condition variables */
 typedef struct cond_t *cond_p;
@@ -188,6 +204,54 @@ extern int cond_destroy(cond_p *c);
 #define cond_clear(c) cond_clear_impl(__func__, __LINE__, c)
 
 
+/*
+ * lightweight mutexes and events.
+ *
+ * These are plain structs that are embedded in the owning struct or
+ * statically initialized with LW_MUTEX_INIT/LW_EVENT_INIT.  Nothing is
+ * allocated.  The mutex is recursive like mutex_p and sleeps in the kernel
+ * only when contended.  The event behaves like cond_p: a signal sets it and
+ * a successful wait clears it.  critical_block() takes a lw_mutex_t pointer.
+ *
+ * The lock functions take the call site and the text of the mutex
+ * expression so that the lock profiler (util/lock_profile.h) can report
+ * where time is spent waiting for and holding each mutex.
+ */
+typedef struct {
+    volatile int state;
+    volatile int owner;
+    int depth;
+} lw_mutex_t;
+
+#define LW_MUTEX_INIT { 0, 0, 0 }
+
+extern int lw_mutex_init(lw_mutex_t *m);
+extern int lw_mutex_lock_impl(const char *func, int line_num, const char *name, lw_mutex_t *m);
+extern int lw_mutex_try_lock_impl(const char *func, int line_num, const char *name, lw_mutex_t *m);
+extern int lw_mutex_unlock(lw_mutex_t *m);
+extern int lw_mutex_destroy(lw_mutex_t *m);
+
+#define lw_mutex_lock(m) lw_mutex_lock_impl(__func__, __LINE__, #m, m)
+#define lw_mutex_try_lock(m) lw_mutex_try_lock_impl(__func__, __LINE__, #m, m)
+
+typedef struct {
+    volatile int flag;
+    volatile int waiters;
+} lw_event_t;
+
+#define LW_EVENT_INIT { 0, 0 }
+
+extern int lw_event_init(lw_event_t *e);
+extern int lw_event_wait_impl(const char *func, int line_num, lw_event_t *e, int timeout_ms);
+extern int lw_event_wait_ns_impl(const char *func, int line_num, lw_event_t *e, int64_t timeout_ns);
+extern int lw_event_signal(lw_event_t *e);
+extern int lw_event_clear(lw_event_t *e);
+extern int lw_event_destroy(lw_event_t *e);
+
+#define lw_event_wait(e, t) lw_event_wait_impl(__func__, __LINE__, e, t)
+#define lw_event_wait_ns(e, t) lw_event_wait_ns_impl(__func__, __LINE__, e, t)
+
+
 /* socket functions */
 typedef struct sock_t *sock_p;
 typedef enum {
@@ -205,6 +269,7 @@ typedef enum {
 extern int socket_create(sock_p *s);
 extern int socket_connect_tcp_start(sock_p s, const char *host, int port);
 extern int socket_connect_tcp_check(sock_p s, int timeout_ms);
+extern int socket_connect_udp(sock_p s, const char *host, int port);
 extern int socket_wait_event(sock_p sock, int events, int timeout_ms);
 extern int socket_wake(sock_p sock);
 extern int socket_read(sock_p s, uint8_t *buf, int size, int timeout_ms);
@@ -224,6 +289,10 @@ extern int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, i
 /* misc functions */
 extern int sleep_ms(int ms);
 extern int64_t time_ms(void);
+extern int64_t time_us(void);
+extern int64_t time_ns(void);
+extern int64_t time_epoch_ms(void);
+extern int process_id(void);
 
 #define snprintf_platform snprintf
 
@@ -56,6 +56,7 @@
 
 #include <lib/libplctag.h>
 #include <util/debug.h>
+#include <util/lock_profile.h>
 
 
 /*#ifdef __cplusplus
@@ -169,7 +170,7 @@ extern void mem_set(void *dest, int c, int size)
  *
  * copy memory from one pointer to another for the passed number of bytes.
  */
-extern void mem_copy(void *dest, void *src, int size)
+extern void mem_copy(void *dest, const void *src, int size)
 {
     if(!dest) {
         pdebug(DEBUG_WARN, "Destination pointer is NULL!");
@@ -203,7 +204,7 @@ extern void mem_copy(void *dest, void *src, int size)
  *
  * move memory from one pointer to another for the passed number of bytes.
  */
-extern void mem_move(void *dest, void *src, int size)
+extern void mem_move(void *dest, const void *src, int size)
 {
     if(!dest) {
         pdebug(DEBUG_WARN, "Destination pointer is NULL!");
@@ -232,7 +233,7 @@ extern void mem_move(void *dest, void *src, int size)
 
 
 
-int mem_cmp(void *src1, int src1_size, void *src2, int src2_size)
+int mem_cmp(const void *src1, int src1_size, const void *src2, int src2_size)
 {
     if(!src1 || src1_size <= 0) {
         if(!src2 || src2_size <= 0) {
@@ -1021,6 +1022,77 @@ extern int thread_destroy(thread_p *t)
 
 
 
+struct thread_exit_hook_t {
+    DWORD fls_index;
+};
+
+
+/*
+ * thread_exit_hook_create
+ *
+ * The function is called with the value a thread set when that thread
+ * exits.  Threads that never set a value are skipped.
+ */
+extern int thread_exit_hook_create(thread_exit_hook_p *hook, thread_exit_func_t func)
+{
+    if(!hook || !func) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *hook = (thread_exit_hook_p)mem_alloc((int)sizeof(**hook));
+    if(!*hook) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*hook)->fls_index = FlsAlloc(func);
+    if((*hook)->fls_index == FLS_OUT_OF_INDEXES) {
+        pdebug(DEBUG_WARN, "Unable to allocate fiber local storage!");
+        mem_free(*hook);
+        *hook = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int thread_exit_hook_set(thread_exit_hook_p hook, void *data)
+{
+    if(!hook) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!FlsSetValue(hook->fls_index, data)) {
+        pdebug(DEBUG_WARN, "Unable to set fiber local storage value!");
+        return PLCTAG_ERR_CREATE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * thread_exit_hook_destroy
+ *
+ * FlsFree() calls the function for every thread that still has a value,
+ * so the caller must be ready for that.
+ */
+extern int thread_exit_hook_destroy(thread_exit_hook_p *hook)
+{
+    if(!hook || !*hook) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    FlsFree((*hook)->fls_index);
+
+    mem_free(*hook);
+    *hook = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 
 /***************************************************************************
@@ -1066,6 +1138,12 @@ extern void lock_release(lock_t *lock)
 }
 
 
+void memory_barrier(void)
+{
+    MemoryBarrier();
+}
+
+
 
 
 
@@ -1257,6 +1335,333 @@ int cond_destroy(cond_p *c)
 
 
 
+/***************************************************************************
+ ******************** Lightweight Mutexes and Events ***********************
+ ***************************************************************************/
+
+/*
+ * The lightweight mutex is a three state lock word: 0 is unlocked, 1 is
+ * locked and 2 is locked with possible sleepers.  Uncontended lock and
+ * unlock are a single interlocked operation each.  Under contention we spin
+ * a short while and then sleep on the lock word.
+ *
+ * Sleepers hash the address into a small table of SRW lock/condition var
+ * pairs.  Both have static initializers so no setup is needed.
+ */
+
+#define LW_MUTEX_UNLOCKED ((LONG)0)
+#define LW_MUTEX_LOCKED ((LONG)1)
+#define LW_MUTEX_CONTENDED ((LONG)2)
+
+#define LW_MUTEX_SPIN_COUNT (100)
+
+#define LW_PARK_BUCKETS (64)
+
+static SRWLOCK lw_park_locks[LW_PARK_BUCKETS] = { SRWLOCK_INIT };
+static CONDITION_VARIABLE lw_park_conds[LW_PARK_BUCKETS] = { CONDITION_VARIABLE_INIT };
+
+static int lw_park_index(volatile long *addr)
+{
+    uintptr_t val = (uintptr_t)addr;
+
+    return (int)((val >> 4) ^ (val >> 10)) & (LW_PARK_BUCKETS - 1);
+}
+
+static void lw_futex_wait(volatile long *addr, long expected, int64_t timeout_ns)
+{
+    int index = lw_park_index(addr);
+
+    /* the wait has millisecond resolution, round up so we do not spin. */
+    DWORD timeout_ms = (timeout_ns >= 0 ? (DWORD)((timeout_ns + 999999) / 1000000) : INFINITE);
+
+    AcquireSRWLockExclusive(&lw_park_locks[index]);
+
+    if(*addr == expected) {
+        SleepConditionVariableSRW(&lw_park_conds[index], &lw_park_locks[index], timeout_ms, 0);
+    }
+
+    ReleaseSRWLockExclusive(&lw_park_locks[index]);
+}
+
+
+static void lw_futex_wake(volatile long *addr)
+{
+    int index = lw_park_index(addr);
+
+    /* other addresses may share the bucket, so wake everyone. */
+    AcquireSRWLockExclusive(&lw_park_locks[index]);
+    WakeAllConditionVariable(&lw_park_conds[index]);
+    ReleaseSRWLockExclusive(&lw_park_locks[index]);
+}
+
+
+int lw_mutex_init(lw_mutex_t *m)
+{
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    m->state = LW_MUTEX_UNLOCKED;
+    m->owner = 0;
+    m->depth = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_mutex_try_lock_impl(const char *func, int line_num, const char *name, lw_mutex_t *m)
+{
+    long self = (long)GetCurrentThreadId();
+
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* only this thread can have stored its own ID. */
+    if(m->owner == self) {
+        m->depth++;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(InterlockedCompareExchange(&(m->state), LW_MUTEX_LOCKED, LW_MUTEX_UNLOCKED) != LW_MUTEX_UNLOCKED) {
+        if(lock_profile_active) {
+            lock_profile_try_failed(func, line_num, name);
+        }
+
+        return PLCTAG_ERR_MUTEX_LOCK;
+    }
+
+    m->owner = self;
+    m->depth = 1;
+
+    if(lock_profile_active) {
+        lock_profile_acquired(func, line_num, name, m, 0, 0);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_mutex_lock_impl(const char *func, int line_num, const char *name, lw_mutex_t *m)
+{
+    long self = (long)GetCurrentThreadId();
+    LONG state = LW_MUTEX_UNLOCKED;
+    int contended = 0;
+    int64_t start_time = 0;
+
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(m->owner == self) {
+        m->depth++;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(lock_profile_active) {
+        start_time = time_ns();
+    }
+
+    state = InterlockedCompareExchange(&(m->state), LW_MUTEX_LOCKED, LW_MUTEX_UNLOCKED);
+    contended = (state != LW_MUTEX_UNLOCKED);
+
+    /* spin a little while, critical sections are short. */
+    for(int i=0; state != LW_MUTEX_UNLOCKED && i < LW_MUTEX_SPIN_COUNT; i++) {
+        if(m->state == LW_MUTEX_UNLOCKED) {
+            state = InterlockedCompareExchange(&(m->state), LW_MUTEX_LOCKED, LW_MUTEX_UNLOCKED);
+        }
+    }
+
+    /* still held, mark it contended and sleep until it is released. */
+    if(state != LW_MUTEX_UNLOCKED) {
+        while(InterlockedExchange(&(m->state), LW_MUTEX_CONTENDED) != LW_MUTEX_UNLOCKED) {
+            lw_futex_wait(&(m->state), LW_MUTEX_CONTENDED, -1);
+        }
+    }
+
+    m->owner = self;
+    m->depth = 1;
+
+    if(start_time) {
+        lock_profile_acquired(func, line_num, name, m, contended, time_ns() - start_time);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_mutex_unlock(lw_mutex_t *m)
+{
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(m->owner != (long)GetCurrentThreadId()) {
+        pdebug(DEBUG_WARN, "Mutex %p is not held by this thread!", m);
+        return PLCTAG_ERR_MUTEX_UNLOCK;
+    }
+
+    m->depth--;
+
+    if(m->depth > 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(lock_profile_active) {
+        lock_profile_released(m);
+    }
+
+    m->owner = 0;
+
+    if(InterlockedExchange(&(m->state), LW_MUTEX_UNLOCKED) == LW_MUTEX_CONTENDED) {
+        lw_futex_wake(&(m->state));
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_mutex_destroy(lw_mutex_t *m)
+{
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(m->state != LW_MUTEX_UNLOCKED) {
+        pdebug(DEBUG_WARN, "Destroying mutex %p while it is locked!", m);
+    }
+
+    m->state = LW_MUTEX_UNLOCKED;
+    m->owner = 0;
+    m->depth = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Events have the same semantics as cond_p.  Signaling sets the flag and a
+ * successful wait clears it again.   The waiter count lets signal skip the
+ * wake up when no one is waiting.
+ */
+
+int lw_event_init(lw_event_t *e)
+{
+    if(!e) {
+        pdebug(DEBUG_WARN, "null event pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    e->flag = 0;
+    e->waiters = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_event_wait_impl(const char *func, int line_num, lw_event_t *e, int timeout_ms)
+{
+    if(timeout_ms <= 0) {
+        pdebug(DEBUG_WARN, "Timeout must be a positive value but was %d in call from %s:%d!", timeout_ms, func, line_num);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return lw_event_wait_ns_impl(func, line_num, e, (int64_t)timeout_ms * 1000000);
+}
+
+
+int lw_event_wait_ns_impl(const char *func, int line_num, lw_event_t *e, int64_t timeout_ns)
+{
+    int64_t end_time = time_ns() + timeout_ns;
+    int rc = PLCTAG_ERR_TIMEOUT;
+
+    if(!e) {
+        pdebug(DEBUG_WARN, "Event pointer is null in call from %s:%d!", func, line_num);
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(timeout_ns <= 0) {
+        pdebug(DEBUG_WARN, "Timeout must be a positive value in call from %s:%d!", func, line_num);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    InterlockedIncrement(&(e->waiters));
+
+    do {
+        int64_t time_left = 0;
+
+        if(InterlockedCompareExchange(&(e->flag), 0, 1) == 1) {
+            rc = PLCTAG_STATUS_OK;
+            break;
+        }
+
+        time_left = end_time - time_ns();
+
+        if(time_left <= 0) {
+            break;
+        }
+
+        lw_futex_wait(&(e->flag), 0, time_left);
+    } while(1);
+
+    InterlockedDecrement(&(e->waiters));
+
+    return rc;
+}
+
+
+int lw_event_signal(lw_event_t *e)
+{
+    if(!e) {
+        pdebug(DEBUG_WARN, "null event pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* interlocked ops are full barriers, so the waiter count read is ordered. */
+    InterlockedExchange(&(e->flag), 1);
+
+    if(e->waiters > 0) {
+        lw_futex_wake(&(e->flag));
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_event_clear(lw_event_t *e)
+{
+    if(!e) {
+        pdebug(DEBUG_WARN, "null event pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    InterlockedExchange(&(e->flag), 0);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int lw_event_destroy(lw_event_t *e)
+{
+    if(!e) {
+        pdebug(DEBUG_WARN, "null event pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    e->flag = 0;
+    e->waiters = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 
 
@@ -1601,6 +2006,120 @@ int socket_connect_tcp_check(sock_p sock, int timeout_ms)
 }
 
 
+/*
+ * socket_connect_udp
+ *
+ * Open a UDP socket and connect it to the host.  Connecting a datagram
+ * socket only sets the default peer so it finishes at once.  Each
+ * socket_write() sends one datagram and each socket_read() returns at most
+ * one, so the read buffer must be large enough for a whole packet.
+ */
+
+int socket_connect_udp(sock_p s, const char *host, int port)
+{
+    int rc = PLCTAG_STATUS_OK;
+    IN_ADDR ips[MAX_IPS];
+    int num_ips = 0;
+    struct sockaddr_in gw_addr;
+    u_long non_blocking=1;
+    int i = 0;
+    SOCKET fd;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* Open a socket for communication with the gateway. */
+    fd = socket(AF_INET, SOCK_DGRAM, 0/*IPPROTO_UDP*/);
+
+    /* check for errors */
+    if(fd == INVALID_SOCKET) {
+        pdebug(DEBUG_WARN, "Socket creation failed, error: %d", WSAGetLastError());
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET,host,(struct in_addr *)ips) > 0) {
+        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s", host);
+        num_ips = 1;
+    } else {
+        struct addrinfo hints;
+        struct addrinfo* res_head = NULL;
+        struct addrinfo *res = NULL;
+
+        mem_set(&ips, 0, sizeof(ips));
+        mem_set(&hints, 0, sizeof(hints));
+
+        hints.ai_socktype = SOCK_DGRAM; /* UDP */
+        hints.ai_family = AF_INET; /* IP V4 only */
+
+        if ((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0) {
+            pdebug(DEBUG_WARN, "Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+            if (res_head) {
+                freeaddrinfo(res_head);
+            }
+
+            closesocket(fd);
+            return PLCTAG_ERR_BAD_GATEWAY;
+        }
+
+        res = res_head;
+        for (num_ips = 0; res && num_ips < MAX_IPS; num_ips++) {
+            ips[num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
+            res = res->ai_next;
+        }
+
+        freeaddrinfo(res_head);
+    }
+
+    /* set the socket to non-blocking. */
+    if (ioctlsocket(fd, FIONBIO, &non_blocking)) {
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    pdebug(DEBUG_DETAIL, "Setting up wake pipe.");
+    rc = sock_create_event_wakeup_channel(s);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create wake channel, error %s!", plc_tag_decode_error(rc));
+        closesocket(fd);
+        return rc;
+    }
+
+    memset((void *)&gw_addr,0, sizeof(gw_addr));
+    gw_addr.sin_family = AF_INET ;
+    gw_addr.sin_port = htons(port);
+
+    /* use the first address that takes. */
+    for(i=0; i < num_ips; i++) {
+        gw_addr.sin_addr.s_addr = ips[i].s_addr;
+
+        if(connect(fd,(struct sockaddr *)&gw_addr,sizeof(gw_addr)) != SOCKET_ERROR) {
+            pdebug(DEBUG_DETAIL, "Using address %d.", i);
+            break;
+        }
+
+        pdebug(DEBUG_DETAIL, "Unable to use address %d, error %d.", i, WSAGetLastError());
+    }
+
+    if(i >= num_ips) {
+        closesocket(fd);
+        pdebug(DEBUG_WARN,"Unable to connect to any gateway host IP address!");
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* save the values */
+    s->fd = fd;
+    s->port = port;
+
+    s->is_open = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int socket_wait_event(sock_p sock, int events, int timeout_ms)
 {
     int result = SOCK_EVENT_NONE;
@@ -2601,11 +3120,27 @@ int sleep_ms(int ms)
 /*
  * time_ms
  *
- * Return current system time in millisecond units.  This is NOT an
- * Unix epoch time.  Windows uses a different epoch starting 1/1/1601.
+ * Return a monotonic time stamp in millisecond units from the performance
+ * counter.  All deadlines and timeouts use this or time_ns() so that they
+ * do not jump when the system clock is changed.
  */
 
 int64_t time_ms(void)
+{
+    return time_ns() / 1000000;
+}
+
+
+
+/*
+ * time_epoch_ms
+ *
+ * Return current system time in millisecond units since the Unix epoch.
+ * This follows the system clock and is only for things like log time
+ * stamps and seeding rand(), never for deadlines.
+ */
+
+int64_t time_epoch_ms(void)
 {
     FILETIME ft;
     int64_t res;
@@ -2622,6 +3157,73 @@ int64_t time_ms(void)
 }
 
 
+
+/*
+ * process_id
+ *
+ * Return the ID of the calling process.
+ */
+
+int process_id(void)
+{
+    return (int)GetCurrentProcessId();
+}
+
+
+
+/*
+ * time_us
+ *
+ * Return a time stamp in microsecond units.  This uses the performance
+ * counter, so only the difference between two values is meaningful.
+ */
+
+int64_t time_us(void)
+{
+    static int64_t freq = 0;
+    LARGE_INTEGER count;
+
+    if(!freq) {
+        LARGE_INTEGER f;
+
+        QueryPerformanceFrequency(&f);
+        freq = (int64_t)f.QuadPart;
+    }
+
+    QueryPerformanceCounter(&count);
+
+    /* split to avoid overflowing the multiply on long uptimes. */
+    return ((int64_t)count.QuadPart / freq) * 1000000 + (((int64_t)count.QuadPart % freq) * 1000000) / freq;
+}
+
+
+
+/*
+ * time_ns
+ *
+ * Return a time stamp in nanosecond units from the performance counter.
+ * Only the difference between two values is meaningful.
+ */
+
+int64_t time_ns(void)
+{
+    static int64_t freq = 0;
+    LARGE_INTEGER count;
+
+    if(!freq) {
+        LARGE_INTEGER f;
+
+        QueryPerformanceFrequency(&f);
+        freq = (int64_t)f.QuadPart;
+    }
+
+    QueryPerformanceCounter(&count);
+
+    /* split to avoid overflowing the multiply on long uptimes. */
+    return ((int64_t)count.QuadPart / freq) * 1000000000 + (((int64_t)count.QuadPart % freq) * 1000000000) / freq;
+}
+
+
 struct tm *localtime_r(const time_t *timep, struct tm *result)
 {
     time_t t = *timep;
@@ -50,9 +50,12 @@
 #include <ab/eip_slc_pccc.h>
 #include <ab/eip_slc_dhp.h>
 #include <ab/session.h>
+#include <ab/symbol_cache.h>
+#include <ab/udt_cache.h>
 #include <ab/tag.h>
 #include <util/attr.h>
 #include <util/debug.h>
+#include <util/intern.h>
 #include <util/vector.h>
 
 
@@ -129,6 +132,11 @@ int ab_init(void)
         return rc;
     }
 
+    if((rc = udt_cache_startup()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to initialize UDT template cache!");
+        return rc;
+    }
+
     pdebug(DEBUG_INFO,"Finished initializing AB protocol library.");
 
     return rc;
@@ -157,6 +165,10 @@ void ab_teardown(void)
 
     session_teardown();
 
+    pdebug(DEBUG_INFO,"Freeing UDT template cache.");
+
+    udt_cache_teardown();
+
     ab_protocol_terminating = 0;
 
     pdebug(DEBUG_INFO,"Done.");
@@ -177,7 +189,7 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
      * we have a vehicle for returning status.
      */
 
-    tag = (ab_tag_p)rc_alloc(sizeof(struct ab_tag_t), (rc_cleanup_func)ab_tag_destroy);
+    tag = (ab_tag_p)rc_alloc(sizeof(struct ab_tag_t), (rc_cleanup_func)ab_tag_destroy, MEM_SUB_TAGS);
     if(!tag) {
         pdebug(DEBUG_ERROR,"Unable to allocate memory for AB EIP tag!");
         return (plc_tag_p)NULL;
@@ -315,6 +327,9 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
         tag->byte_order = &plc5_tag_byte_order;
 
         tag->allow_packing = 0;
+
+        /* reads of nearby data file elements can be merged, off unless asked for. */
+        tag->pccc_merge_reads = attr_get_int(attribs, "pccc_merge_reads", 0);
         break;
 
     case AB_PLC_SLC:
@@ -337,6 +352,9 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
         tag->byte_order = &slc_tag_byte_order;
 
         tag->allow_packing = 0;
+
+        /* reads of nearby data file elements can be merged, off unless asked for. */
+        tag->pccc_merge_reads = attr_get_int(attribs, "pccc_merge_reads", 0);
         break;
 
     case AB_PLC_LGX_PCCC:
@@ -481,6 +499,8 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
             tag->status = PLCTAG_ERR_NO_MEM;
             return (plc_tag_p)tag;
         }
+
+        rc_track_extra(tag, tag->size);
         break;
     }
 
@@ -494,6 +514,24 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
         return (plc_tag_p)tag;
     }
 
+    /* this needs the encoded name. */
+    symbol_instance_setup(tag, attribs);
+
+    /* only @udt tags use this. */
+    udt_cache_setup(tag, attribs);
+
+    /* only @tags tags use this, hand back the listing one packet at a time. */
+    tag->listing_stream = (attr_get_int(attribs, "listing_stream", 0) ? 1 : 0);
+
+    /* how many fragments of a large tag can be in flight at once. */
+    tag->parallel_fragments = attr_get_int(attribs, "parallel_fragments", AB_DEFAULT_PARALLEL_FRAGMENTS);
+    if(tag->parallel_fragments < 1) {
+        tag->parallel_fragments = 1;
+    } else if(tag->parallel_fragments > AB_MAX_PARALLEL_FRAGMENTS) {
+        pdebug(DEBUG_WARN, "Clamping parallel_fragments to %d.", AB_MAX_PARALLEL_FRAGMENTS);
+        tag->parallel_fragments = AB_MAX_PARALLEL_FRAGMENTS;
+    }
+
     /* kick off a read to get the tag type and size. */
     if(!tag->special_tag && tag->vtable->read) {
         /* trigger the first read. */
@@ -616,6 +654,8 @@ int get_tag_data_type(ab_tag_p tag, attr attribs)
                 /* check for special tags. */
                 if(str_cmp_i(tmp_tag_name, "@raw") == 0) {
                     special_tag_rc = setup_raw_tag(tag);
+                } else if(str_cmp_i(tmp_tag_name, "@discover") == 0) {
+                    special_tag_rc = setup_discovery_tag(tag);
                 } else if(str_str_cmp_i(tmp_tag_name, "@tags")) {
                     // if(tag->plc_type != AB_PLC_OMRON_NJNX) {
                         special_tag_rc = setup_tag_listing_tag(tag, tmp_tag_name);
@@ -731,6 +771,21 @@ int ab_tag_abort(ab_tag_p tag)
 {
     pdebug(DEBUG_DETAIL, "Starting.");
 
+    for(int i=0; i < AB_MAX_PARALLEL_FRAGMENTS; i++) {
+        if(tag->frag_req[i]) {
+            spin_block(&tag->frag_req[i]->lock) {
+                tag->frag_req[i]->abort_request = 1;
+            }
+
+            tag->frag_req[i] = rc_dec(tag->frag_req[i]);
+        }
+    }
+
+    tag->frag_in_flight = 0;
+
+    discovery_tag_release(tag);
+    udt_cache_release(tag);
+
     if(tag->req) {
         spin_block(&tag->req->lock) {
             tag->req->abort_request = 1;
@@ -808,6 +863,7 @@ void ab_tag_destroy(ab_tag_p tag)
 
     /* abort anything in flight */
     ab_tag_abort(tag);
+    symbol_instance_release(tag);
 
     session = tag->session;
 
@@ -821,20 +877,9 @@ void ab_tag_destroy(ab_tag_p tag)
         pdebug(DEBUG_WARN,"No session pointer!");
     }
 
-    if(tag->ext_mutex) {
-        mutex_destroy(&(tag->ext_mutex));
-        tag->ext_mutex = NULL;
-    }
-
-    if(tag->api_mutex) {
-        mutex_destroy(&(tag->api_mutex));
-        tag->api_mutex = NULL;
-    }
-
-    if(tag->tag_cond_wait) {
-        cond_destroy(&(tag->tag_cond_wait));
-        tag->tag_cond_wait = NULL;
-    }
+    lw_mutex_destroy(&(tag->ext_mutex));
+    lw_mutex_destroy(&(tag->api_mutex));
+    lw_event_destroy(&(tag->tag_cond_wait));
 
     if(tag->byte_order && tag->byte_order->is_allocated) {
         mem_free(tag->byte_order);
@@ -846,6 +891,12 @@ void ab_tag_destroy(ab_tag_p tag)
         tag->data = NULL;
     }
 
+    intern_release(tag->encoded_name);
+    tag->encoded_name = NULL;
+
+    intern_release(tag->encoded_type_info);
+    tag->encoded_type_info = NULL;
+
     pdebug(DEBUG_INFO,"Finished releasing all tag resources.");
 
     pdebug(DEBUG_INFO, "done");
@@ -884,6 +935,20 @@ int ab_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_va
                 pdebug(DEBUG_WARN, "Unsupported PLC type %d!", tag->plc_type);
                 break;
         }
+    } else if(str_cmp_i(attrib_name, "symbol_instance") == 0) {
+        /* zero while the tag reads by name. */
+        res = (int)tag->symbol_instance;
+    } else if(str_cmp_i(attrib_name, "session_queue_depth") == 0 || str_cmp_i(attrib_name, "session_max_queue_depth") == 0) {
+        int depth = 0;
+        int max_depth = 0;
+
+        /* for the session this tag uses, the stats tag only has totals. */
+        if(!tag->session || session_get_queue_depth(tag->session, &depth, &max_depth) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Tag has no session!");
+            tag->status = PLCTAG_ERR_UNSUPPORTED;
+        } else {
+            res = (str_cmp_i(attrib_name, "session_queue_depth") == 0 ? depth : max_depth);
+        }
     } else {
         pdebug(DEBUG_WARN, "Unsupported attribute name \"%s\"!", attrib_name);
         tag->status = PLCTAG_ERR_UNSUPPORTED;
@@ -962,6 +1027,8 @@ int check_tag_name(ab_tag_p tag, const char* name)
 {
     int rc = PLCTAG_STATUS_OK;
     pccc_addr_t pccc_address;
+    uint8_t encoded_name[MAX_TAG_NAME] = {0};
+    int encoded_name_size = 0;
 
     if (!name) {
         pdebug(DEBUG_WARN,"No tag name parameter found!");
@@ -985,11 +1052,16 @@ int check_tag_name(ab_tag_p tag, const char* name)
             pdebug(DEBUG_DETAIL, "PLC/5 address references bit %d.", tag->bit);
         }
 
-        if((rc = plc5_encode_address(tag->encoded_name, &(tag->encoded_name_size), MAX_TAG_NAME, &pccc_address)) != PLCTAG_STATUS_OK) {
+        if((rc = plc5_encode_address(encoded_name, &encoded_name_size, MAX_TAG_NAME, &pccc_address)) != PLCTAG_STATUS_OK) {
             pdebug(DEBUG_WARN, "Encoding of PLC/5-style tag name %s failed!", name);
             return rc;
         }
 
+        /* keep the address so that reads can be merged, see merge_pccc_reads_unsafe(). */
+        tag->pccc_address = pccc_address;
+
+        rc = ab_tag_set_encoded_name(tag, encoded_name, encoded_name_size);
+
         break;
 
     case AB_PLC_SLC:
@@ -1005,11 +1077,16 @@ int check_tag_name(ab_tag_p tag, const char* name)
             pdebug(DEBUG_DETAIL, "SLC/Micrologix address references bit %d.", tag->bit);
         }
 
-        if ((rc = slc_encode_address(tag->encoded_name, &(tag->encoded_name_size), MAX_TAG_NAME, &pccc_address)) != PLCTAG_STATUS_OK) {
+        if ((rc = slc_encode_address(encoded_name, &encoded_name_size, MAX_TAG_NAME, &pccc_address)) != PLCTAG_STATUS_OK) {
             pdebug(DEBUG_WARN, "Encoding of SLC-style tag name %s failed!", name);
             return rc;
         }
 
+        /* keep the address so that reads can be merged, see merge_pccc_reads_unsafe(). */
+        tag->pccc_address = pccc_address;
+
+        rc = ab_tag_set_encoded_name(tag, encoded_name, encoded_name_size);
+
         break;
 
     case AB_PLC_MICRO800:
@@ -1032,6 +1109,83 @@ int check_tag_name(ab_tag_p tag, const char* name)
         break;
     }
 
+    return rc;
+}
+
+
+
+/*
+ * ab_tag_mark_pccc_read
+ *
+ * Mark a built PCCC read request so that the session can merge it with
+ * queued reads of nearby elements in the same data file.  Only the SLC
+ * byte count or the PLC/5 packet byte count may follow the encoded
+ * address.  Sub-element reads, tags without pccc_merge_reads=1 and tags
+ * whose own read was refused by the PLC are always sent as they are.
+ */
+
+void ab_tag_mark_pccc_read(ab_tag_p tag, ab_request_p req, int merge_kind, uint8_t *size_field, uint8_t *addr_field, int resp_offset)
+{
+    if(!tag->pccc_merge_reads || tag->pccc_no_merge || tag->pccc_address.sub_element >= 0 || tag->pccc_address.element_size_bytes <= 0) {
+        return;
+    }
+
+    req->pccc_merge = merge_kind;
+    req->pccc_addr = tag->pccc_address;
+    req->pccc_size = tag->size;
+    req->pccc_size_offset = (int)(size_field - req->data);
+    req->pccc_addr_offset = (int)(addr_field - req->data);
+    req->pccc_resp_offset = resp_offset;
+}
+
+
+
+/*
+ * ab_tag_set_encoded_name
+ *
+ * Replace the encoded name of the tag with a shared copy of the passed
+ * name.  Tags with identical encoded names point to the same copy.
+ */
+
+int ab_tag_set_encoded_name(ab_tag_p tag, const uint8_t *encoded_name, int encoded_name_size)
+{
+    const uint8_t *shared_name = intern_bytes(encoded_name, encoded_name_size);
+
+    if(!shared_name) {
+        pdebug(DEBUG_WARN, "Unable to store encoded tag name!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    intern_release(tag->encoded_name);
+
+    tag->encoded_name = shared_name;
+    tag->encoded_name_size = encoded_name_size;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * ab_tag_set_encoded_type_info
+ *
+ * As above, but for the type information returned by the PLC.
+ */
+
+int ab_tag_set_encoded_type_info(ab_tag_p tag, const uint8_t *type_info, int type_info_size)
+{
+    const uint8_t *shared_type_info = intern_bytes(type_info, type_info_size);
+
+    if(!shared_type_info) {
+        pdebug(DEBUG_WARN, "Unable to store encoded type info!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    intern_release(tag->encoded_type_info);
+
+    tag->encoded_type_info = shared_type_info;
+    tag->encoded_type_info_size = type_info_size;
+
     return PLCTAG_STATUS_OK;
 }
 
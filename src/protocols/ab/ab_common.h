@@ -97,6 +97,8 @@ extern int ab_set_float32(plc_tag_p tag, int offset, float val);
 extern plc_type_t get_plc_type(attr attribs);
 extern int check_cpu(ab_tag_p tag, attr attribs);
 extern int check_tag_name(ab_tag_p tag, const char *name);
+extern int ab_tag_set_encoded_name(ab_tag_p tag, const uint8_t *encoded_name, int encoded_name_size);
+extern int ab_tag_set_encoded_type_info(ab_tag_p tag, const uint8_t *type_info, int type_info_size);
 extern int check_mutex(int debug);
 extern vector_p find_read_group_tags(ab_tag_p tag);
 
@@ -106,5 +108,8 @@ THREAD_FUNC(request_handler_func);
 extern int check_read_request_status(ab_tag_p tag, ab_request_p request);
 extern int check_write_request_status(ab_tag_p tag, ab_request_p request);
 
+/* helper for PCCC reads that the session may merge. */
+extern void ab_tag_mark_pccc_read(ab_tag_p tag, ab_request_p req, int merge_kind, uint8_t *size_field, uint8_t *addr_field, int resp_offset);
+
 #define rc_is_error(rc) (rc < PLCTAG_STATUS_OK)
 
@@ -47,8 +47,8 @@
 
 static int skip_whitespace(const char *name, int *name_index);
 static int parse_bit_segment(ab_tag_p tag, const char *name, int *name_index);
-static int parse_symbolic_segment(ab_tag_p tag, const char *name, int *encoded_index, int *name_index);
-static int parse_numeric_segment(ab_tag_p tag, const char *name, int *encoded_index, int *name_index);
+static int parse_symbolic_segment(const char *name, uint8_t *encoded_name, int *encoded_index, int *name_index);
+static int parse_numeric_segment(const char *name, uint8_t *encoded_name, int *encoded_index, int *name_index);
 
 static int match_numeric_segment(const char *path, size_t *path_index, uint8_t *conn_path, size_t *conn_path_index);
 static int match_ip_addr_segment(const char *path, size_t *path_index, uint8_t *conn_path, size_t *conn_path_index);
@@ -593,13 +593,14 @@ int cip_encode_tag_name(ab_tag_p tag, const char *name)
     int encoded_index = 0;
     int name_index = 0;
     int name_len = str_length(name);
+    uint8_t encoded_name[MAX_TAG_NAME] = {0};
 
     /* zero out the CIP encoded name size. Byte zero in the encoded name. */
-    tag->encoded_name[encoded_index] = 0;
+    encoded_name[encoded_index] = 0;
     encoded_index++;
 
     /* names must start with a symbolic segment. */
-    if(parse_symbolic_segment(tag, name, &encoded_index, &name_index) != PLCTAG_STATUS_OK) {
+    if(parse_symbolic_segment(name, encoded_name, &encoded_index, &name_index) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to parse initial symbolic segment in tag name %s!", name);
         return PLCTAG_ERR_BAD_PARAM;
     }
@@ -609,7 +610,7 @@ int cip_encode_tag_name(ab_tag_p tag, const char *name)
         if(name[name_index] == '.') {
             name_index++;
             /* could be a name segment or could be a bit identifier. */
-            if(parse_symbolic_segment(tag, name, &encoded_index, &name_index) != PLCTAG_STATUS_OK) {
+            if(parse_symbolic_segment(name, encoded_name, &encoded_index, &name_index) != PLCTAG_STATUS_OK) {
                 /* try a bit identifier. */
                 if(parse_bit_segment(tag, name, &name_index) == PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_DETAIL, "Found bit identifier %u.", tag->bit);
@@ -629,7 +630,7 @@ int cip_encode_tag_name(ab_tag_p tag, const char *name)
                 num_dimensions++;
 
                 skip_whitespace(name, &name_index);
-                rc = parse_numeric_segment(tag, name, &encoded_index, &name_index);
+                rc = parse_numeric_segment(name, encoded_name, &encoded_index, &name_index);
                 skip_whitespace(name, &name_index);
             } while(rc == PLCTAG_STATUS_OK && name[name_index] == ',' && num_dimensions < 3);
 
@@ -653,10 +654,9 @@ int cip_encode_tag_name(ab_tag_p tag, const char *name)
     }
 
     /* set the word count. */
-    tag->encoded_name[0] = (uint8_t)((encoded_index -1)/2);
-    tag->encoded_name_size = encoded_index;
+    encoded_name[0] = (uint8_t)((encoded_index -1)/2);
 
-    return PLCTAG_STATUS_OK;
+    return ab_tag_set_encoded_name(tag, encoded_name, encoded_index);
 }
 
 int skip_whitespace(const char *name, int *name_index)
@@ -709,7 +709,7 @@ int parse_bit_segment(ab_tag_p tag, const char *name, int *name_index)
 }
 
 
-int parse_symbolic_segment(ab_tag_p tag, const char *name, int *encoded_index, int *name_index)
+int parse_symbolic_segment(const char *name, uint8_t *encoded_name, int *encoded_index, int *name_index)
 {
     int encoded_i = *encoded_index;
     int name_i = *name_index;
@@ -726,30 +726,30 @@ int parse_symbolic_segment(ab_tag_p tag, const char *name, int *encoded_index, i
     }
 
     /* start building the encoded symbolic segment. */
-    tag->encoded_name[encoded_i] = 0x91; /* start of symbolic segment. */
+    encoded_name[encoded_i] = 0x91; /* start of symbolic segment. */
     encoded_i++;
     seg_len_index = encoded_i;
-    tag->encoded_name[seg_len_index]++;
+    encoded_name[seg_len_index]++;
     encoded_i++;
 
     /* store the first character of the name. */
-    tag->encoded_name[encoded_i] = (uint8_t)name[name_i];
+    encoded_name[encoded_i] = (uint8_t)name[name_i];
     encoded_i++;
     name_i++;
 
     /* get the rest of the name. */
     while((isalnum(name[name_i]) || name[name_i] == ':' || name[name_i] == '_') && (encoded_i < (MAX_TAG_NAME - 1))) {
-        tag->encoded_name[encoded_i] = (uint8_t)name[name_i];
+        encoded_name[encoded_i] = (uint8_t)name[name_i];
         encoded_i++;
-        tag->encoded_name[seg_len_index]++;
+        encoded_name[seg_len_index]++;
         name_i++;
     }
 
-    seg_len = tag->encoded_name[seg_len_index];
+    seg_len = encoded_name[seg_len_index];
 
     /* finish up the encoded name.   Space for the name must be a multiple of two bytes long. */
-    if((tag->encoded_name[seg_len_index] & 0x01) && (encoded_i < MAX_TAG_NAME)) {
-        tag->encoded_name[encoded_i] = 0;
+    if((encoded_name[seg_len_index] & 0x01) && (encoded_i < MAX_TAG_NAME)) {
+        encoded_name[encoded_i] = 0;
         encoded_i++;
     }
 
@@ -762,7 +762,7 @@ int parse_symbolic_segment(ab_tag_p tag, const char *name, int *encoded_index, i
 }
 
 
-int parse_numeric_segment(ab_tag_p tag, const char *name, int *encoded_index, int *name_index)
+int parse_numeric_segment(const char *name, uint8_t *encoded_name, int *encoded_index, int *name_index)
 {
     const char *p, *q;
     long val;
@@ -791,40 +791,40 @@ int parse_numeric_segment(ab_tag_p tag, const char *name, int *encoded_index, in
 
     /* encode the segment. */
     if(val > 0xFFFF) {
-        tag->encoded_name[*encoded_index] = (uint8_t)0x2A; /* 4-byte segment value. */
+        encoded_name[*encoded_index] = (uint8_t)0x2A; /* 4-byte segment value. */
         (*encoded_index)++;
 
-        tag->encoded_name[*encoded_index] = (uint8_t)0; /* padding. */
+        encoded_name[*encoded_index] = (uint8_t)0; /* padding. */
         (*encoded_index)++;
 
-        tag->encoded_name[*encoded_index] = (uint8_t)val & 0xFF;
+        encoded_name[*encoded_index] = (uint8_t)val & 0xFF;
         (*encoded_index)++;
-        tag->encoded_name[*encoded_index] = (uint8_t)((val >> 8) & 0xFF);
+        encoded_name[*encoded_index] = (uint8_t)((val >> 8) & 0xFF);
         (*encoded_index)++;
-        tag->encoded_name[*encoded_index] = (uint8_t)((val >> 16) & 0xFF);
+        encoded_name[*encoded_index] = (uint8_t)((val >> 16) & 0xFF);
         (*encoded_index)++;
-        tag->encoded_name[*encoded_index] = (uint8_t)((val >> 24) & 0xFF);
+        encoded_name[*encoded_index] = (uint8_t)((val >> 24) & 0xFF);
         (*encoded_index)++;
 
         pdebug(DEBUG_DETAIL, "Parsed 4-byte numeric segment of value %u.", (uint32_t)val);
     } else if(val > 0xFF) {
-        tag->encoded_name[*encoded_index] = (uint8_t)0x29; /* 2-byte segment value. */
+        encoded_name[*encoded_index] = (uint8_t)0x29; /* 2-byte segment value. */
         (*encoded_index)++;
 
-        tag->encoded_name[*encoded_index] = (uint8_t)0; /* padding. */
+        encoded_name[*encoded_index] = (uint8_t)0; /* padding. */
         (*encoded_index)++;
 
-        tag->encoded_name[*encoded_index] = (uint8_t)val & 0xFF;
+        encoded_name[*encoded_index] = (uint8_t)val & 0xFF;
         (*encoded_index)++;
-        tag->encoded_name[*encoded_index] = (uint8_t)((val >> 8) & 0xFF);
+        encoded_name[*encoded_index] = (uint8_t)((val >> 8) & 0xFF);
         (*encoded_index)++;
 
         pdebug(DEBUG_DETAIL, "Parsed 2-byte numeric segment of value %u.", (uint32_t)val);
     } else {
-        tag->encoded_name[*encoded_index] = (uint8_t)0x28; /* 1-byte segment value. */
+        encoded_name[*encoded_index] = (uint8_t)0x28; /* 1-byte segment value. */
         (*encoded_index)++;
 
-        tag->encoded_name[*encoded_index] = (uint8_t)val & 0xFF;
+        encoded_name[*encoded_index] = (uint8_t)val & 0xFF;
         (*encoded_index)++;
 
         pdebug(DEBUG_DETAIL, "Parsed 1-byte numeric segment of value %u.", (uint32_t)val);
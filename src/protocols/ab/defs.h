@@ -93,6 +93,8 @@
 #define AB_CIP_STATUS_OK                ((uint8_t)0x00)
 #define AB_CIP_STATUS_FRAG              ((uint8_t)0x06)
 
+#define AB_CIP_ERR_PATH_SEGMENT         ((uint8_t)0x04)
+#define AB_CIP_ERR_PATH_DEST_UNKNOWN    ((uint8_t)0x05)
 #define AB_CIP_ERR_UNSUPPORTED_SERVICE  ((uint8_t)0x08)
 #define AB_CIP_ERR_PARTIAL_ERROR  ((uint8_t)0x1e)
 
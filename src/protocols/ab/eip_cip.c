@@ -41,6 +41,7 @@
 #include <ab/tag.h>
 #include <ab/session.h>
 #include <ab/eip_cip.h>
+#include <ab/symbol_cache.h>
 #include <ab/error_codes.h>
 #include <util/attr.h>
 #include <util/debug.h>
@@ -129,9 +130,11 @@ START_PACK typedef struct {
 
 
 static int build_read_request_connected(ab_tag_p tag, int byte_offset);
+static int queue_read_request_connected(ab_tag_p tag, int byte_offset, int allow_packing, ab_request_p *request);
 //static int build_tag_list_request_connected(ab_tag_p tag);
 static int build_read_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_request_connected(ab_tag_p tag, int byte_offset);
+static int queue_write_request_connected(ab_tag_p tag, int byte_offset, int write_size, int multiple_requests, int allow_packing, ab_request_p *request);
 static int build_write_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_bit_request_connected(ab_tag_p tag);
 static int build_write_bit_request_unconnected(ab_tag_p tag);
@@ -140,6 +143,14 @@ static int check_read_status_unconnected(ab_tag_p tag);
 static int check_write_status_connected(ab_tag_p tag);
 static int check_write_status_unconnected(ab_tag_p tag);
 static int calculate_write_data_per_packet(ab_tag_p tag);
+static int parallel_fragment_size(ab_tag_p tag, int is_write);
+static int start_parallel_fragments(ab_tag_p tag, int frag_size, int is_write);
+static int fill_fragment_window(ab_tag_p tag, int is_write);
+static int check_fragment_request(ab_request_p request);
+static int copy_read_fragment(ab_tag_p tag, int slot, ab_request_p request, int *retry_by_name);
+static int check_write_fragment(ab_request_p request);
+static int check_parallel_read_status(ab_tag_p tag);
+static int check_parallel_write_status(ab_tag_p tag);
 
 static int tag_read_start(ab_tag_p tag);
 static int tag_tickler(ab_tag_p tag);
@@ -238,8 +249,14 @@ int tag_tickler(ab_tag_p tag)
 
     pdebug(DEBUG_SPEW,"Starting.");
 
+    if(tag->use_symbol_instance) {
+        symbol_instance_tickler(tag);
+    }
+
     if (tag->read_in_progress) {
-        if(tag->use_connected_msg) {
+        if(tag->frag_in_flight) {
+            rc = check_parallel_read_status(tag);
+        } else if(tag->use_connected_msg) {
             rc = check_read_status_connected(tag);
         } else {
             rc = check_read_status_unconnected(tag);
@@ -264,7 +281,9 @@ int tag_tickler(ab_tag_p tag)
     }
 
     if (tag->write_in_progress) {
-        if(tag->use_connected_msg) {
+        if(tag->frag_in_flight) {
+            rc = check_parallel_write_status(tag);
+        } else if(tag->use_connected_msg) {
             rc = check_write_status_connected(tag);
         } else {
             rc = check_write_status_unconnected(tag);
@@ -303,6 +322,7 @@ int tag_tickler(ab_tag_p tag)
 int tag_read_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
+    int frag_size = 0;
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -319,7 +339,12 @@ int tag_read_start(ab_tag_p tag)
         // if(tag->tag_list) {
         //     rc = build_tag_list_request_connected(tag);
         // } else {
+        frag_size = parallel_fragment_size(tag, 0);
+        if(frag_size > 0) {
+            rc = start_parallel_fragments(tag, frag_size, 0);
+        } else {
             rc = build_read_request_connected(tag, tag->offset);
+        }
         // }
     } else {
         rc = build_read_request_unconnected(tag, tag->offset);
@@ -353,6 +378,7 @@ int tag_read_start(ab_tag_p tag)
 int tag_write_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
+    int frag_size = 0;
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -388,7 +414,12 @@ int tag_write_start(ab_tag_p tag)
     }
 
     if(tag->use_connected_msg) {
-        rc = build_write_request_connected(tag, tag->offset);
+        frag_size = parallel_fragment_size(tag, 1);
+        if(frag_size > 0) {
+            rc = start_parallel_fragments(tag, frag_size, 1);
+        } else {
+            rc = build_write_request_connected(tag, tag->offset);
+        }
     } else {
         rc = build_write_request_unconnected(tag, tag->offset);
     }
@@ -408,6 +439,37 @@ int tag_write_start(ab_tag_p tag)
 
 
 int build_read_request_connected(ab_tag_p tag, int byte_offset)
+{
+    ab_request_p req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = queue_read_request_connected(tag, byte_offset, tag->allow_packing, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue read request!");
+        return rc;
+    }
+
+    /* save the request for later */
+    tag->req = req;
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/*
+ * queue_read_request_connected
+ *
+ * Build a connected read of the tag data starting at byte_offset and
+ * add it to the session queue.  The caller owns the returned request.
+ */
+
+int queue_read_request_connected(ab_tag_p tag, int byte_offset, int allow_packing, ab_request_p *request)
 {
     eip_cip_co_req* cip = NULL;
     uint8_t* data = NULL;
@@ -451,9 +513,14 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
     *data = read_cmd;
     data++;
 
-    /* copy the tag name into the request */
-    mem_copy(data, tag->encoded_name, tag->encoded_name_size);
-    data += tag->encoded_name_size;
+    /* copy the tag name into the request, the instance form is shorter. */
+    if(tag->encoded_instance_name) {
+        mem_copy(data, tag->encoded_instance_name, tag->encoded_instance_name_size);
+        data += tag->encoded_instance_name_size;
+    } else {
+        mem_copy(data, tag->encoded_name, tag->encoded_name_size);
+        data += tag->encoded_name_size;
+    }
 
     /* add the count of elements to read. */
     *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
@@ -486,19 +553,18 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
     /* set the session so that we know what session the request is aiming at */
     //req->session = tag->session;
 
-    req->allow_packing = tag->allow_packing;
+    req->allow_packing = allow_packing;
 
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
-        tag->req = rc_dec(req);
+        rc_dec(req);
         return rc;
     }
 
-    /* save the request for later */
-    tag->req = req;
+    *request = req;
 
     pdebug(DEBUG_INFO, "Done");
 
@@ -991,8 +1057,6 @@ int build_write_bit_request_unconnected(ab_tag_p tag)
 int build_write_request_connected(ab_tag_p tag, int byte_offset)
 {
     int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_req* cip = NULL;
-    uint8_t* data = NULL;
     ab_request_p req = NULL;
     int multiple_requests = 0;
     int write_size = 0;
@@ -1003,13 +1067,6 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
         return build_write_bit_request_connected(tag);
     }
 
-    /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
-    if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
-        return rc;
-    }
-
     rc = calculate_write_data_per_packet(tag);
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to calculate valid write data per packet!.  rc=%s", plc_tag_decode_error(rc));
@@ -1025,6 +1082,62 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
         return PLCTAG_ERR_TOO_LARGE;
     }
 
+    /* how much data to write? */
+    write_size = tag->size - byte_offset;
+
+    if(write_size > tag->write_data_per_packet) {
+        write_size = tag->write_data_per_packet;
+    }
+
+    rc = queue_write_request_connected(tag, byte_offset, write_size, multiple_requests, tag->allow_packing, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue write request!");
+        return rc;
+    }
+
+    tag->offset = byte_offset + write_size;
+
+    /* save the request for later */
+    tag->req = req;
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/*
+ * queue_write_request_connected
+ *
+ * Build a connected write of write_size bytes of the tag data starting
+ * at byte_offset and add it to the session queue.  The caller owns the
+ * returned request.
+ */
+
+int queue_write_request_connected(ab_tag_p tag, int byte_offset, int write_size, int multiple_requests, int allow_packing, ab_request_p *request)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_req* cip = NULL;
+    uint8_t* data = NULL;
+    ab_request_p req = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* we need the type information to write. */
+    if (!tag->encoded_type_info_size) {
+        pdebug(DEBUG_WARN,"Data type unsupported!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    /* get a request buffer */
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
     cip = (eip_cip_co_req*)(req->data);
 
     /* point to the end of the struct */
@@ -1056,13 +1169,8 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     data += tag->encoded_name_size;
 
     /* copy encoded type info */
-    if (tag->encoded_type_info_size) {
-        mem_copy(data, tag->encoded_type_info, tag->encoded_type_info_size);
-        data += tag->encoded_type_info_size;
-    } else {
-        pdebug(DEBUG_WARN,"Data type unsupported!");
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
+    mem_copy(data, tag->encoded_type_info, tag->encoded_type_info_size);
+    data += tag->encoded_type_info_size;
 
     /* copy the item count, little endian */
     *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
@@ -1074,17 +1182,9 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
         data += sizeof(uint32_le);
     }
 
-    /* how much data to write? */
-    write_size = tag->size - tag->offset;
-
-    if(write_size > tag->write_data_per_packet) {
-        write_size = tag->write_data_per_packet;
-    }
-
     /* now copy the data to write */
-    mem_copy(data, tag->data + tag->offset, write_size);
+    mem_copy(data, tag->data + byte_offset, write_size);
     data += write_size;
-    tag->offset += write_size;
 
     /* need to pad data to multiple of 16-bits */
     if (write_size & 0x01) {
@@ -1110,20 +1210,19 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     /* set the size of the request */
     req->request_size = (int)(data - (req->data));
 
-    /* allow packing if the tag allows it. */
-    req->allow_packing = tag->allow_packing;
+    /* allow packing if the caller allows it. */
+    req->allow_packing = allow_packing;
 
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
-        tag->req = rc_dec(req);
+        rc_dec(req);
         return rc;
     }
 
-    /* save the request for later */
-    tag->req = req;
+    *request = req;
 
     pdebug(DEBUG_INFO, "Done");
 
@@ -1329,6 +1428,7 @@ static int check_read_status_connected(ab_tag_p tag)
     uint8_t* data;
     uint8_t* data_end;
     int partial_data = 0;
+    int retry_by_name = 0;
     ab_request_p request = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -1389,6 +1489,12 @@ static int check_read_status_connected(ab_tag_p tag)
         }
 
         if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+            if(symbol_instance_fallback(tag, cip_resp->status, NULL, 0)) {
+                retry_by_name = 1;
+                rc = PLCTAG_STATUS_OK;
+                break;
+            }
+
             pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
             pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
 
@@ -1415,8 +1521,13 @@ static int check_read_status_connected(ab_tag_p tag)
             if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
                 /* copy the type info for later. */
                 if (tag->encoded_type_info_size == 0) {
-                    tag->encoded_type_info_size = 2;
-                    mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
+                    rc = ab_tag_set_encoded_type_info(tag, data, 2);
+                    if(rc != PLCTAG_STATUS_OK) {
+                        break;
+                    }
+                } else if(symbol_instance_fallback(tag, AB_CIP_STATUS_OK, data, 2)) {
+                    retry_by_name = 1;
+                    break;
                 }
 
                 /* skip the type byte and zero length byte */
@@ -1439,8 +1550,13 @@ static int check_read_status_connected(ab_tag_p tag)
 
                 /* copy the type info for later. */
                 if (tag->encoded_type_info_size == 0) {
-                    tag->encoded_type_info_size = type_length;
-                    mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
+                    rc = ab_tag_set_encoded_type_info(tag, data, type_length);
+                    if(rc != PLCTAG_STATUS_OK) {
+                        break;
+                    }
+                } else if(symbol_instance_fallback(tag, AB_CIP_STATUS_OK, data, type_length)) {
+                    retry_by_name = 1;
+                    break;
                 }
 
                 data += type_length;
@@ -1455,6 +1571,8 @@ static int check_read_status_connected(ab_tag_p tag)
 
             /* copy the data into the tag and realloc if we need more space. */
             if(payload_size + tag->offset > tag->size) {
+                int old_size = tag->size;
+
                 tag->size = (int)payload_size + tag->offset;
                 tag->elem_size = tag->size / tag->elem_count;
 
@@ -1466,6 +1584,8 @@ static int check_read_status_connected(ab_tag_p tag)
                     rc = PLCTAG_ERR_NO_MEM;
                     break;
                 }
+
+                rc_track_extra(tag, tag->size - old_size);
             }
 
             pdebug(DEBUG_INFO, "Got %d bytes of data", (int)payload_size);
@@ -1508,9 +1628,13 @@ static int check_read_status_connected(ab_tag_p tag)
         /* this particular read is done. */
         tag->read_in_progress = 0;
 
-        /* skip if we are doing a pre-write read. */
-        if (!tag->pre_write_read && partial_data) {
-            /* call read start again to get the next piece */
+        if(retry_by_name) {
+            /* the symbol instance was stale, read the same data by name. */
+            pdebug(DEBUG_DETAIL, "Retrying the read by name.");
+            tag->offset = 0;
+            rc = tag_read_start(tag);
+        } else if (!tag->pre_write_read && partial_data) {
+            /* not a pre-write read, call read start again to get the next piece */
             pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
             rc = tag_read_start(tag);
         } else {
@@ -1629,8 +1753,10 @@ static int check_read_status_unconnected(ab_tag_p tag)
         if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
             /* copy the type info for later. */
             if (tag->encoded_type_info_size == 0) {
-                tag->encoded_type_info_size = 2;
-                mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
+                rc = ab_tag_set_encoded_type_info(tag, data, 2);
+                if(rc != PLCTAG_STATUS_OK) {
+                    break;
+                }
             }
 
             /* skip the type byte and zero length byte */
@@ -1654,8 +1780,10 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
             /* copy the type info for later. */
             if (tag->encoded_type_info_size == 0) {
-                tag->encoded_type_info_size = type_length;
-                mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
+                rc = ab_tag_set_encoded_type_info(tag, data, type_length);
+                if(rc != PLCTAG_STATUS_OK) {
+                    break;
+                }
             }
 
             data += type_length;
@@ -1670,6 +1798,8 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
         /* copy the data into the tag and realloc if we need more space. */
         if(payload_size + tag->offset > tag->size) {
+            int old_size = tag->size;
+
             tag->size = (int)payload_size + tag->offset;
             tag->elem_size = tag->size / tag->elem_count;
 
@@ -1681,6 +1811,8 @@ static int check_read_status_unconnected(ab_tag_p tag)
                 rc = PLCTAG_ERR_NO_MEM;
                 break;
             }
+
+            rc_track_extra(tag, tag->size - old_size);
         }
 
         pdebug(DEBUG_INFO, "Got %d bytes of data", (int)payload_size);
@@ -2009,3 +2141,455 @@ int calculate_write_data_per_packet(ab_tag_p tag)
 
     return PLCTAG_STATUS_OK;
 }
+
+
+
+
+
+/*
+ * parallel_fragment_size
+ *
+ * Large tags need more than one fragmented read or write.  Once the
+ * element size and count are known, all of the fragment offsets are
+ * known too.  Instead of asking for the next fragment only when the
+ * previous one comes back, the tag keeps a window of fragment requests
+ * queued in the session so that they go out back to back.
+ *
+ * Returns the number of bytes per fragment if the tag should use
+ * parallel fragments, or zero if it should use the sequential path.
+ */
+
+int parallel_fragment_size(ab_tag_p tag, int is_write)
+{
+    int frag_size = 0;
+
+    if(tag->parallel_fragments < 2 || tag->plc_type == AB_PLC_OMRON_NJNX) {
+        return 0;
+    }
+
+    /* we need to know the type and size of the tag and start at the beginning. */
+    if(tag->first_read || tag->pre_write_read || tag->is_bit || tag->offset != 0) {
+        return 0;
+    }
+
+    if(tag->encoded_type_info_size <= 0 || tag->elem_size <= 0 || tag->size <= 0) {
+        return 0;
+    }
+
+    if(is_write) {
+        if(calculate_write_data_per_packet(tag) != PLCTAG_STATUS_OK) {
+            return 0;
+        }
+
+        frag_size = tag->write_data_per_packet;
+    } else {
+        frag_size = session_get_max_payload(tag->session)
+                    - (4                                /* reply service, reserved, status and extended status size */
+                       + tag->encoded_type_info_size    /* type info leads each reply */
+                       + 8);                            /* MAGIC fudge factor */
+
+        /* we want a multiple of 8 bytes */
+        frag_size &= 0xFFFFF8;
+
+        /* an earlier read found out that the PLC returns less. */
+        if(tag->frag_read_size > 0 && tag->frag_read_size < frag_size) {
+            frag_size = tag->frag_read_size;
+        }
+    }
+
+    /* if it fits in one packet, there is nothing to do in parallel. */
+    if(frag_size <= 0 || tag->size <= frag_size) {
+        return 0;
+    }
+
+    return frag_size;
+}
+
+
+
+/*
+ * start_parallel_fragments
+ *
+ * Set up the fragment window for the tag and queue the first fragments.
+ */
+
+int start_parallel_fragments(ab_tag_p tag, int frag_size, int is_write)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting parallel %s of %d bytes in fragments of %d bytes.", (is_write ? "write" : "read"), tag->size, frag_size);
+
+    tag->frag_size = frag_size;
+    tag->frag_next_offset = 0;
+    tag->frag_in_flight = 0;
+
+    rc = fill_fragment_window(tag, is_write);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue fragment requests, error %s!", plc_tag_decode_error(rc));
+        ab_tag_abort(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * fill_fragment_window
+ *
+ * Queue requests for the next fragments of the tag into any free slots.
+ *
+ * Full sized fragments are not packed.  A Logix PLC limits the whole
+ * multi-service reply to one packet so packing two of them would only
+ * split the same reply space.  The last, short fragment can be packed
+ * with other requests if the tag allows it.
+ */
+
+int fill_fragment_window(ab_tag_p tag, int is_write)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int slot=0; slot < tag->parallel_fragments && tag->frag_next_offset < tag->size; slot++) {
+        int start = tag->frag_next_offset;
+        int end = start + tag->frag_size;
+        int allow_packing = 0;
+
+        if(tag->frag_req[slot]) {
+            continue;
+        }
+
+        if(end >= tag->size) {
+            end = tag->size;
+            allow_packing = tag->allow_packing;
+        }
+
+        if(is_write) {
+            rc = queue_write_request_connected(tag, start, end - start, 1, allow_packing, &(tag->frag_req[slot]));
+        } else {
+            rc = queue_read_request_connected(tag, start, allow_packing, &(tag->frag_req[slot]));
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to queue fragment at offset %d, error %s!", start, plc_tag_decode_error(rc));
+            return rc;
+        }
+
+        pdebug(DEBUG_DETAIL, "Queued fragment %d for bytes %d to %d.", slot, start, end);
+
+        tag->frag_start[slot] = start;
+        tag->frag_end[slot] = end;
+        tag->frag_next_offset = end;
+        tag->frag_in_flight++;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * check_fragment_request
+ *
+ * Returns PLCTAG_STATUS_PENDING until the response arrives, then the
+ * status the session reported for the request.
+ */
+
+int check_fragment_request(ab_request_p request)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    spin_block(&request->lock) {
+        if(!request->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        if(request->status != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(request->status));
+            rc = request->status;
+        }
+
+        request->abort_request = 1;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * copy_read_fragment
+ *
+ * Copy the data in a read fragment response into the tag at the
+ * fragment's offset.  The PLC returns as much as fits in the reply,
+ * so a short reply leaves the rest of the slot to be read again.
+ */
+
+int copy_read_fragment(ab_tag_p tag, int slot, ab_request_p request, int *retry_by_name)
+{
+    eip_cip_co_resp* cip_resp = (eip_cip_co_resp*)(request->data);
+    uint8_t* data = (request->data) + sizeof(eip_cip_co_resp);
+    uint8_t* data_end = (request->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+    int type_length = 0;
+    int payload_size = 0;
+    int remaining = tag->frag_end[slot] - tag->frag_start[slot];
+
+    if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    if (cip_resp->reply_service != (AB_EIP_CMD_CIP_READ_FRAG | AB_EIP_CMD_CIP_OK)) {
+        pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+        if(symbol_instance_fallback(tag, cip_resp->status, NULL, 0)) {
+            *retry_by_name = 1;
+            return PLCTAG_STATUS_OK;
+        }
+
+        pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+        pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+
+        return decode_cip_error_code((uint8_t *)&cip_resp->status);
+    }
+
+    /* skip the type info, we already have it from the first read. */
+    if(data >= data_end) {
+        pdebug(DEBUG_WARN, "Fragment reply has no data!");
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
+        type_length = 2;
+    } else if ((*data) == AB_CIP_DATA_ABREV_STRUCT || (*data) == AB_CIP_DATA_ABREV_ARRAY ||
+               (*data) == AB_CIP_DATA_FULL_STRUCT || (*data) == AB_CIP_DATA_FULL_ARRAY) {
+        type_length = *(data + 1) + 2;
+    } else {
+        pdebug(DEBUG_WARN, "Unsupported data type returned, type byte=%d", *data);
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(symbol_instance_fallback(tag, AB_CIP_STATUS_OK, data, type_length)) {
+        *retry_by_name = 1;
+        return PLCTAG_STATUS_OK;
+    }
+
+    data += type_length;
+    payload_size = (int)(data_end - data);
+
+    if(payload_size <= 0) {
+        pdebug(DEBUG_WARN, "Fragment reply for offset %d has no data!", tag->frag_start[slot]);
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    if(payload_size > remaining) {
+        payload_size = remaining;
+    } else if(payload_size < remaining && cip_resp->status == AB_CIP_STATUS_OK) {
+        /* the PLC says this is the end of the data, but we expected more. */
+        pdebug(DEBUG_WARN, "Tag data ended at byte %d, expected %d bytes!", tag->frag_start[slot] + payload_size, tag->size);
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    pdebug(DEBUG_DETAIL, "Got %d bytes of data at offset %d.", payload_size, tag->frag_start[slot]);
+
+    mem_copy(tag->data + tag->frag_start[slot], data, payload_size);
+    tag->frag_start[slot] += payload_size;
+
+    /* the PLC returned less than we guessed, use its size for the next fragments and reads. */
+    if(tag->frag_start[slot] < tag->frag_end[slot] && (payload_size & 0xFFFFF8) > 0) {
+        tag->frag_size = (payload_size & 0xFFFFF8);
+        tag->frag_read_size = tag->frag_size;
+        pdebug(DEBUG_DETAIL, "Reducing fragment size to %d bytes.", tag->frag_size);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * check_write_fragment
+ *
+ * Check the reply to one write fragment.
+ */
+
+int check_write_fragment(ab_request_p request)
+{
+    eip_cip_co_resp* cip_resp = (eip_cip_co_resp*)(request->data);
+
+    if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    if (cip_resp->reply_service != (AB_EIP_CMD_CIP_WRITE_FRAG | AB_EIP_CMD_CIP_OK)) {
+        pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+        pdebug(DEBUG_WARN, "CIP write failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+        pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+        return decode_cip_error_code((uint8_t *)&cip_resp->status);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * check_parallel_read_status
+ *
+ * Copy in any fragments that have arrived, ask again for the part of
+ * a fragment that did not fit in its reply and keep the window full.
+ * This must be called with the tag mutex locked.
+ */
+
+int check_parallel_read_status(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int retry_by_name = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    for(int slot=0; slot < tag->parallel_fragments && rc == PLCTAG_STATUS_OK && !retry_by_name; slot++) {
+        ab_request_p request = tag->frag_req[slot];
+
+        if(!request) {
+            continue;
+        }
+
+        rc = check_fragment_request(request);
+        if(rc == PLCTAG_STATUS_PENDING) {
+            rc = PLCTAG_STATUS_OK;
+            continue;
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = copy_read_fragment(tag, slot, request, &retry_by_name);
+        }
+
+        tag->frag_req[slot] = rc_dec(request);
+        tag->frag_in_flight--;
+
+        if(rc == PLCTAG_STATUS_OK && !retry_by_name && tag->frag_start[slot] < tag->frag_end[slot]) {
+            /* short reply, ask for the rest of this fragment. */
+            rc = queue_read_request_connected(tag, tag->frag_start[slot], 0, &(tag->frag_req[slot]));
+            if(rc == PLCTAG_STATUS_OK) {
+                tag->frag_in_flight++;
+            }
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK && !retry_by_name) {
+        rc = fill_fragment_window(tag, 0);
+    }
+
+    if(rc != PLCTAG_STATUS_OK || retry_by_name) {
+        /* stop all the other fragments. */
+        ab_tag_abort(tag);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            /* the symbol instance was stale, read the same data by name. */
+            pdebug(DEBUG_DETAIL, "Retrying the read by name.");
+            rc = tag_read_start(tag);
+        } else {
+            pdebug(DEBUG_WARN, "Parallel read failed with error %s!", plc_tag_decode_error(rc));
+        }
+
+        return rc;
+    }
+
+    if(tag->frag_in_flight > 0) {
+        pdebug(DEBUG_SPEW, "Done.  %d fragments still in flight.", tag->frag_in_flight);
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    /* all the data is in. */
+    tag->read_in_progress = 0;
+    tag->offset = 0;
+
+    pdebug(DEBUG_DETAIL, "Done.  Read all %d bytes.", tag->size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * check_parallel_write_status
+ *
+ * Retire any write fragments that have been acknowledged and keep the
+ * window full.  This must be called with the tag mutex locked.
+ */
+
+int check_parallel_write_status(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    for(int slot=0; slot < tag->parallel_fragments && rc == PLCTAG_STATUS_OK; slot++) {
+        ab_request_p request = tag->frag_req[slot];
+
+        if(!request) {
+            continue;
+        }
+
+        rc = check_fragment_request(request);
+        if(rc == PLCTAG_STATUS_PENDING) {
+            rc = PLCTAG_STATUS_OK;
+            continue;
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = check_write_fragment(request);
+        }
+
+        tag->frag_req[slot] = rc_dec(request);
+        tag->frag_in_flight--;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = fill_fragment_window(tag, 1);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Parallel write failed with error %s!", plc_tag_decode_error(rc));
+
+        /* stop all the other fragments. */
+        ab_tag_abort(tag);
+
+        return rc;
+    }
+
+    if(tag->frag_in_flight > 0) {
+        pdebug(DEBUG_SPEW, "Done.  %d fragments still in flight.", tag->frag_in_flight);
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    /* all the data is written. */
+    tag->write_in_progress = 0;
+    tag->offset = 0;
+
+    pdebug(DEBUG_DETAIL, "Done.  Wrote all %d bytes.", tag->size);
+
+    return PLCTAG_STATUS_OK;
+}
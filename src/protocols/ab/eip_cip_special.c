@@ -43,6 +43,7 @@
 #include <ab/eip_cip.h>  /* for the Logix decode types. */
 #include <ab/eip_cip_special.h>
 #include <ab/error_codes.h>
+#include <ab/udt_cache.h>
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/vector.h>
@@ -128,6 +129,88 @@ START_PACK typedef struct {
 } END_PACK tag_list_entry;
 
 
+/*
+ * A streamed listing hands back each entry decoded into a fixed size
+ * record, see setup_tag_listing_tag().
+ */
+
+#define LISTING_BATCH_HEADER_SIZE (4)
+#define LISTING_RECORD_NAME_SIZE (104)
+#define LISTING_TYPE_DIMS_MASK ((uint16_t)0x6000)
+#define LISTING_TYPE_DIMS_SHIFT (13)
+
+START_PACK typedef struct {
+        uint32_le instance_id;
+        uint16_le symbol_type;
+        uint16_le element_length;
+        uint32_le array_dims[3];
+        uint16_le num_dims;
+        uint16_le name_len;
+        uint8_t name[LISTING_RECORD_NAME_SIZE]; /* zero padded. */
+} END_PACK listing_record;
+
+
+/*
+ * Controller discovery.  A read of a @discover tag lists the controller
+ * scope, every program scope and every template that the tags use.  The
+ * listings and template reads run as separate jobs with up to
+ * DISCOVERY_MAX_IN_FLIGHT requests out at once so that the session can
+ * pack them together.
+ */
+
+#define DISCOVERY_MAX_IN_FLIGHT (32)
+#define DISCOVERY_MAX_UDTS (4096)
+#define DISCOVERY_MAX_SCOPE_SIZE (260)
+
+#define DISCOVERY_TYPE_IS_STRUCT ((uint16_t)0x8000)
+#define DISCOVERY_TYPE_IS_SYSTEM ((uint16_t)0x1000)
+#define DISCOVERY_TYPE_UDT_ID_MASK ((uint16_t)0x0FFF)
+
+typedef enum {
+    DISCOVERY_JOB_LISTING,
+    DISCOVERY_JOB_UDT_METADATA,
+    DISCOVERY_JOB_UDT_FIELDS
+} discovery_job_state_t;
+
+struct discovery_job_t {
+    struct discovery_job_t *next;
+    discovery_job_state_t state;
+    ab_request_p req;
+
+    /* listing jobs, the scope name is NULL for the controller scope. */
+    char *scope_name;
+    uint8_t encoded_scope[DISCOVERY_MAX_SCOPE_SIZE];
+    int encoded_scope_size;
+    uint32_t next_id;
+
+    /* template jobs build up the same data as a @udt tag. */
+    uint16_t udt_id;
+    uint32_t total_size;
+    uint8_t *udt_data;
+    int udt_size;
+};
+
+struct discovery_buffer_t {
+    uint8_t *data;
+    int size;
+    int capacity;
+    uint32_t count;
+};
+
+struct discovery_t {
+    struct discovery_job_t *active[DISCOVERY_MAX_IN_FLIGHT];
+    int in_flight;
+
+    struct discovery_job_t *queue_head;
+    struct discovery_job_t *queue_tail;
+
+    uint8_t udt_queued[DISCOVERY_MAX_UDTS];
+
+    struct discovery_buffer_t tags;
+    struct discovery_buffer_t udts;
+};
+
+
 /* raw tag functions */
 //static int raw_tag_read_start(ab_tag_p tag);
 static int raw_tag_tickler(ab_tag_p tag);
@@ -145,6 +228,9 @@ static int listing_tag_tickler(ab_tag_p tag);
 //static int listing_tag_write_start(ab_tag_p tag);
 static int listing_tag_check_read_status_connected(ab_tag_p tag);
 static int listing_tag_build_read_request_connected(ab_tag_p tag);
+static int listing_tag_scan_entries(ab_tag_p tag, uint8_t *data, uint8_t *data_end, int *num_entries);
+static int listing_tag_decode_batch(ab_tag_p tag, uint8_t *data, int num_entries);
+static int listing_tag_reserve(ab_tag_p tag, int size);
 
 
 
@@ -158,6 +244,32 @@ static int udt_tag_check_read_fields_status_connected(ab_tag_p tag);
 static int udt_tag_build_read_fields_request_connected(ab_tag_p tag);
 
 
+/* discovery tag functions. */
+static int discovery_tag_read_start(ab_tag_p tag);
+static int discovery_tag_tickler(ab_tag_p tag);
+static int discovery_check_status(ab_tag_p tag);
+static int discovery_check_job(ab_tag_p tag, struct discovery_job_t *job);
+static int discovery_get_response(ab_request_p request, uint8_t service, uint8_t **data, uint8_t **data_end, int *partial_data);
+static int discovery_add_entries(struct discovery_t *discovery, struct discovery_job_t *job, uint8_t *data, uint8_t *data_end);
+static int discovery_add_udt(struct discovery_t *discovery, struct discovery_job_t *job);
+static int discovery_queue_listing(struct discovery_t *discovery, const uint8_t *name, int name_len);
+static int discovery_queue_udt(struct discovery_t *discovery, uint16_t udt_id);
+static void discovery_queue_job(struct discovery_t *discovery, struct discovery_job_t *job);
+static int discovery_fill_window(ab_tag_p tag);
+static int discovery_finish(ab_tag_p tag);
+static void discovery_free_job(struct discovery_job_t *job);
+static int discovery_append(struct discovery_buffer_t *buf, const void *data, int size);
+static int discovery_append_u16(struct discovery_buffer_t *buf, uint16_t val);
+static int discovery_append_string(struct discovery_buffer_t *buf, const uint8_t *str, int str_len);
+
+
+/* request builders shared by the listing, UDT and discovery tags. */
+static int build_listing_request(ab_tag_p tag, const uint8_t *encoded_scope, int encoded_scope_size, uint32_t next_id, ab_request_p *req_out);
+static int build_udt_metadata_request(ab_tag_p tag, uint16_t udt_id, ab_request_p *req_out);
+static uint32_t udt_field_data_size(const uint8_t *header);
+static int build_udt_fields_request(ab_tag_p tag, uint16_t udt_id, uint32_t offset, uint32_t total_size, ab_request_p *req_out);
+
+
 /* define the vtable for raw tag type. */
 struct tag_vtable_t raw_tag_vtable = {
     (tag_vtable_func)ab_tag_abort, /* shared */
@@ -203,6 +315,22 @@ struct tag_vtable_t udt_tag_vtable = {
 
 
 
+/* define the vtable for discovery tag type. */
+struct tag_vtable_t discovery_tag_vtable = {
+    (tag_vtable_func)ab_tag_abort, /* shared */
+    (tag_vtable_func)discovery_tag_read_start,
+    (tag_vtable_func)ab_tag_status, /* shared */
+    (tag_vtable_func)discovery_tag_tickler,
+    (tag_vtable_func)NULL, /* write */
+    (tag_vtable_func)NULL, /* wake_plc */
+
+    /* attribute accessors */
+    ab_get_int_attrib,
+    ab_set_int_attrib
+};
+
+
+
 tag_byte_order_t listing_tag_logix_byte_order = {
     .is_allocated = 0,
 
@@ -447,6 +575,8 @@ static int raw_tag_check_write_status_connected(ab_tag_p tag)
         uint8_t *tag_data_buffer = mem_realloc(tag->data, data_size);
 
         if(tag_data_buffer) {
+            rc_track_extra(tag, data_size - tag->size);
+
             tag->data = tag_data_buffer;
             tag->size = data_size;
 
@@ -554,6 +684,8 @@ static int raw_tag_check_write_status_unconnected(ab_tag_p tag)
         uint8_t *tag_data_buffer = mem_realloc(tag->data, data_size);
 
         if(tag_data_buffer) {
+            rc_track_extra(tag, data_size - tag->size);
+
             tag->data = tag_data_buffer;
             tag->size = data_size;
 
@@ -804,6 +936,26 @@ int raw_tag_build_write_request_unconnected(ab_tag_p tag)
  *
  * There are two main cases here: 1) a bare tag listing, 2) a program tag listing.
  * We know that we got here because the string "@tags" was in the name.
+ *
+ * With listing_stream=1, each read returns the entries of one response
+ * packet and the request for the next packet is already out while the
+ * application works on them.  The entries are decoded into fixed size
+ * records:
+ *
+ * Bytes   Meaning
+ * 0-3     32-bit number of records in this batch.
+ *
+ * N x 128 byte records:
+ *     uint32_t instance_id
+ *     uint16_t symbol_type
+ *     uint16_t element_length
+ *     uint32_t array_dims[3]
+ *     uint16_t num_dims - from bits 13 and 14 of the symbol type.
+ *     uint16_t name_len, then the name, zero padded to 104 bytes.
+ *
+ * The name can be read with plc_tag_get_string() at offset 22 of a record.
+ * A batch with no records marks the end of the listing and the next read
+ * starts over.
  */
 
 int setup_tag_listing_tag(ab_tag_p tag, const char *name)
@@ -926,6 +1078,20 @@ int listing_tag_read_start(ab_tag_p tag)
     /* mark the tag read in progress */
     tag->read_in_progress = 1;
 
+    if(tag->listing_stream) {
+        /* the request for this batch went out when the last batch came in. */
+        if(tag->req) {
+            pdebug(DEBUG_INFO, "Done.  Next batch already requested.");
+            return PLCTAG_STATUS_PENDING;
+        }
+
+        /* the tickler reports the end of the listing. */
+        if(tag->listing_done) {
+            pdebug(DEBUG_INFO, "Done.  Listing already complete.");
+            return PLCTAG_STATUS_PENDING;
+        }
+    }
+
     /* build the new request */
     rc = listing_tag_build_read_request_connected(tag);
 
@@ -957,7 +1123,16 @@ int listing_tag_tickler(ab_tag_p tag)
             tag->read_in_flight = 0;
         }
 
-        rc = listing_tag_check_read_status_connected(tag);
+        if(tag->listing_stream && tag->listing_done) {
+            /* an empty batch marks the end, the next read starts over. */
+            pdebug(DEBUG_DETAIL, "End of streamed tag listing.");
+
+            rc = listing_tag_decode_batch(tag, NULL, 0);
+            tag->listing_done = 0;
+            tag->read_in_progress = 0;
+        } else {
+            rc = listing_tag_check_read_status_connected(tag);
+        }
         // if (rc != PLCTAG_STATUS_PENDING) {
         //     pdebug(DEBUG_WARN,"Error %s getting tag list read status!", plc_tag_decode_error(rc));
         // }
@@ -1005,11 +1180,9 @@ static int listing_tag_check_read_status_connected(ab_tag_p tag)
     uint8_t* data;
     uint8_t* data_end;
     int partial_data = 0;
+    int num_entries = 0;
     ab_request_p request = NULL;
 
-    static int symbol_index=0;
-
-
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
@@ -1069,32 +1242,33 @@ static int listing_tag_check_read_status_connected(ab_tag_p tag)
         /* check to see if this is a partial response. */
         partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
 
+        /* make sure the entries are whole before we use any of them. */
+        rc = listing_tag_scan_entries(tag, data, data_end, &num_entries);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Malformed tag listing response!");
+            break;
+        }
+
+        /*
+         * a streaming listing hands back each packet as its own batch of
+         * records, so the buffer never holds more than one response.
+         */
+        if(tag->listing_stream) {
+            rc = listing_tag_decode_batch(tag, data, num_entries);
+            break;
+        }
+
         /*
          * check to see if there is any data to process.  If this is a packed
          * response, there might not be.
          */
         if(payload_size > 0) {
-            uint8_t *current_entry_data = data;
             int new_size = (int)payload_size + tag->offset;
 
-            /* copy the data into the tag and realloc if we need more space. */
-
-            if(new_size > tag->size) {
-                uint8_t *new_buffer = NULL;
-
-                tag->elem_count = tag->size = new_size;
-
-                pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", new_size);
-
-                new_buffer = (uint8_t*)mem_realloc(tag->data, new_size);
-                if(!new_buffer) {
-                    pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
-                    rc = PLCTAG_ERR_NO_MEM;
-                    break;
-                }
-
-                tag->data = new_buffer;
-                tag->elem_count = tag->size = new_size;
+            rc = listing_tag_reserve(tag, new_size);
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+                break;
             }
 
             /* copy the data into the tag's data buffer. */
@@ -1103,25 +1277,12 @@ static int listing_tag_check_read_status_connected(ab_tag_p tag)
             tag->offset += (int)payload_size;
 
             pdebug(DEBUG_DETAIL, "current offset %d", tag->offset);
-
-            /* scan through the data to get the next ID to use. */
-            while((data_end - current_entry_data) > 0) {
-                tag_list_entry *current_entry = (tag_list_entry*)current_entry_data;
-
-                /* first element is the symbol instance ID */
-                tag->next_id = (uint16_t)(le2h32(current_entry->instance_id) + 1);
-
-                pdebug(DEBUG_DETAIL, "Next ID: %d", tag->next_id);
-
-                /* skip past to the next instance. */
-                current_entry_data += (sizeof(*current_entry) + le2h16(current_entry->string_len));
-
-                symbol_index++;
-            }
         } else {
             pdebug(DEBUG_DETAIL, "Response returned no data and no error.");
         }
 
+        tag->elem_count = tag->size = tag->offset;
+
         /* set the return code */
         rc = PLCTAG_STATUS_OK;
     } while(0);
@@ -1143,16 +1304,28 @@ static int listing_tag_check_read_status_connected(ab_tag_p tag)
     if (rc == PLCTAG_STATUS_OK) {
         /* keep going if we are not done yet. */
         if (partial_data) {
-            /* call read start again to get the next piece */
+            /*
+             * call read start again to get the next piece.  When streaming,
+             * this request is in flight while the caller works on the batch
+             * we just decoded.
+             */
             pdebug(DEBUG_DETAIL, "calling listing_tag_build_read_request_connected() to get the next chunk.");
             rc = listing_tag_build_read_request_connected(tag);
+
+            if(rc == PLCTAG_STATUS_OK && tag->listing_stream && num_entries > 0) {
+                pdebug(DEBUG_DETAIL, "Tag listing batch of %d bytes ready.", tag->size);
+
+                tag->offset = 0;
+                tag->read_in_progress = 0;
+            }
         } else {
             /* done! */
             pdebug(DEBUG_DETAIL, "Done reading tag list data!");
 
-            pdebug(DEBUG_DETAIL, "total symbols: %d", symbol_index);
-
-            tag->elem_count = tag->offset;
+            /* a final batch with entries is followed by an empty one. */
+            if(tag->listing_stream && num_entries > 0) {
+                tag->listing_done = 1;
+            }
 
             tag->first_read = 0;
             tag->offset = 0;
@@ -1170,6 +1343,7 @@ static int listing_tag_check_read_status_connected(ab_tag_p tag)
 
         tag->offset = 0;
         tag->next_id = 0;
+        tag->listing_done = 0;
 
         /* clean up everything. */
         ab_tag_abort(tag);
@@ -1182,8 +1356,170 @@ static int listing_tag_check_read_status_connected(ab_tag_p tag)
 
 
 
+/*
+ * listing_tag_scan_entries
+ *
+ * Walk the tag entries in one response, check that each one fits in the
+ * packet and note the instance ID to ask for next.
+ */
+
+static int listing_tag_scan_entries(ab_tag_p tag, uint8_t *data, uint8_t *data_end, int *num_entries_out)
+{
+    uint8_t *current_entry_data = data;
+    int num_entries = 0;
+
+    *num_entries_out = 0;
+
+    while((data_end - current_entry_data) > 0) {
+        tag_list_entry *current_entry = (tag_list_entry*)current_entry_data;
+
+        if((data_end - current_entry_data) < (ptrdiff_t)sizeof(*current_entry)) {
+            pdebug(DEBUG_WARN, "Tag entry header truncated after %d entries!", num_entries);
+            return PLCTAG_ERR_BAD_REPLY;
+        }
+
+        if((data_end - current_entry_data) < (ptrdiff_t)(sizeof(*current_entry) + le2h16(current_entry->string_len))) {
+            pdebug(DEBUG_WARN, "Tag entry name truncated after %d entries!", num_entries);
+            return PLCTAG_ERR_BAD_REPLY;
+        }
+
+        /* first element is the symbol instance ID */
+        tag->next_id = le2h32(current_entry->instance_id) + 1;
+
+        /* skip past to the next instance. */
+        current_entry_data += (sizeof(*current_entry) + le2h16(current_entry->string_len));
+
+        num_entries++;
+    }
+
+    pdebug(DEBUG_DETAIL, "Found %d entries, next ID: %u", num_entries, (unsigned int)tag->next_id);
+
+    *num_entries_out = num_entries;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * listing_tag_decode_batch
+ *
+ * Replace the tag data with the records for the entries of one response.
+ * The entries were checked by listing_tag_scan_entries().  With no entries
+ * this makes the empty batch that ends a streamed listing.
+ */
+
+static int listing_tag_decode_batch(ab_tag_p tag, uint8_t *data, int num_entries)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int size = LISTING_BATCH_HEADER_SIZE + (num_entries * (int)(unsigned int)sizeof(listing_record));
+    uint32_le count = h2le32((uint32_t)(unsigned int)num_entries);
+    listing_record *record = NULL;
+
+    rc = listing_tag_reserve(tag, size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+        return rc;
+    }
+
+    mem_set(tag->data, 0, size);
+    mem_copy(tag->data, &count, (int)(unsigned int)sizeof(count));
+
+    record = (listing_record *)(tag->data + LISTING_BATCH_HEADER_SIZE);
+
+    for(int i=0; i < num_entries; i++, record++) {
+        tag_list_entry *entry = (tag_list_entry *)data;
+        uint16_t symbol_type = le2h16(entry->symbol_type);
+        int name_len = (int)(unsigned int)le2h16(entry->string_len);
+
+        if(name_len > LISTING_RECORD_NAME_SIZE) {
+            pdebug(DEBUG_WARN, "Tag name of %d bytes does not fit in a listing record!", name_len);
+            return PLCTAG_ERR_TOO_LARGE;
+        }
+
+        record->instance_id = entry->instance_id;
+        record->symbol_type = entry->symbol_type;
+        record->element_length = entry->element_length;
+        record->array_dims[0] = entry->array_dims[0];
+        record->array_dims[1] = entry->array_dims[1];
+        record->array_dims[2] = entry->array_dims[2];
+        record->num_dims = h2le16((uint16_t)((symbol_type & LISTING_TYPE_DIMS_MASK) >> LISTING_TYPE_DIMS_SHIFT));
+        record->name_len = entry->string_len;
+        mem_copy(record->name, data + sizeof(*entry), name_len);
+
+        data += sizeof(*entry) + (size_t)(unsigned int)name_len;
+    }
+
+    tag->elem_count = tag->size = size;
+    tag->offset = 0;
+
+    pdebug(DEBUG_DETAIL, "Decoded %d records.", num_entries);
+
+    return rc;
+}
+
+
+
+/*
+ * listing_tag_reserve
+ *
+ * Make sure the tag buffer holds at least size bytes.  The buffer grows
+ * geometrically so that a long listing is not copied on every packet.
+ */
+
+static int listing_tag_reserve(ab_tag_p tag, int size)
+{
+    uint8_t *new_buffer = NULL;
+    int new_capacity = 0;
+
+    /* the buffer starts out at the size set up when the tag was created. */
+    if(tag->listing_capacity < tag->size) {
+        tag->listing_capacity = tag->size;
+    }
+
+    if(size <= tag->listing_capacity) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    new_capacity = tag->listing_capacity * 2;
+    if(new_capacity < size) {
+        new_capacity = size;
+    }
+
+    pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", new_capacity);
+
+    new_buffer = (uint8_t*)mem_realloc(tag->data, new_capacity);
+    if(!new_buffer) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    rc_track_extra(tag, new_capacity - tag->listing_capacity);
+
+    tag->data = new_buffer;
+    tag->listing_capacity = new_capacity;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 int listing_tag_build_read_request_connected(ab_tag_p tag)
+{
+    return build_listing_request(tag, tag->encoded_name, tag->encoded_name_size, tag->next_id, &(tag->req));
+}
+
+
+
+/*
+ * build_listing_request
+ *
+ * Queue a request for the symbols of one scope starting at the instance
+ * next_id.  The scope is an encoded program name, with the leading word
+ * count byte, or NULL for the controller scope.
+ */
+
+int build_listing_request(ab_tag_p tag, const uint8_t *encoded_scope, int encoded_scope_size, uint32_t next_id, ab_request_p *req_out)
 {
     eip_cip_co_req* cip = NULL;
     //tag_list_req *list_req = NULL;
@@ -1230,13 +1566,13 @@ int listing_tag_build_read_request_connected(ab_tag_p tag)
     data++;
 
     /* request path size, in 16-bit words */
-    *data = (uint8_t)(3 + ((tag->encoded_name_size-1)/2)); /* size in words of routing header + routing and instance ID. */
+    *data = (uint8_t)(3 + ((encoded_scope_size-1)/2)); /* size in words of routing header + routing and instance ID. */
     data++;
 
     /* add in the encoded name, but without the leading word count byte! */
-    if(tag->encoded_name_size > 1) {
-        mem_copy(data, &tag->encoded_name[1], (tag->encoded_name_size-1));
-        data += (tag->encoded_name_size-1);
+    if(encoded_scope_size > 1) {
+        mem_copy(data, &encoded_scope[1], (encoded_scope_size-1));
+        data += (encoded_scope_size-1);
     }
 
     /* add in the routing header . */
@@ -1249,7 +1585,7 @@ int listing_tag_build_read_request_connected(ab_tag_p tag)
     data += 4;
 
     /* now the instance ID */
-    tmp_u16 = h2le16((uint16_t)tag->next_id);
+    tmp_u16 = h2le16((uint16_t)next_id);
     mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
     data += (int)sizeof(tmp_u16);
 
@@ -1305,12 +1641,12 @@ int listing_tag_build_read_request_connected(ab_tag_p tag)
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
-        tag->req = rc_dec(req);
+        *req_out = rc_dec(req);
         return rc;
     }
 
     /* save the request for later */
-    tag->req = req;
+    *req_out = req;
 
     pdebug(DEBUG_INFO, "Done");
 
@@ -1404,8 +1740,23 @@ int udt_tag_read_start(ab_tag_p tag)
 
     /* set up the state for the requests (there are two!) */
     tag->udt_get_fields = 0;
+    tag->udt_from_cache = 0;
     tag->offset = 0;
 
+    /* a template already checked on this connection needs no requests. */
+    rc = udt_cache_read(tag);
+    if(rc == PLCTAG_STATUS_OK) {
+        tag->udt_from_cache = 1;
+
+        pdebug(DEBUG_INFO, "Done.  Using cached template.");
+
+        return PLCTAG_STATUS_PENDING;
+    } else if(rc == PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_INFO, "Done.  Waiting for the template cache.");
+
+        return PLCTAG_STATUS_PENDING;
+    }
+
     /* build the new request */
     rc = udt_tag_build_read_metadata_request_connected(tag);
     if (rc != PLCTAG_STATUS_OK) {
@@ -1436,7 +1787,25 @@ int udt_tag_tickler(ab_tag_p tag)
             tag->read_in_flight = 0;
         }
 
-        if(tag->udt_get_fields) {
+        if(tag->udt_from_cache) {
+            tag->udt_from_cache = 0;
+            tag->read_in_progress = 0;
+            rc = PLCTAG_STATUS_OK;
+        } else if(tag->udt_cache_state) {
+            rc = udt_cache_tickler(tag);
+            if(rc == PLCTAG_STATUS_OK) {
+                tag->read_in_progress = 0;
+            } else if(rc == PLCTAG_ERR_NOT_FOUND) {
+                /* not cached, read it from the PLC. */
+                rc = udt_tag_build_read_metadata_request_connected(tag);
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = PLCTAG_STATUS_PENDING;
+                } else {
+                    pdebug(DEBUG_WARN,"Unable to build read request!");
+                    tag->read_in_progress = 0;
+                }
+            }
+        } else if(tag->udt_get_fields) {
             rc = udt_tag_check_read_fields_status_connected(tag);
         } else {
             rc = udt_tag_check_read_metadata_status_connected(tag);
@@ -1577,6 +1946,8 @@ static int udt_tag_check_read_metadata_status_connected(ab_tag_p tag)
                 break;
             }
 
+            rc_track_extra(tag, new_size - tag->size);
+
             tag->data = new_buffer;
             tag->size = new_size;
             tag->elem_count = 1;
@@ -1636,10 +2007,17 @@ static int udt_tag_check_read_metadata_status_connected(ab_tag_p tag)
 
             tag->elem_count = 1;
             tag->offset = 0;
-            tag->udt_get_fields = 1;
 
-            pdebug(DEBUG_DETAIL, "calling udt_tag_build_read_fields_request_connected() to get field data.");
-            rc = udt_tag_build_read_fields_request_connected(tag);
+            if(udt_cache_check(tag) == PLCTAG_STATUS_OK) {
+                /* the cached field data is still good. */
+                pdebug(DEBUG_DETAIL, "Using cached udt field data.");
+                tag->read_in_progress = 0;
+            } else {
+                tag->udt_get_fields = 1;
+
+                pdebug(DEBUG_DETAIL, "calling udt_tag_build_read_fields_request_connected() to get field data.");
+                rc = udt_tag_build_read_fields_request_connected(tag);
+            }
         }
     }
 
@@ -1664,6 +2042,19 @@ static int udt_tag_check_read_metadata_status_connected(ab_tag_p tag)
 
 
 int udt_tag_build_read_metadata_request_connected(ab_tag_p tag)
+{
+    return build_udt_metadata_request(tag, tag->udt_id, &(tag->req));
+}
+
+
+
+/*
+ * build_udt_metadata_request
+ *
+ * Queue a request for the attributes of the template udt_id.
+ */
+
+int build_udt_metadata_request(ab_tag_p tag, uint16_t udt_id, ab_request_p *req_out)
 {
     eip_cip_co_req* cip = NULL;
     //tag_list_req *list_req = NULL;
@@ -1723,7 +2114,7 @@ int udt_tag_build_read_metadata_request_connected(ab_tag_p tag)
     data += 4;
 
     /* now the instance ID */
-    tmp_u16 = h2le16((uint16_t)tag->udt_id);
+    tmp_u16 = h2le16((uint16_t)udt_id);
     mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
     data += (int)sizeof(tmp_u16);
 
@@ -1779,12 +2170,12 @@ int udt_tag_build_read_metadata_request_connected(ab_tag_p tag)
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
-        tag->req = rc_dec(req);
+        *req_out = rc_dec(req);
         return rc;
     }
 
     /* save the request for later */
-    tag->req = req;
+    *req_out = req;
 
     pdebug(DEBUG_INFO, "Done");
 
@@ -1896,6 +2287,8 @@ int udt_tag_check_read_fields_status_connected(ab_tag_p tag)
             /* copy the data into the tag's data buffer. */
             mem_copy(new_buffer + tag->offset + 14, data, (int)payload_size); /* MAGIC, offset plus the header. */
 
+            rc_track_extra(tag, new_size - tag->size);
+
             tag->data = new_buffer;
             tag->size = new_size;
             tag->elem_size = new_size;
@@ -1942,6 +2335,8 @@ int udt_tag_check_read_fields_status_connected(ab_tag_p tag)
             tag->udt_get_fields = 0;
             tag->read_in_progress = 0;
             tag->offset = 0;
+
+            udt_cache_store(tag);
         }
     }
 
@@ -1966,6 +2361,45 @@ int udt_tag_check_read_fields_status_connected(ab_tag_p tag)
 
 
 int udt_tag_build_read_fields_request_connected(ab_tag_p tag)
+{
+    return build_udt_fields_request(tag, tag->udt_id, (uint32_t)tag->offset, udt_field_data_size(tag->data), &(tag->req));
+}
+
+
+
+/*
+ * udt_field_data_size
+ *
+ * Work out how many bytes of field data a template has from the 14 byte
+ * header built from its attributes.
+ */
+
+uint32_t udt_field_data_size(const uint8_t *header)
+{
+    uint32_le tmp_u32 = UINT32_LE_INIT(0);
+    uint32_t total_size = 0;
+    uint32_t neg_4 = (~(uint32_t)4) + 1; /* twos-complement */
+
+    /* calculate the total size we need to get. */
+    mem_copy(&tmp_u32, header + 2, (int)(unsigned int)(sizeof(tmp_u32)));
+    total_size = (4 * le2h32(tmp_u32)) - 23; /* formula according to the docs. */
+
+    pdebug(DEBUG_DETAIL, "Calculating total size of request, %d to %d.", (int)(unsigned int)total_size, (int)(unsigned int)((total_size + (uint32_t)3) & (uint32_t)neg_4));
+
+    /* make the total size a multiple of 4 bytes.  Round up. */
+    return (total_size + 3) & (uint32_t)neg_4;
+}
+
+
+
+/*
+ * build_udt_fields_request
+ *
+ * Queue a request for the field definitions of the template udt_id,
+ * starting offset bytes in.
+ */
+
+int build_udt_fields_request(ab_tag_p tag, uint16_t udt_id, uint32_t offset, uint32_t total_size, ab_request_p *req_out)
 {
     eip_cip_co_req* cip = NULL;
     //tag_list_req *list_req = NULL;
@@ -1975,8 +2409,6 @@ int udt_tag_build_read_fields_request_connected(ab_tag_p tag)
     uint8_t *data = NULL;
     uint16_le tmp_u16 = UINT16_LE_INIT(0);
     uint32_le tmp_u32 = UINT32_LE_INIT(0);
-    uint32_t total_size = 0;
-    uint32_t neg_4 = (~(uint32_t)4) + 1; /* twos-complement */
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -1987,15 +2419,6 @@ int udt_tag_build_read_fields_request_connected(ab_tag_p tag)
         return rc;
     }
 
-    /* calculate the total size we need to get. */
-    mem_copy(&tmp_u32, tag->data + 2, (int)(unsigned int)(sizeof(tmp_u32)));
-    total_size = (4 * le2h32(tmp_u32)) - 23; /* formula according to the docs. */
-
-    pdebug(DEBUG_DETAIL, "Calculating total size of request, %d to %d.", (int)(unsigned int)total_size, (int)(unsigned int)((total_size + (uint32_t)3) & (uint32_t)neg_4));
-
-    /* make the total size a multiple of 4 bytes.  Round up. */
-    total_size = (total_size + 3) & (uint32_t)neg_4;
-
     /* point the request struct at the buffer */
     cip = (eip_cip_co_req*)(req->data);
 
@@ -2033,18 +2456,18 @@ int udt_tag_build_read_fields_request_connected(ab_tag_p tag)
     data += 4;
 
     /* now the instance ID */
-    tmp_u16 = h2le16((uint16_t)tag->udt_id);
+    tmp_u16 = h2le16((uint16_t)udt_id);
     mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
     data += (int)sizeof(tmp_u16);
 
     /* set the offset */
-    tmp_u32 = h2le32((uint32_t)(tag->offset));
+    tmp_u32 = h2le32(offset);
     mem_copy(data, &tmp_u32, (int)(unsigned int)sizeof(tmp_u32));
     data += sizeof(tmp_u32);
 
     /* set the total size */
-    pdebug(DEBUG_DETAIL, "Total size %d less offset %d gives %d bytes for the request.", total_size, tag->offset, ((int)(unsigned int)total_size - tag->offset));
-    tmp_u16 = h2le16((uint16_t)(total_size - (uint16_t)(unsigned int)tag->offset));
+    pdebug(DEBUG_DETAIL, "Total size %d less offset %d gives %d bytes for the request.", (int)(unsigned int)total_size, (int)(unsigned int)offset, ((int)(unsigned int)total_size - (int)(unsigned int)offset));
+    tmp_u16 = h2le16((uint16_t)(total_size - offset));
     mem_copy(data, &tmp_u16, (int)(unsigned int)sizeof(tmp_u16));
     data += sizeof(tmp_u16);
 
@@ -2073,12 +2496,12 @@ int udt_tag_build_read_fields_request_connected(ab_tag_p tag)
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
-        tag->req = rc_dec(req);
+        *req_out = rc_dec(req);
         return rc;
     }
 
     /* save the request for later */
-    tag->req = req;
+    *req_out = req;
 
     pdebug(DEBUG_INFO, "Done");
 
@@ -2086,3 +2509,896 @@ int udt_tag_build_read_fields_request_connected(ab_tag_p tag)
 }
 
 
+
+
+
+
+
+
+
+
+/******************************************************************
+ ******************* controller discovery functions ***************
+ ******************************************************************/
+
+
+
+
+/*
+ * Handle discovery tag set up.
+ *
+ * A read of the tag fills the buffer with every tag in the controller and
+ * program scopes and the layout of every template that they use.  The
+ * buffer looks like this:
+ *
+ * Bytes   Meaning
+ * 0-3     32-bit number of tag entries.
+ * 4-7     32-bit number of UDT entries.
+ *
+ * N x tag entries, the same as the entries of a @tags listing:
+ *     uint32_t instance_id
+ *     uint16_t symbol_type
+ *     uint16_t element_length
+ *     uint32_t array_dims[3]
+ *     uint16_t name_len, then the name.  Program tags are named "Program:X.tag".
+ *
+ * M x UDT entries:
+ *     uint16_t udt_id
+ *     uint16_t struct_handle
+ *     uint32_t instance_size
+ *     uint16_t num_fields
+ *     uint16_t name_len, then the name without the ";..." suffix.
+ *     num_fields x fields:
+ *         uint16_t field_metadata - array element count or bit number
+ *         uint16_t field_type
+ *         uint32_t field_offset
+ *         uint16_t name_len, then the name.
+ *
+ * All strings are counted so the tag uses the same byte order as @tags.
+ */
+
+int setup_discovery_tag(ab_tag_p tag)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(tag->plc_type != AB_PLC_LGX) {
+        pdebug(DEBUG_WARN, "Controller discovery is only supported on *Logix PLCs.");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    tag->special_tag = 1;
+    tag->elem_type = AB_TYPE_TAG_ENTRY;
+    tag->elem_count = 1;
+    tag->elem_size = 1;
+
+    tag->byte_order = &listing_tag_logix_byte_order;
+
+    tag->vtable = &discovery_tag_vtable;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * discovery_tag_release
+ *
+ * Stop all the requests of a discovery in progress and free its state.
+ * This is called when the tag is aborted or destroyed.
+ */
+
+void discovery_tag_release(ab_tag_p tag)
+{
+    struct discovery_t *discovery = tag->discovery;
+
+    if(!discovery) {
+        return;
+    }
+
+    for(int slot=0; slot < DISCOVERY_MAX_IN_FLIGHT; slot++) {
+        if(discovery->active[slot]) {
+            discovery_free_job(discovery->active[slot]);
+            discovery->active[slot] = NULL;
+        }
+    }
+
+    while(discovery->queue_head) {
+        struct discovery_job_t *job = discovery->queue_head;
+
+        discovery->queue_head = job->next;
+        discovery_free_job(job);
+    }
+
+    if(discovery->tags.data) {
+        mem_free(discovery->tags.data);
+    }
+
+    if(discovery->udts.data) {
+        mem_free(discovery->udts.data);
+    }
+
+    mem_free(discovery);
+
+    tag->discovery = NULL;
+}
+
+
+
+/*
+ * discovery_tag_read_start
+ *
+ * This function must be called only from within one thread, or while
+ * the tag's mutex is locked.
+ *
+ * Start with the controller scope listing.  The jobs for the program
+ * scopes and templates are queued as the responses come in.
+ */
+
+int discovery_tag_read_start(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting");
+
+    if(tag->write_in_progress) {
+        pdebug(DEBUG_WARN, "A write is in progress on a discovery tag!");
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    if(tag->read_in_progress) {
+        pdebug(DEBUG_WARN, "Read or write operation already in flight!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    tag->discovery = (struct discovery_t *)mem_alloc((int)(unsigned int)sizeof(struct discovery_t));
+    if(!tag->discovery) {
+        pdebug(DEBUG_WARN, "Unable to allocate discovery state!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    /* mark the tag read in progress */
+    tag->read_in_progress = 1;
+
+    rc = discovery_queue_listing(tag->discovery, NULL, 0);
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = discovery_fill_window(tag);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to start discovery, error %s!", plc_tag_decode_error(rc));
+
+        discovery_tag_release(tag);
+        tag->read_in_progress = 0;
+
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+int discovery_tag_tickler(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW,"Starting.");
+
+    if (tag->read_in_progress) {
+        rc = discovery_check_status(tag);
+
+        tag->status = (int8_t)rc;
+
+        /* if the operation completed, make a note so that the callback will be called. */
+        if(!tag->read_in_progress) {
+            pdebug(DEBUG_DETAIL, "Read complete.");
+            tag->read_complete = 1;
+        }
+
+        pdebug(DEBUG_SPEW,"Done.  Read in progress.");
+
+        return rc;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.  No operation in progress.");
+
+    return tag->status;
+}
+
+
+
+/*
+ * discovery_check_status
+ *
+ * Handle the responses that came in, start queued jobs in the free slots
+ * and build the tag data once nothing is left to do.
+ *
+ * This is not thread-safe!  It should be called with the tag mutex
+ * locked!
+ */
+
+int discovery_check_status(ab_tag_p tag)
+{
+    struct discovery_t *discovery = tag->discovery;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!discovery) {
+        pdebug(DEBUG_WARN, "Read in progress, but no discovery state!");
+        tag->read_in_progress = 0;
+        return PLCTAG_ERR_READ;
+    }
+
+    for(int slot=0; slot < DISCOVERY_MAX_IN_FLIGHT && rc == PLCTAG_STATUS_OK; slot++) {
+        struct discovery_job_t *job = discovery->active[slot];
+
+        if(!job) {
+            continue;
+        }
+
+        rc = discovery_check_job(tag, job);
+        if(rc == PLCTAG_STATUS_PENDING) {
+            rc = PLCTAG_STATUS_OK;
+            continue;
+        }
+
+        /* a job with no request left is done. */
+        if(rc == PLCTAG_STATUS_OK && !job->req) {
+            discovery_free_job(job);
+            discovery->active[slot] = NULL;
+            discovery->in_flight--;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = discovery_fill_window(tag);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Discovery failed with error %s!", plc_tag_decode_error(rc));
+
+        /* clean up everything, this frees the discovery state. */
+        ab_tag_abort(tag);
+
+        return rc;
+    }
+
+    if(discovery->in_flight > 0) {
+        pdebug(DEBUG_SPEW, "Done.  %d jobs still in flight.", discovery->in_flight);
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    rc = discovery_finish(tag);
+
+    discovery_tag_release(tag);
+    tag->read_in_progress = 0;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * discovery_check_job
+ *
+ * Handle the response to the job's request if there is one.  The job
+ * either queues its next request or is done and has no request left.
+ */
+
+int discovery_check_job(ab_tag_p tag, struct discovery_job_t *job)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p request = job->req;
+    uint8_t *data = NULL;
+    uint8_t *data_end = NULL;
+    int partial_data = 0;
+    uint8_t service = (job->state == DISCOVERY_JOB_LISTING ? AB_EIP_CMD_CIP_LIST_TAGS : (job->state == DISCOVERY_JOB_UDT_METADATA ? AB_EIP_CMD_CIP_GET_ATTR_LIST : AB_EIP_CMD_CIP_READ));
+
+    spin_block(&request->lock) {
+        if(!request->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        if(request->status != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(request->status));
+            rc = request->status;
+        }
+
+        request->abort_request = 1;
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = discovery_get_response(request, service, &data, &data_end, &partial_data);
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        switch(job->state) {
+            case DISCOVERY_JOB_LISTING:
+                rc = discovery_add_entries(tag->discovery, job, data, data_end);
+                break;
+
+            case DISCOVERY_JOB_UDT_METADATA:
+                if(!partial_data) {
+                    uint8_t *new_buffer = NULL;
+                    uint16_le tmp_u16 = h2le16(job->udt_id);
+
+                    if((data_end - data) < 30) { /* MAGIC, the end of the last attribute. */
+                        pdebug(DEBUG_WARN, "Template %d attributes truncated!", (int)job->udt_id);
+                        rc = PLCTAG_ERR_BAD_REPLY;
+                        break;
+                    }
+
+                    new_buffer = (uint8_t *)mem_realloc(job->udt_data, 14); /* MAGIC, size of the @udt header. */
+                    if(!new_buffer) {
+                        rc = PLCTAG_ERR_NO_MEM;
+                        break;
+                    }
+
+                    /* the same 14 byte header as an @udt tag. */
+                    job->udt_data = new_buffer;
+                    job->udt_size = 14;
+
+                    mem_copy(job->udt_data + 0, &tmp_u16, (int)(unsigned int)(sizeof(tmp_u16)));
+                    mem_copy(job->udt_data + 2, data + 6, 4);
+                    mem_copy(job->udt_data + 6, data + 14, 4);
+                    mem_copy(job->udt_data + 10, data + 22, 2);
+                    mem_copy(job->udt_data + 12, data + 28, 2);
+
+                    job->total_size = udt_field_data_size(job->udt_data);
+                }
+                break;
+
+            case DISCOVERY_JOB_UDT_FIELDS:
+                if(data_end > data) {
+                    int payload_size = (int)(data_end - data);
+                    uint8_t *new_buffer = (uint8_t *)mem_realloc(job->udt_data, job->udt_size + payload_size);
+
+                    if(!new_buffer) {
+                        rc = PLCTAG_ERR_NO_MEM;
+                        break;
+                    }
+
+                    mem_copy(new_buffer + job->udt_size, data, payload_size);
+
+                    job->udt_data = new_buffer;
+                    job->udt_size += payload_size;
+                }
+
+                if(!partial_data) {
+                    rc = discovery_add_udt(tag->discovery, job);
+                }
+                break;
+
+            default:
+                pdebug(DEBUG_WARN, "Unknown discovery job state %d!", (int)job->state);
+                rc = PLCTAG_ERR_BAD_STATUS;
+                break;
+        }
+    }
+
+    job->req = rc_dec(request);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /* queue the next request of this job, if any. */
+    switch(job->state) {
+        case DISCOVERY_JOB_LISTING:
+            if(partial_data) {
+                rc = build_listing_request(tag, job->encoded_scope, job->encoded_scope_size, job->next_id, &(job->req));
+            }
+            break;
+
+        case DISCOVERY_JOB_UDT_METADATA:
+            if(partial_data) {
+                rc = build_udt_metadata_request(tag, job->udt_id, &(job->req));
+            } else {
+                job->state = DISCOVERY_JOB_UDT_FIELDS;
+                rc = build_udt_fields_request(tag, job->udt_id, 0, job->total_size, &(job->req));
+            }
+            break;
+
+        case DISCOVERY_JOB_UDT_FIELDS:
+            if(partial_data) {
+                rc = build_udt_fields_request(tag, job->udt_id, (uint32_t)(job->udt_size - 14), job->total_size, &(job->req));
+            }
+            break;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * discovery_get_response
+ *
+ * Check the response to a discovery request and find its payload.
+ */
+
+int discovery_get_response(ab_request_p request, uint8_t service, uint8_t **data, uint8_t **data_end, int *partial_data)
+{
+    eip_cip_co_resp* cip_resp = (eip_cip_co_resp*)(request->data);
+
+    if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    if (cip_resp->reply_service != (service | AB_EIP_CMD_CIP_OK) ) {
+        pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+        pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+        pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+        return decode_cip_error_code((uint8_t *)&cip_resp->status);
+    }
+
+    *partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+    *data = (request->data) + sizeof(eip_cip_co_resp);
+    *data_end = (request->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * discovery_add_entries
+ *
+ * Copy the entries of one listing response into the tag table.  Program
+ * tags get the program name in front.  The controller scope queues a
+ * listing for each program and every scope queues the templates its tags
+ * use.
+ */
+
+int discovery_add_entries(struct discovery_t *discovery, struct discovery_job_t *job, uint8_t *data, uint8_t *data_end)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int scope_name_len = (job->scope_name ? str_length(job->scope_name) : 0);
+
+    while((data_end - data) > 0 && rc == PLCTAG_STATUS_OK) {
+        tag_list_entry *entry = (tag_list_entry *)data;
+        uint8_t *name = data + sizeof(*entry);
+        int name_len = 0;
+        uint16_t symbol_type = 0;
+
+        if((data_end - data) < (ptrdiff_t)sizeof(*entry) || (data_end - data) < (ptrdiff_t)(sizeof(*entry) + le2h16(entry->string_len))) {
+            pdebug(DEBUG_WARN, "Tag entry truncated!");
+            return PLCTAG_ERR_BAD_REPLY;
+        }
+
+        name_len = (int)(unsigned int)le2h16(entry->string_len);
+        symbol_type = le2h16(entry->symbol_type);
+
+        job->next_id = le2h32(entry->instance_id) + 1;
+
+        /* the entry up to the name is copied as is. */
+        rc = discovery_append(&discovery->tags, entry, (int)(unsigned int)(sizeof(*entry) - sizeof(entry->string_len)));
+
+        if(rc == PLCTAG_STATUS_OK) {
+            if(job->scope_name) {
+                rc = discovery_append_u16(&discovery->tags, (uint16_t)(scope_name_len + 1 + name_len));
+
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = discovery_append(&discovery->tags, job->scope_name, scope_name_len);
+                }
+
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = discovery_append(&discovery->tags, ".", 1);
+                }
+
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = discovery_append(&discovery->tags, name, name_len);
+                }
+            } else {
+                rc = discovery_append_string(&discovery->tags, name, name_len);
+            }
+        }
+
+        discovery->tags.count++;
+
+        /* each program has its own scope. */
+        if(rc == PLCTAG_STATUS_OK && !job->scope_name && name_len > str_length("PROGRAM:") && str_cmp_i_n((const char *)name, "PROGRAM:", str_length("PROGRAM:")) == 0) {
+            rc = discovery_queue_listing(discovery, name, name_len);
+        }
+
+        if(rc == PLCTAG_STATUS_OK && (symbol_type & DISCOVERY_TYPE_IS_STRUCT) && !(symbol_type & DISCOVERY_TYPE_IS_SYSTEM)) {
+            rc = discovery_queue_udt(discovery, (uint16_t)(symbol_type & DISCOVERY_TYPE_UDT_ID_MASK));
+        }
+
+        data = name + name_len;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * discovery_add_udt
+ *
+ * Decode a template read into the @udt format and add its layout to the
+ * UDT table.  Any templates used by its fields are queued.
+ *
+ * After the 14 byte header, the template has the field definitions:
+ *     uint16_t field_metadata
+ *     uint16_t field_type
+ *     uint32_t field_offset
+ * then zero terminated strings, the template name up to the first ';'
+ * and the field names.  System templates might not have all the names.
+ */
+
+int discovery_add_udt(struct discovery_t *discovery, struct discovery_job_t *job)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint8_t *data = job->udt_data;
+    int size = job->udt_size;
+    uint16_le tmp_u16 = UINT16_LE_INIT(0);
+    uint16_t num_fields = 0;
+    int name_offset = 0;
+    int name_len = 0;
+
+    mem_copy(&tmp_u16, data + 10, (int)(unsigned int)sizeof(tmp_u16));
+    num_fields = le2h16(tmp_u16);
+
+    name_offset = 14 + (8 * (int)(unsigned int)num_fields); /* MAGIC, header plus 8 bytes per field. */
+    if(name_offset > size) {
+        pdebug(DEBUG_WARN, "Template %d field definitions truncated!", (int)job->udt_id);
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    /* the template name ends at the first ';' or the zero terminator. */
+    while(name_offset + name_len < size && data[name_offset + name_len] != 0 && data[name_offset + name_len] != ';') {
+        name_len++;
+    }
+
+    /* UDT ID and struct handle. */
+    rc = discovery_append(&discovery->udts, data + 0, 2);
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = discovery_append(&discovery->udts, data + 12, 2);
+    }
+
+    /* instance size and number of fields. */
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = discovery_append(&discovery->udts, data + 6, 4);
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = discovery_append(&discovery->udts, data + 10, 2);
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = discovery_append_string(&discovery->udts, data + name_offset, name_len);
+    }
+
+    /* skip the rest of the name string. */
+    while(name_offset < size && data[name_offset] != 0) {
+        name_offset++;
+    }
+
+    name_offset++;
+
+    for(int field=0; field < (int)(unsigned int)num_fields && rc == PLCTAG_STATUS_OK; field++) {
+        uint8_t *field_def = data + 14 + (8 * field);
+        uint16_t field_type = 0;
+
+        name_len = 0;
+        while(name_offset + name_len < size && data[name_offset + name_len] != 0) {
+            name_len++;
+        }
+
+        rc = discovery_append(&discovery->udts, field_def, 8);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = discovery_append_string(&discovery->udts, (name_offset < size ? data + name_offset : NULL), name_len);
+        }
+
+        name_offset += name_len + 1;
+
+        mem_copy(&tmp_u16, field_def + 2, (int)(unsigned int)sizeof(tmp_u16));
+        field_type = le2h16(tmp_u16);
+
+        if(rc == PLCTAG_STATUS_OK && (field_type & DISCOVERY_TYPE_IS_STRUCT) && !(field_type & DISCOVERY_TYPE_IS_SYSTEM)) {
+            rc = discovery_queue_udt(discovery, (uint16_t)(field_type & DISCOVERY_TYPE_UDT_ID_MASK));
+        }
+    }
+
+    discovery->udts.count++;
+
+    return rc;
+}
+
+
+
+/*
+ * discovery_queue_listing
+ *
+ * Queue a listing of a program scope, or of the controller scope if the
+ * name is NULL.
+ */
+
+int discovery_queue_listing(struct discovery_t *discovery, const uint8_t *name, int name_len)
+{
+    struct discovery_job_t *job = NULL;
+
+    /* word count, symbolic segment, length, name and a pad byte. */
+    if(name_len > 255 || 3 + name_len + 1 > DISCOVERY_MAX_SCOPE_SIZE) {
+        pdebug(DEBUG_WARN, "Program name is too long!");
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    job = (struct discovery_job_t *)mem_alloc((int)(unsigned int)sizeof(*job));
+    if(!job) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    job->state = DISCOVERY_JOB_LISTING;
+
+    if(name) {
+        job->scope_name = (char *)mem_alloc(name_len + 1);
+        if(!job->scope_name) {
+            mem_free(job);
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        mem_copy(job->scope_name, name, name_len);
+
+        job->encoded_scope[1] = 0x91; /* symbolic segment. */
+        job->encoded_scope[2] = (uint8_t)(unsigned int)name_len;
+        mem_copy(&job->encoded_scope[3], name, name_len);
+        job->encoded_scope_size = 3 + name_len;
+
+        /* pad the segment, not counting the word count byte, to a whole number of words. */
+        if(name_len & 0x01) {
+            job->encoded_scope[job->encoded_scope_size] = 0;
+            job->encoded_scope_size++;
+        }
+
+        job->encoded_scope[0] = (uint8_t)((job->encoded_scope_size - 1) / 2);
+
+        pdebug(DEBUG_DETAIL, "Queued listing of %s.", job->scope_name);
+    }
+
+    discovery_queue_job(discovery, job);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * discovery_queue_udt
+ *
+ * Queue a read of a template unless it was already queued.
+ */
+
+int discovery_queue_udt(struct discovery_t *discovery, uint16_t udt_id)
+{
+    struct discovery_job_t *job = NULL;
+
+    if(discovery->udt_queued[udt_id]) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    job = (struct discovery_job_t *)mem_alloc((int)(unsigned int)sizeof(*job));
+    if(!job) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    job->state = DISCOVERY_JOB_UDT_METADATA;
+    job->udt_id = udt_id;
+
+    discovery->udt_queued[udt_id] = 1;
+
+    pdebug(DEBUG_DETAIL, "Queued template %d.", (int)udt_id);
+
+    discovery_queue_job(discovery, job);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void discovery_queue_job(struct discovery_t *discovery, struct discovery_job_t *job)
+{
+    if(discovery->queue_tail) {
+        discovery->queue_tail->next = job;
+    } else {
+        discovery->queue_head = job;
+    }
+
+    discovery->queue_tail = job;
+}
+
+
+
+/*
+ * discovery_fill_window
+ *
+ * Start queued jobs until all the slots are in use.
+ */
+
+int discovery_fill_window(ab_tag_p tag)
+{
+    struct discovery_t *discovery = tag->discovery;
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int slot=0; slot < DISCOVERY_MAX_IN_FLIGHT && discovery->queue_head && rc == PLCTAG_STATUS_OK; slot++) {
+        struct discovery_job_t *job = NULL;
+
+        if(discovery->active[slot]) {
+            continue;
+        }
+
+        job = discovery->queue_head;
+        discovery->queue_head = job->next;
+        if(!discovery->queue_head) {
+            discovery->queue_tail = NULL;
+        }
+
+        job->next = NULL;
+
+        if(job->state == DISCOVERY_JOB_LISTING) {
+            rc = build_listing_request(tag, job->encoded_scope, job->encoded_scope_size, 0, &(job->req));
+        } else {
+            rc = build_udt_metadata_request(tag, job->udt_id, &(job->req));
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            discovery_free_job(job);
+            break;
+        }
+
+        discovery->active[slot] = job;
+        discovery->in_flight++;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * discovery_finish
+ *
+ * Put the counts, the tag table and the UDT table into the tag buffer.
+ */
+
+int discovery_finish(ab_tag_p tag)
+{
+    struct discovery_t *discovery = tag->discovery;
+    int new_size = 8 + discovery->tags.size + discovery->udts.size; /* MAGIC, two 32-bit counts. */
+    uint8_t *new_buffer = NULL;
+    uint32_le tmp_u32 = UINT32_LE_INIT(0);
+
+    new_buffer = (uint8_t *)mem_realloc(tag->data, new_size);
+    if(!new_buffer) {
+        pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    rc_track_extra(tag, new_size - tag->size);
+
+    tag->data = new_buffer;
+    tag->elem_count = tag->size = new_size;
+
+    tmp_u32 = h2le32(discovery->tags.count);
+    mem_copy(tag->data + 0, &tmp_u32, (int)(unsigned int)sizeof(tmp_u32));
+
+    tmp_u32 = h2le32(discovery->udts.count);
+    mem_copy(tag->data + 4, &tmp_u32, (int)(unsigned int)sizeof(tmp_u32));
+
+    if(discovery->tags.size > 0) {
+        mem_copy(tag->data + 8, discovery->tags.data, discovery->tags.size);
+    }
+
+    if(discovery->udts.size > 0) {
+        mem_copy(tag->data + 8 + discovery->tags.size, discovery->udts.data, discovery->udts.size);
+    }
+
+    pdebug(DEBUG_INFO, "Found %u tags and %u UDTs in %d bytes.", (unsigned int)discovery->tags.count, (unsigned int)discovery->udts.count, new_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void discovery_free_job(struct discovery_job_t *job)
+{
+    if(job->req) {
+        spin_block(&job->req->lock) {
+            job->req->abort_request = 1;
+        }
+
+        job->req = rc_dec(job->req);
+    }
+
+    if(job->scope_name) {
+        mem_free(job->scope_name);
+    }
+
+    if(job->udt_data) {
+        mem_free(job->udt_data);
+    }
+
+    mem_free(job);
+}
+
+
+
+/*
+ * discovery_append
+ *
+ * Add bytes to the end of a table.  The buffer grows geometrically.
+ */
+
+int discovery_append(struct discovery_buffer_t *buf, const void *data, int size)
+{
+    if(buf->size + size > buf->capacity) {
+        int new_capacity = (buf->capacity > 0 ? buf->capacity * 2 : 1024);
+        uint8_t *new_buffer = NULL;
+
+        if(new_capacity < buf->size + size) {
+            new_capacity = buf->size + size;
+        }
+
+        new_buffer = (uint8_t *)mem_realloc(buf->data, new_capacity);
+        if(!new_buffer) {
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        buf->data = new_buffer;
+        buf->capacity = new_capacity;
+    }
+
+    if(size > 0) {
+        mem_copy(buf->data + buf->size, data, size);
+        buf->size += size;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int discovery_append_u16(struct discovery_buffer_t *buf, uint16_t val)
+{
+    uint16_le tmp_u16 = h2le16(val);
+
+    return discovery_append(buf, &tmp_u16, (int)(unsigned int)sizeof(tmp_u16));
+}
+
+
+
+/* strings have a 16-bit count, the same as in a @tags listing. */
+int discovery_append_string(struct discovery_buffer_t *buf, const uint8_t *str, int str_len)
+{
+    int rc = discovery_append_u16(buf, (uint16_t)(unsigned int)str_len);
+
+    if(rc == PLCTAG_STATUS_OK && str_len > 0) {
+        rc = discovery_append(buf, str, str_len);
+    }
+
+    return rc;
+}
@@ -464,8 +464,12 @@ static int check_read_status(ab_tag_p tag)
         }
 
         /* copy type data into tag. */
-        tag->encoded_type_info_size = (int)(type_end - type_start);
-        mem_copy(tag->encoded_type_info, type_start, tag->encoded_type_info_size);
+        if(tag->encoded_type_info_size == 0) {
+            rc = ab_tag_set_encoded_type_info(tag, type_start, (int)(type_end - type_start));
+            if(rc != PLCTAG_STATUS_OK) {
+                break;
+            }
+        }
 
         /* have the IO thread take care of the request buffers */
         ab_tag_abort(tag);
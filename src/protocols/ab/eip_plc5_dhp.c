@@ -332,6 +332,12 @@ int tag_read_start(ab_tag_p tag)
     /* get ready to add the request to the queue for this session */
     req->request_size = (int)(data - (req->data));
 
+    /* let the session merge this with reads of nearby elements. */
+    ab_tag_mark_pccc_read(tag, req, PCCC_MERGE_PLC5,
+                          (req->data) + sizeof(*pccc) + sizeof(transfer_offset),
+                          (req->data) + sizeof(*pccc) + sizeof(transfer_offset) + sizeof(transfer_size),
+                          (int)sizeof(pccc_dhp_co_resp));
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -597,6 +603,8 @@ static int check_read_status(ab_tag_p tag)
         if(resp->pccc_status != AB_EIP_OK) {
             pdebug(DEBUG_WARN, "PCCC command failed, response code: %d - %s", resp->pccc_status, pccc_decode_error(&resp->pccc_status));
             rc = PLCTAG_ERR_REMOTE_ERR;
+            /* the PLC refused our address, do not merge this tag's reads any more. */
+            tag->pccc_no_merge = 1;
             break;
         }
 
@@ -327,6 +327,9 @@ int tag_read_start(ab_tag_p tag)
     /* get ready to add the request to the queue for this session */
     req->request_size = (int)(data - (req->data));
 
+    /* let the session merge this with reads of nearby elements. */
+    ab_tag_mark_pccc_read(tag, req, PCCC_MERGE_SLC, &pccc->pccc_transfer_size, (uint8_t *)(pccc + 1), (int)sizeof(pccc_dhp_co_resp));
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -532,6 +535,8 @@ static int check_read_status(ab_tag_p tag)
         if(resp->pccc_status != AB_EIP_OK) {
             pdebug(DEBUG_WARN, "PCCC command failed, response code: %d - %s", resp->pccc_status, pccc_decode_error(&resp->pccc_status));
             rc = PLCTAG_ERR_REMOTE_ERR;
+            /* the PLC refused our address, do not merge this tag's reads any more. */
+            tag->pccc_no_merge = 1;
             break;
         }
 
@@ -318,6 +318,9 @@ int tag_read_start(ab_tag_p tag)
     /* set the size of the request */
     req->request_size = (int)(data - (req->data));
 
+    /* let the session merge this with reads of nearby elements. */
+    ab_tag_mark_pccc_read(tag, req, PCCC_MERGE_SLC, &pccc->pccc_transfer_size, (uint8_t *)(pccc + 1), (int)sizeof(pccc_resp));
+
     /* mark it as ready to send */
     //req->send_request = 1;
 
@@ -410,6 +413,8 @@ static int check_read_status(ab_tag_p tag)
         if(pccc->pccc_status != AB_EIP_OK) {
             pdebug(DEBUG_WARN, "PCCC command failed, response code: %d - %s", pccc->pccc_status, pccc_decode_error(&pccc->pccc_status));
             rc = PLCTAG_ERR_REMOTE_ERR;
+            /* the PLC refused our address, do not merge this tag's reads any more. */
+            tag->pccc_no_merge = 1;
             break;
         }
 
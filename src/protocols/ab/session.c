@@ -37,7 +37,12 @@
 #include <ab/defs.h>
 #include <ab/error_codes.h>
 #include <ab/session.h>
+#include <ab/udt_cache.h>
+#include <util/attr.h>
 #include <util/debug.h>
+#include <util/intern.h>
+#include <util/stats.h>
+#include <util/trace.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -96,6 +101,13 @@ static int prepare_request(ab_session_p session);
 static int send_eip_request(ab_session_p session, int timeout);
 static int recv_eip_response(ab_session_p session, int timeout);
 static int unpack_response(ab_session_p session, ab_request_p request, int sub_packet);
+static int pccc_read_elements(ab_request_p request);
+static int merge_pccc_reads_unsafe(ab_session_p session, ab_request_p *requests, int num_requests);
+static int pack_pccc_read(ab_session_p session, ab_request_p *requests, int num_requests, int *merged_size);
+static int pccc_merged_response_ok(ab_session_p session, ab_request_p request, int merged_size);
+static int unpack_pccc_response(ab_session_p session, ab_request_p request, int merged_size);
+static int reissue_pccc_reads(ab_session_p session, ab_request_p *requests, int num_requests);
+static int exchange_packet(ab_session_p session, ab_request_p *requests, int num_requests);
 // static int perform_forward_open(ab_session_p session);
 static int perform_forward_close(ab_session_p session);
 // static int try_forward_open_ex(ab_session_p session, int *max_payload_size_guess);
@@ -110,10 +122,11 @@ static int send_old_forward_open_request(ab_session_p session);
 static int send_extended_forward_open_request(ab_session_p session);
 static int receive_forward_open_response(ab_session_p session);
 static void request_destroy(void *req_arg);
+static void trace_request(ab_request_p req);
 static int session_request_increase_buffer(ab_request_p request, int new_capacity);
 
 
-static volatile mutex_p session_mutex = NULL;
+static lw_mutex_t session_mutex = LW_MUTEX_INIT;
 static volatile vector_p sessions = NULL;
 
 
@@ -123,10 +136,7 @@ int session_startup()
 {
     int rc = PLCTAG_STATUS_OK;
 
-    if((rc = mutex_create((mutex_p *)&session_mutex)) != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to create session mutex %s!", plc_tag_decode_error(rc));
-        return rc;
-    }
+    lw_mutex_init(&session_mutex);
 
     if((sessions = vector_create(25, 5)) == NULL) {
         pdebug(DEBUG_ERROR, "Unable to create session vector!");
@@ -137,17 +147,65 @@ int session_startup()
 }
 
 
+
+/*
+ * reissue_pccc_reads
+ *
+ * The merged read failed.  Send each request as it was built by its tag
+ * and give each one its own response, so that a bad address only fails
+ * the tag that has it.  That tag sees the PCCC error in its own response
+ * and stops marking its reads for merging, see ab_tag_mark_pccc_read().
+ * Requests that are done are released and cleared.
+ */
+
+int reissue_pccc_reads(ab_session_p session, ab_request_p *requests, int num_requests)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Merged PCCC read failed, reading %d tags one at a time.", num_requests);
+
+    for(int i=0; i < num_requests; i++) {
+        debug_set_tag_id(requests[i]->tag_id);
+
+        /* the request buffer still holds the tag's own read. */
+        rc = pack_requests(session, &requests[i], 1);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error while packing request, %s!", plc_tag_decode_error(rc));
+            break;
+        }
+
+        rc = exchange_packet(session, &requests[i], 1);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        rc = unpack_response(session, requests[i], 0);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to unpack response!");
+            break;
+        }
+
+        /* release our reference */
+        requests[i] = rc_dec(requests[i]);
+    }
+
+    debug_set_tag_id(0);
+
+    return rc;
+}
+
+
 void session_teardown()
 {
     pdebug(DEBUG_INFO, "Starting.");
 
-    if(sessions && session_mutex) {
+    if(sessions) {
         pdebug(DEBUG_DETAIL, "Waiting for sessions to terminate.");
 
         while(1) {
             int remaining_sessions = 0;
 
-            critical_block(session_mutex) {
+            critical_block(&session_mutex) {
                 remaining_sessions = vector_length(sessions);
             }
 
@@ -168,10 +226,7 @@ void session_teardown()
 
     pdebug(DEBUG_DETAIL, "Destroying session mutex.");
 
-    if(session_mutex) {
-        mutex_destroy((mutex_p *)&session_mutex);
-        session_mutex = NULL;
-    }
+    lw_mutex_destroy(&session_mutex);
 
     pdebug(DEBUG_INFO, "Done.");
 }
@@ -208,7 +263,7 @@ uint64_t session_get_new_seq_id(ab_session_p sess)
     uint16_t res = 0;
 
     //pdebug(DEBUG_DETAIL, "entering critical block %p",session_mutex);
-    critical_block(sess->mutex) {
+    critical_block(&sess->mutex) {
         res = (uint16_t)session_get_new_seq_id_unsafe(sess);
     }
     //pdebug(DEBUG_DETAIL, "leaving critical block %p", session_mutex);
@@ -227,7 +282,7 @@ int session_get_max_payload(ab_session_p session)
         return 0;
     }
 
-    critical_block(session->mutex) {
+    critical_block(&session->mutex) {
         result = session->max_payload_size;
     }
 
@@ -264,7 +319,7 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
     //     attr_set_int(attribs, "use_connected_msg", 1);
     // }
 
-    critical_block(session_mutex) {
+    critical_block(&session_mutex) {
         /* if we are to share sessions, then look for an existing one. */
         if (shared_session) {
             session = find_session_by_host_unsafe(session_gw, session_path, connection_group_id);
@@ -340,6 +395,8 @@ int add_session_unsafe(ab_session_p session)
 
     session->on_list = 1;
 
+    stats_add(STATS_LIVE_SESSIONS, 1);
+
     pdebug(DEBUG_DETAIL, "Done");
 
     return PLCTAG_STATUS_OK;
@@ -353,7 +410,7 @@ int add_session(ab_session_p s)
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
-    critical_block(session_mutex) {
+    critical_block(&session_mutex) {
         rc = add_session_unsafe(s);
     }
 
@@ -378,6 +435,7 @@ int remove_session_unsafe(ab_session_p session)
 
         if(tmp == session) {
             vector_remove(sessions, i);
+            stats_add(STATS_LIVE_SESSIONS, -1);
             break;
         }
     }
@@ -394,7 +452,7 @@ int remove_session(ab_session_p s)
     pdebug(DEBUG_DETAIL, "Starting.");
 
     if(s->on_list) {
-        critical_block(session_mutex) {
+        critical_block(&session_mutex) {
             rc = remove_session_unsafe(s);
         }
     }
@@ -426,11 +484,12 @@ int session_match_valid(const char *host, const char *path, ab_session_p session
         return 0;
     }
 
-    if(str_cmp_i(host, session->host)) {
+    /* interned strings from the same attributes match by pointer. */
+    if(host != session->host && str_cmp_i(host, session->host)) {
         return 0;
     }
 
-    if(str_cmp_i(path, session->path)) {
+    if(path != session->path && str_cmp_i(path, session->path)) {
         return 0;
     }
 
@@ -474,15 +533,15 @@ ab_session_p session_create_unsafe(const char *host, const char *path, plc_type_
         pdebug(DEBUG_DETAIL, "Session should not use connected messaging.");
     }
 
-    session = (ab_session_p)rc_alloc(sizeof(struct ab_session_t), session_destroy);
+    session = (ab_session_p)rc_alloc(sizeof(struct ab_session_t), session_destroy, MEM_SUB_SESSIONS);
     if (!session) {
         pdebug(DEBUG_WARN, "Error allocating new session.");
         return AB_SESSION_NULL;
     }
 
-    session->host = str_dup(host);
+    session->host = intern_str(host);
     if(!session->host) {
-        pdebug(DEBUG_WARN, "Unable to duplicate host string!");
+        pdebug(DEBUG_WARN, "Unable to intern host string!");
         rc_dec(session);
         return NULL;
     }
@@ -495,9 +554,9 @@ ab_session_p session_create_unsafe(const char *host, const char *path, plc_type_
     }
 
     if(path && str_length(path)) {
-        session->path = str_dup(path);
-        if(path && str_length(path) && !session->path) {
-            pdebug(DEBUG_WARN, "Unable to duplicate path string!");
+        session->path = intern_str(path);
+        if(!session->path) {
+            pdebug(DEBUG_WARN, "Unable to intern path string!");
             rc_dec(session);
             return NULL;
         }
@@ -597,18 +656,15 @@ int session_init(ab_session_p session)
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    /* create the session mutex. */
-    if((rc = mutex_create(&(session->mutex))) != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Unable to create session mutex!");
-        session->failed = 1;
-        return rc;
-    }
+    /* the session mutex and event are embedded, nothing to allocate. */
+    lw_mutex_init(&(session->mutex));
+    lw_event_init(&(session->wait_cond));
 
-    /* create the session condition variable. */
-    if((rc = cond_create(&(session->wait_cond))) != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Unable to create session condition var!");
+    session->symbols = symbol_cache_create(session);
+    if(!session->symbols) {
+        pdebug(DEBUG_WARN, "Unable to create symbol cache!");
         session->failed = 1;
-        return rc;
+        return PLCTAG_ERR_NO_MEM;
     }
 
     if((rc = thread_create((thread_p *)&(session->handler_thread), session_handler, 32*1024, session)) != PLCTAG_STATUS_OK) {
@@ -823,9 +879,7 @@ void session_destroy(void *session_arg)
     session->terminating = 1;
 
     /* signal the condition variable in case it is waiting */
-    if(session->wait_cond) {
-        cond_signal(session->wait_cond);
-    }
+    lw_event_signal(&session->wait_cond);
 
     /* get rid of the handler thread. */
     pdebug(DEBUG_DETAIL, "Destroying session thread.");
@@ -834,7 +888,7 @@ void session_destroy(void *session_arg)
         thread_join(session->handler_thread);
 
         /* FIXME - is this critical block needed? */
-        critical_block(session->mutex) {
+        critical_block(&session->mutex) {
             thread_destroy(&(session->handler_thread));
             session->handler_thread = NULL;
         }
@@ -842,7 +896,7 @@ void session_destroy(void *session_arg)
 
 
     /* this needs to be handled in the mutex to prevent double frees due to queued requests. */
-    critical_block(session->mutex) {
+    critical_block(&session->mutex) {
         /* close off the connection if is one. This helps the PLC clean up. */
         if (session->targ_connection_id) {
             /*
@@ -866,6 +920,8 @@ void session_destroy(void *session_arg)
 
         /* release all the requests that are in the queue. */
         if (session->requests) {
+            stats_add(STATS_QUEUED_REQUESTS, -(int64_t)vector_length(session->requests));
+
             for (int i = 0; i < vector_length(session->requests); i++) {
                 rc_dec(vector_get(session->requests, i));
             }
@@ -875,19 +931,16 @@ void session_destroy(void *session_arg)
         }
     }
 
+    symbol_cache_destroy(session->symbols);
+    session->symbols = NULL;
+
     /* we are done with the condition variable, finally destroy it. */
     pdebug(DEBUG_DETAIL, "Destroying session condition variable.");
-    if(session->wait_cond) {
-        cond_destroy(&(session->wait_cond));
-        session->wait_cond = NULL;
-    }
+    lw_event_destroy(&(session->wait_cond));
 
     /* we are done with the mutex, finally destroy it. */
     pdebug(DEBUG_DETAIL, "Destroying session mutex.");
-    if(session->mutex) {
-        mutex_destroy(&(session->mutex));
-        session->mutex = NULL;
-    }
+    lw_mutex_destroy(&(session->mutex));
 
     pdebug(DEBUG_DETAIL, "Cleaning up allocated memory for paths and host name.");
     if(session->conn_path) {
@@ -895,15 +948,12 @@ void session_destroy(void *session_arg)
         session->conn_path = NULL;
     }
 
-    if(session->path) {
-        mem_free(session->path);
-        session->path = NULL;
-    }
+    /* the host and path strings are interned and shared, give back our references. */
+    intern_release(session->path);
+    session->path = NULL;
 
-    if(session->host) {
-        mem_free(session->host);
-        session->host = NULL;
-    }
+    intern_release(session->host);
+    session->host = NULL;
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -938,9 +988,20 @@ int session_add_request_unsafe(ab_session_p session, ab_request_p req)
 
     /* make sure the request points to the session */
 
+    if(trace_enabled()) {
+        req->time_queued = time_us();
+    }
+
     /* insert into the requests vector */
     vector_put(session->requests, vector_length(session->requests), req);
 
+    stats_add(STATS_QUEUED_REQUESTS, 1);
+    stats_max(STATS_MAX_QUEUE_DEPTH, vector_length(session->requests));
+
+    if(vector_length(session->requests) > session->max_queue_depth) {
+        session->max_queue_depth = vector_length(session->requests);
+    }
+
     pdebug(DEBUG_DETAIL, "Total requests in the queue: %d", vector_length(session->requests));
 
     pdebug(DEBUG_DETAIL, "Done.");
@@ -959,11 +1020,11 @@ int session_add_request(ab_session_p sess, ab_request_p req)
 
     pdebug(DEBUG_INFO, "Starting. sess=%p, req=%p", sess, req);
 
-    critical_block(sess->mutex) {
+    critical_block(&sess->mutex) {
         rc = session_add_request_unsafe(sess, req);
     }
 
-    cond_signal(sess->wait_cond);
+    lw_event_signal(&sess->wait_cond);
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -971,6 +1032,27 @@ int session_add_request(ab_session_p sess, ab_request_p req)
 }
 
 
+/*
+ * session_get_queue_depth
+ *
+ * Get the number of requests queued in this session now and the most
+ * there have ever been.
+ */
+int session_get_queue_depth(ab_session_p session, int *depth, int *max_depth)
+{
+    if(!session || !depth || !max_depth) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(&session->mutex) {
+        *depth = vector_length(session->requests);
+        *max_depth = session->max_queue_depth;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /*
  * session_remove_request_unsafe
  *
@@ -990,6 +1072,7 @@ int session_remove_request_unsafe(ab_session_p session, ab_request_p req)
     for(int i=0; i < vector_length(session->requests); i++) {
         if(vector_get(session->requests, i) == req) {
             vector_remove(session->requests, i);
+            stats_add(STATS_QUEUED_REQUESTS, -1);
             break;
         }
     }
@@ -997,7 +1080,7 @@ int session_remove_request_unsafe(ab_session_p session, ab_request_p req)
     /* release the request refcount */
     rc_dec(req);
 
-    cond_signal(session->wait_cond);
+    lw_event_signal(&session->wait_cond);
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -1043,7 +1126,7 @@ THREAD_FUNC(session_handler)
          */
 
         pdebug(DEBUG_SPEW,"Critical block.");
-        critical_block(session->mutex) {
+        critical_block(&session->mutex) {
             purge_aborted_requests_unsafe(session);
         }
 
@@ -1072,7 +1155,7 @@ THREAD_FUNC(session_handler)
             }
 
             /* in all cases, don't wait. */
-            cond_signal(session->wait_cond);
+            lw_event_signal(&session->wait_cond);
 
             break;
 
@@ -1099,7 +1182,7 @@ THREAD_FUNC(session_handler)
             }
 
             /* in all cases, don't wait. */
-            cond_signal(session->wait_cond);
+            lw_event_signal(&session->wait_cond);
 
             break;
 
@@ -1110,13 +1193,17 @@ THREAD_FUNC(session_handler)
                 pdebug(DEBUG_WARN, "session registration failed %s!", plc_tag_decode_error(rc));
                 state = SESSION_CLOSE_SOCKET;
             } else {
+                /* the PLC program may have changed while we were not connected. */
+                udt_cache_connected(session);
+                symbol_cache_invalidate(session->symbols);
+
                 if(session->use_connected_msg) {
                     state = SESSION_SEND_FORWARD_OPEN;
                 } else {
                     state = SESSION_IDLE;
                 }
             }
-            cond_signal(session->wait_cond);
+            lw_event_signal(&session->wait_cond);
             break;
 
         case SESSION_SEND_FORWARD_OPEN:
@@ -1129,7 +1216,7 @@ THREAD_FUNC(session_handler)
                 pdebug(DEBUG_DETAIL, "Send Forward Open succeeded, going to SESSION_RECEIVE_FORWARD_OPEN state.");
                 state = SESSION_RECEIVE_FORWARD_OPEN;
             }
-            cond_signal(session->wait_cond);
+            lw_event_signal(&session->wait_cond);
             break;
 
         case SESSION_RECEIVE_FORWARD_OPEN:
@@ -1155,14 +1242,14 @@ THREAD_FUNC(session_handler)
                 pdebug(DEBUG_DETAIL, "Send Forward Open succeeded, going to SESSION_IDLE state.");
                 state = SESSION_IDLE;
             }
-            cond_signal(session->wait_cond);
+            lw_event_signal(&session->wait_cond);
             break;
 
         case SESSION_IDLE:
             pdebug(DEBUG_DETAIL, "in SESSION_IDLE state.");
 
             /* if there is work to do, make sure we do not disconnect. */
-            critical_block(session->mutex) {
+            critical_block(&session->mutex) {
                 int num_reqs = vector_length(session->requests);
                 if(num_reqs > 0) {
                     pdebug(DEBUG_DETAIL, "There are %d requests pending before cleanup and sending.", num_reqs);
@@ -1177,7 +1264,7 @@ THREAD_FUNC(session_handler)
                 } else {
                     state = SESSION_UNREGISTER;
                 }
-                cond_signal(session->wait_cond);
+                lw_event_signal(&session->wait_cond);
             }
 
             /* check if we should disconnect */
@@ -1191,15 +1278,15 @@ THREAD_FUNC(session_handler)
                 } else {
                     state = SESSION_UNREGISTER;
                 }
-                cond_signal(session->wait_cond);
+                lw_event_signal(&session->wait_cond);
             }
 
             /* if there is work to do, make sure we signal the condition var. */
-            critical_block(session->mutex) {
+            critical_block(&session->mutex) {
                 int num_reqs = vector_length(session->requests);
                 if(num_reqs > 0) {
                     pdebug(DEBUG_DETAIL, "There are %d requests still pending after abort purge and sending.", num_reqs);
-                    cond_signal(session->wait_cond);
+                    lw_event_signal(&session->wait_cond);
                 }
             }
 
@@ -1213,7 +1300,7 @@ THREAD_FUNC(session_handler)
             }
 
             state = SESSION_UNREGISTER;
-            cond_signal(session->wait_cond);
+            lw_event_signal(&session->wait_cond);
             break;
 
         case SESSION_UNREGISTER:
@@ -1224,7 +1311,7 @@ THREAD_FUNC(session_handler)
             }
 
             state = SESSION_CLOSE_SOCKET;
-            cond_signal(session->wait_cond);
+            lw_event_signal(&session->wait_cond);
             break;
 
         case SESSION_CLOSE_SOCKET:
@@ -1239,7 +1326,7 @@ THREAD_FUNC(session_handler)
             } else {
                 state = SESSION_START_RETRY;
             }
-            cond_signal(session->wait_cond);
+            lw_event_signal(&session->wait_cond);
             break;
 
         case SESSION_START_RETRY:
@@ -1251,7 +1338,7 @@ THREAD_FUNC(session_handler)
             /* start waiting. */
             state = SESSION_WAIT_RETRY;
 
-            cond_signal(session->wait_cond);
+            lw_event_signal(&session->wait_cond);
             break;
 
         case SESSION_WAIT_RETRY:
@@ -1260,7 +1347,9 @@ THREAD_FUNC(session_handler)
             if(timeout_time < time_ms()) {
                 pdebug(DEBUG_DETAIL, "Transitioning to SESSION_OPEN_SOCKET_START.");
                 state = SESSION_OPEN_SOCKET_START;
-                cond_signal(session->wait_cond);
+                stats_add(STATS_RECONNECTS, 1);
+
+                lw_event_signal(&session->wait_cond);
             }
 
             break;
@@ -1273,12 +1362,13 @@ THREAD_FUNC(session_handler)
 
             /* if there is work to do, reconnect.. */
             pdebug(DEBUG_SPEW,"Critical block.");
-            critical_block(session->mutex) {
+            critical_block(&session->mutex) {
                 if(vector_length(session->requests) > 0) {
                     pdebug(DEBUG_DETAIL, "There are requests waiting, reopening connection to PLC.");
 
                     state = SESSION_OPEN_SOCKET_START;
-                    cond_signal(session->wait_cond);
+                    stats_add(STATS_RECONNECTS, 1);
+                    lw_event_signal(&session->wait_cond);
                 }
             }
 
@@ -1296,7 +1386,7 @@ THREAD_FUNC(session_handler)
                 state = SESSION_UNREGISTER;
             }
 
-            cond_signal(session->wait_cond);
+            lw_event_signal(&session->wait_cond);
             break;
         }
 
@@ -1308,7 +1398,7 @@ THREAD_FUNC(session_handler)
             int64_t time_left = wait_until_time - time_ms();
 
             if(time_left > 0) {
-                cond_wait(session->wait_cond, (int)time_left);
+                lw_event_wait(&session->wait_cond, (int)time_left);
             }
         }
     }
@@ -1317,7 +1407,7 @@ THREAD_FUNC(session_handler)
      * One last time before we exit.
      */
     pdebug(DEBUG_DETAIL,"Critical block.");
-    critical_block(session->mutex) {
+    critical_block(&session->mutex) {
         purge_aborted_requests_unsafe(session);
     }
 
@@ -1346,6 +1436,7 @@ int purge_aborted_requests_unsafe(ab_session_p session)
 
             /* remove it from the queue. */
             vector_remove(session->requests, i);
+            stats_add(STATS_QUEUED_REQUESTS, -1);
 
             /* set the debug tag to the owning tag. */
             debug_set_tag_id(request->tag_id);
@@ -1381,6 +1472,8 @@ int process_requests(ab_session_p session)
     ab_request_p bundled_requests[MAX_REQUESTS] = {NULL};
     int num_bundled_requests = 0;
     int remaining_space = 0;
+    int merged_pccc = 0;
+    int merged_pccc_size = 0;
 
     debug_set_tag_id(0);
 
@@ -1397,9 +1490,10 @@ int process_requests(ab_session_p session)
     request = NULL;
     session->data_size = 0;
     session->data_offset = 0;
+    session->data_first_byte_time = 0;
 
     /* grab a request off the front of the list. */
-    critical_block(session->mutex) {
+    critical_block(&session->mutex) {
         /* is there anything to do? */
         if(vector_length(session->requests)) {
             /* get rid of all aborted requests. */
@@ -1428,8 +1522,15 @@ int process_requests(ab_session_p session)
 
                         /* remove it from the queue. */
                         vector_remove(session->requests, 0);
+                        stats_add(STATS_QUEUED_REQUESTS, -1);
                     }
                 } while(vector_length(session->requests) && remaining_space > 0 && num_bundled_requests < MAX_REQUESTS && request->allow_packing);
+
+                /* PCCC reads are never bundled, but reads of nearby elements can be merged. */
+                if(num_bundled_requests == 1 && bundled_requests[0]->pccc_merge != PCCC_MERGE_NONE) {
+                    num_bundled_requests = merge_pccc_reads_unsafe(session, bundled_requests, num_bundled_requests);
+                    merged_pccc = (num_bundled_requests > 1);
+                }
             } else {
                 pdebug(DEBUG_DETAIL, "All requests in queue were aborted, nothing to do.");
             }
@@ -1443,38 +1544,48 @@ int process_requests(ab_session_p session)
 
         pdebug(DEBUG_INFO, "%d requests to process.", num_bundled_requests);
 
+        if(trace_enabled()) {
+            int64_t now = time_us();
+
+            for(int i=0; i < num_bundled_requests; i++) {
+                bundled_requests[i]->time_packed = now;
+            }
+        }
+
         do {
             /* copy and pack the requests into the session buffer. */
-            rc = pack_requests(session, bundled_requests, num_bundled_requests);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
-                break;
+            if(merged_pccc) {
+                rc = pack_pccc_read(session, bundled_requests, num_bundled_requests, &merged_pccc_size);
+            } else {
+                rc = pack_requests(session, bundled_requests, num_bundled_requests);
             }
 
-            /* fill in all the necessary parts to the request. */
-            if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
                 break;
             }
 
-            /* send the request */
-            if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
+            /* send the packet and wait for the response. */
+            rc = exchange_packet(session, bundled_requests, num_bundled_requests);
+            if(rc != PLCTAG_STATUS_OK) {
                 break;
             }
 
-            /* wait for the response */
-            if((rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
+            /*
+             * a merged read fails as a whole if any one of the tags has a bad
+             * address.  Read each tag on its own so that only that tag fails.
+             */
+            if(merged_pccc && !pccc_merged_response_ok(session, bundled_requests[0], merged_pccc_size)) {
+                rc = reissue_pccc_reads(session, bundled_requests, num_bundled_requests);
                 break;
             }
 
             /*
              * check the CIP status, but only if this is a bundled
-             * response.   If it is a singleton, then we pass the
-             * status back to the tag.
+             * response.   If it is a singleton or a merged PCCC read,
+             * then we pass the status back to the tags.
              */
-            if(num_bundled_requests > 1) {
+            if(num_bundled_requests > 1 && !merged_pccc) {
                 if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
                     eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(session->data);
                     pdebug(DEBUG_INFO, "Received unconnected packet with session sequence ID %llx", resp->encap_sender_context);
@@ -1502,7 +1613,12 @@ int process_requests(ab_session_p session)
             for(int i=0; i < num_bundled_requests; i++) {
                 debug_set_tag_id(bundled_requests[i]->tag_id);
 
-                rc = unpack_response(session, bundled_requests[i], i);
+                if(merged_pccc) {
+                    rc = unpack_pccc_response(session, bundled_requests[i], merged_pccc_size);
+                } else {
+                    rc = unpack_response(session, bundled_requests[i], i);
+                }
+
                 if(rc != PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_WARN, "Unable to unpack response!");
                     break;
@@ -1540,6 +1656,54 @@ int process_requests(ab_session_p session)
 }
 
 
+/*
+ * exchange_packet
+ *
+ * Send the packet in the session buffer for the requests and wait for
+ * the response to come back into the same buffer.
+ */
+
+int exchange_packet(ab_session_p session, ab_request_p *requests, int num_requests)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t send_time = 0;
+
+    /* fill in all the necessary parts to the request. */
+    if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* send the request */
+    if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    send_time = time_us();
+    stats_add(STATS_REQUESTS_SENT, num_requests);
+
+    if(trace_enabled()) {
+        int64_t now = send_time;
+
+        for(int i=0; i < num_requests; i++) {
+            requests[i]->time_sent = now;
+            requests[i]->trace_packet_id = (int64_t)session->packet_count;
+        }
+    }
+
+    /* wait for the response */
+    if((rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    stats_record_rtt(time_us() - send_time);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -1565,7 +1729,7 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 
             pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
 
-            critical_block(session->mutex) {
+            critical_block(&session->mutex) {
                 request_capacity = (int)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
             }
 
@@ -1612,7 +1776,7 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 
             pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
 
-            critical_block(session->mutex) {
+            critical_block(&session->mutex) {
                 request_capacity = (int)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
             }
 
@@ -1650,6 +1814,11 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
     pdebug(DEBUG_INFO, "Unpacked packet:");
     pdebug_dump_bytes(DEBUG_INFO, request->data, new_eip_len);
 
+    if(trace_enabled()) {
+        request->time_first_byte = session->data_first_byte_time;
+        request->time_unpacked = time_us();
+    }
+
     /* notify the reading thread that the request is ready */
     spin_block(&request->lock) {
         request->status = PLCTAG_STATUS_OK;
@@ -1663,6 +1832,269 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 }
 
 
+/*
+ * pccc_read_elements
+ *
+ * Number of data file elements covered by a PCCC read.
+ */
+
+int pccc_read_elements(ab_request_p request)
+{
+    int elem_size = request->pccc_addr.element_size_bytes;
+
+    return (request->pccc_size + elem_size - 1) / elem_size;
+}
+
+
+
+/*
+ * merge_pccc_reads_unsafe
+ *
+ * The first request is a PCCC data file read.  Pull queued reads of the
+ * same data file that fit, together with the ones we already have, into a
+ * single typed read of PCCC_MAX_MERGED_READ bytes or less.  Gaps between
+ * the elements are read and thrown away.
+ *
+ * We stop at the first request that is not a mergeable read so that a
+ * read is never moved ahead of a write.
+ *
+ * Returns the new number of requests.  The session mutex must be held.
+ */
+
+int merge_pccc_reads_unsafe(ab_session_p session, ab_request_p *requests, int num_requests)
+{
+    ab_request_p first = requests[0];
+    int elem_size = first->pccc_addr.element_size_bytes;
+    int first_elem = first->pccc_addr.element;
+    int end_elem = first_elem + pccc_read_elements(first);
+    int max_size = PCCC_MAX_MERGED_READ;
+    int index = 0;
+
+    /* the whole response, headers included, must fit in one packet. */
+    if(max_size > (int)session->max_payload_size - first->pccc_resp_offset) {
+        max_size = (int)session->max_payload_size - first->pccc_resp_offset;
+    }
+
+    while(index < vector_length(session->requests) && num_requests < MAX_REQUESTS) {
+        ab_request_p request = vector_get(session->requests, index);
+        int new_first_elem = first_elem;
+        int new_end_elem = end_elem;
+
+        if(request->pccc_merge == PCCC_MERGE_NONE) {
+            break;
+        }
+
+        if(request->pccc_addr.element < new_first_elem) {
+            new_first_elem = request->pccc_addr.element;
+        }
+
+        if(request->pccc_addr.element + pccc_read_elements(request) > new_end_elem) {
+            new_end_elem = request->pccc_addr.element + pccc_read_elements(request);
+        }
+
+        if(request->pccc_merge != first->pccc_merge
+           || request->pccc_addr.file != first->pccc_addr.file
+           || request->pccc_addr.file_type != first->pccc_addr.file_type
+           || request->pccc_addr.element_size_bytes != elem_size
+           || (new_end_elem - new_first_elem) * elem_size > max_size) {
+            index++;
+            continue;
+        }
+
+        requests[num_requests] = request;
+        num_requests++;
+
+        vector_remove(session->requests, index);
+        stats_add(STATS_QUEUED_REQUESTS, -1);
+
+        first_elem = new_first_elem;
+        end_elem = new_end_elem;
+    }
+
+    if(num_requests > 1) {
+        pdebug(DEBUG_DETAIL, "Merged %d PCCC reads of file %d covering elements %d to %d.", num_requests, first->pccc_addr.file, first_elem, end_elem - 1);
+
+        for(int i=0; i < num_requests; i++) {
+            requests[i]->pccc_merge_offset = (requests[i]->pccc_addr.element - first_elem) * elem_size;
+        }
+
+        stats_add(STATS_PCCC_MERGED_READS, num_requests - 1);
+    }
+
+    return num_requests;
+}
+
+
+
+/*
+ * pack_pccc_read
+ *
+ * Copy the first request of a merged PCCC read into the session buffer
+ * and rewrite its address and transfer size to cover all the requests.
+ */
+
+int pack_pccc_read(ab_session_p session, ab_request_p *requests, int num_requests, int *merged_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p first = requests[0];
+    pccc_addr_t address = first->pccc_addr;
+    eip_encap *encap = (eip_encap *)(session->data);
+    uint8_t *addr_field = session->data + first->pccc_addr_offset;
+    int addr_size = 0;
+    int old_size = 0;
+    int new_size = 0;
+    int first_elem = first->pccc_addr.element;
+    int end_elem = first->pccc_addr.element + pccc_read_elements(first);
+    uint16_le word_count = h2le16(0);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = pack_requests(session, requests, 1);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    for(int i=1; i < num_requests; i++) {
+        if(requests[i]->pccc_addr.element < first_elem) {
+            first_elem = requests[i]->pccc_addr.element;
+        }
+
+        if(requests[i]->pccc_addr.element + pccc_read_elements(requests[i]) > end_elem) {
+            end_elem = requests[i]->pccc_addr.element + pccc_read_elements(requests[i]);
+        }
+    }
+
+    *merged_size = (end_elem - first_elem) * address.element_size_bytes;
+    address.element = first_elem;
+    old_size = (int)session->data_size;
+
+    if(first->pccc_merge == PCCC_MERGE_SLC) {
+        rc = slc_encode_address(addr_field, &addr_size, MAX_PACKET_SIZE_EX - first->pccc_addr_offset, &address);
+
+        /* SLC typed reads take the size in bytes. */
+        session->data[first->pccc_size_offset] = (uint8_t)(*merged_size);
+
+        new_size = first->pccc_addr_offset + addr_size;
+    } else {
+        rc = plc5_encode_address(addr_field, &addr_size, MAX_PACKET_SIZE_EX - first->pccc_addr_offset, &address);
+
+        /* PLC/5 range reads take the total size in words and the packet size in bytes. */
+        word_count = h2le16((uint16_t)(*merged_size / 2));
+        mem_copy(session->data + first->pccc_size_offset, &word_count, (int)(unsigned int)sizeof(word_count));
+        addr_field[addr_size] = (uint8_t)(*merged_size);
+
+        new_size = first->pccc_addr_offset + addr_size + 1;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to encode merged PCCC address, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* stitch up the CPF item length. */
+    if(le2h16(encap->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+        eip_cip_uc_req *uc_req = (eip_cip_uc_req *)(session->data);
+
+        uc_req->cpf_udi_item_length = h2le16((uint16_t)(le2h16(uc_req->cpf_udi_item_length) + new_size - old_size));
+    } else {
+        eip_cip_co_req *co_req = (eip_cip_co_req *)(session->data);
+
+        co_req->cpf_cdi_item_length = h2le16((uint16_t)(le2h16(co_req->cpf_cdi_item_length) + new_size - old_size));
+    }
+
+    session->data_size = (uint32_t)new_size;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * pccc_merged_response_ok
+ *
+ * A merged PCCC read worked if the response carries all the data asked
+ * for.  Errors come back with a status and no data.
+ */
+
+int pccc_merged_response_ok(ab_session_p session, ab_request_p request, int merged_size)
+{
+    eip_encap *encap = (eip_encap *)(session->data);
+    int resp_end = (int)le2h16(encap->encap_length) + (int)sizeof(eip_encap);
+
+    if(resp_end > (int)session->data_size || (resp_end - request->pccc_resp_offset) != merged_size) {
+        pdebug(DEBUG_DETAIL, "Merged PCCC read did not return %d bytes of data.", merged_size);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+/*
+ * unpack_pccc_response
+ *
+ * Give a request its part of a merged PCCC read response as if it had
+ * been read on its own.  The response has been checked with
+ * pccc_merged_response_ok().
+ */
+
+int unpack_pccc_response(ab_session_p session, ab_request_p request, int merged_size)
+{
+    eip_encap *encap = (eip_encap *)(session->data);
+    int new_size = request->pccc_resp_offset + request->pccc_size;
+    int extra = merged_size - request->pccc_size;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(new_size > request->request_capacity) {
+        pdebug(DEBUG_WARN, "Request buffer of %d bytes is too small for %d byte response!", request->request_capacity, new_size);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    mem_set(request->data, 0, request->request_capacity);
+
+    /* copy the response header and then our slice of the data. */
+    mem_copy(request->data, session->data, request->pccc_resp_offset);
+    mem_copy(request->data + request->pccc_resp_offset, session->data + request->pccc_resp_offset + request->pccc_merge_offset, request->pccc_size);
+
+    /* stitch up the packet sizes. */
+    encap = (eip_encap *)(request->data);
+    encap->encap_length = h2le16((uint16_t)(new_size - (int)sizeof(eip_encap)));
+
+    if(le2h16(encap->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+        eip_cip_uc_resp *uc_resp = (eip_cip_uc_resp *)(request->data);
+
+        uc_resp->cpf_udi_item_length = h2le16((uint16_t)(le2h16(uc_resp->cpf_udi_item_length) - extra));
+    } else {
+        eip_cip_co_resp *co_resp = (eip_cip_co_resp *)(request->data);
+
+        co_resp->cpf_cdi_item_length = h2le16((uint16_t)(le2h16(co_resp->cpf_cdi_item_length) - extra));
+    }
+
+    pdebug(DEBUG_INFO, "Unpacked merged PCCC packet:");
+    pdebug_dump_bytes(DEBUG_INFO, request->data, new_size);
+
+    if(trace_enabled()) {
+        request->time_first_byte = session->data_first_byte_time;
+        request->time_unpacked = time_us();
+    }
+
+    /* notify the reading thread that the request is ready */
+    spin_block(&request->lock) {
+        request->status = PLCTAG_STATUS_OK;
+        request->request_size = new_size;
+        request->resp_received = 1;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 
 int get_payload_size(ab_request_p request)
 {
@@ -1923,6 +2355,9 @@ int send_eip_request(ab_session_p session, int timeout)
         return PLCTAG_ERR_TIMEOUT;
     }
 
+    stats_add(STATS_PACKETS_SENT, 1);
+    stats_add(STATS_BYTES_SENT, session->data_offset);
+
     pdebug(DEBUG_INFO, "Done.");
 
     return PLCTAG_STATUS_OK;
@@ -1959,6 +2394,7 @@ int recv_eip_response(ab_session_p session, int timeout)
 
     session->data_offset = 0;
     session->data_size = 0;
+    session->data_first_byte_time = 0;
     data_needed = sizeof(eip_encap);
 
     do {
@@ -1968,6 +2404,10 @@ int recv_eip_response(ab_session_p session, int timeout)
                          SOCKET_WAIT_TIMEOUT_MS);
 
         if(rc >= 0) {
+            if(rc > 0 && session->data_offset == 0 && trace_enabled()) {
+                session->data_first_byte_time = time_us();
+            }
+
             session->data_offset += (uint32_t)rc;
 
             /*pdebug_dump_bytes(session->debug, session->data, session->data_offset);*/
@@ -2012,6 +2452,9 @@ int recv_eip_response(ab_session_p session, int timeout)
     session->resp_seq_id = le2h64(((eip_encap *)(session->data))->encap_sender_context);
     session->data_size = data_needed;
 
+    stats_add(STATS_PACKETS_RECEIVED, 1);
+    stats_add(STATS_BYTES_RECEIVED, data_needed);
+
     rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "request received all needed data (%d bytes of %d).", session->data_offset, data_needed);
@@ -2510,7 +2953,7 @@ int session_create_request(ab_session_p session, int tag_id, ab_request_p *req)
     size_t request_capacity = 0;
     uint8_t *buffer = NULL;
 
-    critical_block(session->mutex) {
+    critical_block(&session->mutex) {
         request_capacity = (size_t)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
     }
 
@@ -2523,7 +2966,7 @@ int session_create_request(ab_session_p session, int tag_id, ab_request_p *req)
         return PLCTAG_ERR_NO_MEM;
     }
 
-    res = (ab_request_p)rc_alloc((int)sizeof(struct ab_request_t), request_destroy);
+    res = (ab_request_p)rc_alloc((int)sizeof(struct ab_request_t), request_destroy, MEM_SUB_REQUESTS);
     if (!res) {
         mem_free(buffer);
         *req = NULL;
@@ -2534,6 +2977,8 @@ int session_create_request(ab_session_p session, int tag_id, ab_request_p *req)
         res->request_capacity = (int)request_capacity;
         res->lock = LOCK_INIT;
 
+        rc_track_extra(res, res->request_capacity);
+
         *req = res;
     }
 
@@ -2560,6 +3005,10 @@ void request_destroy(void *req_arg)
 
     req->abort_request = 1;
 
+    if(trace_enabled()) {
+        trace_request(req);
+    }
+
     if(req->data) {
         mem_free(req->data);
         req->data = NULL;
@@ -2569,10 +3018,34 @@ void request_destroy(void *req_arg)
 }
 
 
+/*
+ * trace_request
+ *
+ * Emit the lifecycle spans for a finished request.  The request is done
+ * from the tag's point of view when the tag drops its last reference, so
+ * that is the completion time.  Stages that were never reached, such as
+ * for aborted requests, have no time stamp and are skipped.
+ */
+
+void trace_request(ab_request_p req)
+{
+    int64_t now = time_us();
+    int64_t id = req->trace_packet_id;
+
+    trace_span("request", "request", req->tag_id, id, req->time_queued, now);
+    trace_span("queued", "request", req->tag_id, id, req->time_queued, req->time_packed);
+    trace_span("pack and send", "request", req->tag_id, id, req->time_packed, req->time_sent);
+    trace_span("wait for response", "request", req->tag_id, id, req->time_sent, req->time_first_byte);
+    trace_span("receive and unpack", "request", req->tag_id, id, req->time_first_byte, req->time_unpacked);
+    trace_span("tag completion", "request", req->tag_id, id, req->time_unpacked, now);
+}
+
+
 int session_request_increase_buffer(ab_request_p request, int new_capacity)
 {
     uint8_t *old_buffer = NULL;
     uint8_t *new_buffer = NULL;
+    int old_capacity = 0;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
@@ -2584,12 +3057,15 @@ int session_request_increase_buffer(ab_request_p request, int new_capacity)
 
     spin_block(&request->lock) {
         old_buffer = request->data;
+        old_capacity = request->request_capacity;
         request->request_capacity = new_capacity;
         request->data = new_buffer;
     }
 
     mem_free(old_buffer);
 
+    rc_track_extra(request, new_capacity - old_capacity);
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return PLCTAG_STATUS_OK;
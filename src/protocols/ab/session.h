@@ -36,6 +36,8 @@
 
 #include <ab/ab_common.h>
 #include <ab/defs.h>
+#include <ab/pccc.h>
+#include <ab/symbol_cache.h>
 #include <util/rc.h>
 #include <util/vector.h>
 
@@ -48,6 +50,17 @@
 #define SESSION_MIN_REQUESTS    (10)
 #define SESSION_INC_REQUESTS    (10)
 
+/* room for the vendor:product:serial identity of the controller. */
+#define SESSION_IDENTITY_SIZE   (24)
+
+/* kinds of PCCC data file reads that can be merged, see merge_pccc_reads_unsafe(). */
+#define PCCC_MERGE_NONE     (0)
+#define PCCC_MERGE_SLC      (1)
+#define PCCC_MERGE_PLC5     (2)
+
+/* largest merged PCCC read in bytes, further limited by the session packet size. */
+#define PCCC_MAX_MERGED_READ    (236)
+
 
 struct ab_session_t {
 //    int status;
@@ -55,9 +68,9 @@ struct ab_session_t {
     int on_list;
 
     /* gateway connection related info */
-    char *host;
+    const char *host; /* interned, see intern_str() */
     int port;
-    char *path;
+    const char *path; /* interned */
     sock_p sock;
 
     /* connection variables. */
@@ -87,20 +100,30 @@ struct ab_session_t {
 
     /* list of outstanding requests for this session */
     vector_p requests;
+    int max_queue_depth;
 
     /* data for receiving messages */
     uint64_t resp_seq_id;
     uint32_t data_offset;
     uint32_t data_capacity;
     uint32_t data_size;
+    int64_t data_first_byte_time; /* for tracing, 0 when not tracing. */
     uint8_t data[MAX_PACKET_SIZE_EX];
 
     uint64_t packet_count;
 
     thread_p handler_thread;
     volatile int terminating;
-    mutex_p mutex;
-    cond_p wait_cond;
+    lw_mutex_t mutex;
+    lw_event_t wait_cond;
+
+    /* symbol instance IDs for tags using instance addressing. */
+    symbol_cache_p symbols;
+
+    /* the controller this connection reaches, see udt_cache.c. */
+    uint32_t udt_connect_serial;
+    int udt_identity_state;
+    char udt_identity[SESSION_IDENTITY_SIZE];
 
     /* disconnect handling */
     int auto_disconnect_enabled;
@@ -125,8 +148,26 @@ struct ab_request_t {
     int allow_packing;
     int packing_num;
 
-    /* time stamp for debugging output */
+    /*
+     * PCCC data file reads can be merged with queued reads of nearby
+     * elements in the same file.   The tag fills these in when it
+     * builds the request.  The offsets are into data.
+     */
+    int pccc_merge;             /* PCCC_MERGE_NONE, _SLC or _PLC5 */
+    pccc_addr_t pccc_addr;
+    int pccc_size;              /* bytes of data read */
+    int pccc_size_offset;       /* transfer size field, bytes for SLC, words for PLC/5 */
+    int pccc_addr_offset;       /* encoded address, PLC/5 adds a byte count after it */
+    int pccc_resp_offset;       /* start of the data in the response */
+    int pccc_merge_offset;      /* start of our data in the merged response */
+
+    /* lifecycle time stamps in microseconds, only filled in when tracing. */
+    int64_t time_queued;
+    int64_t time_packed;
     int64_t time_sent;
+    int64_t time_first_byte;
+    int64_t time_unpacked;
+    int64_t trace_packet_id;
 
     /* used by the background thread for incrementally getting data */
     int request_size; /* total bytes, not just data */
@@ -146,5 +187,6 @@ extern int session_find_or_create(ab_session_p *session, attr attribs);
 extern int session_get_max_payload(ab_session_p session);
 extern int session_create_request(ab_session_p session, int tag_id, ab_request_p *request);
 extern int session_add_request(ab_session_p sess, ab_request_p req);
+extern int session_get_queue_depth(ab_session_p session, int *depth, int *max_depth);
 
 #endif
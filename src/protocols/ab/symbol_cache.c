@@ -0,0 +1,1086 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <ctype.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <ab/defs.h>
+#include <ab/ab_common.h>
+#include <ab/error_codes.h>
+#include <ab/session.h>
+#include <ab/symbol_cache.h>
+#include <ab/tag.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/hash.h>
+#include <util/hashtable.h>
+#include <util/intern.h>
+#include <util/rc.h>
+
+
+/*
+ * Symbol instance addressing
+ *
+ * Every Logix read normally carries the full symbolic segment of the tag
+ * name.  The controller also numbers its symbols as instances of the
+ * symbol class (0x6B), so "Program:Line3.Station12.Motor.Speed" can be
+ * sent as the program segment, a short class/instance logical segment for
+ * "Station12", and the remaining member segments.  That lets the session
+ * pack more reads into each packet.
+ *
+ * The instance IDs come from the same 0x55 listing service the @tags
+ * listing uses.  The first opted-in tag that needs a scope (the controller
+ * or one program) walks the listing for that scope and fills the session
+ * cache.  Other tags in that scope wait for it and then look their names
+ * up.
+ *
+ * Only reads are addressed by instance.  Writes always use the name so a
+ * stale instance ID can never write into the wrong tag.  A read of an
+ * instance that no longer exists or that returns a different type than the
+ * name did means the controller program was changed.  The tag then goes
+ * back to its name, the whole cache is dropped and all tags resolve again
+ * against a fresh listing.
+ *
+ * A download can also reuse an instance ID for another tag of the same
+ * type, which no read can detect.  So the cache is dropped every time the
+ * session reconnects and once it is older than symbol_verify_ms (30
+ * seconds by default, 0 turns this off).  The tag with the shortest period
+ * decides for the whole session.  A read by instance that was queued or in
+ * flight while the cache was dropped is thrown away and read again by
+ * name.
+ */
+
+
+/* tag side states. */
+#define SYMBOL_TAG_UNRESOLVED   (0)
+#define SYMBOL_TAG_LOADING      (1)
+#define SYMBOL_TAG_RESOLVED     (2)
+#define SYMBOL_TAG_SYMBOLIC     (3)
+
+/* cache scope states. */
+#define SYMBOL_SCOPE_LOADING    (0)
+#define SYMBOL_SCOPE_LOADED     (1)
+#define SYMBOL_SCOPE_FAILED     (2)
+
+/* results of a lookup. */
+#define SYMBOL_LOOKUP_FOUND     (0)
+#define SYMBOL_LOOKUP_MISSING   (1)
+#define SYMBOL_LOOKUP_WAIT      (2)
+#define SYMBOL_LOOKUP_LOAD      (3)
+
+#define SYMBOL_CACHE_INITIAL_SIZE   (64)
+#define SYMBOL_MAX_NAME             (255)
+#define SYMBOL_MAX_FALLBACKS        (3)
+#define SYMBOL_DEFAULT_VERIFY_MS    (30000)
+
+#define SYMBOL_CLASS                ((uint8_t)0x6B)
+#define SYMBOL_ATTR_NAME            ((uint16_t)0x01)
+
+struct symbol_entry_t {
+    struct symbol_entry_t *next;
+    uint32_t instance;
+    int name_len;
+    char name[]; /* lower case, zero terminated. */
+};
+
+struct symbol_scope_t {
+    struct symbol_scope_t *next;
+    int state;
+    int32_t loader_tag_id;
+    hashtable_p symbols;
+    int scope_size;
+    uint8_t scope[]; /* encoded program segment, empty for the controller. */
+};
+
+struct symbol_cache_t {
+    lw_mutex_t mutex;
+    void *owner; /* the session, entry memory is counted against it. */
+    uint32_t generation;
+    int64_t load_time; /* when the oldest loaded scope was listed, zero if none. */
+    struct symbol_scope_t *scopes;
+};
+
+
+static int split_encoded_name(ab_tag_p tag, int *scope_size, int *symbol_start, int *symbol_size);
+static int fold_name(const uint8_t *name, int name_len, char *folded);
+static int64_t name_key(const char *folded, int name_len);
+static int encode_instance_segment(uint8_t *data, uint32_t instance);
+static struct symbol_scope_t *find_scope_unsafe(symbol_cache_p cache, const uint8_t *scope, int scope_size);
+static int add_entry_unsafe(struct symbol_scope_t *scope, const uint8_t *name, int name_len, uint32_t instance);
+static int free_entries(hashtable_p table, int64_t key, void *data, void *context);
+static int free_scopes_unsafe(symbol_cache_p cache);
+static int lookup(ab_tag_p tag, uint32_t *instance);
+static int resolve(ab_tag_p tag);
+static int use_instance(ab_tag_p tag, uint32_t instance);
+static void use_name(ab_tag_p tag);
+static int build_list_request(ab_tag_p tag);
+static int check_list_response(ab_tag_p tag);
+static void finish_load(ab_tag_p tag, int scope_state);
+
+
+
+/*************************************************************************
+ ***************************** Cache Functions ***************************
+ ************************************************************************/
+
+
+symbol_cache_p symbol_cache_create(void *owner)
+{
+    symbol_cache_p cache = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    cache = (symbol_cache_p)mem_alloc((int)sizeof(*cache));
+    if(!cache) {
+        pdebug(DEBUG_WARN, "Unable to allocate symbol cache!");
+        return NULL;
+    }
+
+    lw_mutex_init(&(cache->mutex));
+    cache->owner = owner;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return cache;
+}
+
+
+
+void symbol_cache_destroy(symbol_cache_p cache)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!cache) {
+        pdebug(DEBUG_DETAIL, "No cache to destroy.");
+        return;
+    }
+
+    free_scopes_unsafe(cache);
+
+    lw_mutex_destroy(&(cache->mutex));
+
+    mem_free(cache);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/*
+ * symbol_cache_invalidate
+ *
+ * Drop every scope and bump the generation so that all tags using
+ * instance addressing go back to their names and resolve again.
+ */
+
+void symbol_cache_invalidate(symbol_cache_p cache)
+{
+    int freed = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!cache) {
+        return;
+    }
+
+    critical_block(&(cache->mutex)) {
+        freed = free_scopes_unsafe(cache);
+        cache->generation++;
+        cache->load_time = 0;
+    }
+
+    rc_track_extra(cache->owner, -freed);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/*************************************************************************
+ ****************************** Tag Functions ****************************
+ ************************************************************************/
+
+
+/*
+ * symbol_instance_setup
+ *
+ * Called when a tag is created.  Only connected Logix tags can use
+ * instance addressing.
+ */
+
+int symbol_instance_setup(ab_tag_p tag, attr attribs)
+{
+    tag->use_symbol_instance = attr_get_int(attribs, "use_symbol_instance", 0);
+
+    if(!tag->use_symbol_instance) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    tag->symbol_verify_ms = attr_get_int(attribs, "symbol_verify_ms", SYMBOL_DEFAULT_VERIFY_MS);
+    if(tag->symbol_verify_ms < 0) {
+        pdebug(DEBUG_WARN, "symbol_verify_ms must not be negative, was %d.", tag->symbol_verify_ms);
+        tag->symbol_verify_ms = SYMBOL_DEFAULT_VERIFY_MS;
+    }
+
+    if(tag->plc_type != AB_PLC_LGX || !tag->use_connected_msg || tag->special_tag) {
+        pdebug(DEBUG_WARN, "Symbol instance addressing needs a connected Logix tag, using the tag name.");
+        tag->use_symbol_instance = 0;
+        return PLCTAG_STATUS_OK;
+    }
+
+    tag->symbol_state = SYMBOL_TAG_UNRESOLVED;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * symbol_instance_tickler
+ *
+ * Called from the tag tickler.  Drives the listing when this tag is
+ * loading a scope and switches the tag between instance and name
+ * addressing while no read or write is using the current one.
+ */
+
+int symbol_instance_tickler(ab_tag_p tag)
+{
+    symbol_cache_p cache = NULL;
+    uint32_t generation = 0;
+    int64_t load_time = 0;
+
+    if(!tag->use_symbol_instance || !tag->session || !(cache = tag->session->symbols)) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(tag->symbol_state == SYMBOL_TAG_LOADING) {
+        return check_list_response(tag);
+    }
+
+    /* wait until the name has been read once, we need the type to check against. */
+    if(tag->read_in_progress || tag->write_in_progress || tag->encoded_type_info_size == 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    critical_block(&(cache->mutex)) {
+        generation = cache->generation;
+        load_time = cache->load_time;
+    }
+
+    /* the listing is old, check it against the controller again. */
+    if(tag->symbol_verify_ms > 0 && load_time > 0 && load_time + tag->symbol_verify_ms < time_ms()) {
+        pdebug(DEBUG_DETAIL, "Symbol cache is more than %dms old, listing again.", tag->symbol_verify_ms);
+        symbol_cache_invalidate(cache);
+
+        critical_block(&(cache->mutex)) {
+            generation = cache->generation;
+        }
+    }
+
+    if(tag->symbol_state != SYMBOL_TAG_UNRESOLVED && tag->symbol_generation != generation) {
+        pdebug(DEBUG_DETAIL, "Symbol cache was invalidated, resolving tag %d again.", tag->tag_id);
+        use_name(tag);
+        tag->symbol_state = SYMBOL_TAG_UNRESOLVED;
+    }
+
+    if(tag->symbol_state == SYMBOL_TAG_UNRESOLVED) {
+        return resolve(tag);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * symbol_instance_fallback
+ *
+ * Called by the read status checks with the CIP status of the response
+ * and, when it succeeded, the type information.  Returns non-zero if the
+ * tag was reading by instance and the response shows the instance is
+ * stale or the cache was dropped since the tag resolved.  The tag is then
+ * back on its name and the caller should restart the read.
+ */
+
+int symbol_instance_fallback(ab_tag_p tag, uint8_t cip_status, const uint8_t *type_info, int type_info_size)
+{
+    symbol_cache_p cache = tag->session->symbols;
+    uint32_t generation = 0;
+    int stale = 0;
+
+    if(!tag->encoded_instance_name) {
+        return 0;
+    }
+
+    critical_block(&(cache->mutex)) {
+        generation = cache->generation;
+    }
+
+    /*
+     * the request was built before the cache was dropped, for instance
+     * while the session reconnected.  The instance may belong to another
+     * tag of the same type by now.
+     */
+    if(tag->symbol_generation != generation) {
+        pdebug(DEBUG_DETAIL, "Symbol cache was dropped while tag %d read by instance, reading by name.", tag->tag_id);
+        use_name(tag);
+        tag->symbol_state = SYMBOL_TAG_UNRESOLVED;
+        return 1;
+    }
+
+    if(cip_status == AB_CIP_ERR_PATH_SEGMENT || cip_status == AB_CIP_ERR_PATH_DEST_UNKNOWN) {
+        pdebug(DEBUG_WARN, "Symbol instance %u of tag %d no longer exists.", (unsigned int)tag->symbol_instance, tag->tag_id);
+        stale = 1;
+    } else if(cip_status == AB_CIP_STATUS_OK && type_info && mem_cmp(type_info, type_info_size, tag->encoded_type_info, tag->encoded_type_info_size)) {
+        pdebug(DEBUG_WARN, "Symbol instance %u of tag %d has a different type.", (unsigned int)tag->symbol_instance, tag->tag_id);
+        stale = 1;
+    }
+
+    if(!stale) {
+        return 0;
+    }
+
+    use_name(tag);
+
+    tag->symbol_fallbacks++;
+    if(tag->symbol_fallbacks >= SYMBOL_MAX_FALLBACKS) {
+        pdebug(DEBUG_WARN, "Tag %d fell back too often, it will always use its name.", tag->tag_id);
+        tag->use_symbol_instance = 0;
+    } else {
+        tag->symbol_state = SYMBOL_TAG_UNRESOLVED;
+    }
+
+    /* the program changed, so every cached instance is suspect. */
+    symbol_cache_invalidate(tag->session->symbols);
+
+    return 1;
+}
+
+
+
+/*
+ * symbol_instance_release
+ *
+ * Called when the tag is destroyed.  A listing this tag was driving is
+ * dropped so that another tag can start it again.
+ */
+
+void symbol_instance_release(ab_tag_p tag)
+{
+    if(tag->symbol_req) {
+        spin_block(&tag->symbol_req->lock) {
+            tag->symbol_req->abort_request = 1;
+        }
+
+        tag->symbol_req = rc_dec(tag->symbol_req);
+    }
+
+    if(tag->symbol_state == SYMBOL_TAG_LOADING) {
+        finish_load(tag, -1);
+    }
+
+    use_name(tag);
+}
+
+
+
+/*************************************************************************
+ **************************** Helper Functions ***************************
+ ************************************************************************/
+
+
+/*
+ * split_encoded_name
+ *
+ * Find the scope and symbol segments at the start of the encoded name.
+ * Program scoped names start with a "Program:<name>" segment that stays
+ * symbolic.  Offsets are into the encoded name, after the word count.
+ */
+
+int split_encoded_name(ab_tag_p tag, int *scope_size, int *symbol_start, int *symbol_size)
+{
+    const uint8_t *name = tag->encoded_name;
+    int index = 1;
+    int seg_len = 0;
+
+    if(!name || tag->encoded_name_size < 4 || name[index] != 0x91) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    seg_len = name[index + 1];
+
+    *scope_size = 0;
+
+    if(seg_len > 8 && str_cmp_i_n((const char *)&name[index + 2], "program:", 8) == 0) {
+        *scope_size = 2 + seg_len + (seg_len & 0x01);
+        index += *scope_size;
+
+        if(index + 2 > tag->encoded_name_size || name[index] != 0x91) {
+            return PLCTAG_ERR_UNSUPPORTED;
+        }
+
+        seg_len = name[index + 1];
+    }
+
+    *symbol_start = index;
+    *symbol_size = 2 + seg_len + (seg_len & 0x01);
+
+    if(index + *symbol_size > tag->encoded_name_size) {
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int fold_name(const uint8_t *name, int name_len, char *folded)
+{
+    if(name_len <= 0 || name_len > SYMBOL_MAX_NAME) {
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    for(int i=0; i < name_len; i++) {
+        folded[i] = (char)tolower((int)name[i]);
+    }
+
+    folded[name_len] = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int64_t name_key(const char *folded, int name_len)
+{
+    uint32_t high = hash((uint8_t *)folded, (size_t)(unsigned int)name_len, SYMBOL_CLASS);
+    uint32_t low = hash((uint8_t *)folded, (size_t)(unsigned int)name_len, 0x91);
+
+    return (int64_t)(((uint64_t)high << 32) | (uint64_t)low);
+}
+
+
+
+/* use the smallest logical segment that holds the instance. */
+int encode_instance_segment(uint8_t *data, uint32_t instance)
+{
+    if(instance <= 0xFF) {
+        data[0] = 0x24;
+        data[1] = (uint8_t)instance;
+        return 2;
+    } else if(instance <= 0xFFFF) {
+        data[0] = 0x25;
+        data[1] = 0x00;
+        data[2] = (uint8_t)(instance & 0xFF);
+        data[3] = (uint8_t)((instance >> 8) & 0xFF);
+        return 4;
+    } else {
+        data[0] = 0x26;
+        data[1] = 0x00;
+        data[2] = (uint8_t)(instance & 0xFF);
+        data[3] = (uint8_t)((instance >> 8) & 0xFF);
+        data[4] = (uint8_t)((instance >> 16) & 0xFF);
+        data[5] = (uint8_t)((instance >> 24) & 0xFF);
+        return 6;
+    }
+}
+
+
+
+struct symbol_scope_t *find_scope_unsafe(symbol_cache_p cache, const uint8_t *scope, int scope_size)
+{
+    struct symbol_scope_t *entry = cache->scopes;
+
+    while(entry && mem_cmp(entry->scope, entry->scope_size, scope, scope_size)) {
+        entry = entry->next;
+    }
+
+    return entry;
+}
+
+
+
+/* returns the number of bytes used or an error. */
+int add_entry_unsafe(struct symbol_scope_t *scope, const uint8_t *name, int name_len, uint32_t instance)
+{
+    struct symbol_entry_t *entry = NULL;
+    struct symbol_entry_t *head = NULL;
+    int entry_size = (int)sizeof(*entry) + name_len + 1;
+    int64_t key = 0;
+
+    if(name_len <= 0 || name_len > SYMBOL_MAX_NAME) {
+        pdebug(DEBUG_DETAIL, "Skipping symbol with name length %d.", name_len);
+        return 0;
+    }
+
+    entry = (struct symbol_entry_t *)mem_alloc(entry_size);
+    if(!entry) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    fold_name(name, name_len, entry->name);
+    entry->name_len = name_len;
+    entry->instance = instance;
+
+    key = name_key(entry->name, name_len);
+
+    /* a full key collision is chained behind the entry in the table. */
+    head = (struct symbol_entry_t *)hashtable_get(scope->symbols, key);
+    if(head) {
+        entry->next = head->next;
+        head->next = entry;
+    } else if(hashtable_put(scope->symbols, key, entry) != PLCTAG_STATUS_OK) {
+        mem_free(entry);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    return entry_size;
+}
+
+
+
+int free_entries(hashtable_p table, int64_t key, void *data, void *context)
+{
+    struct symbol_entry_t *entry = (struct symbol_entry_t *)data;
+    int *freed = (int *)context;
+
+    (void)table;
+    (void)key;
+
+    while(entry) {
+        struct symbol_entry_t *next = entry->next;
+
+        *freed += (int)sizeof(*entry) + entry->name_len + 1;
+        mem_free(entry);
+
+        entry = next;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* returns the number of entry bytes freed. */
+int free_scopes_unsafe(symbol_cache_p cache)
+{
+    int freed = 0;
+
+    while(cache->scopes) {
+        struct symbol_scope_t *scope = cache->scopes;
+
+        cache->scopes = scope->next;
+
+        if(scope->symbols) {
+            hashtable_on_each(scope->symbols, free_entries, &freed);
+            hashtable_destroy(scope->symbols);
+        }
+
+        mem_free(scope);
+    }
+
+    return freed;
+}
+
+
+
+/*
+ * lookup
+ *
+ * Find the instance for the tag's symbol.  If nobody has loaded the scope
+ * yet, the tag claims it and must load it.
+ */
+
+int lookup(ab_tag_p tag, uint32_t *instance)
+{
+    symbol_cache_p cache = tag->session->symbols;
+    int scope_size = 0;
+    int symbol_start = 0;
+    int symbol_size = 0;
+    char folded[SYMBOL_MAX_NAME + 1];
+    int result = SYMBOL_LOOKUP_MISSING;
+
+    if(split_encoded_name(tag, &scope_size, &symbol_start, &symbol_size) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Tag name cannot be addressed by instance.");
+        return SYMBOL_LOOKUP_MISSING;
+    }
+
+    if(fold_name(&tag->encoded_name[symbol_start + 2], tag->encoded_name[symbol_start + 1], folded) != PLCTAG_STATUS_OK) {
+        return SYMBOL_LOOKUP_MISSING;
+    }
+
+    critical_block(&(cache->mutex)) {
+        struct symbol_scope_t *scope = find_scope_unsafe(cache, &tag->encoded_name[1], scope_size);
+        struct symbol_entry_t *entry = NULL;
+
+        tag->symbol_generation = cache->generation;
+
+        if(!scope) {
+            scope = (struct symbol_scope_t *)mem_alloc((int)sizeof(*scope) + scope_size);
+            if(!scope) {
+                pdebug(DEBUG_WARN, "Unable to allocate symbol scope!");
+                result = SYMBOL_LOOKUP_MISSING;
+                break;
+            }
+
+            scope->symbols = hashtable_create(SYMBOL_CACHE_INITIAL_SIZE);
+            if(!scope->symbols) {
+                pdebug(DEBUG_WARN, "Unable to allocate symbol table!");
+                mem_free(scope);
+                result = SYMBOL_LOOKUP_MISSING;
+                break;
+            }
+
+            scope->state = SYMBOL_SCOPE_LOADING;
+            scope->loader_tag_id = tag->tag_id;
+            scope->scope_size = scope_size;
+            mem_copy(scope->scope, &tag->encoded_name[1], scope_size);
+
+            scope->next = cache->scopes;
+            cache->scopes = scope;
+
+            result = SYMBOL_LOOKUP_LOAD;
+            break;
+        }
+
+        if(scope->state == SYMBOL_SCOPE_LOADING) {
+            result = SYMBOL_LOOKUP_WAIT;
+            break;
+        }
+
+        if(scope->state == SYMBOL_SCOPE_FAILED) {
+            result = SYMBOL_LOOKUP_MISSING;
+            break;
+        }
+
+        entry = (struct symbol_entry_t *)hashtable_get(scope->symbols, name_key(folded, str_length(folded)));
+        while(entry && str_cmp(entry->name, folded)) {
+            entry = entry->next;
+        }
+
+        if(entry) {
+            *instance = entry->instance;
+            result = SYMBOL_LOOKUP_FOUND;
+        } else {
+            result = SYMBOL_LOOKUP_MISSING;
+        }
+    }
+
+    return result;
+}
+
+
+
+int resolve(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint32_t instance = 0;
+
+    switch(lookup(tag, &instance)) {
+    case SYMBOL_LOOKUP_FOUND:
+        if(use_instance(tag, instance) == PLCTAG_STATUS_OK) {
+            tag->symbol_state = SYMBOL_TAG_RESOLVED;
+        } else {
+            tag->symbol_state = SYMBOL_TAG_SYMBOLIC;
+        }
+        break;
+
+    case SYMBOL_LOOKUP_LOAD:
+        pdebug(DEBUG_INFO, "Tag %d is loading the symbol instances.", tag->tag_id);
+
+        tag->symbol_state = SYMBOL_TAG_LOADING;
+        tag->symbol_next_id = 0;
+
+        rc = build_list_request(tag);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to start symbol listing, error %s!", plc_tag_decode_error(rc));
+            finish_load(tag, SYMBOL_SCOPE_FAILED);
+        }
+        break;
+
+    case SYMBOL_LOOKUP_WAIT:
+        break;
+
+    default:
+        pdebug(DEBUG_DETAIL, "Tag %d will use its name.", tag->tag_id);
+        tag->symbol_state = SYMBOL_TAG_SYMBOLIC;
+        break;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * use_instance
+ *
+ * Build the instance addressed copy of the encoded name.  Very short
+ * names with large instance IDs are not worth it.
+ */
+
+int use_instance(ab_tag_p tag, uint32_t instance)
+{
+    uint8_t encoded_name[MAX_TAG_NAME];
+    int scope_size = 0;
+    int symbol_start = 0;
+    int symbol_size = 0;
+    int index = 1;
+    int rest_size = 0;
+    const uint8_t *shared_name = NULL;
+
+    if(split_encoded_name(tag, &scope_size, &symbol_start, &symbol_size) != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    rest_size = tag->encoded_name_size - (symbol_start + symbol_size);
+
+    mem_copy(&encoded_name[index], &tag->encoded_name[1], scope_size);
+    index += scope_size;
+
+    encoded_name[index++] = 0x20;
+    encoded_name[index++] = SYMBOL_CLASS;
+    index += encode_instance_segment(&encoded_name[index], instance);
+
+    if(index + rest_size >= tag->encoded_name_size) {
+        pdebug(DEBUG_DETAIL, "Instance addressing does not make the name shorter.");
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    mem_copy(&encoded_name[index], &tag->encoded_name[symbol_start + symbol_size], rest_size);
+    index += rest_size;
+
+    /* the word count does not include itself. */
+    encoded_name[0] = (uint8_t)((index - 1) / 2);
+
+    shared_name = intern_bytes(encoded_name, index);
+    if(!shared_name) {
+        pdebug(DEBUG_WARN, "Unable to store instance encoded name!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    intern_release(tag->encoded_instance_name);
+
+    tag->encoded_instance_name = shared_name;
+    tag->encoded_instance_name_size = index;
+    tag->symbol_instance = instance;
+
+    pdebug(DEBUG_INFO, "Tag %d reads symbol instance %u, %d bytes instead of %d.", tag->tag_id, (unsigned int)instance, index, tag->encoded_name_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void use_name(ab_tag_p tag)
+{
+    intern_release(tag->encoded_instance_name);
+
+    tag->encoded_instance_name = NULL;
+    tag->encoded_instance_name_size = 0;
+    tag->symbol_instance = 0;
+}
+
+
+
+/*
+ * build_list_request
+ *
+ * Ask for the names of the symbols in the tag's scope, starting at
+ * symbol_next_id.  This is the same 0x55 request as the @tags listing but
+ * only asks for the name attribute.
+ */
+
+int build_list_request(ab_tag_p tag)
+{
+    eip_cip_co_req* cip = NULL;
+    ab_request_p req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    uint8_t *data_start = NULL;
+    uint8_t *data = NULL;
+    uint8_t *path_start = NULL;
+    int scope_size = 0;
+    int symbol_start = 0;
+    int symbol_size = 0;
+    uint16_le tmp_u16 = UINT16_LE_INIT(0);
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    rc = split_encoded_name(tag, &scope_size, &symbol_start, &symbol_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    cip = (eip_cip_co_req*)(req->data);
+    data_start = data = (uint8_t*)(cip + 1);
+
+    *data = AB_EIP_CMD_CIP_LIST_TAGS;
+    data++;
+
+    /* fill in the path size when we know it. */
+    data++;
+    path_start = data;
+
+    if(scope_size > 0) {
+        mem_copy(data, &tag->encoded_name[1], scope_size);
+        data += scope_size;
+    }
+
+    *data = 0x20; /* class type */
+    data++;
+    *data = SYMBOL_CLASS;
+    data++;
+    data += encode_instance_segment(data, tag->symbol_next_id);
+
+    path_start[-1] = (uint8_t)((data - path_start) / 2);
+
+    /* just the name attribute. */
+    tmp_u16 = h2le16((uint16_t)1);
+    mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+    data += (int)sizeof(tmp_u16);
+
+    tmp_u16 = h2le16(SYMBOL_ATTR_NAME);
+    mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+    data += (int)sizeof(tmp_u16);
+
+    cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND);
+    cip->router_timeout = h2le16(1);
+    cip->cpf_item_count = h2le16(2);
+    cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);
+    cip->cpf_cai_item_length = h2le16(4);
+    cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+    cip->cpf_cdi_item_length = h2le16((uint16_t)((int)(data - data_start) + (int)sizeof(cip->cpf_conn_seq_num)));
+
+    req->request_size = (int)((int)sizeof(*cip) + (int)(data - data_start));
+    req->allow_packing = tag->allow_packing;
+
+    rc = session_add_request(tag->session, req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
+    tag->symbol_req = req;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * check_list_response
+ *
+ * Add the symbols in a listing response to the scope and ask for the
+ * next batch until the controller says there are no more.
+ */
+
+int check_list_response(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p request = tag->symbol_req;
+    symbol_cache_p cache = tag->session->symbols;
+    eip_cip_co_resp* cip_resp = NULL;
+    uint8_t *data = NULL;
+    uint8_t *data_end = NULL;
+    int partial_data = 0;
+    int added = 0;
+
+    if(!request) {
+        finish_load(tag, SYMBOL_SCOPE_FAILED);
+        return PLCTAG_ERR_READ;
+    }
+
+    spin_block(&request->lock) {
+        if(!request->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        rc = request->status;
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    cip_resp = (eip_cip_co_resp*)(request->data);
+    data = (request->data) + sizeof(eip_cip_co_resp);
+    data_end = (request->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+
+    do {
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Session reported failure of symbol listing: %s.", plc_tag_decode_error(rc));
+            break;
+        }
+
+        if(le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND || le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "Symbol listing failed at the EIP level!");
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        if(cip_resp->reply_service != (AB_EIP_CMD_CIP_LIST_TAGS | AB_EIP_CMD_CIP_OK)) {
+            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if(cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+            pdebug(DEBUG_WARN, "Symbol listing failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            break;
+        }
+
+        partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+
+        critical_block(&(cache->mutex)) {
+            struct symbol_scope_t *scope = cache->scopes;
+
+            while(scope && !(scope->state == SYMBOL_SCOPE_LOADING && scope->loader_tag_id == tag->tag_id)) {
+                scope = scope->next;
+            }
+
+            if(!scope || tag->symbol_generation != cache->generation) {
+                pdebug(DEBUG_DETAIL, "Symbol cache was invalidated during the listing.");
+                rc = PLCTAG_ERR_ABORT;
+                break;
+            }
+
+            /* each entry is the instance ID then the name as a counted string. */
+            while(data_end - data >= 6) {
+                uint32_t instance = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+                int name_len = (int)data[4] | ((int)data[5] << 8);
+
+                if(data_end - data < 6 + name_len) {
+                    pdebug(DEBUG_WARN, "Symbol listing entry is truncated!");
+                    rc = PLCTAG_ERR_BAD_REPLY;
+                    break;
+                }
+
+                rc = add_entry_unsafe(scope, data + 6, name_len, instance);
+                if(rc < 0) {
+                    break;
+                }
+
+                added += rc;
+                rc = PLCTAG_STATUS_OK;
+
+                tag->symbol_next_id = instance + 1;
+                data += 6 + name_len;
+            }
+        }
+    } while(0);
+
+    rc_track_extra(cache->owner, added);
+
+    request->abort_request = 1;
+    tag->symbol_req = rc_dec(request);
+
+    if(rc == PLCTAG_ERR_ABORT) {
+        tag->symbol_state = SYMBOL_TAG_UNRESOLVED;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(rc == PLCTAG_STATUS_OK && partial_data) {
+        rc = build_list_request(tag);
+    } else if(rc == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_INFO, "Symbol listing done.");
+        finish_load(tag, SYMBOL_SCOPE_LOADED);
+        return resolve(tag);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Symbol listing failed, tags in this scope will use their names.");
+        finish_load(tag, SYMBOL_SCOPE_FAILED);
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * finish_load
+ *
+ * Mark the scope this tag was loading as loaded or failed.  A negative
+ * state removes the scope so another tag can load it.
+ */
+
+void finish_load(ab_tag_p tag, int scope_state)
+{
+    symbol_cache_p cache = tag->session->symbols;
+    int freed = 0;
+
+    critical_block(&(cache->mutex)) {
+        struct symbol_scope_t **scope_ref = &(cache->scopes);
+
+        while(*scope_ref && !((*scope_ref)->state == SYMBOL_SCOPE_LOADING && (*scope_ref)->loader_tag_id == tag->tag_id)) {
+            scope_ref = &((*scope_ref)->next);
+        }
+
+        if(!*scope_ref) {
+            break;
+        }
+
+        if(scope_state >= 0) {
+            (*scope_ref)->state = scope_state;
+
+            if(scope_state == SYMBOL_SCOPE_LOADED && !cache->load_time) {
+                cache->load_time = time_ms();
+            }
+        } else {
+            struct symbol_scope_t *scope = *scope_ref;
+
+            *scope_ref = scope->next;
+
+            hashtable_on_each(scope->symbols, free_entries, &freed);
+            hashtable_destroy(scope->symbols);
+            mem_free(scope);
+        }
+    }
+
+    rc_track_extra(cache->owner, -freed);
+
+    tag->symbol_state = (scope_state == SYMBOL_SCOPE_FAILED ? SYMBOL_TAG_SYMBOLIC : SYMBOL_TAG_UNRESOLVED);
+}
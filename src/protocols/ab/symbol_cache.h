@@ -0,0 +1,57 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <ab/ab_common.h>
+#include <util/attr.h>
+
+/*
+ * Per-session cache of Logix symbol instance IDs.  Tags that opt in
+ * with use_symbol_instance=1 read with a class 0x6B/instance logical
+ * segment instead of the full symbolic segment once their name has been
+ * resolved.
+ */
+
+typedef struct symbol_cache_t *symbol_cache_p;
+
+extern symbol_cache_p symbol_cache_create(void *owner);
+extern void symbol_cache_destroy(symbol_cache_p cache);
+extern void symbol_cache_invalidate(symbol_cache_p cache);
+
+extern int symbol_instance_setup(ab_tag_p tag, attr attribs);
+extern int symbol_instance_tickler(ab_tag_p tag);
+extern int symbol_instance_fallback(ab_tag_p tag, uint8_t cip_status, const uint8_t *type_info, int type_info_size);
+extern void symbol_instance_release(ab_tag_p tag);
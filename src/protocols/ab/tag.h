@@ -38,6 +38,8 @@
 #define MAX_TAG_NAME        (260)
 #define MAX_TAG_TYPE_INFO   (64)
 #define MAX_CONN_PATH       (260)   /* 256 plus padding. */
+#define AB_MAX_PARALLEL_FRAGMENTS (16)
+#define AB_DEFAULT_PARALLEL_FRAGMENTS (8)
 
 /* they are used in some of these includes */
 #include <lib/libplctag.h>
@@ -66,6 +68,8 @@ typedef enum {
 } elem_type_t;
 
 
+struct discovery_t;
+
 struct ab_tag_t {
     /*struct plc_tag_t p_tag;*/
     TAG_BASE_STRUCT;
@@ -77,18 +81,21 @@ struct ab_tag_t {
     ab_session_p session;
     int use_connected_msg;
 
-    /* this contains the encoded name */
-    uint8_t encoded_name[MAX_TAG_NAME];
+    /*
+     * the encoded name and type are shared between tags with the same
+     * values.  They are read-only, use the setters in ab_common.h.
+     */
+    const uint8_t *encoded_name;
     int encoded_name_size;
 
 //    const char *read_group;
 
-    /* storage for the encoded type. */
-    uint8_t encoded_type_info[MAX_TAG_TYPE_INFO];
+    const uint8_t *encoded_type_info;
     int encoded_type_info_size;
 
     /* number of elements and size of each in the tag. */
     pccc_file_t file_type;
+    pccc_addr_t pccc_address;   /* parsed data file address for PCCC tags. */
     elem_type_t elem_type;
 
     int elem_count;
@@ -101,10 +108,20 @@ struct ab_tag_t {
 
     /* used for listing tags. */
     uint32_t next_id;
+    int listing_capacity;
+    int listing_stream;
+    int listing_done;
+
+    /* used for discovery tags, see eip_cip_special.c. */
+    struct discovery_t *discovery;
 
     /* used for UDT tags. */
     uint8_t udt_get_fields;
+    uint8_t udt_from_cache;
     uint16_t udt_id;
+    int use_udt_cache;
+    int udt_cache_state;
+    struct udt_check_t *udt_check;
 
     /* requests */
     int pre_write_read;
@@ -113,6 +130,36 @@ struct ab_tag_t {
     int offset;
 
     int allow_packing;
+    int pccc_merge_reads;   /* merge reads of nearby PCCC data file elements. */
+    int pccc_no_merge;      /* set when our own read failed, the address is bad. */
+
+    /*
+     * symbol instance addressing for reads, see symbol_cache.c.  The
+     * instance name is interned and is NULL while reading by name.
+     */
+    int use_symbol_instance;
+    int symbol_state;
+    uint32_t symbol_generation;
+    uint32_t symbol_instance;
+    uint32_t symbol_next_id;
+    int symbol_fallbacks;
+    int symbol_verify_ms;
+    ab_request_p symbol_req;
+    const uint8_t *encoded_instance_name;
+    int encoded_instance_name_size;
+
+    /*
+     * fragments of large tags that are in flight at the same time,
+     * see eip_cip.c.  Each slot covers the bytes [start, end) of the tag.
+     */
+    int parallel_fragments;
+    int frag_size;
+    int frag_read_size; /* what the PLC really returns per read fragment, zero until known. */
+    int frag_next_offset;
+    int frag_in_flight;
+    ab_request_p frag_req[AB_MAX_PARALLEL_FRAGMENTS];
+    int frag_start[AB_MAX_PARALLEL_FRAGMENTS];
+    int frag_end[AB_MAX_PARALLEL_FRAGMENTS];
 
     /* flags for operations */
     int read_in_progress;
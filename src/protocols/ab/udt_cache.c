@@ -0,0 +1,1447 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+#include <stdio.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <ab/defs.h>
+#include <ab/ab_common.h>
+#include <ab/session.h>
+#include <ab/tag.h>
+#include <ab/udt_cache.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/hashtable.h>
+#include <util/rc.h>
+
+
+/*
+ * UDT template cache
+ *
+ * Reading a @udt/<id> tag costs one request for the template attributes
+ * and one or more requests for the field definitions.  An HMI that
+ * restarts and reads hundreds of templates from each controller pays
+ * that every time even though the templates rarely change.
+ *
+ * The cache keeps the whole template buffer, the 14 byte header the UDT
+ * tag builds plus the field definitions, keyed by the template ID and the
+ * structure handle.  The handle is the controller's CRC of the template
+ * definition, so the same data serves every controller that runs the same
+ * template.
+ *
+ * Which handle each template ID has is kept per controller.  A controller
+ * is known by the vendor, product code and serial number in its identity
+ * object, not by the gateway and path used to reach it, so a controller
+ * reached by two routes shares one scope and a replaced controller at the
+ * same address starts a new one.
+ *
+ * The program might change while we are not connected.  So after each
+ * connect, the first @udt tag that uses the cache reads the identity and
+ * then checks every template the scope knows with one handle request each.
+ * These go out together and the session packs them into a few packets.
+ * Templates whose handle changed are dropped from the scope.  Until the
+ * next connect, templates in the scope are then served with no network
+ * traffic at all.  A template the scope does not know yet is read as
+ * before, but if its attributes match a template already cached, the
+ * field definitions come from the cache.
+ *
+ * With udt_cache_file=<path> the cache is loaded from that file the first
+ * time a tag names it and the file is rewritten whenever a new or changed
+ * template is read.
+ */
+
+
+#define UDT_CACHE_INITIAL_SIZE  (64)
+#define UDT_CACHE_HEADER_SIZE   (14)    /* MAGIC, the header built in eip_cip_special.c */
+#define UDT_CACHE_HANDLE_OFFSET (12)    /* MAGIC, of the structure handle in the header. */
+#define UDT_CACHE_MAX_ID        (4095)
+#define UDT_CACHE_MAX_TEMPLATE  (65535)
+#define UDT_CACHE_MAX_FILE_NAME (1024)
+#define UDT_CACHE_MAX_IN_FLIGHT (32)
+
+#define UDT_REF_VALID           ((uint32_t)0x10000)
+
+#define IDENTITY_CLASS          ((uint8_t)0x01)
+#define IDENTITY_ATTR_VENDOR    ((uint16_t)1)
+#define IDENTITY_ATTR_PRODUCT   ((uint16_t)3)
+#define IDENTITY_ATTR_SERIAL    ((uint16_t)6)
+#define TEMPLATE_CLASS          ((uint8_t)0x6C)
+#define TEMPLATE_ATTR_HANDLE    ((uint16_t)1)
+
+/* session identity states. */
+#define UDT_IDENTITY_UNKNOWN    (0)
+#define UDT_IDENTITY_KNOWN      (1)
+#define UDT_IDENTITY_NONE       (2)     /* no identity on this connection, so no cache. */
+
+/* tag side states. */
+#define UDT_CACHE_TAG_IDLE      (0)
+#define UDT_CACHE_TAG_IDENTITY  (1)
+#define UDT_CACHE_TAG_CHECKING  (2)
+#define UDT_CACHE_TAG_WAITING   (3)
+
+/* results of a lookup. */
+#define UDT_LOOKUP_FOUND        (0)
+#define UDT_LOOKUP_MISSING      (1)
+#define UDT_LOOKUP_IDENTITY     (2)
+#define UDT_LOOKUP_CHECK        (3)
+#define UDT_LOOKUP_WAIT         (4)
+
+static const char UDT_CACHE_FILE_MAGIC[] = "libplctag UDT cache 2\n";
+
+/* template data, shared by every controller with the same template. */
+struct udt_entry_t {
+    uint16_t udt_id;
+    uint16_t handle;
+    int size;
+    uint8_t data[];
+};
+
+/* the templates one controller uses. */
+struct udt_scope_t {
+    struct udt_scope_t *next;
+    uint32_t checked_serial;    /* when the last check of the whole scope started, zero if never. */
+    int32_t checker_tag_id;     /* the tag checking the scope now, zero if none. */
+    uint32_t refs[UDT_CACHE_MAX_ID + 1]; /* UDT_REF_VALID | handle, zero if not known. */
+    char identity[];
+};
+
+/* a check of a scope or an identity read in progress. */
+struct udt_check_t {
+    struct udt_scope_t *scope;  /* scopes live until teardown. */
+    uint32_t serial;
+    int next_id;
+    int in_flight;
+    ab_request_p req[UDT_CACHE_MAX_IN_FLIGHT];
+    uint16_t req_id[UDT_CACHE_MAX_IN_FLIGHT];
+};
+
+
+static lw_mutex_t udt_cache_mutex;
+static hashtable_p udt_entries = NULL;
+static struct udt_scope_t *udt_scopes = NULL;
+static char *udt_cache_file = NULL;
+
+/* orders connects against scope checks, see lookup(). */
+static uint32_t udt_serial = 0;
+
+
+static int lookup(ab_tag_p tag, struct udt_scope_t **scope_out);
+static int start_lookup(ab_tag_p tag);
+static int check_identity_response(ab_tag_p tag);
+static int check_handle_responses(ab_tag_p tag);
+static int fill_check_window(ab_tag_p tag);
+static void finish_check(ab_tag_p tag, int checked);
+static int build_request(ab_tag_p tag, const uint8_t *cip, int cip_size, ab_request_p *req_out);
+static int get_response(ab_request_p request, uint8_t service, uint8_t **data, uint8_t **data_end);
+static int64_t entry_key(uint16_t udt_id, uint16_t handle);
+static uint16_t header_handle(const uint8_t *header);
+static struct udt_scope_t *find_scope_unsafe(const char *identity, int create);
+static int add_entry_unsafe(uint16_t udt_id, uint16_t handle, const uint8_t *data, int size);
+static int free_entries(hashtable_p table, int64_t key, void *data, void *context);
+static int count_entries(hashtable_p table, int64_t key, void *data, void *context);
+static int save_entries(hashtable_p table, int64_t key, void *data, void *context);
+static int entry_in_use_unsafe(struct udt_entry_t *entry);
+static int set_tag_data(ab_tag_p tag, const uint8_t *data, int size);
+static int load_file_unsafe(const char *file_name);
+static int save_file_unsafe(void);
+static int read_u16(FILE *in, uint16_t *val);
+static int read_u32(FILE *in, uint32_t *val);
+static int write_u16(FILE *out, uint16_t val);
+static int write_u32(FILE *out, uint32_t val);
+
+
+
+
+/*************************************************************************
+ **************************** API Functions ******************************
+ ************************************************************************/
+
+
+int udt_cache_startup(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    lw_mutex_init(&udt_cache_mutex);
+
+    udt_entries = hashtable_create(UDT_CACHE_INITIAL_SIZE);
+    if(!udt_entries) {
+        pdebug(DEBUG_ERROR, "Unable to create UDT cache table!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void udt_cache_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    critical_block(&udt_cache_mutex) {
+        if(udt_entries) {
+            hashtable_on_each(udt_entries, free_entries, NULL);
+            hashtable_destroy(udt_entries);
+            udt_entries = NULL;
+        }
+
+        while(udt_scopes) {
+            struct udt_scope_t *next = udt_scopes->next;
+
+            mem_free(udt_scopes);
+
+            udt_scopes = next;
+        }
+
+        if(udt_cache_file) {
+            mem_free(udt_cache_file);
+            udt_cache_file = NULL;
+        }
+    }
+
+    lw_mutex_destroy(&udt_cache_mutex);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/*
+ * udt_cache_setup
+ *
+ * Check the UDT cache attributes of a new @udt tag.  The first tag that
+ * names a cache file loads it.
+ */
+
+int udt_cache_setup(ab_tag_p tag, attr attribs)
+{
+    const char *file_name = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(tag->elem_type != AB_TYPE_TAG_UDT) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    file_name = attr_get_str(attribs, "udt_cache_file", NULL);
+
+    tag->use_udt_cache = attr_get_int(attribs, "udt_cache", (file_name && str_length(file_name) > 0) ? 1 : 0);
+    if(!tag->use_udt_cache || !file_name || str_length(file_name) == 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    critical_block(&udt_cache_mutex) {
+        if(!udt_entries) {
+            rc = PLCTAG_ERR_NOT_FOUND;
+            break;
+        }
+
+        if(udt_cache_file) {
+            if(str_cmp(udt_cache_file, file_name) != 0) {
+                pdebug(DEBUG_WARN, "The UDT cache already uses the file \"%s\", ignoring \"%s\".", udt_cache_file, file_name);
+            }
+
+            break;
+        }
+
+        udt_cache_file = str_dup(file_name);
+        if(!udt_cache_file) {
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        rc = load_file_unsafe(file_name);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        /* a missing or bad file only means we start with an empty cache. */
+        pdebug(DEBUG_INFO, "Unable to load the UDT cache file, error %s.", plc_tag_decode_error(rc));
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * udt_cache_read
+ *
+ * Fill the tag with the cached template if the controller's scope was
+ * checked on the current connection.  Returns PLCTAG_STATUS_PENDING if the
+ * cache has requests of its own out first, see udt_cache_tickler(), and
+ * PLCTAG_ERR_NOT_FOUND if the tag needs to go to the PLC.
+ */
+
+int udt_cache_read(ab_tag_p tag)
+{
+    if(!tag->use_udt_cache || !tag->session) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    return start_lookup(tag);
+}
+
+
+
+/*
+ * udt_cache_tickler
+ *
+ * Called from the UDT tag tickler while the cache has requests out for the
+ * tag.  Returns the same as udt_cache_read() once they are done.
+ */
+
+int udt_cache_tickler(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    switch(tag->udt_cache_state) {
+    case UDT_CACHE_TAG_IDENTITY:
+        rc = check_identity_response(tag);
+        break;
+
+    case UDT_CACHE_TAG_CHECKING:
+        rc = check_handle_responses(tag);
+        break;
+
+    case UDT_CACHE_TAG_WAITING:
+        /* another tag is checking the scope, look again. */
+        tag->udt_cache_state = UDT_CACHE_TAG_IDLE;
+        rc = PLCTAG_STATUS_OK;
+        break;
+
+    default:
+        rc = PLCTAG_STATUS_OK;
+        break;
+    }
+
+    if(rc != PLCTAG_STATUS_OK || tag->udt_cache_state != UDT_CACHE_TAG_IDLE) {
+        return rc;
+    }
+
+    return start_lookup(tag);
+}
+
+
+
+/*
+ * udt_cache_check
+ *
+ * Called once the template attributes are in the tag's 14 byte header.
+ * If a template with the same ID and structure handle is cached, fill in
+ * the field definitions from it and note the handle in the controller's
+ * scope.  Returns PLCTAG_ERR_NOT_FOUND if the fields need to be read from
+ * the PLC.
+ */
+
+int udt_cache_check(ab_tag_p tag)
+{
+    ab_session_p session = tag->session;
+    uint16_t handle = 0;
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!tag->use_udt_cache || !session || tag->size < UDT_CACHE_HEADER_SIZE) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    handle = header_handle(tag->data);
+
+    critical_block(&udt_cache_mutex) {
+        struct udt_entry_t *entry = NULL;
+        struct udt_scope_t *scope = NULL;
+
+        if(!udt_entries || !(entry = (struct udt_entry_t *)hashtable_get(udt_entries, entry_key(tag->udt_id, handle)))) {
+            break;
+        }
+
+        if(mem_cmp(entry->data, UDT_CACHE_HEADER_SIZE, tag->data, UDT_CACHE_HEADER_SIZE) != 0) {
+            pdebug(DEBUG_INFO, "Template %d with handle %04x has different attributes, reading it again.", (int)tag->udt_id, (unsigned int)handle);
+            break;
+        }
+
+        rc = set_tag_data(tag, entry->data, entry->size);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        if(session->udt_identity_state == UDT_IDENTITY_KNOWN && (scope = find_scope_unsafe(session->udt_identity, 1))) {
+            scope->refs[tag->udt_id] = UDT_REF_VALID | handle;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Using cached fields of template %d with handle %04x.", (int)tag->udt_id, (unsigned int)handle);
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * udt_cache_store
+ *
+ * Save a template that was just read from the PLC.
+ */
+
+void udt_cache_store(ab_tag_p tag)
+{
+    ab_session_p session = tag->session;
+    uint16_t handle = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!tag->use_udt_cache || !session || tag->size < UDT_CACHE_HEADER_SIZE || tag->size > UDT_CACHE_MAX_TEMPLATE) {
+        return;
+    }
+
+    handle = header_handle(tag->data);
+
+    critical_block(&udt_cache_mutex) {
+        struct udt_scope_t *scope = NULL;
+
+        rc = add_entry_unsafe(tag->udt_id, handle, tag->data, tag->size);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        if(session->udt_identity_state == UDT_IDENTITY_KNOWN && (scope = find_scope_unsafe(session->udt_identity, 1))) {
+            scope->refs[tag->udt_id] = UDT_REF_VALID | handle;
+        }
+
+        if(udt_cache_file) {
+            rc = save_file_unsafe();
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to cache template %d, error %s!", (int)tag->udt_id, plc_tag_decode_error(rc));
+    } else {
+        pdebug(DEBUG_DETAIL, "Cached template %d with handle %04x.", (int)tag->udt_id, (unsigned int)handle);
+    }
+}
+
+
+
+/*
+ * udt_cache_connected
+ *
+ * A session to the controller just connected.  The program might have
+ * changed while we were not connected, and it might not even be the same
+ * controller, so the identity must be read again and the scope checked
+ * before any template is served.
+ */
+
+void udt_cache_connected(ab_session_p session)
+{
+    critical_block(&udt_cache_mutex) {
+        session->udt_connect_serial = ++udt_serial;
+        session->udt_identity_state = UDT_IDENTITY_UNKNOWN;
+        session->udt_identity[0] = 0;
+    }
+}
+
+
+
+/*
+ * udt_cache_release
+ *
+ * Stop any cache requests of the tag.  A check this tag was driving is
+ * dropped so that another tag can start it again.  This is called when
+ * the tag is aborted or destroyed.
+ */
+
+void udt_cache_release(ab_tag_p tag)
+{
+    if(!tag->udt_check) {
+        tag->udt_cache_state = UDT_CACHE_TAG_IDLE;
+        return;
+    }
+
+    finish_check(tag, 0);
+}
+
+
+
+
+/***********************************************************************
+ *********************** Implementation Functions **********************
+ **********************************************************************/
+
+
+/*
+ * lookup
+ *
+ * Find the template in the scope of the controller the tag's session is
+ * connected to.  A connect and the start of a scope check each take the
+ * next serial number, so a scope checked with a larger serial than the
+ * session's connect was checked on the current connection.
+ */
+
+int lookup(ab_tag_p tag, struct udt_scope_t **scope_out)
+{
+    ab_session_p session = tag->session;
+    int result = UDT_LOOKUP_MISSING;
+
+    critical_block(&udt_cache_mutex) {
+        struct udt_scope_t *scope = NULL;
+        struct udt_entry_t *entry = NULL;
+        uint32_t ref = 0;
+
+        if(!udt_entries || session->udt_identity_state == UDT_IDENTITY_NONE) {
+            result = UDT_LOOKUP_MISSING;
+            break;
+        }
+
+        if(session->udt_identity_state == UDT_IDENTITY_UNKNOWN) {
+            result = UDT_LOOKUP_IDENTITY;
+            break;
+        }
+
+        scope = find_scope_unsafe(session->udt_identity, 1);
+        if(!scope) {
+            result = UDT_LOOKUP_MISSING;
+            break;
+        }
+
+        if(scope->checked_serial <= session->udt_connect_serial) {
+            if(scope->checker_tag_id && scope->checker_tag_id != tag->tag_id) {
+                result = UDT_LOOKUP_WAIT;
+            } else {
+                scope->checker_tag_id = tag->tag_id;
+                *scope_out = scope;
+                result = UDT_LOOKUP_CHECK;
+            }
+
+            break;
+        }
+
+        ref = scope->refs[tag->udt_id];
+        if(!(ref & UDT_REF_VALID)) {
+            result = UDT_LOOKUP_MISSING;
+            break;
+        }
+
+        entry = (struct udt_entry_t *)hashtable_get(udt_entries, entry_key(tag->udt_id, (uint16_t)(ref & 0xFFFF)));
+        if(entry && set_tag_data(tag, entry->data, entry->size) == PLCTAG_STATUS_OK) {
+            result = UDT_LOOKUP_FOUND;
+        } else {
+            result = UDT_LOOKUP_MISSING;
+        }
+    }
+
+    return result;
+}
+
+
+
+/*
+ * start_lookup
+ *
+ * Look the template up and start whatever requests the cache needs first.
+ */
+
+int start_lookup(ab_tag_p tag)
+{
+    static const uint8_t identity_request[] = {
+        AB_EIP_CMD_CIP_GET_ATTR_LIST, 0x02, 0x20, IDENTITY_CLASS, 0x24, 0x01,
+        0x03, 0x00, (uint8_t)IDENTITY_ATTR_VENDOR, 0x00, (uint8_t)IDENTITY_ATTR_PRODUCT, 0x00, (uint8_t)IDENTITY_ATTR_SERIAL, 0x00
+    };
+    struct udt_scope_t *scope = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    switch(lookup(tag, &scope)) {
+    case UDT_LOOKUP_FOUND:
+        pdebug(DEBUG_DETAIL, "Using cached template %d.", (int)tag->udt_id);
+        return PLCTAG_STATUS_OK;
+
+    case UDT_LOOKUP_IDENTITY:
+        pdebug(DEBUG_DETAIL, "Reading the controller identity for the UDT cache.");
+
+        tag->udt_check = (struct udt_check_t *)mem_alloc((int)sizeof(*(tag->udt_check)));
+        if(!tag->udt_check) {
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        tag->udt_cache_state = UDT_CACHE_TAG_IDENTITY;
+
+        rc = build_request(tag, identity_request, (int)sizeof(identity_request), &(tag->udt_check->req[0]));
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to read the controller identity, error %s!", plc_tag_decode_error(rc));
+            finish_check(tag, 0);
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        tag->udt_check->in_flight = 1;
+
+        return PLCTAG_STATUS_PENDING;
+
+    case UDT_LOOKUP_CHECK:
+        pdebug(DEBUG_DETAIL, "Checking the cached templates of the controller.");
+
+        tag->udt_check = (struct udt_check_t *)mem_alloc((int)sizeof(*(tag->udt_check)));
+        if(!tag->udt_check) {
+            critical_block(&udt_cache_mutex) {
+                scope->checker_tag_id = 0;
+            }
+
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        tag->udt_check->scope = scope;
+        tag->udt_cache_state = UDT_CACHE_TAG_CHECKING;
+
+        critical_block(&udt_cache_mutex) {
+            tag->udt_check->serial = ++udt_serial;
+        }
+
+        /* with nothing to check, the scope is valid right away. */
+        rc = check_handle_responses(tag);
+        if(rc == PLCTAG_STATUS_OK) {
+            return start_lookup(tag);
+        }
+
+        return rc;
+
+    case UDT_LOOKUP_WAIT:
+        tag->udt_cache_state = UDT_CACHE_TAG_WAITING;
+        return PLCTAG_STATUS_PENDING;
+
+    default:
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+}
+
+
+
+/*
+ * check_identity_response
+ *
+ * Make the identity the scope of the session.  If the controller has no
+ * identity we can read, the cache is not used on this connection.
+ */
+
+int check_identity_response(ab_tag_p tag)
+{
+    ab_session_p session = tag->session;
+    ab_request_p request = tag->udt_check->req[0];
+    uint8_t *data = NULL;
+    uint8_t *data_end = NULL;
+    uint16_t vendor = 0;
+    uint16_t product = 0;
+    uint32_t serial = 0;
+    int found = 0;
+    int rc = get_response(request, AB_EIP_CMD_CIP_GET_ATTR_LIST, &data, &data_end);
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    /* a count, then each attribute as its ID, its status and its value. */
+    if(rc == PLCTAG_STATUS_OK && data_end - data >= 2) {
+        int count = (int)data[0] | ((int)data[1] << 8);
+
+        data += 2;
+
+        for(int i=0; i < count && data_end - data >= 4; i++) {
+            uint16_t attr_id = (uint16_t)((unsigned int)data[0] | ((unsigned int)data[1] << 8));
+            uint16_t attr_status = (uint16_t)((unsigned int)data[2] | ((unsigned int)data[3] << 8));
+            int value_size = (attr_id == IDENTITY_ATTR_SERIAL ? 4 : 2);
+
+            data += 4;
+
+            if(attr_status != 0 || data_end - data < value_size) {
+                break;
+            }
+
+            if(attr_id == IDENTITY_ATTR_VENDOR) {
+                vendor = (uint16_t)((unsigned int)data[0] | ((unsigned int)data[1] << 8));
+                found++;
+            } else if(attr_id == IDENTITY_ATTR_PRODUCT) {
+                product = (uint16_t)((unsigned int)data[0] | ((unsigned int)data[1] << 8));
+                found++;
+            } else if(attr_id == IDENTITY_ATTR_SERIAL) {
+                serial = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+                found++;
+            }
+
+            data += value_size;
+        }
+    }
+
+    critical_block(&udt_cache_mutex) {
+        if(found == 3) {
+            snprintf(session->udt_identity, sizeof(session->udt_identity), "%u:%u:%08X", (unsigned int)vendor, (unsigned int)product, (unsigned int)serial);
+            session->udt_identity_state = UDT_IDENTITY_KNOWN;
+        } else {
+            session->udt_identity_state = UDT_IDENTITY_NONE;
+        }
+    }
+
+    if(found == 3) {
+        pdebug(DEBUG_INFO, "Controller identity is %s.", session->udt_identity);
+    } else {
+        pdebug(DEBUG_WARN, "Unable to read the controller identity, not using the UDT cache on this connection.");
+    }
+
+    finish_check(tag, 0);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * check_handle_responses
+ *
+ * Compare the handles that came back with the scope and keep up to
+ * UDT_CACHE_MAX_IN_FLIGHT handle requests out until every template in the
+ * scope was checked.
+ */
+
+int check_handle_responses(ab_tag_p tag)
+{
+    struct udt_check_t *check = tag->udt_check;
+    int failed = 0;
+
+    for(int slot=0; slot < UDT_CACHE_MAX_IN_FLIGHT; slot++) {
+        uint8_t *data = NULL;
+        uint8_t *data_end = NULL;
+        uint16_t handle = 0;
+        int present = 0;
+        int rc = PLCTAG_STATUS_OK;
+
+        if(!check->req[slot]) {
+            continue;
+        }
+
+        rc = get_response(check->req[slot], AB_EIP_CMD_CIP_GET_ATTR_LIST, &data, &data_end);
+        if(rc == PLCTAG_STATUS_PENDING) {
+            continue;
+        }
+
+        /* one attribute: count, ID, status and the 16-bit handle. */
+        if(rc == PLCTAG_STATUS_OK && data_end - data >= 8 && data[4] == 0 && data[5] == 0) {
+            handle = (uint16_t)((unsigned int)data[6] | ((unsigned int)data[7] << 8));
+            present = 1;
+        } else if(rc == PLCTAG_STATUS_OK || rc == PLCTAG_ERR_REMOTE_ERR) {
+            /* the template is not in the program any more. */
+            present = 0;
+        } else {
+            pdebug(DEBUG_WARN, "Template check failed with error %s!", plc_tag_decode_error(rc));
+            failed = 1;
+        }
+
+        if(!failed) {
+            critical_block(&udt_cache_mutex) {
+                struct udt_scope_t *scope = check->scope;
+                uint16_t udt_id = check->req_id[slot];
+
+                if(!present || scope->refs[udt_id] != (UDT_REF_VALID | handle)) {
+                    pdebug(DEBUG_INFO, "Template %d changed, it will be read again.", (int)udt_id);
+                    scope->refs[udt_id] = 0;
+                }
+            }
+        }
+
+        check->req[slot]->abort_request = 1;
+        check->req[slot] = rc_dec(check->req[slot]);
+        check->in_flight--;
+    }
+
+    if(failed || fill_check_window(tag) != PLCTAG_STATUS_OK) {
+        finish_check(tag, 0);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(check->in_flight > 0) {
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    pdebug(DEBUG_DETAIL, "Checked all cached templates of the controller.");
+
+    finish_check(tag, 1);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * fill_check_window
+ *
+ * Queue handle requests for the next templates in the scope.
+ */
+
+int fill_check_window(ab_tag_p tag)
+{
+    struct udt_check_t *check = tag->udt_check;
+    uint8_t cip[] = {
+        AB_EIP_CMD_CIP_GET_ATTR_LIST, 0x03, 0x20, TEMPLATE_CLASS, 0x25, 0x00,
+        0x00, 0x00,     /* template ID */
+        0x01, 0x00, (uint8_t)TEMPLATE_ATTR_HANDLE, 0x00
+    };
+
+    for(int slot=0; slot < UDT_CACHE_MAX_IN_FLIGHT && check->next_id <= UDT_CACHE_MAX_ID; slot++) {
+        int udt_id = -1;
+        int rc = PLCTAG_STATUS_OK;
+
+        if(check->req[slot]) {
+            continue;
+        }
+
+        critical_block(&udt_cache_mutex) {
+            struct udt_scope_t *scope = check->scope;
+
+            while(check->next_id <= UDT_CACHE_MAX_ID) {
+                if(scope->refs[check->next_id] & UDT_REF_VALID) {
+                    udt_id = check->next_id;
+                }
+
+                check->next_id++;
+
+                if(udt_id >= 0) {
+                    break;
+                }
+            }
+        }
+
+        if(udt_id < 0) {
+            break;
+        }
+
+        cip[6] = (uint8_t)(udt_id & 0xFF);
+        cip[7] = (uint8_t)((udt_id >> 8) & 0xFF);
+
+        rc = build_request(tag, cip, (int)sizeof(cip), &(check->req[slot]));
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to check template %d, error %s!", udt_id, plc_tag_decode_error(rc));
+            return rc;
+        }
+
+        check->req_id[slot] = (uint16_t)udt_id;
+        check->in_flight++;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * finish_check
+ *
+ * Stop the tag's cache requests and give up its claim on the scope.  If
+ * every template was checked, the scope counts as checked from the time
+ * the check started.
+ */
+
+void finish_check(ab_tag_p tag, int checked)
+{
+    struct udt_check_t *check = tag->udt_check;
+
+    if(check) {
+        for(int slot=0; slot < UDT_CACHE_MAX_IN_FLIGHT; slot++) {
+            if(check->req[slot]) {
+                spin_block(&check->req[slot]->lock) {
+                    check->req[slot]->abort_request = 1;
+                }
+
+                check->req[slot] = rc_dec(check->req[slot]);
+            }
+        }
+    }
+
+    if(check && check->scope) {
+        critical_block(&udt_cache_mutex) {
+            struct udt_scope_t *scope = check->scope;
+
+            if(scope->checker_tag_id != tag->tag_id) {
+                break;
+            }
+
+            scope->checker_tag_id = 0;
+
+            if(checked) {
+                scope->checked_serial = check->serial;
+            }
+        }
+    }
+
+    if(check) {
+        mem_free(check);
+        tag->udt_check = NULL;
+    }
+
+    tag->udt_cache_state = UDT_CACHE_TAG_IDLE;
+}
+
+
+
+/*
+ * build_request
+ *
+ * Queue a connected request with the given CIP service, path and data.
+ */
+
+int build_request(ab_tag_p tag, const uint8_t *cip_data, int cip_size, ab_request_p *req_out)
+{
+    eip_cip_co_req* cip = NULL;
+    ab_request_p req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    cip = (eip_cip_co_req*)(req->data);
+    mem_copy((uint8_t*)(cip + 1), cip_data, cip_size);
+
+    cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND);
+    cip->router_timeout = h2le16(1);
+    cip->cpf_item_count = h2le16(2);
+    cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);
+    cip->cpf_cai_item_length = h2le16(4);
+    cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+    cip->cpf_cdi_item_length = h2le16((uint16_t)(cip_size + (int)sizeof(cip->cpf_conn_seq_num)));
+
+    req->request_size = (int)sizeof(*cip) + cip_size;
+    req->allow_packing = 1;
+
+    rc = session_add_request(tag->session, req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
+    *req_out = req;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * get_response
+ *
+ * Point at the data of a response to one of our requests.  Returns
+ * PLCTAG_STATUS_PENDING until the response is in, and PLCTAG_ERR_REMOTE_ERR
+ * if the controller returned an error for the request itself.
+ */
+
+int get_response(ab_request_p request, uint8_t service, uint8_t **data, uint8_t **data_end)
+{
+    eip_cip_co_resp* cip_resp = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    spin_block(&request->lock) {
+        if(!request->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        rc = request->status;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    cip_resp = (eip_cip_co_resp*)(request->data);
+
+    if(le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND || le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "Request failed at the EIP level!");
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    if(cip_resp->reply_service != (service | AB_EIP_CMD_CIP_OK)) {
+        pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    if(cip_resp->status != AB_CIP_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Request failed with CIP status 0x%x.", cip_resp->status);
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    *data = (request->data) + sizeof(eip_cip_co_resp);
+    *data_end = (request->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int64_t entry_key(uint16_t udt_id, uint16_t handle)
+{
+    return (int64_t)(((uint32_t)udt_id << 16) | (uint32_t)handle);
+}
+
+
+
+uint16_t header_handle(const uint8_t *header)
+{
+    return (uint16_t)((unsigned int)header[UDT_CACHE_HANDLE_OFFSET] | ((unsigned int)header[UDT_CACHE_HANDLE_OFFSET + 1] << 8));
+}
+
+
+
+struct udt_scope_t *find_scope_unsafe(const char *identity, int create)
+{
+    struct udt_scope_t *scope = udt_scopes;
+    int identity_size = 0;
+
+    while(scope && str_cmp(scope->identity, identity) != 0) {
+        scope = scope->next;
+    }
+
+    if(scope || !create) {
+        return scope;
+    }
+
+    identity_size = str_length(identity) + 1;
+
+    scope = (struct udt_scope_t *)mem_alloc((int)sizeof(*scope) + identity_size);
+    if(!scope) {
+        pdebug(DEBUG_WARN, "Unable to allocate UDT cache scope!");
+        return NULL;
+    }
+
+    str_copy(scope->identity, identity_size, identity);
+
+    scope->next = udt_scopes;
+    udt_scopes = scope;
+
+    return scope;
+}
+
+
+
+/* replaces any existing copy of the template. */
+int add_entry_unsafe(uint16_t udt_id, uint16_t handle, const uint8_t *data, int size)
+{
+    int64_t key = entry_key(udt_id, handle);
+    struct udt_entry_t *entry = NULL;
+
+    if(!udt_entries) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    entry = (struct udt_entry_t *)hashtable_remove(udt_entries, key);
+    if(entry) {
+        mem_free(entry);
+    }
+
+    entry = (struct udt_entry_t *)mem_alloc((int)sizeof(*entry) + size);
+    if(!entry) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    entry->udt_id = udt_id;
+    entry->handle = handle;
+    entry->size = size;
+    mem_copy(entry->data, data, size);
+
+    if(hashtable_put(udt_entries, key, entry) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to put template in the cache table!");
+        mem_free(entry);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int free_entries(hashtable_p table, int64_t key, void *data, void *context)
+{
+    (void)table;
+    (void)key;
+    (void)context;
+
+    mem_free(data);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* templates no controller uses any more are not saved. */
+int entry_in_use_unsafe(struct udt_entry_t *entry)
+{
+    for(struct udt_scope_t *scope = udt_scopes; scope; scope = scope->next) {
+        if(scope->refs[entry->udt_id] == (UDT_REF_VALID | entry->handle)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+int count_entries(hashtable_p table, int64_t key, void *data, void *context)
+{
+    (void)table;
+    (void)key;
+
+    if(entry_in_use_unsafe((struct udt_entry_t *)data)) {
+        (*(uint32_t *)context)++;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int save_entries(hashtable_p table, int64_t key, void *data, void *context)
+{
+    FILE *out = (FILE *)context;
+    struct udt_entry_t *entry = (struct udt_entry_t *)data;
+
+    (void)table;
+    (void)key;
+
+    if(!entry_in_use_unsafe(entry)) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(write_u16(out, entry->udt_id) != PLCTAG_STATUS_OK || write_u16(out, entry->handle) != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_WRITE;
+    }
+
+    if(write_u32(out, (uint32_t)entry->size) != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_WRITE;
+    }
+
+    if(fwrite(entry->data, 1, (size_t)(unsigned int)entry->size, out) != (size_t)(unsigned int)entry->size) {
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* the tag buffer takes the size of the template. */
+int set_tag_data(ab_tag_p tag, const uint8_t *data, int size)
+{
+    uint8_t *new_buffer = NULL;
+
+    if(tag->size != size) {
+        new_buffer = (uint8_t*)mem_realloc(tag->data, size);
+        if(!new_buffer) {
+            pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        rc_track_extra(tag, size - tag->size);
+
+        tag->data = new_buffer;
+        tag->size = size;
+        tag->elem_size = size;
+    }
+
+    tag->elem_count = 1;
+
+    mem_copy(tag->data, data, size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * The file starts with a magic line and the templates:
+ *
+ * uint32_t number of templates, then for each:
+ *     uint16_t template ID
+ *     uint16_t structure handle
+ *     uint32_t template size
+ *     uint8_t  template data
+ *
+ * Each controller follows until the end of the file:
+ *
+ * uint16_t identity length
+ * char     identity, not terminated
+ * uint16_t number of templates, then for each:
+ *     uint16_t template ID
+ *     uint16_t structure handle
+ *
+ * All integers are little endian.  Controllers from the file are not
+ * trusted until they are checked.
+ */
+
+int load_file_unsafe(const char *file_name)
+{
+    FILE *in = NULL;
+    char magic[sizeof(UDT_CACHE_FILE_MAGIC)];
+    char identity[SESSION_IDENTITY_SIZE];
+    uint8_t *data = NULL;
+    uint32_t num_templates = 0;
+    int num_scopes = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    in = fopen(file_name, "rb");
+    if(!in) {
+        pdebug(DEBUG_INFO, "No UDT cache file \"%s\" yet.", file_name);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(fread(magic, 1, sizeof(UDT_CACHE_FILE_MAGIC) - 1, in) != sizeof(UDT_CACHE_FILE_MAGIC) - 1
+       || mem_cmp(magic, (int)sizeof(UDT_CACHE_FILE_MAGIC) - 1, UDT_CACHE_FILE_MAGIC, (int)sizeof(UDT_CACHE_FILE_MAGIC) - 1) != 0
+       || read_u32(in, &num_templates) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "\"%s\" is not a UDT cache file!", file_name);
+        fclose(in);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    data = (uint8_t *)mem_alloc(UDT_CACHE_MAX_TEMPLATE);
+    if(!data) {
+        fclose(in);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    for(uint32_t i=0; i < num_templates && rc == PLCTAG_STATUS_OK; i++) {
+        uint16_t udt_id = 0;
+        uint16_t handle = 0;
+        uint32_t size = 0;
+
+        if(read_u16(in, &udt_id) != PLCTAG_STATUS_OK
+           || read_u16(in, &handle) != PLCTAG_STATUS_OK
+           || read_u32(in, &size) != PLCTAG_STATUS_OK
+           || udt_id > UDT_CACHE_MAX_ID
+           || size < UDT_CACHE_HEADER_SIZE || size > UDT_CACHE_MAX_TEMPLATE
+           || fread(data, 1, size, in) != size) {
+            pdebug(DEBUG_WARN, "UDT cache file \"%s\" is truncated or corrupt after %u templates!", file_name, (unsigned int)i);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        /* templates read on this run are newer. */
+        if(!hashtable_get(udt_entries, entry_key(udt_id, handle))) {
+            rc = add_entry_unsafe(udt_id, handle, data, (int)size);
+        }
+    }
+
+    while(rc == PLCTAG_STATUS_OK) {
+        struct udt_scope_t *scope = NULL;
+        uint16_t identity_len = 0;
+        uint16_t num_refs = 0;
+
+        /* a clean end of file is where the identity length would be. */
+        if(read_u16(in, &identity_len) != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        if(identity_len >= sizeof(identity)
+           || fread(identity, 1, identity_len, in) != identity_len
+           || read_u16(in, &num_refs) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "UDT cache file \"%s\" is truncated or corrupt after %d controllers!", file_name, num_scopes);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        identity[identity_len] = 0;
+
+        scope = find_scope_unsafe(identity, 1);
+        if(!scope) {
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        for(uint16_t i=0; i < num_refs; i++) {
+            uint16_t udt_id = 0;
+            uint16_t handle = 0;
+
+            if(read_u16(in, &udt_id) != PLCTAG_STATUS_OK || read_u16(in, &handle) != PLCTAG_STATUS_OK || udt_id > UDT_CACHE_MAX_ID) {
+                pdebug(DEBUG_WARN, "UDT cache file \"%s\" is truncated or corrupt in controller %s!", file_name, identity);
+                rc = PLCTAG_ERR_BAD_DATA;
+                break;
+            }
+
+            if(!scope->refs[udt_id] && hashtable_get(udt_entries, entry_key(udt_id, handle))) {
+                scope->refs[udt_id] = UDT_REF_VALID | handle;
+            }
+        }
+
+        num_scopes++;
+    }
+
+    mem_free(data);
+    fclose(in);
+
+    pdebug(DEBUG_INFO, "Loaded %u templates for %d controllers from \"%s\".", (unsigned int)num_templates, num_scopes, file_name);
+
+    return rc;
+}
+
+
+
+/* write a new file next to the old one and swap it in. */
+int save_file_unsafe(void)
+{
+    char tmp_name[UDT_CACHE_MAX_FILE_NAME];
+    FILE *out = NULL;
+    uint32_t num_templates = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", udt_cache_file) >= (int)sizeof(tmp_name)) {
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    out = fopen(tmp_name, "wb");
+    if(!out) {
+        pdebug(DEBUG_WARN, "Unable to open UDT cache file \"%s\"!", tmp_name);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    hashtable_on_each(udt_entries, count_entries, &num_templates);
+
+    if(fwrite(UDT_CACHE_FILE_MAGIC, 1, sizeof(UDT_CACHE_FILE_MAGIC) - 1, out) != sizeof(UDT_CACHE_FILE_MAGIC) - 1
+       || write_u32(out, num_templates) != PLCTAG_STATUS_OK) {
+        rc = PLCTAG_ERR_WRITE;
+    } else {
+        rc = hashtable_on_each(udt_entries, save_entries, out);
+    }
+
+    for(struct udt_scope_t *scope = udt_scopes; scope && rc == PLCTAG_STATUS_OK; scope = scope->next) {
+        size_t identity_len = (size_t)(unsigned int)str_length(scope->identity);
+        uint16_t num_refs = 0;
+
+        for(int udt_id=0; udt_id <= UDT_CACHE_MAX_ID; udt_id++) {
+            if(scope->refs[udt_id] & UDT_REF_VALID) {
+                num_refs++;
+            }
+        }
+
+        if(write_u16(out, (uint16_t)identity_len) != PLCTAG_STATUS_OK
+           || fwrite(scope->identity, 1, identity_len, out) != identity_len
+           || write_u16(out, num_refs) != PLCTAG_STATUS_OK) {
+            rc = PLCTAG_ERR_WRITE;
+            break;
+        }
+
+        for(int udt_id=0; udt_id <= UDT_CACHE_MAX_ID && rc == PLCTAG_STATUS_OK; udt_id++) {
+            if(scope->refs[udt_id] & UDT_REF_VALID) {
+                if(write_u16(out, (uint16_t)udt_id) != PLCTAG_STATUS_OK || write_u16(out, (uint16_t)(scope->refs[udt_id] & 0xFFFF)) != PLCTAG_STATUS_OK) {
+                    rc = PLCTAG_ERR_WRITE;
+                }
+            }
+        }
+    }
+
+    if(fclose(out) && rc == PLCTAG_STATUS_OK) {
+        rc = PLCTAG_ERR_WRITE;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error writing UDT cache file \"%s\"!", tmp_name);
+        remove(tmp_name);
+        return rc;
+    }
+
+    /* rename() does not replace an existing file on all platforms. */
+    if(rename(tmp_name, udt_cache_file) != 0) {
+        remove(udt_cache_file);
+
+        if(rename(tmp_name, udt_cache_file) != 0) {
+            pdebug(DEBUG_WARN, "Unable to replace UDT cache file \"%s\"!", udt_cache_file);
+            remove(tmp_name);
+            return PLCTAG_ERR_WRITE;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int read_u16(FILE *in, uint16_t *val)
+{
+    uint8_t buf[2];
+
+    if(fread(buf, 1, sizeof(buf), in) != sizeof(buf)) {
+        return PLCTAG_ERR_READ;
+    }
+
+    *val = (uint16_t)((unsigned int)buf[0] | ((unsigned int)buf[1] << 8));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int read_u32(FILE *in, uint32_t *val)
+{
+    uint8_t buf[4];
+
+    if(fread(buf, 1, sizeof(buf), in) != sizeof(buf)) {
+        return PLCTAG_ERR_READ;
+    }
+
+    *val = (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int write_u16(FILE *out, uint16_t val)
+{
+    uint8_t buf[2];
+
+    buf[0] = (uint8_t)(val & 0xFF);
+    buf[1] = (uint8_t)((val >> 8) & 0xFF);
+
+    return (fwrite(buf, 1, sizeof(buf), out) == sizeof(buf) ? PLCTAG_STATUS_OK : PLCTAG_ERR_WRITE);
+}
+
+
+
+int write_u32(FILE *out, uint32_t val)
+{
+    uint8_t buf[4];
+
+    buf[0] = (uint8_t)(val & 0xFF);
+    buf[1] = (uint8_t)((val >> 8) & 0xFF);
+    buf[2] = (uint8_t)((val >> 16) & 0xFF);
+    buf[3] = (uint8_t)((val >> 24) & 0xFF);
+
+    return (fwrite(buf, 1, sizeof(buf), out) == sizeof(buf) ? PLCTAG_STATUS_OK : PLCTAG_ERR_WRITE);
+}
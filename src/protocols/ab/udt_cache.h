@@ -0,0 +1,56 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#pragma once
+
+#include <ab/ab_common.h>
+#include <ab/session.h>
+#include <util/attr.h>
+
+/*
+ * Process wide cache of Logix UDT templates.  Tags that opt in with
+ * udt_cache=1 or udt_cache_file=<path> share the templates read from each
+ * controller across sessions and, with a file, across restarts.
+ */
+
+extern int udt_cache_startup(void);
+extern void udt_cache_teardown(void);
+
+extern int udt_cache_setup(ab_tag_p tag, attr attribs);
+extern int udt_cache_read(ab_tag_p tag);
+extern int udt_cache_tickler(ab_tag_p tag);
+extern int udt_cache_check(ab_tag_p tag);
+extern void udt_cache_store(ab_tag_p tag);
+extern void udt_cache_connected(ab_session_p session);
+extern void udt_cache_release(ab_tag_p tag);
@@ -43,6 +43,7 @@
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/rc.h>
+#include <util/stats.h>
 
 /* data definitions */
 
@@ -56,12 +57,18 @@
 #define MAX_MODBUS_REQUEST_PAYLOAD (246)
 #define MAX_MODBUS_RESPONSE_PAYLOAD (250)
 #define MAX_MODBUS_PDU_PAYLOAD (253)  /* everything after the server address */
+#define MAX_MODBUS_READ_WRITE_REGISTERS (121)  /* write registers in a 0x17 request */
 #define MODBUS_INACTIVITY_TIMEOUT (5000)
 #define SOCKET_READ_TIMEOUT (20) /* read timeout in milliseconds */
 #define SOCKET_WRITE_TIMEOUT (20) /* write timeout in milliseconds */
 #define SOCKET_CONNECT_TIMEOUT (20) /* connect timeout step in milliseconds */
 #define MODBUS_IDLE_WAIT_TIMEOUT (100) /* idle wait timeout in milliseconds */
 #define MAX_MODBUS_REQUESTS (16) /* per the Modbus specification */
+#define MODBUS_MIN_RESPONSE_TIMEOUT (250) /* adaptive window response timeout bounds in milliseconds */
+#define MODBUS_MAX_RESPONSE_TIMEOUT (5000)
+#define MODBUS_MAX_TIMEOUT_BACKOFF (5) /* the response timeout doubles at most this many times */
+#define MODBUS_MIN_PROBE_ROUNDS (32) /* clean rounds before retrying a window size that failed */
+#define MODBUS_MAX_PROBE_ROUNDS (1024)
 
 typedef struct modbus_tag_t *modbus_tag_p;
 typedef struct modbus_tag_list_t *modbus_tag_list_p;
@@ -81,12 +88,29 @@ struct modbus_plc_t {
     // struct modbus_tag_list_t request_tag_list;
     // struct modbus_tag_list_t response_tag_list;
 
+    /*
+     * tags that need the PLC thread, linked through ready_next.  Other
+     * threads add tags so this has its own mutex.  The tags being worked
+     * on in the current pass are moved to tickle_list.
+     */
+    lw_mutex_t ready_mutex;
+    struct modbus_tag_list_t ready_list;
+    struct modbus_tag_list_t tickle_list;
+
+    /* earliest automatic read due on a tag that is not in the ready list. */
+    int64_t next_auto_read_ns;
+
+    /* tags that could not get a request slot although one is free now. */
+    int requests_waiting;
+
     /* hostname/ip and possibly port of the server. */
     char *server;
     sock_p sock;
-    uint8_t server_id;
     int connection_group_id;
 
+    /* Modbus/UDP, each request and response is one datagram. */
+    int is_udp;
+
     /* State */
     struct {
         unsigned int terminate:1;
@@ -98,7 +122,7 @@ struct modbus_plc_t {
 
     /* thread related state */
     thread_p handler_thread;
-    mutex_p mutex;
+    lw_mutex_t mutex;
     //cond_p wait_cond;
     enum {
         PLC_CONNECT_START = 0,
@@ -112,6 +136,42 @@ struct modbus_plc_t {
     int max_requests_in_flight;
     int32_t tags_with_requests[MAX_MODBUS_REQUESTS];
 
+    /*
+     * what each slot is waiting for.  A large read can have several chunks
+     * in flight at once, see send_next_read_chunk().
+     */
+    uint16_t slot_seq_id[MAX_MODBUS_REQUESTS];
+    uint16_t slot_request_num[MAX_MODBUS_REQUESTS];
+    int64_t slot_start_ms[MAX_MODBUS_REQUESTS];
+
+    /*
+     * requests allowed in flight right now.  This is max_requests_in_flight
+     * unless adaptive_window is set, see adjust_request_window().
+     */
+    int request_window;
+    int adaptive_window;
+    int window_full;
+    int window_responses;
+    int loss_window;
+    int clean_rounds;
+    int probe_rounds;
+    int64_t window_cut_ms;
+    int64_t base_rtt_ms;
+    int64_t srtt_ms;
+
+    /* response timeouts in a row, see request_timed_out(). */
+    int timeout_backoff;
+
+    /* merge reads of nearby registers, see plan_read_group(). */
+    int coalesce_reads;
+    int coalesce_gap;
+
+    /* merge writes of adjacent registers, see gather_write_group(). */
+    int coalesce_writes;
+
+    /* send a pending read along with a write, see attach_read_to_write(). */
+    int combine_read_write;
+
     /* comms timeout/disconnect. */
     int64_t inactivity_timeout_ms;
 
@@ -138,7 +198,8 @@ typedef enum {
     MB_CMD_WRITE_COIL_SINGLE = 0x05,
     MB_CMD_WRITE_HOLDING_REGISTER_SINGLE = 0x06,
     MB_CMD_WRITE_COIL_MULTI = 0x0F,
-    MB_CMD_WRITE_HOLDING_REGISTER_MULTI = 0x10
+    MB_CMD_WRITE_HOLDING_REGISTER_MULTI = 0x10,
+    MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI = 0x17
 } modbug_cmd_t;
 
 
@@ -159,6 +220,16 @@ struct modbus_tag_t {
     /* next one in the list for this PLC */
     struct modbus_tag_t *next;
 
+    /* next one in the PLC ready list, ready_queued is protected by the ready mutex. */
+    struct modbus_tag_t *ready_next;
+    int ready_queued;
+
+    /*
+     * unit ID of the device, from the path.  Devices behind one gateway
+     * share the PLC connection and are told apart by this.
+     */
+    uint8_t server_id;
+
     /* register type. */
     modbus_reg_type_t reg_type;
     uint16_t reg_base;
@@ -170,9 +241,29 @@ struct modbus_tag_t {
     uint16_t request_num;
     uint16_t seq_id;
 
+    /* chunks of a read that have come back.  request_num counts the ones sent. */
+    uint16_t response_count;
+
     /* which request slot are we using? */
     int request_slot;
 
+    /* when the request the tag is waiting on was built. */
+    int64_t request_start_ms;
+
+    /*
+     * set when the tag's read shares one request with other tags.  The
+     * request covers read_count registers starting at read_base.
+     */
+    int coalesced;
+    uint16_t read_base;
+    uint16_t read_count;
+
+    /*
+     * set when a shared request failed.  The tag's next request goes out
+     * on its own so that only the tag that caused the error gets it.
+     */
+    int no_coalesce;
+
     /* data for the tag. */
     int elem_count;
     int elem_size;
@@ -203,7 +294,7 @@ tag_byte_order_t modbus_tag_byte_order = {
 
 
 /* Modbus module globals. */
-mutex_p mb_mutex = NULL;
+lw_mutex_t mb_mutex = LW_MUTEX_INIT;
 modbus_plc_p plcs = NULL;
 volatile int library_terminating = 0;
 
@@ -221,20 +312,42 @@ static int tickle_all_tags(modbus_plc_p plc);
 static int tickle_tag(modbus_plc_p plc, modbus_tag_p tag);
 static int find_request_slot(modbus_plc_p plc, modbus_tag_p tag);
 static void clear_request_slot(modbus_plc_p plc, modbus_tag_p tag);
+static void release_request_slot(modbus_plc_p plc, modbus_tag_p tag);
+static void adjust_request_window(modbus_plc_p plc, modbus_tag_p tag, int status);
+static int request_timed_out(modbus_plc_p plc, modbus_tag_p tag);
 static int receive_response(modbus_plc_p plc);
+static int receive_datagram(modbus_plc_p plc);
 static int send_request(modbus_plc_p plc);
 static int check_read_response(modbus_plc_p plc, modbus_tag_p tag);
 static int create_read_request(modbus_plc_p plc, modbus_tag_p tag);
+static int read_request_count(modbus_tag_p tag);
+static int read_chunks_left(modbus_tag_p tag);
+static int find_response_slot(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id);
+static void track_oldest_chunk(modbus_plc_p plc, modbus_tag_p tag);
+static int send_next_read_chunk(modbus_plc_p plc, modbus_tag_p tag);
+static int resend_read_chunk(modbus_plc_p plc, modbus_tag_p tag);
+static int can_share_read(modbus_tag_p leader, modbus_tag_p tag);
+static void plan_read_group(modbus_plc_p plc, modbus_tag_p tag);
+static void join_read_group(modbus_plc_p plc, modbus_tag_p tag);
+static int copy_coalesced_data(modbus_plc_p plc, modbus_tag_p tag);
+static void copy_bits(uint8_t *dest, int dest_bit, const uint8_t *src, int src_bit, int bit_count);
+static int can_share_write(modbus_tag_p leader, modbus_tag_p tag);
+static int gather_write_group(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int max_registers, uint8_t *data, int *base_register, int *register_count);
+static int attach_read_to_write(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int *read_base, int *read_count);
 static int check_write_response(modbus_plc_p plc, modbus_tag_p tag);
 static int create_write_request(modbus_plc_p plc, modbus_tag_p tag);
 static int translate_modbus_error(uint8_t err_code);
 
 /* tag list functions */
 // static int list_is_empty(modbus_tag_list_p list);
-static modbus_tag_p pop_tag(modbus_tag_list_p list);
 static void push_tag(modbus_tag_list_p list, modbus_tag_p tag);
-static struct modbus_tag_list_t merge_lists(modbus_tag_list_p first, modbus_tag_list_p last);
 static int remove_tag(modbus_tag_list_p list, modbus_tag_p tag);
+static void queue_ready_tag(modbus_plc_p plc, modbus_tag_p tag);
+static int tag_needs_plc(modbus_tag_p tag);
+static void wake_auto_read_tags(modbus_plc_p plc);
+static modbus_tag_p pop_ready_tag(modbus_tag_list_p list);
+static void push_ready_tag(modbus_tag_list_p list, modbus_tag_p tag);
+static void remove_ready_tag(modbus_tag_list_p list, modbus_tag_p tag);
 
 
 /* tag vtable functions. */
@@ -294,7 +407,7 @@ plc_tag_p mb_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
     rc = find_or_create_plc(attribs, &(tag->plc));
     if(rc == PLCTAG_STATUS_OK) {
         /* put the tag on the PLC's list. */
-        critical_block(tag->plc->mutex) {
+        critical_block(&tag->plc->mutex) {
             push_tag(&(tag->plc->tag_list), tag);
         }
     } else {
@@ -321,6 +434,7 @@ int create_tag_object(attr attribs, modbus_tag_p *tag)
     int data_size = 0;
     int reg_size = 0;
     int elem_count = attr_get_int(attribs, "elem_count", 1);
+    int server_id = attr_get_int(attribs, "path", -1);
     modbus_reg_type_t reg_type = MB_REG_UNKNOWN;
     int reg_base = 0;
 
@@ -329,6 +443,11 @@ int create_tag_object(attr attribs, modbus_tag_p *tag)
         return PLCTAG_ERR_BAD_PARAM;
     }
 
+    if(server_id < 0 || server_id > 255) {
+        pdebug(DEBUG_WARN, "Server ID, %d, out of bounds or missing!", server_id);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
     pdebug(DEBUG_INFO, "Starting.");
 
     *tag = NULL;
@@ -367,7 +486,7 @@ int create_tag_object(attr attribs, modbus_tag_p *tag)
     pdebug(DEBUG_DETAIL, "Tag data size is %d bytes.", data_size);
 
     /* allocate the tag */
-    *tag = (modbus_tag_p)rc_alloc((int)(unsigned int)sizeof(struct modbus_tag_t)+data_size, modbus_tag_destructor);
+    *tag = (modbus_tag_p)rc_alloc((int)(unsigned int)sizeof(struct modbus_tag_t)+data_size, modbus_tag_destructor, MEM_SUB_TAGS);
     if(! *tag) {
         pdebug(DEBUG_WARN, "Unable to allocate Modbus tag!");
         return PLCTAG_ERR_NO_MEM;
@@ -376,6 +495,8 @@ int create_tag_object(attr attribs, modbus_tag_p *tag)
     /* point the data just after the tag struct. */
     (*tag)->data = (uint8_t *)((*tag) + 1);
 
+    (*tag)->server_id = (uint8_t)(unsigned int)server_id;
+
     /* set the various size/element fields. */
     (*tag)->reg_base = (uint16_t)(unsigned int)reg_base;
     (*tag)->reg_type = reg_type;
@@ -422,8 +543,20 @@ void modbus_tag_destructor(void *tag_arg)
 
     if(tag->plc) {
         /* unlink the tag from the PLC. */
-        critical_block(tag->plc->mutex) {
-            int rc = remove_tag(&(tag->plc->tag_list), tag);
+        critical_block(&tag->plc->mutex) {
+            int rc = PLCTAG_STATUS_OK;
+
+            critical_block(&tag->plc->ready_mutex) {
+                if(tag->ready_queued) {
+                    remove_ready_tag(&(tag->plc->ready_list), tag);
+                    tag->ready_queued = 0;
+                }
+            }
+
+            /* the PLC thread may have started an automatic read after the abort above. */
+            clear_request_slot(tag->plc, tag);
+
+            rc = remove_tag(&(tag->plc->tag_list), tag);
             if(rc == PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_DETAIL, "Tag removed from the PLC successfully.");
             } else if(rc == PLCTAG_ERR_NOT_FOUND) {
@@ -437,20 +570,9 @@ void modbus_tag_destructor(void *tag_arg)
         tag->plc = rc_dec(tag->plc);
     }
 
-    if(tag->api_mutex) {
-        mutex_destroy(&(tag->api_mutex));
-        tag->api_mutex = NULL;
-    }
-
-    if(tag->ext_mutex) {
-        mutex_destroy(&(tag->ext_mutex));
-        tag->ext_mutex = NULL;
-    }
-
-    if(tag->tag_cond_wait) {
-        cond_destroy(&(tag->tag_cond_wait));
-        tag->tag_cond_wait = NULL;
-    }
+    lw_mutex_destroy(&(tag->api_mutex));
+    lw_mutex_destroy(&(tag->ext_mutex));
+    lw_event_destroy(&(tag->tag_cond_wait));
 
     if(tag->byte_order && tag->byte_order->is_allocated) {
         mem_free(tag->byte_order);
@@ -466,9 +588,15 @@ void modbus_tag_destructor(void *tag_arg)
 int find_or_create_plc(attr attribs, modbus_plc_p *plc)
 {
     const char *server = attr_get_str(attribs, "gateway", NULL);
-    int server_id = attr_get_int(attribs, "path", -1);
+    const char *protocol = attr_get_str(attribs, "protocol", "modbus-tcp");
+    int is_udp = (str_cmp_i(protocol, "modbus-udp") == 0 || str_cmp_i(protocol, "modbus_udp") == 0);
     int connection_group_id = attr_get_int(attribs, "connection_group_id", 0);
-    int max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", 1);
+    int adaptive_window = attr_get_int(attribs, "adaptive_window", 0);
+    int max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", (adaptive_window ? MAX_MODBUS_REQUESTS : 1));
+    int coalesce_reads = attr_get_int(attribs, "coalesce_reads", 0);
+    int coalesce_gap = attr_get_int(attribs, "coalesce_gap", 0);
+    int coalesce_writes = attr_get_int(attribs, "coalesce_writes", 0);
+    int combine_read_write = attr_get_int(attribs, "combine_read_write", 0);
     int is_new = 0;
     int rc = PLCTAG_STATUS_OK;
 
@@ -485,21 +613,24 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
         max_requests_in_flight = 1;
     }
 
-    if(server_id < 0 || server_id > 255) {
-        pdebug(DEBUG_WARN, "Server ID, %d, out of bounds or missing!", server_id);
-        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    if(coalesce_gap < 0) {
+        pdebug(DEBUG_WARN, "coalesce_gap must not be negative, was %d.", coalesce_gap);
+        coalesce_gap = 0;
     }
 
-    /* see if we can find a matching server. */
-    critical_block(mb_mutex) {
+    /*
+     * see if we can find a matching server.  All unit IDs behind one gateway
+     * share the connection, use connection_group_id to keep them apart.
+     */
+    critical_block(&mb_mutex) {
         modbus_plc_p *walker = &plcs;
 
-        while(*walker && (*walker)->connection_group_id != connection_group_id && (*walker)->server_id != (uint8_t)(unsigned int)server_id && str_cmp_i(server, (*walker)->server) != 0) {
+        while(*walker && ((*walker)->connection_group_id != connection_group_id || (*walker)->is_udp != is_udp || str_cmp_i(server, (*walker)->server) != 0)) {
             walker = &((*walker)->next);
         }
 
         /* did we find one. */
-        if(*walker && (*walker)->connection_group_id == connection_group_id && (*walker)->server_id == (uint8_t)(unsigned int)server_id && str_cmp_i(server, (*walker)->server) == 0) {
+        if(*walker) {
             pdebug(DEBUG_DETAIL, "Using existing PLC connection.");
             *plc = rc_inc(*walker);
             is_new = 0;
@@ -510,10 +641,11 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
 
             is_new = 1;
 
-            *plc = (modbus_plc_p)rc_alloc((int)(unsigned int)sizeof(struct modbus_plc_t), modbus_plc_destructor);
+            *plc = (modbus_plc_p)rc_alloc((int)(unsigned int)sizeof(struct modbus_plc_t), modbus_plc_destructor, MEM_SUB_MODBUS_PLCS);
             if(*plc) {
                 pdebug(DEBUG_DETAIL, "Setting connection_group_id to %d.", connection_group_id);
                 (*plc)->connection_group_id = connection_group_id;
+                (*plc)->is_udp = is_udp;
 
                 /* copy the server string so that we can find this again. */
                 (*plc)->server = str_dup(server);
@@ -521,29 +653,40 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
                     pdebug(DEBUG_WARN, "Unable to allocate Modbus PLC server string!");
                     rc = PLCTAG_ERR_NO_MEM;
                 } else {
-                    /* make sure we can be found. */
-                    (*plc)->server_id = (uint8_t)(unsigned int)server_id;
-
                     /* other tags could try to add themselves immediately. */
 
                     /* clear tag list */
                     (*plc)->tag_list.head = NULL;
                     (*plc)->tag_list.tail = NULL;
 
-                    /* create the PLC mutex to protect the tag list. */
-                    rc = mutex_create(&((*plc)->mutex));
-                    if(rc != PLCTAG_STATUS_OK) {
-                        pdebug(DEBUG_WARN, "Unable to create new mutex, error %s!", plc_tag_decode_error(rc));
-                        break;
-                    }
+                    /* set up the PLC mutex to protect the tag list. */
+                    lw_mutex_init(&((*plc)->mutex));
+
+                    /* tags queue themselves for the PLC thread under this one. */
+                    lw_mutex_init(&((*plc)->ready_mutex));
+                    (*plc)->ready_list.head = NULL;
+                    (*plc)->ready_list.tail = NULL;
+                    (*plc)->tickle_list.head = NULL;
+                    (*plc)->tickle_list.tail = NULL;
 
-                    /* set up the maximum request depth. */
+                    /* set up the maximum request depth, an adaptive window starts at one request. */
                     (*plc)->max_requests_in_flight = max_requests_in_flight;
+                    (*plc)->adaptive_window = (adaptive_window ? 1 : 0);
+                    (*plc)->request_window = (adaptive_window ? 1 : max_requests_in_flight);
+
+                    /* the first tag sets up read merging for the connection. */
+                    (*plc)->coalesce_reads = (coalesce_reads ? 1 : 0);
+                    (*plc)->coalesce_gap = coalesce_gap;
+                    (*plc)->coalesce_writes = (coalesce_writes ? 1 : 0);
+                    (*plc)->combine_read_write = (combine_read_write ? 1 : 0);
 
                     /* link up the the PLC into the global list. */
                     (*plc)->next = plcs;
                     plcs = *plc;
 
+                    stats_add(STATS_LIVE_SESSIONS, 1);
+                    stats_add(STATS_MB_SLOTS_TOTAL, max_requests_in_flight);
+
                     /* now the PLC can be found and the tag list is ready for use. */
                 }
             } else {
@@ -602,7 +745,7 @@ void modbus_plc_destructor(void *plc_arg)
     }
 
     /* remove the plc from the list. */
-    critical_block(mb_mutex) {
+    critical_block(&mb_mutex) {
         modbus_plc_p *walker = &plcs;
 
         while(*walker && *walker != plc) {
@@ -613,6 +756,9 @@ void modbus_plc_destructor(void *plc_arg)
             /* unlink the list. */
             *walker = plc->next;
             plc->next = NULL;
+
+            stats_add(STATS_LIVE_SESSIONS, -1);
+            stats_add(STATS_MB_SLOTS_TOTAL, -(int64_t)plc->max_requests_in_flight);
         } else {
             pdebug(DEBUG_WARN, "PLC not found in the list!");
         }
@@ -635,10 +781,8 @@ void modbus_plc_destructor(void *plc_arg)
         plc->handler_thread = NULL;
     }
 
-    if(plc->mutex) {
-        mutex_destroy(&plc->mutex);
-        plc->mutex = NULL;
-    }
+    lw_mutex_destroy(&plc->mutex);
+    lw_mutex_destroy(&plc->ready_mutex);
 
     if(plc->sock) {
         socket_destroy(&plc->sock);
@@ -676,6 +820,7 @@ THREAD_FUNC(modbus_plc_handler)
     int64_t err_delay_until = 0;
     int sock_events = SOCK_EVENT_NONE;
     int waitable_events = SOCK_EVENT_NONE;
+    int wait_ms = MODBUS_IDLE_WAIT_TIMEOUT;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -691,9 +836,13 @@ THREAD_FUNC(modbus_plc_handler)
             /* FIXME - what should we do here? */
         }
 
-        /* if there is still a response marked ready, clean it up. */
+        /*
+         * if there is still a response marked ready, clean it up.  Responses
+         * to coalesced reads are left for every tag in the group and end up
+         * here after the pass.
+         */
         if(plc->flags.response_ready) {
-            pdebug(DEBUG_DETAIL, "Orphan response found.");
+            pdebug(DEBUG_DETAIL, "Orphan or shared response found.");
             plc->flags.response_ready = 0;
             plc->read_data_len = 0;
         }
@@ -761,6 +910,12 @@ THREAD_FUNC(modbus_plc_handler)
         case PLC_READY:
             pdebug(DEBUG_DETAIL, "in PLC_READY state.");
 
+            /* go around again right away if a tag can use a free request slot. */
+            if(plc->requests_waiting) {
+                pdebug(DEBUG_DETAIL, "%d tags waiting for a free request slot.", plc->requests_waiting);
+                break;
+            }
+
             /* calculate what events we should be waiting for. */
             waitable_events = SOCK_EVENT_DEFAULT_MASK | SOCK_EVENT_CAN_READ;
 
@@ -769,8 +924,23 @@ THREAD_FUNC(modbus_plc_handler)
                 waitable_events |= SOCK_EVENT_CAN_WRITE;
             }
 
+            /*
+             * idle tags are not visited, so do not sleep past the next automatic
+             * read.  A zero timeout would wait forever.
+             */
+            wait_ms = MODBUS_IDLE_WAIT_TIMEOUT;
+            if(plc->next_auto_read_ns) {
+                int64_t until_ms = (plc->next_auto_read_ns - time_ns()) / 1000000;
+
+                if(until_ms < 1) {
+                    wait_ms = 1;
+                } else if(until_ms < wait_ms) {
+                    wait_ms = (int)until_ms;
+                }
+            }
+
             /* this will wait if nothing wakes it up or until it times out. */
-            sock_events = socket_wait_event(plc->sock, waitable_events, MODBUS_IDLE_WAIT_TIMEOUT);
+            sock_events = socket_wait_event(plc->sock, waitable_events, wait_ms);
 
             /* check for socket errors or disconnects. */
             if((sock_events & SOCK_EVENT_ERROR) || (sock_events & SOCK_EVENT_DISCONNECT)) {
@@ -785,6 +955,7 @@ THREAD_FUNC(modbus_plc_handler)
                 socket_destroy(&(plc->sock));
 
                 plc->state = PLC_CONNECT_START;
+                stats_add(STATS_RECONNECTS, 1);
                 break;
             }
 
@@ -847,6 +1018,7 @@ THREAD_FUNC(modbus_plc_handler)
 
                 /* try to reconnect immediately. */
                 plc->state = PLC_CONNECT_START;
+                stats_add(STATS_RECONNECTS, 1);
             }
 
             /* if we did not send all the packet, we stay in this state and keep trying. */
@@ -866,7 +1038,13 @@ THREAD_FUNC(modbus_plc_handler)
                 plc->flags.response_ready = 1;
                 plc->state = PLC_READY;
             } else if(rc == PLCTAG_STATUS_PENDING) {
-                pdebug(DEBUG_DETAIL, "Response not complete, continue reading data.");
+                if(plc->is_udp) {
+                    /* a datagram comes whole or not at all. */
+                    pdebug(DEBUG_DETAIL, "No usable datagram, going back to PLC_READY state.");
+                    plc->state = PLC_READY;
+                } else {
+                    pdebug(DEBUG_DETAIL, "Response not complete, continue reading data.");
+                }
             } else {
                 pdebug(DEBUG_WARN, "Closing socket due to read error %s.", plc_tag_decode_error(rc));
 
@@ -881,6 +1059,7 @@ THREAD_FUNC(modbus_plc_handler)
 
                 /* try to reconnect immediately. */
                 plc->state = PLC_CONNECT_START;
+                stats_add(STATS_RECONNECTS, 1);
             }
 
             /* in all cases we want to cycle through the state machine immediately. */
@@ -902,6 +1081,7 @@ THREAD_FUNC(modbus_plc_handler)
             } else {
                 pdebug(DEBUG_DETAIL, "Error wait is over, going to state PLC_CONNECT_START.");
                 plc->state = PLC_CONNECT_START;
+                stats_add(STATS_RECONNECTS, 1);
             }
             break;
 
@@ -989,7 +1169,11 @@ int connect_plc(modbus_plc_p plc)
 
     /* connect to the socket */
     pdebug(DEBUG_DETAIL, "Connecting to %s on port %d...", server, port);
-    rc = socket_connect_tcp_start(plc->sock, server, port);
+    if(plc->is_udp) {
+        rc = socket_connect_udp(plc->sock, server, port);
+    } else {
+        rc = socket_connect_tcp_start(plc->sock, server, port);
+    }
     if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
         /* done with the split string. */
         mem_free(server_port);
@@ -1021,47 +1205,73 @@ int connect_plc(modbus_plc_p plc)
 int tickle_all_tags(modbus_plc_p plc)
 {
     int rc = PLCTAG_STATUS_OK;
-    struct modbus_tag_list_t idle_list = { NULL, NULL };
-    struct modbus_tag_list_t active_list = { NULL, NULL };
     modbus_tag_p tag = NULL;
+    int waiting = 0;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
     /*
      * The mutex prevents the list from changing, the PLC
      * from being freed, and the tags from being freed.
+     *
+     * Only tags in the ready list are visited.  Idle tags cost
+     * nothing until something queues them again.
      */
-    critical_block(plc->mutex) {
-        while((tag = pop_tag(&(plc->tag_list)))) {
-            int tag_pushed = 0;
+    critical_block(&plc->mutex) {
+        critical_block(&plc->ready_mutex) {
+            plc->tickle_list = plc->ready_list;
+            plc->ready_list.head = NULL;
+            plc->ready_list.tail = NULL;
+        }
+
+        wake_auto_read_tags(plc);
+
+        while((tag = pop_ready_tag(&(plc->tickle_list)))) {
+            int tag_tickled = 0;
 
             debug_set_tag_id(tag->tag_id);
 
             /* make sure nothing else can modify the tag while we are */
-            critical_block(tag->api_mutex) {
-            // if(mutex_try_lock(tag->api_mutex) == PLCTAG_STATUS_OK) {
+            critical_block(&tag->api_mutex) {
                 rc = tickle_tag(plc, tag);
-                if(rc == PLCTAG_STATUS_OK) {
-                    pdebug(DEBUG_SPEW, "Pushing tag onto idle list.");
-                    push_tag(&idle_list, tag);
-                    tag_pushed = 1;
-                } else if(rc == PLCTAG_STATUS_PENDING) {
-                    pdebug(DEBUG_SPEW, "Pushing tag onto active list.");
-                    push_tag(&active_list, tag);
-                    tag_pushed = 1;
-                } else {
-                    pdebug(DEBUG_WARN, "Error %s tickling tag! Pushing tag onto idle list.", plc_tag_decode_error(rc));
-                    push_tag(&idle_list, tag);
-                    tag_pushed = 1;
+                if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+                    pdebug(DEBUG_WARN, "Error %s tickling tag!", plc_tag_decode_error(rc));
+                }
+
+                if(tag->op == TAG_OP_READ_REQUEST || tag->op == TAG_OP_WRITE_REQUEST || read_chunks_left(tag)) {
+                    waiting++;
+                }
+
+                /*
+                 * decide whether the tag stays queued while we still hold the
+                 * API mutex so that a new read or write cannot slip in between.
+                 */
+                critical_block(&plc->ready_mutex) {
+                    if(tag_needs_plc(tag)) {
+                        pdebug(DEBUG_SPEW, "Keeping tag in the ready list.");
+                        push_ready_tag(&(plc->ready_list), tag);
+                    } else {
+                        pdebug(DEBUG_SPEW, "Tag is idle.");
+                        tag->ready_queued = 0;
+                    }
+                }
+
+                /* idle tags with automatic reads come back on a timer. */
+                if(!tag->ready_queued && tag->auto_sync_read_ns > 0) {
+                    if(!plc->next_auto_read_ns || tag->auto_sync_next_read < plc->next_auto_read_ns) {
+                        plc->next_auto_read_ns = tag->auto_sync_next_read;
+                    }
                 }
+
+                tag_tickled = 1;
             }
 
-            if(tag_pushed) {
+            if(tag_tickled) {
                 /* call the callbacks outside the API mutex. */
                 plc_tag_generic_handle_event_callbacks((plc_tag_p)tag);
             } else {
-                pdebug(DEBUG_WARN, "Tag mutex not taken!  Doing emergency push of tag onto idle list.");
-                push_tag(&idle_list, tag);
+                pdebug(DEBUG_WARN, "Tag mutex not taken!  Putting the tag back in the ready list.");
+                queue_ready_tag(plc, tag);
             }
 
             rc = PLCTAG_STATUS_OK;
@@ -1069,9 +1279,24 @@ int tickle_all_tags(modbus_plc_p plc)
             debug_set_tag_id(0);
         }
 
-        /* merge the lists and replace the old list. */
-        pdebug(DEBUG_SPEW, "Merging active and idle lists.");
-        plc->tag_list = merge_lists(&active_list, &idle_list);
+        /*
+         * a slot freed by a response late in the pass could not be used by
+         * the tags visited before it.  Tell the PLC thread not to sleep.
+         */
+        plc->requests_waiting = 0;
+        if(waiting && !plc->flags.request_ready) {
+            int in_use = 0;
+
+            for(int slot=0; slot < plc->max_requests_in_flight; slot++) {
+                if(plc->tags_with_requests[slot] != 0) {
+                    in_use++;
+                }
+            }
+
+            if(in_use < plc->request_window) {
+                plc->requests_waiting = waiting;
+            }
+        }
     }
 
     pdebug(DEBUG_DETAIL, "Done: %s", plc_tag_decode_error(rc));
@@ -1100,6 +1325,9 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
         case TAG_OP_READ_REQUEST:
             /* if the PLC is ready and there is no request queued yet, build a request. */
             if(find_request_slot(plc, tag) == PLCTAG_STATUS_OK) {
+                /* see if other pending reads can ride along. */
+                plan_read_group(plc, tag);
+
                 rc = create_read_request(plc, tag);
                 if(rc == PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_DETAIL, "Read request created.");
@@ -1107,6 +1335,8 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
                     tag->op = TAG_OP_READ_RESPONSE;
                     plc->flags.request_ready = 1;
 
+                    join_read_group(plc, tag);
+
                     rc = PLCTAG_STATUS_PENDING;
                 } else {
                     pdebug(DEBUG_WARN, "Error %s creating read request!", plc_tag_decode_error(rc));
@@ -1114,6 +1344,7 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
                     /* remove the tag from the request slot. */
                     clear_request_slot(plc, tag);
 
+                    tag->coalesced = 0;
                     tag->op = TAG_OP_IDLE;
                     tag->read_complete = 1;
                     tag->read_in_flight = 0;
@@ -1139,6 +1370,53 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
             || plc->state == PLC_CONNECT_WAIT
             || plc->state == PLC_ERR_WAIT) {
                 pdebug(DEBUG_WARN, "PLC changed state, restarting request.");
+                clear_request_slot(plc, tag);
+                tag->coalesced = 0;
+                tag->request_num = 0;
+                tag->response_count = 0;
+                tag->op = TAG_OP_READ_REQUEST;
+                break;
+            }
+
+            if(!tag->coalesced) {
+                track_oldest_chunk(plc, tag);
+            }
+
+            if(request_timed_out(plc, tag)) {
+                adjust_request_window(plc, tag, PLCTAG_ERR_TIMEOUT);
+
+                /* the other chunks of the read are still good. */
+                if(!tag->coalesced && tag->request_slot >= 0) {
+                    pdebug(DEBUG_WARN, "No response from the server, sending the request again.");
+
+                    rc = resend_read_chunk(plc, tag);
+                    if(rc == PLCTAG_STATUS_OK || rc == PLCTAG_STATUS_PENDING) {
+                        break;
+                    }
+
+                    clear_request_slot(plc, tag);
+
+                    tag->request_num = 0;
+                    tag->response_count = 0;
+                    tag->op = TAG_OP_IDLE;
+                    tag->read_complete = 1;
+                    tag->read_in_flight = 0;
+                    tag->status = (int8_t)rc;
+
+                    raise_event = 1;
+                    event = PLCTAG_EVENT_READ_COMPLETED;
+                    event_status = rc;
+
+                    plc_tag_generic_wake_tag((plc_tag_p)tag);
+                    rc = PLCTAG_STATUS_OK;
+                    break;
+                }
+
+                pdebug(DEBUG_WARN, "No response from the server, restarting request.");
+                clear_request_slot(plc, tag);
+                tag->coalesced = 0;
+                tag->request_num = 0;
+                tag->response_count = 0;
                 tag->op = TAG_OP_READ_REQUEST;
                 break;
             }
@@ -1150,11 +1428,10 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
                         /* partial response, keep going */
                         pdebug(DEBUG_DETAIL, "Found our response, but we are not done.");
 
-                        /* remove the tag from the request slot. */
-                        clear_request_slot(plc, tag);
+                        adjust_request_window(plc, tag, PLCTAG_STATUS_OK);
 
-                        plc->flags.response_ready = 0;
-                        tag->op = TAG_OP_READ_REQUEST;
+                        /* only this chunk is done, the others keep their slots. */
+                        release_request_slot(plc, tag);
 
                         rc = PLCTAG_STATUS_OK;
                         break;
@@ -1164,24 +1441,66 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
                         rc = PLCTAG_STATUS_PENDING;
                         break;
 
+                    case PLCTAG_ERR_BUSY:
+                        /* an adaptive window backs off and tries again. */
+                        if(plc->adaptive_window) {
+                            pdebug(DEBUG_DETAIL, "Server busy, retrying the request.");
+
+                            adjust_request_window(plc, tag, rc);
+                            clear_request_slot(plc, tag);
+
+                            tag->coalesced = 0;
+                            tag->request_num = 0;
+                            tag->response_count = 0;
+                            tag->op = TAG_OP_READ_REQUEST;
+                            tag->read_complete = 0;
+                            tag->read_in_flight = 1;
+                            tag->status = (int8_t)PLCTAG_STATUS_PENDING;
+
+                            rc = PLCTAG_STATUS_OK;
+                            break;
+                        }
+
+                        /* fall through */
                     case PLCTAG_STATUS_OK:
                         /* fall through */
                     default:
+                        /* the error may belong to another tag in the group. */
+                        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_BUSY && tag->coalesced) {
+                            pdebug(DEBUG_DETAIL, "Shared read failed with %s, reading the tag on its own.", plc_tag_decode_error(rc));
+
+                            clear_request_slot(plc, tag);
+
+                            tag->coalesced = 0;
+                            tag->no_coalesce = 1;
+                            tag->request_num = 0;
+                            tag->response_count = 0;
+                            tag->op = TAG_OP_READ_REQUEST;
+                            tag->read_complete = 0;
+                            tag->read_in_flight = 1;
+                            tag->status = (int8_t)PLCTAG_STATUS_PENDING;
+
+                            rc = PLCTAG_STATUS_OK;
+                            break;
+                        }
+
                         /* set the status before we might change it. */
                         tag->status = (int8_t)rc;
 
+                        adjust_request_window(plc, tag, rc);
+
+                        /* check_read_response() releases the response unless other tags share it. */
                         if(rc == PLCTAG_STATUS_OK) {
                             pdebug(DEBUG_DETAIL, "Found our response.");
-                            plc->flags.response_ready = 0;
                         } else {
                             pdebug(DEBUG_WARN, "Error %s checking read response!", plc_tag_decode_error(rc));
-                            rc = PLCTAG_STATUS_OK;
                         }
 
                         /* remove the tag from the request slot. */
                         clear_request_slot(plc, tag);
 
-                        plc->flags.response_ready = 0;
+                        /* the tag keeps the error, the PLC thread carries on. */
+                        tag->coalesced = 0;
                         tag->op = TAG_OP_IDLE;
                         tag->read_in_flight = 0;
                         tag->read_complete = 1;
@@ -1195,12 +1514,35 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
                         //plc_tag_tickler_wake();
                         plc_tag_generic_wake_tag((plc_tag_p)tag);
 
+                        rc = PLCTAG_STATUS_OK;
                         break;
                 }
             } else {
                 pdebug(DEBUG_SPEW, "No response yet, Continue waiting.");
                 rc = PLCTAG_STATUS_PENDING;
             }
+
+            /* use any free slot for the next chunk of a large read. */
+            if(read_chunks_left(tag)) {
+                rc = send_next_read_chunk(plc, tag);
+                if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+                    clear_request_slot(plc, tag);
+
+                    tag->request_num = 0;
+                    tag->response_count = 0;
+                    tag->op = TAG_OP_IDLE;
+                    tag->read_complete = 1;
+                    tag->read_in_flight = 0;
+                    tag->status = (int8_t)rc;
+
+                    raise_event = 1;
+                    event = PLCTAG_EVENT_READ_COMPLETED;
+                    event_status = rc;
+
+                    plc_tag_generic_wake_tag((plc_tag_p)tag);
+                    rc = PLCTAG_STATUS_OK;
+                }
+            }
             break;
 
         case TAG_OP_WRITE_REQUEST:
@@ -1220,6 +1562,7 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
                     /* remove the tag from the request slot. */
                     clear_request_slot(plc, tag);
 
+                    tag->coalesced = 0;
                     tag->op = TAG_OP_IDLE;
                     tag->write_complete = 1;
                     tag->write_in_flight = 0;
@@ -1246,6 +1589,16 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
             || plc->state == PLC_CONNECT_WAIT
             || plc->state == PLC_ERR_WAIT) {
                 pdebug(DEBUG_WARN, "PLC changed state, restarting request.");
+                tag->coalesced = 0;
+                tag->op = TAG_OP_WRITE_REQUEST;
+                break;
+            }
+
+            if(request_timed_out(plc, tag)) {
+                pdebug(DEBUG_WARN, "No response from the server, restarting request.");
+                adjust_request_window(plc, tag, PLCTAG_ERR_TIMEOUT);
+                clear_request_slot(plc, tag);
+                tag->coalesced = 0;
                 tag->op = TAG_OP_WRITE_REQUEST;
                 break;
             }
@@ -1255,10 +1608,16 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
                 if(rc == PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_DETAIL, "Found our response.");
 
+                    adjust_request_window(plc, tag, rc);
+
                     /* remove the tag from the request slot. */
                     clear_request_slot(plc, tag);
 
-                    plc->flags.response_ready = 0;
+                    if(!tag->coalesced) {
+                        plc->flags.response_ready = 0;
+                    }
+
+                    tag->coalesced = 0;
                     tag->op = TAG_OP_IDLE;
                     tag->write_complete = 1;
                     tag->write_in_flight = 0;
@@ -1276,20 +1635,67 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
                 } else if(rc == PLCTAG_ERR_PARTIAL) {
                     pdebug(DEBUG_DETAIL, "Found our response, but we are not done.");
 
-                    plc->flags.response_ready = 0;
+                    adjust_request_window(plc, tag, PLCTAG_STATUS_OK);
+
+                    /* remove the tag from the request slot. */
+                    clear_request_slot(plc, tag);
+
+                    if(!tag->coalesced) {
+                        plc->flags.response_ready = 0;
+                    }
+
+                    tag->coalesced = 0;
                     tag->op = TAG_OP_WRITE_REQUEST;
 
                     rc = PLCTAG_STATUS_OK;
                 } else if(rc == PLCTAG_ERR_NO_MATCH) {
                     pdebug(DEBUG_SPEW, "Not our response.");
                     rc = PLCTAG_STATUS_PENDING;
+                } else if(rc == PLCTAG_ERR_BUSY && plc->adaptive_window) {
+                    /* an adaptive window backs off and tries again. */
+                    pdebug(DEBUG_DETAIL, "Server busy, retrying the request.");
+
+                    adjust_request_window(plc, tag, rc);
+                    clear_request_slot(plc, tag);
+
+                    tag->coalesced = 0;
+                    tag->op = TAG_OP_WRITE_REQUEST;
+                    tag->write_complete = 0;
+                    tag->write_in_flight = 1;
+                    tag->status = (int8_t)PLCTAG_STATUS_PENDING;
+
+                    rc = PLCTAG_STATUS_OK;
+                } else if(rc != PLCTAG_ERR_BUSY && tag->coalesced) {
+                    /*
+                     * the error may come from another tag's registers or the
+                     * attached read.  Write on our own, the reads retry alone too.
+                     */
+                    pdebug(DEBUG_DETAIL, "Shared write failed with %s, writing the tag on its own.", plc_tag_decode_error(rc));
+
+                    clear_request_slot(plc, tag);
+
+                    tag->coalesced = 0;
+                    tag->no_coalesce = 1;
+                    tag->request_num = 0;
+                    tag->op = TAG_OP_WRITE_REQUEST;
+                    tag->write_complete = 0;
+                    tag->write_in_flight = 1;
+                    tag->status = (int8_t)PLCTAG_STATUS_PENDING;
+
+                    rc = PLCTAG_STATUS_OK;
                 } else {
                     pdebug(DEBUG_WARN, "Error %s checking write response!", plc_tag_decode_error(rc));
 
+                    adjust_request_window(plc, tag, rc);
+
                     /* remove the tag from the request slot. */
                     clear_request_slot(plc, tag);
 
-                    plc->flags.response_ready = 0;
+                    if(!tag->coalesced) {
+                        plc->flags.response_ready = 0;
+                    }
+
+                    tag->coalesced = 0;
                     tag->op = TAG_OP_IDLE;
                     tag->write_complete = 1;
                     tag->write_in_flight = 0;
@@ -1346,6 +1752,8 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag)
 
 int find_request_slot(modbus_plc_p plc, modbus_tag_p tag)
 {
+    int in_use = 0;
+
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(plc->flags.request_ready) {
@@ -1363,12 +1771,31 @@ int find_request_slot(modbus_plc_p plc, modbus_tag_p tag)
         return PLCTAG_ERR_BUSY;
     }
 
+    /* the window can be smaller than the number of slots. */
+    for(int slot=0; slot < plc->max_requests_in_flight; slot++) {
+        if(plc->tags_with_requests[slot] != 0) {
+            in_use++;
+        }
+    }
+
+    if(in_use >= plc->request_window) {
+        pdebug(DEBUG_SPEW, "Request window of %d is full.", plc->request_window);
+        return PLCTAG_ERR_NO_RESOURCES;
+    }
+
     /* search for a slot. */
     for(int slot=0; slot < plc->max_requests_in_flight; slot++) {
         if(plc->tags_with_requests[slot] == 0) {
             pdebug(DEBUG_DETAIL, "Found request slot %d for tag %"PRId32".", slot, tag->tag_id);
             plc->tags_with_requests[slot] = tag->tag_id;
             tag->request_slot = slot;
+            stats_add(STATS_MB_SLOTS_IN_USE, 1);
+
+            /* only grow the window when it is actually used. */
+            if(in_use + 1 >= plc->request_window) {
+                plc->window_full = 1;
+            }
+
             return PLCTAG_STATUS_OK;
         }
     }
@@ -1394,6 +1821,7 @@ void clear_request_slot(modbus_plc_p plc, modbus_tag_p tag)
 
             plc->tags_with_requests[slot] = 0;
             tag->request_slot = -1;
+            stats_add(STATS_MB_SLOTS_IN_USE, -1);
         }
     }
 
@@ -1402,70 +1830,247 @@ void clear_request_slot(modbus_plc_p plc, modbus_tag_p tag)
 
 
 
-int receive_response(modbus_plc_p plc)
+/*
+ * release_request_slot
+ *
+ * Free only the slot of the request that just finished.  Unlike
+ * clear_request_slot(), other chunks of the same read keep theirs.
+ */
+
+void release_request_slot(modbus_plc_p plc, modbus_tag_p tag)
 {
-    int rc = 0;
-    int data_needed = 0;
+    int slot = tag->request_slot;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+    if(slot >= 0 && slot < plc->max_requests_in_flight && plc->tags_with_requests[slot] == tag->tag_id) {
+        pdebug(DEBUG_DETAIL, "Releasing slot %d of tag %"PRId32".", slot, tag->tag_id);
 
-    /* socket could be closed due to inactivity. */
-    if(!plc->sock) {
-        pdebug(DEBUG_SPEW, "Socket is closed or missing.");
-        return PLCTAG_STATUS_OK;
+        plc->tags_with_requests[slot] = 0;
+        stats_add(STATS_MB_SLOTS_IN_USE, -1);
     }
 
-    do {
-        /* how much data do we need? */
-        if(plc->read_data_len >= MODBUS_MBAP_SIZE) {
-            int packet_size = plc->read_data[5] + (plc->read_data[4] << 8);
-            data_needed = (MODBUS_MBAP_SIZE + packet_size) - plc->read_data_len;
+    tag->request_slot = -1;
+}
 
-            pdebug(DEBUG_DETAIL, "Packet header read, data_needed=%d, packet_size=%d, read_data_len=%d", data_needed, packet_size, plc->read_data_len);
 
-            if(data_needed > PLC_READ_DATA_LEN) {
-                pdebug(DEBUG_WARN, "Error, packet size, %d, greater than buffer size, %d!", data_needed, PLC_READ_DATA_LEN);
-                return PLCTAG_ERR_TOO_LARGE;
-            } else if(data_needed < 0) {
-                pdebug(DEBUG_WARN, "Read more than a packet!  Expected %d bytes, but got %d bytes!", (MODBUS_MBAP_SIZE + packet_size), plc->read_data_len);
-                return PLCTAG_ERR_TOO_LARGE;
-            }
-        } else {
-            data_needed = MODBUS_MBAP_SIZE - plc->read_data_len;
-            pdebug(DEBUG_DETAIL, "Still reading packet header, data_needed=%d, read_data_len=%d", data_needed, plc->read_data_len);
+
+/*
+ * adjust_request_window
+ *
+ * Grow or shrink the number of requests allowed in flight when the
+ * adaptive window is on.  This works like TCP congestion control.  Each
+ * time a full window of responses has come back, the window grows by one
+ * if it was actually filled and the smoothed round trip time is still
+ * close to the best seen.  If the round trip time has doubled instead,
+ * the window shrinks by one.  A busy server or a lost response halves it.
+ * After that, sizes at or past the one that failed are only tried one
+ * step per so many clean rounds.  That number doubles each time the same
+ * size fails again.
+ *
+ * Only the tag that owns the request slot counts, so a shared request is
+ * only counted once.
+ *
+ * Over UDP the round trip time and timeout backoff are kept even with a
+ * fixed window, they set the retransmit timer.
+ *
+ * Called from the PLC thread with the PLC mutex held.
+ */
+
+void adjust_request_window(modbus_plc_p plc, modbus_tag_p tag, int status)
+{
+    int old_window = plc->request_window;
+
+    if((!plc->adaptive_window && !plc->is_udp) || tag->request_slot < 0) {
+        return;
+    }
+
+    if(status == PLCTAG_ERR_BUSY || status == PLCTAG_ERR_TIMEOUT) {
+        /* the rest of a burst sent before the window was cut fails too, only count it once. */
+        if(tag->request_start_ms <= plc->window_cut_ms) {
+            return;
         }
 
-        if(data_needed == 0) {
-            pdebug(DEBUG_DETAIL, "Got all data needed.");
-            break;
+        plc->window_cut_ms = time_ms();
+
+        if(status == PLCTAG_ERR_TIMEOUT && plc->timeout_backoff < MODBUS_MAX_TIMEOUT_BACKOFF) {
+            plc->timeout_backoff++;
         }
 
-        /* read the socket. */
-        rc = socket_read(plc->sock, plc->read_data + plc->read_data_len, data_needed, SOCKET_READ_TIMEOUT);
-        if(rc >= 0) {
-            /* got data! Or got nothing, but no error. */
-            plc->read_data_len += rc;
+        if(!plc->adaptive_window) {
+            return;
+        }
 
-            pdebug_dump_bytes(DEBUG_SPEW, plc->read_data, plc->read_data_len);
-        } else if(rc == PLCTAG_ERR_TIMEOUT) {
-            pdebug(DEBUG_DETAIL, "Done. Socket read timed out.");
-            return PLCTAG_STATUS_PENDING;
+        /* wait longer each time the same size fails again. */
+        if(plc->loss_window > 0 && plc->request_window + 1 >= plc->loss_window) {
+            plc->probe_rounds = (plc->probe_rounds * 2 < MODBUS_MAX_PROBE_ROUNDS ? plc->probe_rounds * 2 : MODBUS_MAX_PROBE_ROUNDS);
         } else {
-            pdebug(DEBUG_WARN, "Error, %s, reading socket!", plc_tag_decode_error(rc));
-            return rc;
+            plc->probe_rounds = MODBUS_MIN_PROBE_ROUNDS;
         }
 
-        pdebug(DEBUG_DETAIL, "After reading the socket, total read=%d and data needed=%d.", plc->read_data_len, data_needed);
-    } while(rc > 0);
+        plc->loss_window = plc->request_window;
+        plc->clean_rounds = 0;
+        plc->request_window = (plc->request_window > 1 ? plc->request_window / 2 : 1);
+        plc->window_responses = 0;
+        plc->window_full = 0;
+    } else {
+        int64_t rtt = time_ms() - tag->request_start_ms;
 
+        if(rtt < 0) {
+            rtt = 0;
+        }
 
-    if(data_needed == 0) {
-        /* we got our packet. */
-        pdebug(DEBUG_DETAIL, "Received full packet.");
-        pdebug_dump_bytes(DEBUG_DETAIL, plc->read_data, plc->read_data_len);
-        plc->flags.response_ready = 1;
+        if(plc->srtt_ms == 0 && plc->base_rtt_ms == 0) {
+            plc->base_rtt_ms = rtt;
+            plc->srtt_ms = rtt;
+        } else {
+            plc->base_rtt_ms = (rtt < plc->base_rtt_ms ? rtt : plc->base_rtt_ms);
+            plc->srtt_ms = ((7 * plc->srtt_ms) + rtt) / 8;
+        }
 
-        rc = PLCTAG_STATUS_OK;
+        plc->timeout_backoff = 0;
+
+        if(!plc->adaptive_window) {
+            return;
+        }
+
+        plc->window_responses++;
+
+        if(plc->window_responses >= plc->request_window) {
+            /* allow a couple of milliseconds of jitter for fast links. */
+            int64_t flat_rtt = plc->base_rtt_ms + (plc->base_rtt_ms / 2) + 2;
+
+            plc->clean_rounds++;
+
+            if(plc->srtt_ms <= flat_rtt) {
+                if(plc->window_full && plc->request_window < plc->max_requests_in_flight) {
+                    if(plc->loss_window == 0 || plc->request_window + 1 < plc->loss_window) {
+                        plc->request_window++;
+                    } else if(plc->clean_rounds >= plc->probe_rounds) {
+                        /* at or past a size that failed, go one step at a time. */
+                        plc->request_window++;
+                        plc->loss_window = plc->request_window + 1;
+                        plc->clean_rounds = 0;
+                    }
+                }
+            } else if(plc->srtt_ms > (2 * flat_rtt) && plc->request_window > 1) {
+                plc->request_window--;
+            }
+
+            plc->window_responses = 0;
+            plc->window_full = 0;
+        }
+    }
+
+    if(plc->request_window != old_window) {
+        pdebug(DEBUG_DETAIL, "Request window changed from %d to %d, smoothed round trip time %" PRId64 "ms, base %" PRId64 "ms.", old_window, plc->request_window, plc->srtt_ms, plc->base_rtt_ms);
+    }
+}
+
+
+
+/*
+ * request_timed_out
+ *
+ * With an adaptive window or over UDP, a request that gets no response is
+ * sent again rather than holding its slot forever.  Some gateways drop
+ * requests past their limit without any error and datagrams get lost.
+ * The timeout follows the smoothed round trip time and doubles with each
+ * timeout in a row, so a slow link still gets its responses in.
+ */
+
+int request_timed_out(modbus_plc_p plc, modbus_tag_p tag)
+{
+    int64_t timeout = 4 * plc->srtt_ms;
+
+    if((!plc->adaptive_window && !plc->is_udp) || tag->request_start_ms == 0) {
+        return 0;
+    }
+
+    if(timeout < MODBUS_MIN_RESPONSE_TIMEOUT) {
+        timeout = MODBUS_MIN_RESPONSE_TIMEOUT;
+    }
+
+    timeout = timeout << plc->timeout_backoff;
+
+    if(timeout > MODBUS_MAX_RESPONSE_TIMEOUT) {
+        timeout = MODBUS_MAX_RESPONSE_TIMEOUT;
+    }
+
+    return (time_ms() - tag->request_start_ms) > timeout;
+}
+
+
+
+int receive_response(modbus_plc_p plc)
+{
+    int rc = 0;
+    int data_needed = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* socket could be closed due to inactivity. */
+    if(!plc->sock) {
+        pdebug(DEBUG_SPEW, "Socket is closed or missing.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(plc->is_udp) {
+        return receive_datagram(plc);
+    }
+
+    do {
+        /* how much data do we need? */
+        if(plc->read_data_len >= MODBUS_MBAP_SIZE) {
+            int packet_size = plc->read_data[5] + (plc->read_data[4] << 8);
+            data_needed = (MODBUS_MBAP_SIZE + packet_size) - plc->read_data_len;
+
+            pdebug(DEBUG_DETAIL, "Packet header read, data_needed=%d, packet_size=%d, read_data_len=%d", data_needed, packet_size, plc->read_data_len);
+
+            if(data_needed > PLC_READ_DATA_LEN) {
+                pdebug(DEBUG_WARN, "Error, packet size, %d, greater than buffer size, %d!", data_needed, PLC_READ_DATA_LEN);
+                return PLCTAG_ERR_TOO_LARGE;
+            } else if(data_needed < 0) {
+                pdebug(DEBUG_WARN, "Read more than a packet!  Expected %d bytes, but got %d bytes!", (MODBUS_MBAP_SIZE + packet_size), plc->read_data_len);
+                return PLCTAG_ERR_TOO_LARGE;
+            }
+        } else {
+            data_needed = MODBUS_MBAP_SIZE - plc->read_data_len;
+            pdebug(DEBUG_DETAIL, "Still reading packet header, data_needed=%d, read_data_len=%d", data_needed, plc->read_data_len);
+        }
+
+        if(data_needed == 0) {
+            pdebug(DEBUG_DETAIL, "Got all data needed.");
+            break;
+        }
+
+        /* read the socket. */
+        rc = socket_read(plc->sock, plc->read_data + plc->read_data_len, data_needed, SOCKET_READ_TIMEOUT);
+        if(rc >= 0) {
+            /* got data! Or got nothing, but no error. */
+            plc->read_data_len += rc;
+
+            pdebug_dump_bytes(DEBUG_SPEW, plc->read_data, plc->read_data_len);
+        } else if(rc == PLCTAG_ERR_TIMEOUT) {
+            pdebug(DEBUG_DETAIL, "Done. Socket read timed out.");
+            return PLCTAG_STATUS_PENDING;
+        } else {
+            pdebug(DEBUG_WARN, "Error, %s, reading socket!", plc_tag_decode_error(rc));
+            return rc;
+        }
+
+        pdebug(DEBUG_DETAIL, "After reading the socket, total read=%d and data needed=%d.", plc->read_data_len, data_needed);
+    } while(rc > 0);
+
+
+    if(data_needed == 0) {
+        /* we got our packet. */
+        pdebug(DEBUG_DETAIL, "Received full packet.");
+        pdebug_dump_bytes(DEBUG_DETAIL, plc->read_data, plc->read_data_len);
+        plc->flags.response_ready = 1;
+
+        stats_add(STATS_PACKETS_RECEIVED, 1);
+        stats_add(STATS_BYTES_RECEIVED, plc->read_data_len);
+
+        rc = PLCTAG_STATUS_OK;
     } else {
         /* data_needed is greater than zero. */
         pdebug(DEBUG_DETAIL, "Received partial packet of %d bytes of %d.", plc->read_data_len, (data_needed + plc->read_data_len));
@@ -1484,6 +2089,63 @@ int receive_response(modbus_plc_p plc)
 
 
 
+/*
+ * receive_datagram
+ *
+ * Read one Modbus/UDP response.  The datagram holds the whole packet, so
+ * there is no partial read to keep between calls.  A short or malformed
+ * datagram, or an error such as an ICMP port unreachable, is dropped like
+ * a lost packet and the request timer sends the request again.
+ */
+
+int receive_datagram(modbus_plc_p plc)
+{
+    int rc = 0;
+    int packet_size = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    plc->read_data_len = 0;
+
+    rc = socket_read(plc->sock, plc->read_data, PLC_READ_DATA_LEN, SOCKET_READ_TIMEOUT);
+    if(rc == 0 || rc == PLCTAG_ERR_TIMEOUT) {
+        pdebug(DEBUG_DETAIL, "No datagram.");
+        return PLCTAG_STATUS_PENDING;
+    } else if(rc < 0) {
+        pdebug(DEBUG_WARN, "Error, %s, reading socket!  Dropping the packet.", plc_tag_decode_error(rc));
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    stats_add(STATS_PACKETS_RECEIVED, 1);
+    stats_add(STATS_BYTES_RECEIVED, rc);
+
+    if(rc < MODBUS_MBAP_SIZE) {
+        pdebug(DEBUG_WARN, "Datagram of %d bytes is too short, dropping it.", rc);
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    packet_size = plc->read_data[5] + (plc->read_data[4] << 8);
+    if(MODBUS_MBAP_SIZE + packet_size != rc) {
+        pdebug(DEBUG_WARN, "Datagram of %d bytes does not match its header size of %d, dropping it.", rc, MODBUS_MBAP_SIZE + packet_size);
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    pdebug(DEBUG_DETAIL, "Received full packet.");
+    pdebug_dump_bytes(DEBUG_DETAIL, plc->read_data, rc);
+
+    plc->read_data_len = rc;
+    plc->flags.response_ready = 1;
+
+    /* keep the socket open while the server answers. */
+    plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int send_request(modbus_plc_p plc)
 {
     int rc = 1;
@@ -1526,6 +2188,10 @@ int send_request(modbus_plc_p plc)
         pdebug(DEBUG_DETAIL, "Full packet written.");
         pdebug_dump_bytes(DEBUG_DETAIL, plc->write_data, plc->write_data_len);
 
+        stats_add(STATS_PACKETS_SENT, 1);
+        stats_add(STATS_REQUESTS_SENT, 1);
+        stats_add(STATS_BYTES_SENT, plc->write_data_len);
+
         // plc->flags.request_ready = 0;
         plc->write_data_len = 0;
         plc->write_data_offset = 0;
@@ -1561,6 +2227,12 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
     pdebug(DEBUG_DETAIL, "base_register = %d", base_register);
     pdebug(DEBUG_DETAIL, "register_count = %d", register_count);
 
+    /* a coalesced read covers the whole group. */
+    if(tag->coalesced) {
+        base_register = tag->read_base;
+        register_count = tag->read_count;
+    }
+
     /* clamp the number of registers we ask for to what will fit. */
     if(register_count > registers_per_request) {
         register_count = registers_per_request;
@@ -1599,7 +2271,7 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = 6; plc->write_data_len++;
 
     /* device address */
-    plc->write_data[plc->write_data_len] = plc->server_id; plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = tag->server_id; plc->write_data_len++;
 
     /* function code depends on the register type. */
     switch(tag->reg_type) {
@@ -1634,9 +2306,21 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 0) & 0xFF); plc->write_data_len++;
 
     tag->seq_id = seq_id;
+    tag->request_start_ms = time_ms();
     plc->flags.request_ready = 1;
     plc->request_tag_id = tag->tag_id;
 
+    /* remember which chunk the slot is waiting for. */
+    if(tag->request_slot >= 0) {
+        plc->slot_seq_id[tag->request_slot] = seq_id;
+        plc->slot_request_num[tag->request_slot] = tag->request_num;
+        plc->slot_start_ms[tag->request_slot] = tag->request_start_ms;
+    }
+
+    if(!tag->coalesced) {
+        tag->request_num++;
+    }
+
     pdebug(DEBUG_DETAIL, "Created read request:");
     pdebug_dump_bytes(DEBUG_DETAIL, plc->write_data, plc->write_data_len);
 
@@ -1663,81 +2347,674 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
  */
 
 
-int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
+int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint16_t seq_id = (uint16_t)((uint16_t)plc->read_data[1] +(uint16_t)(plc->read_data[0] << 8));
+    int partial_read = 0;
+    int slot = -1;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* each chunk of a large read has its own slot and sequence ID. */
+    if(!tag->coalesced) {
+        slot = find_response_slot(plc, tag, seq_id);
+        if(slot >= 0) {
+            tag->request_slot = slot;
+            tag->request_start_ms = plc->slot_start_ms[slot];
+        }
+    }
+
+    if((tag->coalesced && seq_id == tag->seq_id) || slot >= 0) {
+        uint8_t has_error = plc->read_data[7] & (uint8_t)0x80;
+
+        /* the operation is complete regardless of the outcome. */
+        //tag->flags.operation_complete = 1;
+
+        if(has_error) {
+            rc = translate_modbus_error(plc->read_data[8]);
+
+            pdebug(DEBUG_WARN, "Got read response %ud, with error %s, of length %d.", (int)(unsigned int)seq_id, plc_tag_decode_error(rc), plc->read_data_len);
+        } else if(tag->coalesced) {
+            /* our registers are somewhere in the middle of the response. */
+            rc = copy_coalesced_data(plc, tag);
+            partial_read = 0;
+        } else {
+            int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
+            int register_offset = (plc->slot_request_num[slot] * registers_per_request);
+            int byte_offset = (register_offset * tag->elem_size) / 8;
+            uint8_t payload_size = plc->read_data[8];
+            int copy_size = ((tag->size - byte_offset) < payload_size ? (tag->size - byte_offset) : payload_size);
+
+            /* no error. So copy the data. */
+            pdebug(DEBUG_DETAIL, "Got read response %u of length %d with payload of size %d.", (int)(unsigned int)seq_id, plc->read_data_len, payload_size);
+            pdebug(DEBUG_DETAIL, "registers_per_request = %d", registers_per_request);
+            pdebug(DEBUG_DETAIL, "register_offset = %d", register_offset);
+            pdebug(DEBUG_DETAIL, "byte_offset = %d", byte_offset);
+            pdebug(DEBUG_DETAIL, "copy_size = %d", copy_size);
+
+            mem_copy(tag->data + byte_offset, &plc->read_data[9], copy_size);
+
+            /* are we done?  Chunks can come back in any order. */
+            tag->response_count++;
+            if(tag->response_count < read_request_count(tag)) {
+                /* Not yet. */
+                pdebug(DEBUG_DETAIL, "Not done reading entire tag.");
+                partial_read = 1;
+            } else {
+                /* read is done. */
+                pdebug(DEBUG_DETAIL, "Read is complete.");
+                partial_read = 0;
+            }
+
+            rc = PLCTAG_STATUS_OK;
+        }
+
+        /* either way, clean up the PLC buffer unless the rest of the group still needs it. */
+        if(!tag->coalesced) {
+            plc->read_data_len = 0;
+            plc->flags.response_ready = 0;
+        }
+
+        /* clean up tag*/
+        if(!partial_read) {
+            pdebug(DEBUG_DETAIL, "Read is complete.  Cleaning up tag state.");
+            tag->seq_id = 0;
+            tag->read_complete = 1;
+            tag->read_in_flight = 0;
+            tag->status = (int8_t)rc;
+            tag->request_num = 0;
+            tag->response_count = 0;
+        } else {
+            pdebug(DEBUG_DETAIL, "Read is partially complete.  We need at least one more response.");
+            rc = PLCTAG_ERR_PARTIAL;
+            tag->status = (int8_t)PLCTAG_STATUS_PENDING;
+        }
+    } else {
+        pdebug(DEBUG_DETAIL, "Not our response.");
+
+        rc = PLCTAG_ERR_NO_MATCH;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done: %s", plc_tag_decode_error(rc));
+
+    return rc;
+}
+
+
+
+/*
+ * read_request_count
+ *
+ * How many requests it takes to read the whole tag.
+ */
+
+int read_request_count(modbus_tag_p tag)
+{
+    int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
+
+    return (tag->elem_count + registers_per_request - 1) / registers_per_request;
+}
+
+
+
+/*
+ * read_chunks_left
+ *
+ * True when the tag is in the middle of a large read and some of its
+ * requests have not been sent yet.
+ */
+
+int read_chunks_left(modbus_tag_p tag)
+{
+    return (tag->op == TAG_OP_READ_RESPONSE
+            && !tag->coalesced
+            && tag->request_num > 0
+            && tag->request_num < read_request_count(tag));
+}
+
+
+
+/*
+ * find_response_slot
+ *
+ * Find the slot of the tag that is waiting for the response with seq_id.
+ * Returns -1 if the response is not for one of the tag's chunks.
+ */
+
+int find_response_slot(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id)
+{
+    for(int slot=0; slot < plc->max_requests_in_flight; slot++) {
+        if(plc->tags_with_requests[slot] == tag->tag_id && plc->slot_seq_id[slot] == seq_id) {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+
+
+/*
+ * track_oldest_chunk
+ *
+ * Point the tag at the oldest of its chunks still in flight so that a
+ * lost response is timed, and counted against the window, from when
+ * that chunk was sent.
+ */
+
+void track_oldest_chunk(modbus_plc_p plc, modbus_tag_p tag)
+{
+    for(int slot=0; slot < plc->max_requests_in_flight; slot++) {
+        if(plc->tags_with_requests[slot] == tag->tag_id) {
+            if(tag->request_slot < 0 || plc->slot_start_ms[slot] < tag->request_start_ms) {
+                tag->request_slot = slot;
+                tag->request_start_ms = plc->slot_start_ms[slot];
+            }
+        }
+    }
+}
+
+
+
+/*
+ * send_next_read_chunk
+ *
+ * Build the request for the next chunk of a large read if there is a free
+ * slot.  The chunks go out one per pass of the PLC thread and all of them
+ * can be in flight at once, so the read takes about one round trip per
+ * window of chunks instead of one per chunk.
+ *
+ * Returns PLCTAG_STATUS_PENDING if there was no room this time.
+ */
+
+int send_next_read_chunk(modbus_plc_p plc, modbus_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(find_request_slot(plc, tag) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_SPEW, "No free slot for chunk %d yet.", (int)(unsigned int)tag->request_num);
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    rc = create_read_request(plc, tag);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error %s creating read request for chunk %d!", plc_tag_decode_error(rc), (int)(unsigned int)tag->request_num);
+        return rc;
+    }
+
+    pdebug(DEBUG_DETAIL, "Read request for chunk %d of %d created.", (int)(unsigned int)tag->request_num, read_request_count(tag));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * resend_read_chunk
+ *
+ * Send the request in the tag's current slot again with a new sequence
+ * ID.  The slot stays taken, so a lost chunk does not have to wait for
+ * the window.  A late response to the old request no longer matches and
+ * is dropped.
+ *
+ * Returns PLCTAG_STATUS_PENDING if the request cannot be built yet.
+ */
+
+int resend_read_chunk(modbus_plc_p plc, modbus_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint16_t next_request_num = tag->request_num;
+
+    if(plc->flags.request_ready || plc->state != PLC_READY) {
+        pdebug(DEBUG_SPEW, "Request buffer busy or PLC not ready.");
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    tag->request_num = plc->slot_request_num[tag->request_slot];
+
+    rc = create_read_request(plc, tag);
+
+    tag->request_num = next_request_num;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error %s creating read request again!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    stats_add(STATS_MB_RETRANSMITS, 1);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * can_share_read
+ *
+ * A tag can join a coalesced read when it wants a fresh read of the same
+ * kind of register on the same device and its whole range fits in one
+ * request.  A tag retrying after a shared read failed reads alone.
+ */
+
+int can_share_read(modbus_tag_p leader, modbus_tag_p tag)
+{
+    int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / leader->elem_size;
+
+    return (tag != leader
+            && tag->tag_id != 0
+            && !tag->no_coalesce
+            && tag->op == TAG_OP_READ_REQUEST
+            && tag->server_id == leader->server_id
+            && tag->reg_type == leader->reg_type
+            && tag->request_num == 0
+            && tag->elem_count > 0
+            && tag->elem_count <= registers_per_request);
+}
+
+
+
+/*
+ * plan_read_group
+ *
+ * Grow the register range of the tag's read to take in other pending
+ * reads of the same register type.  A tag is taken in when the hole
+ * between it and the range is at most coalesce_gap registers and the
+ * result still fits in one response.  The tags waiting for this pass
+ * are still on the PLC tickle list.
+ *
+ * Called with the PLC mutex and the tag API mutex held.
+ */
+
+void plan_read_group(modbus_plc_p plc, modbus_tag_p tag)
+{
+    int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
+    int low = tag->reg_base;
+    int high = tag->reg_base + tag->elem_count;
+    int changed = 1;
+
+    tag->coalesced = 0;
+
+    /* this read goes out alone after a shared one failed. */
+    if(tag->no_coalesce) {
+        tag->no_coalesce = 0;
+        return;
+    }
+
+    if(!plc->coalesce_reads || tag->request_num != 0 || tag->elem_count > registers_per_request) {
+        return;
+    }
+
+    /* keep going until the range stops growing, each pass can bridge to more tags. */
+    while(changed) {
+        changed = 0;
+
+        for(modbus_tag_p other = plc->tickle_list.head; other; other = other->ready_next) {
+            int other_low = other->reg_base;
+            int other_high = other->reg_base + other->elem_count;
+            int gap = 0;
+
+            if(!can_share_read(tag, other)) {
+                continue;
+            }
+
+            /* already covered? */
+            if(other_low >= low && other_high <= high) {
+                continue;
+            }
+
+            if(other_low > high) {
+                gap = other_low - high;
+            } else if(other_high < low) {
+                gap = low - other_high;
+            }
+
+            if(gap > plc->coalesce_gap) {
+                continue;
+            }
+
+            if(((other_high > high ? other_high : high) - (other_low < low ? other_low : low)) > registers_per_request) {
+                continue;
+            }
+
+            low = (other_low < low ? other_low : low);
+            high = (other_high > high ? other_high : high);
+            changed = 1;
+        }
+    }
+
+    if(low != tag->reg_base || high != tag->reg_base + tag->elem_count) {
+        pdebug(DEBUG_DETAIL, "Coalescing read of %d registers from register %d.", high - low, low);
+
+        tag->coalesced = 1;
+        tag->read_base = (uint16_t)(unsigned int)low;
+        tag->read_count = (uint16_t)(unsigned int)(high - low);
+    }
+}
+
+
+
+/*
+ * join_read_group
+ *
+ * Point every pending read inside the range of the tag's new request at
+ * that request.  Those tags wait for the response as if they had sent it.
+ * A tag busy in another thread is skipped and reads on its own later.
+ *
+ * Called with the PLC mutex and the tag API mutex held.
+ */
+
+void join_read_group(modbus_plc_p plc, modbus_tag_p tag)
+{
+    int low = tag->read_base;
+    int high = tag->read_base + tag->read_count;
+    int joined = 0;
+
+    if(!tag->coalesced) {
+        return;
+    }
+
+    for(modbus_tag_p other = plc->tickle_list.head; other; other = other->ready_next) {
+        if(!can_share_read(tag, other)) {
+            continue;
+        }
+
+        if(other->reg_base < low || (other->reg_base + other->elem_count) > high) {
+            continue;
+        }
+
+        if(lw_mutex_try_lock(&other->api_mutex) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_DETAIL, "Tag %" PRId32 " is busy, not coalescing it.", other->tag_id);
+            continue;
+        }
+
+        /* check again now that nothing else can change the tag. */
+        if(can_share_read(tag, other)) {
+            other->coalesced = 1;
+            other->read_base = tag->read_base;
+            other->read_count = tag->read_count;
+            other->seq_id = tag->seq_id;
+            other->request_start_ms = tag->request_start_ms;
+            other->op = TAG_OP_READ_RESPONSE;
+            joined++;
+        }
+
+        lw_mutex_unlock(&other->api_mutex);
+    }
+
+    pdebug(DEBUG_DETAIL, "%d other tags share read request %d.", joined, (int)(unsigned int)tag->seq_id);
+
+    stats_add(STATS_MB_COALESCED_READS, joined);
+}
+
+
+
+/*
+ * copy_coalesced_data
+ *
+ * Copy the tag's registers out of a response that covers a larger range.
+ * Coils and discrete inputs are packed eight to a byte so they may not
+ * start on a byte boundary in the response.
+ */
+
+int copy_coalesced_data(modbus_plc_p plc, modbus_tag_p tag)
+{
+    int reg_offset = tag->reg_base - tag->read_base;
+    int payload_size = plc->read_data[8];
+    uint8_t *payload = &plc->read_data[9];
+
+    if(plc->read_data_len < (9 + payload_size)) {
+        pdebug(DEBUG_WARN, "Response payload size %d is larger than the response!", payload_size);
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    if(tag->elem_size == 1) {
+        if(((reg_offset + tag->elem_count + 7) / 8) > payload_size) {
+            pdebug(DEBUG_WARN, "Response too short for bits %d to %d!", reg_offset, reg_offset + tag->elem_count);
+            return PLCTAG_ERR_BAD_REPLY;
+        }
+
+        mem_set(tag->data, 0, tag->size);
+
+        copy_bits(tag->data, 0, payload, reg_offset, tag->elem_count);
+    } else {
+        int byte_offset = (reg_offset * tag->elem_size) / 8;
+
+        if((byte_offset + tag->size) > payload_size) {
+            pdebug(DEBUG_WARN, "Response too short for bytes %d to %d!", byte_offset, byte_offset + tag->size);
+            return PLCTAG_ERR_BAD_REPLY;
+        }
+
+        mem_copy(tag->data, payload + byte_offset, tag->size);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * copy_bits
+ *
+ * Copy a run of bits between packed coil buffers.  Bit 0 is the low bit
+ * of the first byte as on the wire.
+ */
+
+void copy_bits(uint8_t *dest, int dest_bit, const uint8_t *src, int src_bit, int bit_count)
+{
+    for(int i=0; i < bit_count; i++) {
+        int from = src_bit + i;
+        int to = dest_bit + i;
+
+        if(src[from / 8] & (1 << (from % 8))) {
+            dest[to / 8] |= (uint8_t)(1 << (to % 8));
+        } else {
+            dest[to / 8] &= (uint8_t)~(1 << (to % 8));
+        }
+    }
+}
+
+
+
+/*
+ * can_share_write
+ *
+ * A tag can join a merged write when it has a write waiting for the same
+ * kind of register on the same device and its whole range fits in one
+ * request.  A tag retrying after a shared write failed writes alone.
+ */
+
+int can_share_write(modbus_tag_p leader, modbus_tag_p tag)
+{
+    int registers_per_request = (MAX_MODBUS_REQUEST_PAYLOAD * 8) / leader->elem_size;
+
+    return (tag != leader
+            && tag->tag_id != 0
+            && !tag->no_coalesce
+            && tag->op == TAG_OP_WRITE_REQUEST
+            && tag->server_id == leader->server_id
+            && tag->reg_type == leader->reg_type
+            && tag->request_num == 0
+            && tag->elem_count > 0
+            && tag->elem_count <= registers_per_request);
+}
+
+
+
+/*
+ * gather_write_group
+ *
+ * Merge pending writes that sit right next to the tag's registers into
+ * one request.  Writes cannot skip registers, so only tags that touch
+ * the range without overlapping it are taken in.  The data of each tag
+ * is copied while it is locked and the tag then waits on seq_id.  The
+ * merged data goes into data and the range into base_register and
+ * register_count.
+ *
+ * Returns the number of other tags in the request.
+ *
+ * Called with the PLC mutex and the tag API mutex held.
+ */
+
+int gather_write_group(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int max_registers, uint8_t *data, int *base_register, int *register_count)
+{
+    /* the tag starts in the middle so that the range can grow either way. */
+    uint8_t staging[2 * MAX_MODBUS_REQUEST_PAYLOAD];
+    int origin = max_registers;
+    int low = tag->reg_base;
+    int high = tag->reg_base + tag->elem_count;
+    int joined = 0;
+    int changed = 1;
+
+    if(!plc->coalesce_writes || tag->request_num != 0 || tag->elem_count > max_registers) {
+        return 0;
+    }
+
+    if(tag->elem_size == 1) {
+        mem_set(staging, 0, (int)(unsigned int)sizeof(staging));
+        copy_bits(staging, origin, tag->data, 0, tag->elem_count);
+    } else {
+        mem_copy(&staging[(origin * tag->elem_size) / 8], tag->data, tag->size);
+    }
+
+    while(changed) {
+        changed = 0;
+
+        for(modbus_tag_p other = plc->tickle_list.head; other; other = other->ready_next) {
+            int other_low = other->reg_base;
+            int other_high = other->reg_base + other->elem_count;
+            int offset = origin + (other_low - tag->reg_base);
+
+            if(!can_share_write(tag, other)) {
+                continue;
+            }
+
+            if(other_low != high && other_high != low) {
+                continue;
+            }
+
+            if(((other_high > high ? other_high : high) - (other_low < low ? other_low : low)) > max_registers) {
+                continue;
+            }
+
+            if(lw_mutex_try_lock(&other->api_mutex) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_DETAIL, "Tag %" PRId32 " is busy, not merging it.", other->tag_id);
+                continue;
+            }
+
+            /* check again now that nothing else can change the tag. */
+            if(can_share_write(tag, other)) {
+                if(tag->elem_size == 1) {
+                    copy_bits(staging, offset, other->data, 0, other->elem_count);
+                } else {
+                    mem_copy(&staging[(offset * tag->elem_size) / 8], other->data, other->size);
+                }
+
+                other->coalesced = 1;
+                other->seq_id = seq_id;
+                other->request_start_ms = time_ms();
+                other->op = TAG_OP_WRITE_RESPONSE;
+
+                low = (other_low < low ? other_low : low);
+                high = (other_high > high ? other_high : high);
+
+                joined++;
+                changed = 1;
+            }
+
+            lw_mutex_unlock(&other->api_mutex);
+        }
+    }
+
+    if(joined) {
+        int first = origin + (low - tag->reg_base);
+
+        if(tag->elem_size == 1) {
+            mem_set(data, 0, ((high - low) + 7) / 8);
+            copy_bits(data, 0, staging, first, high - low);
+        } else {
+            mem_copy(data, &staging[(first * tag->elem_size) / 8], ((high - low) * tag->elem_size) / 8);
+        }
+
+        *base_register = low;
+        *register_count = high - low;
+
+        pdebug(DEBUG_DETAIL, "Merged %d other tags into write of %d registers from register %d.", joined, high - low, low);
+
+        stats_add(STATS_MB_COALESCED_WRITES, joined);
+    }
+
+    return joined;
+}
+
+
+
+/*
+ * attach_read_to_write
+ *
+ * Find a pending holding register read and send it in the same request as
+ * the tag's write using function 0x17.  The read picks up any other reads
+ * that plan_read_group() would have merged with it.  All of them wait on
+ * seq_id and take their data from the shared response.
+ *
+ * Returns 1 if a read was attached.
+ *
+ * Called with the PLC mutex and the tag API mutex held.
+ */
+
+int attach_read_to_write(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int *read_base, int *read_count)
 {
-    int rc = PLCTAG_STATUS_OK;
-    uint16_t seq_id = (uint16_t)((uint16_t)plc->read_data[1] +(uint16_t)(plc->read_data[0] << 8));
-    int partial_read = 0;
+    if(!plc->combine_read_write || tag->reg_type != MB_REG_HOLDING_REGISTER) {
+        return 0;
+    }
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+    for(modbus_tag_p other = plc->tickle_list.head; other; other = other->ready_next) {
+        int attached = 0;
 
-    if(seq_id == tag->seq_id) {
-        uint8_t has_error = plc->read_data[7] & (uint8_t)0x80;
+        /* the write is a holding register, so this only finds holding register reads. */
+        if(!can_share_read(tag, other)) {
+            continue;
+        }
 
-        /* the operation is complete regardless of the outcome. */
-        //tag->flags.operation_complete = 1;
+        if(lw_mutex_try_lock(&other->api_mutex) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_DETAIL, "Tag %" PRId32 " is busy, not attaching its read.", other->tag_id);
+            continue;
+        }
 
-        if(has_error) {
-            rc = translate_modbus_error(plc->read_data[8]);
+        /* check again now that nothing else can change the tag. */
+        if(can_share_read(tag, other)) {
+            plan_read_group(plc, other);
 
-            pdebug(DEBUG_WARN, "Got read response %ud, with error %s, of length %d.", (int)(unsigned int)seq_id, plc_tag_decode_error(rc), plc->read_data_len);
-        } else {
-            int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
-            int register_offset = (tag->request_num * registers_per_request);
-            int byte_offset = (register_offset * tag->elem_size) / 8;
-            uint8_t payload_size = plc->read_data[8];
-            int copy_size = ((tag->size - byte_offset) < payload_size ? (tag->size - byte_offset) : payload_size);
+            /* the response is shared with the write, so the read is always coalesced. */
+            if(!other->coalesced) {
+                other->coalesced = 1;
+                other->read_base = other->reg_base;
+                other->read_count = (uint16_t)(unsigned int)other->elem_count;
+            }
 
-            /* no error. So copy the data. */
-            pdebug(DEBUG_DETAIL, "Got read response %u of length %d with payload of size %d.", (int)(unsigned int)seq_id, plc->read_data_len, payload_size);
-            pdebug(DEBUG_DETAIL, "registers_per_request = %d", registers_per_request);
-            pdebug(DEBUG_DETAIL, "register_offset = %d", register_offset);
-            pdebug(DEBUG_DETAIL, "byte_offset = %d", byte_offset);
-            pdebug(DEBUG_DETAIL, "copy_size = %d", copy_size);
+            other->seq_id = seq_id;
+            other->request_start_ms = time_ms();
+            other->op = TAG_OP_READ_RESPONSE;
 
-            mem_copy(tag->data + byte_offset, &plc->read_data[9], copy_size);
+            join_read_group(plc, other);
 
-            /* are we done? */
-            if(tag->size > (byte_offset + copy_size)) {
-                /* Not yet. */
-                pdebug(DEBUG_DETAIL, "Not done reading entire tag.");
-                partial_read = 1;
-            } else {
-                /* read is done. */
-                pdebug(DEBUG_DETAIL, "Read is complete.");
-                partial_read = 0;
-            }
+            *read_base = other->read_base;
+            *read_count = other->read_count;
 
-            rc = PLCTAG_STATUS_OK;
+            attached = 1;
         }
 
-        /* either way, clean up the PLC buffer. */
-        plc->read_data_len = 0;
-        plc->flags.response_ready = 0;
+        lw_mutex_unlock(&other->api_mutex);
 
-        /* clean up tag*/
-        if(!partial_read) {
-            pdebug(DEBUG_DETAIL, "Read is complete.  Cleaning up tag state.");
-            tag->seq_id = 0;
-            tag->read_complete = 1;
-            tag->read_in_flight = 0;
-            tag->status = (int8_t)rc;
-            tag->request_num = 0;
-        } else {
-            pdebug(DEBUG_DETAIL, "Read is partially complete.  We need to do at least one more request.");
-            rc = PLCTAG_ERR_PARTIAL;
-            tag->request_num++;
-            tag->status = (int8_t)PLCTAG_STATUS_PENDING;
-        }
-    } else {
-        pdebug(DEBUG_DETAIL, "Not our response.");
+        if(attached) {
+            pdebug(DEBUG_DETAIL, "Attached read of %d registers from register %d to write request %d.", *read_count, *read_base, (int)(unsigned int)seq_id);
 
-        rc = PLCTAG_ERR_NO_MATCH;
-    }
+            stats_add(STATS_MB_COALESCED_READS, 1);
 
-    pdebug(DEBUG_DETAIL, "Done: %s", plc_tag_decode_error(rc));
+            return 1;
+        }
+    }
 
-    return rc;
+    return 0;
 }
 
 
@@ -1758,6 +3035,9 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
  *     11    Low byte of the register count.
  *     12    Number of bytes of data to write.
  *     13... Data bytes.
+ *
+ * When a read is attached with function 0x17, the read register address
+ * and count come first and push the rest of the request back four bytes.
  */
 
 int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
@@ -1770,6 +3050,13 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     int register_offset = (tag->request_num * registers_per_request);
     int byte_offset = (register_offset * tag->elem_size) / 8;
     int request_payload_size = 0;
+    int request_length = 0;
+    int max_group_registers = registers_per_request;
+    uint8_t group_data[MAX_MODBUS_REQUEST_PAYLOAD];
+    uint8_t *payload = NULL;
+    uint8_t function_code = 0;
+    int read_base = 0;
+    int read_count = 0;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
@@ -1780,11 +3067,62 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     pdebug(DEBUG_SPEW, "register_offset = %d", register_offset);
     pdebug(DEBUG_SPEW, "byte_offset = %d", byte_offset);
 
+    /* function code depends on the register type. */
+    switch(tag->reg_type) {
+        case MB_REG_COIL:
+            function_code = MB_CMD_WRITE_COIL_MULTI;
+            break;
+
+        case MB_REG_DISCRETE_INPUT:
+            pdebug(DEBUG_WARN, "Done. You cannot write a discrete input!");
+            return PLCTAG_ERR_UNSUPPORTED;
+            break;
+
+        case MB_REG_HOLDING_REGISTER:
+            function_code = MB_CMD_WRITE_HOLDING_REGISTER_MULTI;
+
+            /* leave room for an attached read. */
+            if(plc->combine_read_write) {
+                max_group_registers = MAX_MODBUS_READ_WRITE_REGISTERS;
+            }
+            break;
+
+        case MB_REG_INPUT_REGISTER:
+            pdebug(DEBUG_WARN, "Done. You cannot write an analog input!");
+            return PLCTAG_ERR_UNSUPPORTED;
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "Done. Unsupported register type %d!", tag->reg_type);
+            return PLCTAG_ERR_UNSUPPORTED;
+            break;
+    }
+
     /* clamp the number of registers we ask for to what will fit. */
     if(register_count > registers_per_request) {
         register_count = registers_per_request;
     }
 
+    payload = &tag->data[byte_offset];
+    tag->coalesced = 0;
+
+    if(tag->no_coalesce) {
+        /* a shared request failed, so this is a plain write of our own registers. */
+        tag->no_coalesce = 0;
+    } else {
+        /* see if writes from other tags can go in the same request. */
+        if(gather_write_group(plc, tag, seq_id, max_group_registers, group_data, &base_register, &register_count)) {
+            tag->coalesced = 1;
+            payload = group_data;
+        }
+
+        /* see if a pending read can go along too. */
+        if(register_count <= MAX_MODBUS_READ_WRITE_REGISTERS && attach_read_to_write(plc, tag, seq_id, &read_base, &read_count)) {
+            tag->coalesced = 1;
+            function_code = MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI;
+        }
+    }
+
     /* how many bytes, rounded up to the nearest byte. */
     request_payload_size = ((register_count * tag->elem_size) + 7) / 8;
 
@@ -1801,44 +3139,31 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = 0; plc->write_data_len++;
     plc->write_data[plc->write_data_len] = 0; plc->write_data_len++;
 
-    /* request packet length */
-    plc->write_data[plc->write_data_len] = (uint8_t)(((request_payload_size + 7) >> 8) & 0xFF); plc->write_data_len++;
-    plc->write_data[plc->write_data_len] = (uint8_t)(((request_payload_size + 7) >> 0) & 0xFF); plc->write_data_len++;
+    /* request packet length, the read range adds four bytes. */
+    request_length = request_payload_size + (function_code == MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI ? 11 : 7);
+    plc->write_data[plc->write_data_len] = (uint8_t)((request_length >> 8) & 0xFF); plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = (uint8_t)((request_length >> 0) & 0xFF); plc->write_data_len++;
 
     /* device address */
-    plc->write_data[plc->write_data_len] = plc->server_id; plc->write_data_len++;
-
-    /* function code depends on the register type. */
-    switch(tag->reg_type) {
-        case MB_REG_COIL:
-            plc->write_data[7] = MB_CMD_WRITE_COIL_MULTI; plc->write_data_len++;
-            break;
-
-        case MB_REG_DISCRETE_INPUT:
-            pdebug(DEBUG_WARN, "Done. You cannot write a discrete input!");
-            return PLCTAG_ERR_UNSUPPORTED;
-            break;
+    plc->write_data[plc->write_data_len] = tag->server_id; plc->write_data_len++;
 
-        case MB_REG_HOLDING_REGISTER:
-            plc->write_data[7] = MB_CMD_WRITE_HOLDING_REGISTER_MULTI; plc->write_data_len++;
-            break;
+    plc->write_data[plc->write_data_len] = function_code; plc->write_data_len++;
 
-        case MB_REG_INPUT_REGISTER:
-            pdebug(DEBUG_WARN, "Done. You cannot write an analog input!");
-            return PLCTAG_ERR_UNSUPPORTED;
-            break;
+    if(function_code == MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI) {
+        /* read register base. */
+        plc->write_data[plc->write_data_len] = (uint8_t)((read_base >> 8) & 0xFF); plc->write_data_len++;
+        plc->write_data[plc->write_data_len] = (uint8_t)((read_base >> 0) & 0xFF); plc->write_data_len++;
 
-        default:
-            pdebug(DEBUG_WARN, "Done. Unsupported register type %d!", tag->reg_type);
-            return PLCTAG_ERR_UNSUPPORTED;
-            break;
+        /* number of elements to read. */
+        plc->write_data[plc->write_data_len] = (uint8_t)((read_count >> 8) & 0xFF); plc->write_data_len++;
+        plc->write_data[plc->write_data_len] = (uint8_t)((read_count >> 0) & 0xFF); plc->write_data_len++;
     }
 
     /* register base. */
     plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 8) & 0xFF); plc->write_data_len++;
     plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 0) & 0xFF); plc->write_data_len++;
 
-    /* number of elements to read. */
+    /* number of elements to write. */
     plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 8) & 0xFF); plc->write_data_len++;
     plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 0) & 0xFF); plc->write_data_len++;
 
@@ -1846,10 +3171,11 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = (uint8_t)(unsigned int)(request_payload_size); plc->write_data_len++;
 
     /* copy the tag data. */
-    mem_copy(&plc->write_data[plc->write_data_len], &tag->data[byte_offset], request_payload_size);
+    mem_copy(&plc->write_data[plc->write_data_len], payload, request_payload_size);
     plc->write_data_len += request_payload_size;
 
     tag->seq_id = (uint16_t)(unsigned int)seq_id;
+    tag->request_start_ms = time_ms();
     plc->flags.request_ready = 1;
     plc->request_tag_id = tag->tag_id;
 
@@ -1865,6 +3191,7 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
 
 
 
+
 /* Write response.
  *    Byte  Meaning
  *      0    High byte of request sequence ID.
@@ -1900,7 +3227,8 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
 
             pdebug(DEBUG_WARN, "Got write response %ud, with error %s, of length %d.", (int)(unsigned int)seq_id, plc_tag_decode_error(rc), plc->read_data_len);
         } else {
-            int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
+            /* chunks are sized by create_write_request(). */
+            int registers_per_request = (MAX_MODBUS_REQUEST_PAYLOAD * 8) / tag->elem_size;
             int next_register_offset = ((tag->request_num+1) * registers_per_request);
             int next_byte_offset = (next_register_offset * tag->elem_size) / 8;
 
@@ -1909,8 +3237,8 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
             pdebug(DEBUG_DETAIL, "next_register_offset = %d", next_register_offset);
             pdebug(DEBUG_DETAIL, "next_byte_offset = %d", next_byte_offset);
 
-            /* are we done? */
-            if(tag->size > next_byte_offset) {
+            /* are we done?  A merged write always covers the whole tag. */
+            if(!tag->coalesced && tag->size > next_byte_offset) {
                 /* Not yet. */
                 pdebug(DEBUG_SPEW, "Not done writing entire tag.");
                 partial_write = 1;
@@ -1923,9 +3251,11 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
             rc = PLCTAG_STATUS_OK;
         }
 
-        /* either way, clean up the PLC buffer. */
-        plc->read_data_len = 0;
-        plc->flags.response_ready = 0;
+        /* either way, clean up the PLC buffer unless other tags share it. */
+        if(!tag->coalesced) {
+            plc->read_data_len = 0;
+            plc->flags.response_ready = 0;
+        }
 
         /* clean up tag*/
         if(!partial_write) {
@@ -1944,7 +3274,7 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
     } else {
         pdebug(DEBUG_SPEW, "Not our response.");
 
-        rc = PLCTAG_STATUS_PENDING;
+        rc = PLCTAG_ERR_NO_MATCH;
     }
 
     pdebug(DEBUG_SPEW, "Done.");
@@ -2059,32 +3389,6 @@ int parse_register_name(attr attribs, modbus_reg_type_t *reg_type, int *reg_base
 
 
 
-modbus_tag_p pop_tag(modbus_tag_list_p list)
-{
-    modbus_tag_p tmp = NULL;
-
-    pdebug(DEBUG_SPEW, "Starting.");
-
-    tmp = list->head;
-
-    /* unlink */
-    if(tmp) {
-        list->head = tmp->next;
-        tmp->next = NULL;
-    }
-
-    /* if we removed the last element, then set the tail to NULL. */
-    if(!list->head) {
-        list->tail = NULL;
-    }
-
-    pdebug(DEBUG_SPEW, "Done.");
-
-    return tmp;
-}
-
-
-
 void push_tag(modbus_tag_list_p list, modbus_tag_p tag)
 {
     pdebug(DEBUG_SPEW, "Starting.");
@@ -2105,106 +3409,178 @@ void push_tag(modbus_tag_list_p list, modbus_tag_p tag)
 
 
 
-struct modbus_tag_list_t merge_lists(modbus_tag_list_p first, modbus_tag_list_p last)
+int remove_tag(modbus_tag_list_p list, modbus_tag_p tag)
 {
-    struct modbus_tag_list_t result;
+    int rc = PLCTAG_STATUS_OK;
+    modbus_tag_p cur = list->head;
+    modbus_tag_p prev = NULL;
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    while(cur && cur != tag) {
+        prev = cur;
+        cur = cur->next;
+    }
 
-    if(first->head) {
-        modbus_tag_p tmp = first->head;
+    if(cur == tag) {
+        /* found it. */
+        if(prev) {
+            prev->next = tag->next;
+        } else {
+            /* at the head of the list. */
+            list->head = tag->next;
+        }
 
-        pdebug(DEBUG_SPEW, "First list:");
-        while(tmp) {
-            pdebug(DEBUG_SPEW, "  tag %d", tmp->tag_id);
-            tmp = tmp->next;
+        if(list->tail == tag) {
+            list->tail = prev;
         }
+
+        rc = PLCTAG_STATUS_OK;
     } else {
-        pdebug(DEBUG_SPEW, "First list: empty.");
+        rc = PLCTAG_STATUS_PENDING;
     }
 
-    if(last->head) {
-        modbus_tag_p tmp = last->head;
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * queue_ready_tag
+ *
+ * Put the tag in the PLC ready list unless it is already there or being
+ * worked on by the PLC thread.  Called with the tag API mutex held.
+ */
+
+void queue_ready_tag(modbus_plc_p plc, modbus_tag_p tag)
+{
+    if(!plc) {
+        pdebug(DEBUG_WARN, "PLC pointer is NULL!");
+        return;
+    }
 
-        pdebug(DEBUG_SPEW, "Second list:");
-        while(tmp) {
-            pdebug(DEBUG_SPEW, "  tag %d", tmp->tag_id);
-            tmp = tmp->next;
+    critical_block(&plc->ready_mutex) {
+        if(!tag->ready_queued) {
+            push_ready_tag(&(plc->ready_list), tag);
+            tag->ready_queued = 1;
         }
-    } else {
-        pdebug(DEBUG_SPEW, "Second list: empty.");
     }
+}
 
-    /* set up the head of the new list. */
-    result.head = (first->head ? first->head : last->head);
 
-    /* stitch up the tail of the first list. */
-    if(first->tail) {
-        first->tail->next = last->head;
-    }
 
-    /* set up the tail of the new list */
-    result.tail = (last->tail ? last->tail : first->tail);
+/*
+ * tag_needs_plc
+ *
+ * A tag needs the PLC thread while it has an operation going.  Tags with
+ * automatic writes are checked every pass because the application marks
+ * them dirty without telling the PLC.  Automatic reads are woken up by
+ * wake_auto_read_tags().
+ */
+
+int tag_needs_plc(modbus_tag_p tag)
+{
+    return (tag->op != TAG_OP_IDLE || tag->auto_sync_write_ns > 0);
+}
+
+
+
+/*
+ * wake_auto_read_tags
+ *
+ * Queue the idle tags whose automatic read is due.  The PLC tag list is
+ * only walked when the earliest of those reads comes up.
+ *
+ * Called with the PLC mutex held.
+ */
+
+void wake_auto_read_tags(modbus_plc_p plc)
+{
+    int64_t now = time_ns();
+    int64_t next_read = 0;
 
-    /* make sure the old lists do not reference the tags. */
-    first->head = NULL;
-    first->tail = NULL;
-    last->head = NULL;
-    last->tail = NULL;
+    if(!plc->next_auto_read_ns || plc->next_auto_read_ns > now) {
+        return;
+    }
 
-    if(result.head) {
-        modbus_tag_p tmp = result.head;
+    critical_block(&plc->ready_mutex) {
+        for(modbus_tag_p tag = plc->tag_list.head; tag; tag = tag->next) {
+            if(tag->auto_sync_read_ns <= 0 || tag->ready_queued) {
+                continue;
+            }
 
-        pdebug(DEBUG_SPEW, "Result list:");
-        while(tmp) {
-            pdebug(DEBUG_SPEW, "  tag %d", tmp->tag_id);
-            tmp = tmp->next;
+            if(tag->auto_sync_next_read <= now) {
+                push_ready_tag(&(plc->tickle_list), tag);
+                tag->ready_queued = 1;
+            } else if(!next_read || tag->auto_sync_next_read < next_read) {
+                next_read = tag->auto_sync_next_read;
+            }
         }
-    } else {
-        pdebug(DEBUG_SPEW, "Result list: empty.");
     }
 
-    pdebug(DEBUG_SPEW, "Done.");
+    plc->next_auto_read_ns = next_read;
+}
+
+
+
+modbus_tag_p pop_ready_tag(modbus_tag_list_p list)
+{
+    modbus_tag_p tmp = list->head;
+
+    if(tmp) {
+        list->head = tmp->ready_next;
+        tmp->ready_next = NULL;
+    }
+
+    if(!list->head) {
+        list->tail = NULL;
+    }
 
-    return result;
+    return tmp;
 }
 
 
 
-int remove_tag(modbus_tag_list_p list, modbus_tag_p tag)
+void push_ready_tag(modbus_tag_list_p list, modbus_tag_p tag)
+{
+    tag->ready_next = NULL;
+
+    if(list->tail) {
+        list->tail->ready_next = tag;
+        list->tail = tag;
+    } else {
+        list->head = tag;
+        list->tail = tag;
+    }
+}
+
+
+
+void remove_ready_tag(modbus_tag_list_p list, modbus_tag_p tag)
 {
-    int rc = PLCTAG_STATUS_OK;
     modbus_tag_p cur = list->head;
     modbus_tag_p prev = NULL;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
-
     while(cur && cur != tag) {
         prev = cur;
-        cur = cur->next;
+        cur = cur->ready_next;
     }
 
-    if(cur == tag) {
-        /* found it. */
+    if(cur) {
         if(prev) {
-            prev->next = tag->next;
+            prev->ready_next = tag->ready_next;
         } else {
-            /* at the head of the list. */
-            list->head = tag->next;
+            list->head = tag->ready_next;
         }
 
         if(list->tail == tag) {
             list->tail = prev;
         }
 
-        rc = PLCTAG_STATUS_OK;
-    } else {
-        rc = PLCTAG_STATUS_PENDING;
+        tag->ready_next = NULL;
     }
-
-    pdebug(DEBUG_DETAIL, "Done.");
-
-    return rc;
 }
 
 
@@ -2233,6 +3609,9 @@ int mb_abort(plc_tag_p p_tag)
      */
     tag->seq_id = 0;
     tag->request_num = 0;
+    tag->response_count = 0;
+    tag->coalesced = 0;
+    tag->no_coalesce = 0;
     tag->status = (int8_t)PLCTAG_STATUS_OK;
     tag->op = TAG_OP_IDLE;
 
@@ -2275,6 +3654,7 @@ int mb_read_start(plc_tag_p p_tag)
     }
 
     /* wake the PLC loop if we need to. */
+    queue_ready_tag(tag->plc, tag);
     wake_plc_thread(tag->plc);
 
     pdebug(DEBUG_DETAIL, "Done.");
@@ -2350,6 +3730,7 @@ int mb_write_start(plc_tag_p p_tag)
     }
 
     /* wake the PLC loop if we need to. */
+    queue_ready_tag(tag->plc, tag);
     wake_plc_thread(tag->plc);
 
     pdebug(DEBUG_DETAIL, "Done.");
@@ -2370,6 +3751,12 @@ int mb_wake_plc(plc_tag_p p_tag)
         return PLCTAG_ERR_NULL_PTR;
     }
 
+    /*
+     * visit the tag at least once.  If it is idle afterward, the PLC
+     * thread picks up its automatic read time then.
+     */
+    queue_ready_tag(tag->plc, tag);
+
     /* wake the PLC thread. */
     wake_plc_thread(tag->plc);
 
@@ -2395,6 +3782,8 @@ int mb_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_va
         res = (tag->elem_size + 7)/8; /* return size in bytes! */
     } else if(str_cmp_i(attrib_name, "elem_count") == 0) {
         res = tag->elem_count;
+    } else if(str_cmp_i(attrib_name, "request_window") == 0) {
+        res = tag->plc->request_window;
     } else {
         pdebug(DEBUG_WARN,"Attribute \"%s\" is not supported.", attrib_name);
         tag->status = PLCTAG_ERR_UNSUPPORTED;
@@ -2428,32 +3817,23 @@ void mb_teardown(void)
 
     library_terminating = 1;
 
-    if(mb_mutex) {
-        pdebug(DEBUG_DETAIL, "Waiting for all Modbus PLCs to terminate.");
+    pdebug(DEBUG_DETAIL, "Waiting for all Modbus PLCs to terminate.");
 
-        while(1) {
-            int plcs_remain = 0;
-            
-            critical_block(mb_mutex) {
-                plcs_remain = plcs ? 1 : 0;
-            }
+    while(1) {
+        int plcs_remain = 0;
 
-            if(plcs_remain) {
-                sleep_ms(10); // MAGIC
-            } else {
-                break;
-            }
+        critical_block(&mb_mutex) {
+            plcs_remain = plcs ? 1 : 0;
         }
 
-        pdebug(DEBUG_DETAIL, "All Modbus PLCs terminated.");
+        if(plcs_remain) {
+            sleep_ms(10); // MAGIC
+        } else {
+            break;
+        }
     }
 
-    if(mb_mutex) {
-        pdebug(DEBUG_DETAIL, "Destroying Modbus mutex.");
-        mutex_destroy(&mb_mutex);
-        mb_mutex = NULL;
-    }
-    pdebug(DEBUG_DETAIL, "Modbus mutex destroyed.");
+    pdebug(DEBUG_DETAIL, "All Modbus PLCs terminated.");
 
     pdebug(DEBUG_INFO, "Done.");
 }
@@ -2466,14 +3846,7 @@ int mb_init()
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    pdebug(DEBUG_DETAIL, "Setting up mutex.");
-    if(!mb_mutex) {
-        rc = mutex_create(&mb_mutex);
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Error %s creating mutex!", plc_tag_decode_error(rc));
-            return rc;
-        }
-    }
+    /* the module mutex is statically initialized. */
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -110,7 +110,7 @@ plc_tag_p system_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_
      * we have a vehicle for returning status.
      */
 
-    tag = (system_tag_p)rc_alloc(sizeof(struct system_tag_t), (rc_cleanup_func)system_tag_destroy);
+    tag = (system_tag_p)rc_alloc(sizeof(struct system_tag_t), (rc_cleanup_func)system_tag_destroy, MEM_SUB_TAGS);
 
     if(!tag) {
         pdebug(DEBUG_ERROR,"Unable to allocate memory for system tag!");
@@ -140,7 +140,14 @@ plc_tag_p system_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_
 
     /* point data at the backing store. */
     tag->data = &tag->backing_data[0];
-    tag->size = (int)sizeof(tag->backing_data);
+
+    if(str_cmp_i(tag->name, "stats") == 0) {
+        tag->size = SYSTEM_TAG_STATS_SIZE;
+    } else if(str_cmp_i(tag->name, "memory") == 0) {
+        tag->size = SYSTEM_TAG_MEMORY_SIZE;
+    } else {
+        tag->size = MAX_SYSTEM_TAG_SIZE;
+    }
 
     pdebug(DEBUG_INFO,"Done");
 
@@ -165,17 +172,9 @@ static void system_tag_destroy(plc_tag_p ptag)
         return;
     }
 
-    if(ptag->ext_mutex) {
-        mutex_destroy(&ptag->ext_mutex);
-    }
-
-    if(ptag->api_mutex) {
-        mutex_destroy(&ptag->api_mutex);
-    }
-
-    if(ptag->tag_cond_wait) {
-        cond_destroy(&ptag->tag_cond_wait);
-    }
+    lw_mutex_destroy(&ptag->ext_mutex);
+    lw_mutex_destroy(&ptag->api_mutex);
+    lw_event_destroy(&ptag->tag_cond_wait);
 
     if(tag->byte_order && tag->byte_order->is_allocated) {
         mem_free(tag->byte_order);
@@ -209,6 +208,31 @@ static int system_tag_read(plc_tag_p ptag)
         tag->data[2] = (uint8_t)((debug_level >> 16) & 0xFF);
         tag->data[3] = (uint8_t)((debug_level >> 24) & 0xFF);
         rc = PLCTAG_STATUS_OK;
+    } else if(str_cmp_i(&tag->name[0],"stats") == 0) {
+        int64_t values[STATS_NUM_FIELDS];
+
+        rc = stats_snapshot(values, STATS_NUM_FIELDS);
+
+        /* little endian, matching the tag byte order. */
+        for(int i=0; rc == PLCTAG_STATUS_OK && i < STATS_NUM_FIELDS; i++) {
+            uint64_t val = (uint64_t)values[i];
+
+            for(int b=0; b < (int)sizeof(int64_t); b++) {
+                tag->data[(i * (int)sizeof(int64_t)) + b] = (uint8_t)((val >> (8 * b)) & 0xFF);
+            }
+        }
+    } else if(str_cmp_i(&tag->name[0],"memory") == 0) {
+        int64_t values[MEM_TRACK_SNAPSHOT_SIZE];
+
+        rc = mem_track_snapshot(values, MEM_TRACK_SNAPSHOT_SIZE);
+
+        for(int i=0; rc == PLCTAG_STATUS_OK && i < MEM_TRACK_SNAPSHOT_SIZE; i++) {
+            uint64_t val = (uint64_t)values[i];
+
+            for(int b=0; b < (int)sizeof(int64_t); b++) {
+                tag->data[(i * (int)sizeof(int64_t)) + b] = (uint8_t)((val >> (8 * b)) & 0xFF);
+            }
+        }
     } else {
         pdebug(DEBUG_WARN, "Unsupported system tag %s!", tag->name);
         rc = PLCTAG_ERR_UNSUPPORTED;
@@ -254,7 +278,7 @@ static int system_tag_write(plc_tag_p ptag)
                         ((uint32_t)(tag->data[3]) << 24));
         set_debug_level(res);
         rc = PLCTAG_STATUS_OK;
-    } else if(str_cmp_i(&tag->name[0],"version") == 0) {
+    } else if(str_cmp_i(&tag->name[0],"version") == 0 || str_cmp_i(&tag->name[0],"stats") == 0 || str_cmp_i(&tag->name[0],"memory") == 0) {
         rc = PLCTAG_ERR_NOT_IMPLEMENTED;
     } else {
         pdebug(DEBUG_WARN, "Unsupported system tag %s!", tag->name);
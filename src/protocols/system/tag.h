@@ -35,18 +35,25 @@
 
 #include <util/attr.h>
 #include <util/debug.h>
+#include <util/mem_track.h>
+#include <util/stats.h>
 #include <platform.h>
 #include <lib/tag.h>
 
 #define MAX_SYSTEM_TAG_NAME (20)
 #define MAX_SYSTEM_TAG_SIZE (30)
 
+/* the stats and memory tags are larger than the others. */
+#define SYSTEM_TAG_STATS_SIZE (STATS_NUM_FIELDS * (int)sizeof(int64_t))
+#define SYSTEM_TAG_MEMORY_SIZE (MEM_TRACK_SNAPSHOT_SIZE * (int)sizeof(int64_t))
+#define SYSTEM_TAG_BACKING_SIZE (SYSTEM_TAG_STATS_SIZE > SYSTEM_TAG_MEMORY_SIZE ? SYSTEM_TAG_STATS_SIZE : SYSTEM_TAG_MEMORY_SIZE)
+
 struct system_tag_t {
     /*struct plc_tag_t p_tag;*/
     TAG_BASE_STRUCT;
 
     char name[MAX_SYSTEM_TAG_NAME];
-    uint8_t backing_data[MAX_SYSTEM_TAG_SIZE];
+    uint8_t backing_data[SYSTEM_TAG_BACKING_SIZE];
 };
 
 typedef struct system_tag_t *system_tag_p;
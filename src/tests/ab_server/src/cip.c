@@ -33,7 +33,13 @@
 
 #include <inttypes.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "compat.h"
+#if !defined(IS_WINDOWS)
+#include <strings.h>
+#endif
 #include "cip.h"
 #include "eip.h"
 #include "pccc.h"
@@ -56,7 +62,10 @@ const uint8_t CIP_WRITE_FRAG[] = { 0x53 };
 const uint8_t CIP_PCCC_EXECUTE[] = { 0x4B, 0x02, 0x20, 0x67, 0x24, 0x01, 0x07, 0x3d, 0xf3, 0x45, 0x43, 0x50, 0x21 };
 const uint8_t CIP_FORWARD_CLOSE[] = { 0x4E, 0x02, 0x20, 0x06, 0x24, 0x01 };
 const uint8_t CIP_FORWARD_OPEN[] = { 0x54, 0x02, 0x20, 0x06, 0x24, 0x01 };
-const uint8_t CIP_LIST_TAGS[] = { 0x55, 0x02, 0x20, 0x02, 0x24, 0x01 };
+const uint8_t CIP_LIST_TAGS[] = { 0x55 };
+const uint8_t CIP_TEMPLATE_ATTRIBS[] = { 0x03, 0x03, 0x20, 0x6C, 0x25, 0x00 };
+const uint8_t CIP_TEMPLATE_READ[] = { 0x4C, 0x03, 0x20, 0x6C, 0x25, 0x00 };
+const uint8_t CIP_IDENTITY_ATTRIBS[] = { 0x03, 0x02, 0x20, 0x01, 0x24, 0x01 };
 const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
 
 /* path to match. */
@@ -66,6 +75,8 @@ const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
 #define CIP_DONE               ((uint8_t)0x80)
 
 #define CIP_SYMBOLIC_SEGMENT_MARKER ((uint8_t)0x91)
+#define CIP_CLASS_SEGMENT_MARKER ((uint8_t)0x20)
+#define CIP_SYMBOL_CLASS ((uint8_t)0x6B)
 
 /* CIP Errors */
 
@@ -73,6 +84,7 @@ const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
 #define CIP_ERR_0x01            ((uint8_t)0x01)
 #define CIP_ERR_FRAG            ((uint8_t)0x06)
 #define CIP_ERR_UNSUPPORTED     ((uint8_t)0x08)
+#define CIP_ERR_EMBEDDED        ((uint8_t)0x1e)
 #define CIP_ERR_EXTENDED        ((uint8_t)0xff)
 
 #define CIP_ERR_EX_TOO_LONG     ((uint16_t)0x2105)
@@ -83,22 +95,38 @@ typedef struct {
     slice_s path;           /* store this in a slice to avoid copying */
 } cip_header_s;
 
+static slice_s handle_multi_request(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_forward_close(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_list_tags(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_template_attribs(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_template_read(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_identity_attribs(slice_s input, slice_s output, plc_s *plc);
+static size_t build_template(uint16_t template_id, uint8_t *buf, size_t buf_size);
 
 static bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *start_read_offset);
 static slice_s make_cip_error(slice_s output, uint8_t cip_cmd, uint8_t cip_err, bool extend, uint16_t extended_error);
 static bool match_path(slice_s input, bool need_pad, uint8_t *path, uint8_t path_len);
+static bool process_symbol_instance(slice_s input, size_t *offset, uint32_t *instance);
+static tag_def_s *find_tag_by_instance(plc_s *plc, uint32_t instance);
 
 slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
 {
     info("Got packet:");
     slice_dump(input);
 
-    /* match the prefix and dispatch. */
-    if(slice_match_bytes(input, CIP_READ, sizeof(CIP_READ))) {
+    /* match the prefix and dispatch.  Template reads look like tag reads so check them first. */
+    if(plc->plc_type == PLC_CONTROL_LOGIX && slice_match_bytes(input, CIP_TEMPLATE_READ, sizeof(CIP_TEMPLATE_READ))) {
+        return handle_template_read(input, output, plc);
+    } else if(plc->plc_type == PLC_CONTROL_LOGIX && slice_match_bytes(input, CIP_TEMPLATE_ATTRIBS, sizeof(CIP_TEMPLATE_ATTRIBS))) {
+        return handle_template_attribs(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_IDENTITY_ATTRIBS, sizeof(CIP_IDENTITY_ATTRIBS))) {
+        return handle_identity_attribs(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_MULTI, sizeof(CIP_MULTI))) {
+        return handle_multi_request(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_READ, sizeof(CIP_READ))) {
         return handle_read_request(input, output, plc);
     } else if(slice_match_bytes(input, CIP_READ_FRAG, sizeof(CIP_READ_FRAG))) {
         return handle_read_request(input, output, plc);
@@ -112,6 +140,8 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
         return handle_forward_open(input, output, plc);
     } else if(slice_match_bytes(input, CIP_FORWARD_CLOSE, sizeof(CIP_FORWARD_CLOSE))) {
         return handle_forward_close(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_LIST_TAGS, sizeof(CIP_LIST_TAGS))) {
+        return handle_list_tags(input, output, plc);
     } else if(slice_match_bytes(input, CIP_PCCC_EXECUTE, sizeof(CIP_PCCC_EXECUTE))) {
         return dispatch_pccc_request(input, output, plc);
     } else {
@@ -120,6 +150,89 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
 }
 
 
+/* big enough for any request or reply that fits in the server buffer. */
+#define CIP_MULTI_BUF_SIZE ((size_t)4200)
+
+/*
+ * A multiple service request packs several requests.  After the path
+ * comes the request count and the offset of each request from the count.
+ * Each request is handled on its own and the reply has the same layout.
+ * The reply is built over the request, so the requests are copied first.
+ */
+
+slice_s handle_multi_request(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t req_buf[CIP_MULTI_BUF_SIZE];
+    uint8_t resp_buf[CIP_MULTI_BUF_SIZE];
+    uint8_t multi_cmd = (uint8_t)(CIP_MULTI[0] | CIP_DONE);
+    uint8_t status = CIP_OK;
+    slice_s requests;
+    size_t num_requests = 0;
+    size_t resp_offset = 0;
+
+    if(slice_len(input) < sizeof(CIP_MULTI) + 2 || slice_len(input) - sizeof(CIP_MULTI) > sizeof(req_buf)) {
+        info("Multiple service request is malformed!");
+        return make_cip_error(output, multi_cmd, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    memcpy(req_buf, slice_get_bytes(input, sizeof(CIP_MULTI)), slice_len(input) - sizeof(CIP_MULTI));
+    requests = slice_make(req_buf, (ssize_t)(slice_len(input) - sizeof(CIP_MULTI)));
+
+    num_requests = slice_get_uint16_le(requests, 0);
+    resp_offset = 2 + (num_requests * 2);
+
+    if(num_requests == 0 || resp_offset > slice_len(requests) || 4 + resp_offset > slice_len(output)) {
+        info("Multiple service request has a bad request count %d!", (int)num_requests);
+        return make_cip_error(output, multi_cmd, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    info("Processing %d packed requests.", (int)num_requests);
+
+    for(size_t i=0; i < num_requests; i++) {
+        size_t start = slice_get_uint16_le(requests, 2 + (i * 2));
+        size_t end = (i + 1 < num_requests ? slice_get_uint16_le(requests, 2 + ((i + 1) * 2)) : slice_len(requests));
+        size_t space = slice_len(output) - (4 + resp_offset);
+        slice_s reply;
+
+        if(start < 2 + (num_requests * 2) || start >= end || end > slice_len(requests) || slice_get_uint8(requests, start) == CIP_MULTI[0]) {
+            info("Packed request %d is malformed!", (int)i);
+            return make_cip_error(output, multi_cmd, CIP_ERR_UNSUPPORTED, false, 0);
+        }
+
+        /* a reply only gets the space left in the packet, reads fragment to fit. */
+        reply = cip_dispatch_request(slice_from_slice(requests, start, end - start),
+                                     slice_make(resp_buf, (ssize_t)(space < sizeof(resp_buf) ? space : sizeof(resp_buf))),
+                                     plc);
+        if(slice_has_err(reply) || slice_len(reply) < 4) {
+            info("Packed request %d did not produce a reply!", (int)i);
+            return make_cip_error(output, multi_cmd, CIP_ERR_UNSUPPORTED, false, 0);
+        }
+
+        if(4 + resp_offset + slice_len(reply) > slice_len(output)) {
+            info("Replies to the packed requests do not fit in one packet!");
+            return make_cip_error(output, multi_cmd, CIP_ERR_EXTENDED, true, CIP_ERR_EX_TOO_LONG);
+        }
+
+        if(slice_get_uint8(reply, 2) != CIP_OK) {
+            status = CIP_ERR_EMBEDDED;
+        }
+
+        slice_set_uint16_le(output, 4 + 2 + (i * 2), (uint16_t)resp_offset);
+        memcpy(slice_get_bytes(output, 4 + resp_offset), reply.data, slice_len(reply));
+        resp_offset += slice_len(reply);
+    }
+
+    slice_set_uint8(output, 0, multi_cmd);
+    slice_set_uint8(output, 1, 0); /* reserved, must be zero. */
+    slice_set_uint8(output, 2, status);
+    slice_set_uint8(output, 3, 0); /* no extended status. */
+    slice_set_uint16_le(output, 4, (uint16_t)num_requests);
+
+    return slice_from_slice(output, 0, 4 + resp_offset);
+}
+
+
+
 /* a handy structure to hold all the parameters we need to receive in a Forward Open request. */
 typedef struct {
     uint8_t secs_per_tick;                  /* seconds per tick */
@@ -592,9 +705,510 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
 
 
 
+#define CIP_LIST_TAGS_MIN_SIZE (6)
+#define CIP_LIST_TAGS_MAX_ATTRIBS (4)
+#define CIP_PROGRAM_SYMBOL_TYPE ((uint16_t)0x1068)
+
+
+/* the length of the "Program:<name>" part of a tag name, zero for controller tags. */
+static size_t program_name_length(const char *name)
+{
+    const char *dot = NULL;
+
+    if(str_cmp_i_n(name, "Program:", strlen("Program:")) != 0) {
+        return 0;
+    }
+
+    dot = strchr(name, '.');
+
+    return (dot ? (size_t)(dot - name) : 0);
+}
+
+
+/* check whether an earlier tag is in the same program. */
+static bool program_listed_before(plc_s *plc, tag_def_s *tag, size_t program_len)
+{
+    for(tag_def_s *other = plc->tags; other && other != tag; other = other->next_tag) {
+        if(program_name_length(other->name) == program_len && str_cmp_i_n(other->name, tag->name, program_len) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * List the symbols starting at the instance in the path.  Tags are
+ * numbered from one in the order they are kept.  A symbolic segment in
+ * front of the path lists the tags of that program.  The controller scope
+ * has an entry for each program in place of the program's tags.  We
+ * support the symbol name (1), type (2), element size (7) and dimension
+ * (8) attributes in any order.
+ */
+
+slice_s handle_list_tags(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t list_cmd = slice_get_uint8(input, 0);
+    size_t path_size = 0;
+    size_t offset = 0;
+    uint32_t instance = 0;
+    uint32_t start_instance = 0;
+    uint16_t num_attribs = 0;
+    uint16_t attribs[CIP_LIST_TAGS_MAX_ATTRIBS];
+    bool need_frag = false;
+    tag_def_s *tag = NULL;
+    char scope_buf[256] = {0};
+    const char *scope = NULL;
+    size_t scope_len = 0;
+
+    if(slice_len(input) < CIP_LIST_TAGS_MIN_SIZE) {
+        info("Insufficient data in the CIP list tags request!");
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    path_size = (size_t)slice_get_uint8(input, 1) * 2;
+
+    offset = 0;
+    if(slice_get_uint8(input, 2) == CIP_SYMBOLIC_SEGMENT_MARKER) {
+        scope_len = slice_get_uint8(input, 3);
+        offset = 2 + scope_len + (scope_len & 0x01);
+
+        if(offset > path_size) {
+            info("Program name in the list tags path is malformed!");
+            return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+        }
+
+        /* the response overwrites the request, keep a copy of the name. */
+        for(size_t i=0; i < scope_len; i++) {
+            scope_buf[i] = (char)slice_get_uint8(input, 4 + i);
+        }
+
+        scope = scope_buf;
+    }
+
+    if(!process_symbol_instance(slice_from_slice(input, 2, path_size), &offset, &start_instance) || offset != path_size) {
+        info("Only the symbol class is supported in the list tags path!");
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    offset = 2 + path_size;
+
+    num_attribs = slice_get_uint16_le(input, offset); offset += 2;
+    if(num_attribs == 0 || num_attribs > CIP_LIST_TAGS_MAX_ATTRIBS || offset + (size_t)(num_attribs * 2) != slice_len(input)) {
+        info("Unsupported attribute list in list tags request!");
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    for(size_t i=0; i < num_attribs; i++) {
+        attribs[i] = slice_get_uint16_le(input, offset); offset += 2;
+
+        if(attribs[i] != 1 && attribs[i] != 2 && attribs[i] != 7 && attribs[i] != 8) {
+            info("Unsupported attribute %d in list tags request!", attribs[i]);
+            return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+        }
+    }
+
+    /* skip the header, we fill it in at the end. */
+    offset = 4;
+    instance = 1;
+
+    for(tag = plc->tags; tag; tag = tag->next_tag, instance++) {
+        const char *name = tag->name;
+        size_t name_len = strlen(tag->name);
+        size_t program_len = program_name_length(tag->name);
+        uint16_t symbol_type = (uint16_t)(tag->tag_type | (uint16_t)(tag->num_dimensions << 13));
+        size_t elem_size = tag->elem_size;
+        size_t dimensions[3] = { tag->dimensions[0], tag->dimensions[1], tag->dimensions[2] };
+        size_t entry_size = 4;
+
+        if(instance < start_instance) {
+            continue;
+        }
+
+        if(scope) {
+            /* only this program's tags, without the program part. */
+            if(program_len != scope_len || str_cmp_i_n(tag->name, scope, scope_len) != 0) {
+                continue;
+            }
+
+            name += program_len + 1;
+            name_len -= program_len + 1;
+        } else if(program_len > 0) {
+            /* one entry for the whole program. */
+            if(program_listed_before(plc, tag, program_len)) {
+                continue;
+            }
+
+            name_len = program_len;
+            symbol_type = CIP_PROGRAM_SYMBOL_TYPE;
+            elem_size = 0;
+            dimensions[0] = dimensions[1] = dimensions[2] = 0;
+        }
+
+        for(size_t i=0; i < num_attribs; i++) {
+            switch(attribs[i]) {
+                case 1: entry_size += 2 + name_len; break;
+                case 2: entry_size += 2; break;
+                case 7: entry_size += 2; break;
+                case 8: entry_size += 12; break;
+                default: break;
+            }
+        }
+
+        if(offset + entry_size > slice_len(output)) {
+            need_frag = true;
+            break;
+        }
+
+        slice_set_uint32_le(output, offset, instance); offset += 4;
+
+        for(size_t i=0; i < num_attribs; i++) {
+            switch(attribs[i]) {
+                case 1:
+                    slice_set_uint16_le(output, offset, (uint16_t)name_len); offset += 2;
+                    for(size_t j=0; j < name_len; j++) {
+                        slice_set_uint8(output, offset + j, (uint8_t)name[j]);
+                    }
+                    offset += name_len;
+                    break;
+
+                case 2:
+                    /* the number of dimensions goes in bits 13 and 14. */
+                    slice_set_uint16_le(output, offset, symbol_type); offset += 2;
+                    break;
+
+                case 7:
+                    slice_set_uint16_le(output, offset, (uint16_t)elem_size); offset += 2;
+                    break;
+
+                case 8:
+                    for(size_t j=0; j < 3; j++) {
+                        slice_set_uint32_le(output, offset, (uint32_t)dimensions[j]); offset += 4;
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    slice_set_uint8(output, 0, list_cmd | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* padding/reserved. */
+    slice_set_uint8(output, 2, (need_frag ? CIP_ERR_FRAG : CIP_OK));
+    slice_set_uint8(output, 3, 0); /* no extra error fields. */
+
+    return slice_from_slice(output, 0, offset);
+}
+
+
+
+
+#define CIP_TEMPLATE_ATTRIBS_MIN_SIZE (10)
+#define CIP_TEMPLATE_MAX_ATTRIBS (4)
+#define CIP_TEMPLATE_READ_SIZE (14)
+#define CIP_TEMPLATE_MAX_SIZE (512)
+#define CIP_TEMPLATE_DINT ((uint16_t)0xC4)
+
+/*
+ * Synthetic UDT templates.  Template N has (N % 7) + 2 DINT members
+ * named M0, M1 and so on.  The structure handle depends on the template
+ * ID and on --udt_revision so that tests can simulate a program change.
+ */
+
+static uint16_t template_member_count(uint16_t template_id)
+{
+    return (uint16_t)((template_id % 7) + 2);
+}
+
+
+static uint16_t template_handle(plc_s *plc, uint16_t template_id)
+{
+    return (uint16_t)(0x1000 + (template_id * 31) + template_member_count(template_id) + (plc->udt_revision * 7919));
+}
+
+
+/* the size of one structure using the template, all members are DINTs. */
+size_t cip_template_instance_size(uint16_t template_id)
+{
+    return (size_t)template_member_count(template_id) * 4;
+}
+
+
+/* the template definition size in 32-bit words, as reported by attribute 4. */
+static uint32_t template_definition_words(uint16_t template_id)
+{
+    uint8_t buf[CIP_TEMPLATE_MAX_SIZE];
+    size_t def_size = build_template(template_id, buf, sizeof(buf));
+
+    return (uint32_t)((def_size + 23 + 3) / 4);
+}
+
+
+size_t build_template(uint16_t template_id, uint8_t *buf, size_t buf_size)
+{
+    uint16_t num_members = template_member_count(template_id);
+    size_t offset = 0;
+
+    memset(buf, 0, buf_size);
+
+    /* member info: array size, type and byte offset. */
+    for(uint16_t i=0; i < num_members; i++) {
+        uint32_t member_offset = (uint32_t)(i * 4);
+
+        buf[offset + 0] = 0;
+        buf[offset + 1] = 0;
+        buf[offset + 2] = (uint8_t)(CIP_TEMPLATE_DINT & 0xFF);
+        buf[offset + 3] = (uint8_t)(CIP_TEMPLATE_DINT >> 8);
+        buf[offset + 4] = (uint8_t)(member_offset & 0xFF);
+        buf[offset + 5] = (uint8_t)((member_offset >> 8) & 0xFF);
+        buf[offset + 6] = (uint8_t)((member_offset >> 16) & 0xFF);
+        buf[offset + 7] = (uint8_t)((member_offset >> 24) & 0xFF);
+        offset += 8;
+    }
+
+    /* the template name and then the member names, all zero terminated. */
+    offset += (size_t)snprintf((char *)buf + offset, buf_size - offset, "UDT_%u;n", (unsigned int)template_id) + 1;
+
+    for(uint16_t i=0; i < num_members; i++) {
+        offset += (size_t)snprintf((char *)buf + offset, buf_size - offset, "M%u", (unsigned int)i) + 1;
+    }
+
+    return offset;
+}
+
+
+
+/*
+ * Get Attribute List on a template instance.  We support the structure
+ * handle (1), member count (2), definition size (4) and structure size (5)
+ * attributes in any order.
+ */
+
+slice_s handle_template_attribs(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t cmd = slice_get_uint8(input, 0);
+    uint16_t template_id = 0;
+    uint16_t num_attribs = 0;
+    uint16_t attribs[CIP_TEMPLATE_MAX_ATTRIBS];
+    size_t in_offset = 0;
+    size_t out_offset = 0;
+
+    if(slice_len(input) < CIP_TEMPLATE_ATTRIBS_MIN_SIZE) {
+        info("Insufficient data in the template attribute request!");
+        return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    template_id = slice_get_uint16_le(input, 6);
+    num_attribs = slice_get_uint16_le(input, 8);
+    in_offset = 10;
+
+    if(num_attribs > CIP_TEMPLATE_MAX_ATTRIBS || slice_len(input) != in_offset + (size_t)(num_attribs * 2)) {
+        info("Attribute list size does not match the request!");
+        return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    /* the reply overwrites the request, get the attribute list first. */
+    for(uint16_t i=0; i < num_attribs; i++) {
+        attribs[i] = slice_get_uint16_le(input, in_offset); in_offset += 2;
+    }
+
+    info("Getting %d attributes of template %d.", num_attribs, template_id);
+
+    out_offset = 4;
+    slice_set_uint16_le(output, out_offset, num_attribs); out_offset += 2;
+
+    for(uint16_t i=0; i < num_attribs; i++) {
+        uint16_t attrib = attribs[i];
+
+        slice_set_uint16_le(output, out_offset, attrib); out_offset += 2;
+        slice_set_uint16_le(output, out_offset, 0); out_offset += 2; /* status */
+
+        switch(attrib) {
+            case 1:
+                slice_set_uint16_le(output, out_offset, template_handle(plc, template_id)); out_offset += 2;
+                break;
+
+            case 2:
+                slice_set_uint16_le(output, out_offset, template_member_count(template_id)); out_offset += 2;
+                break;
+
+            case 4:
+                slice_set_uint32_le(output, out_offset, template_definition_words(template_id)); out_offset += 4;
+                break;
+
+            case 5:
+                slice_set_uint32_le(output, out_offset, (uint32_t)(template_member_count(template_id) * 4)); out_offset += 4;
+                break;
+
+            default:
+                info("Unsupported template attribute %d!", attrib);
+                return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+        }
+    }
+
+    slice_set_uint8(output, 0, cmd | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* padding/reserved. */
+    slice_set_uint8(output, 2, CIP_OK);
+    slice_set_uint8(output, 3, 0); /* no extra error fields. */
+
+    return slice_from_slice(output, 0, out_offset);
+}
+
+
+
+/*
+ * Read the template definition.  The request has the byte offset to start
+ * at and the number of bytes wanted.  Whatever does not fit in the reply
+ * is left for the next request.
+ */
+
+slice_s handle_template_read(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t cmd = slice_get_uint8(input, 0);
+    uint8_t buf[CIP_TEMPLATE_MAX_SIZE];
+    uint16_t template_id = 0;
+    uint32_t start = 0;
+    uint32_t wanted = 0;
+    uint32_t total = 0;
+    uint32_t amount = 0;
+
+    (void)plc;
+
+    if(slice_len(input) != CIP_TEMPLATE_READ_SIZE) {
+        info("Unexpected template read request size!");
+        return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    template_id = slice_get_uint16_le(input, 6);
+    start = slice_get_uint32_le(input, 8);
+    wanted = slice_get_uint16_le(input, 12);
+
+    build_template(template_id, buf, sizeof(buf));
+
+    /* the client asks for the definition size less 23 bytes, rounded up to 4 bytes. */
+    total = ((template_definition_words(template_id) * 4) - 23 + 3) & ~(uint32_t)3;
+
+    if(start > total) {
+        info("Template read offset %u is past the end of the template!", start);
+        return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    amount = total - start;
+
+    if(amount > wanted) {
+        amount = wanted;
+    }
+
+    if(amount > (uint32_t)(slice_len(output) - 4)) {
+        amount = (uint32_t)(slice_len(output) - 4) & ~(uint32_t)3;
+    }
+
+    info("Reading %u bytes of template %d at offset %u.", amount, template_id, start);
+
+    for(uint32_t i=0; i < amount; i++) {
+        slice_set_uint8(output, 4 + i, buf[start + i]);
+    }
+
+    slice_set_uint8(output, 0, cmd | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* padding/reserved. */
+    slice_set_uint8(output, 2, (start + amount < total ? CIP_ERR_FRAG : CIP_OK));
+    slice_set_uint8(output, 3, 0); /* no extra error fields. */
+
+    return slice_from_slice(output, 0, 4 + amount);
+}
+
+
+
+#define CIP_IDENTITY_ATTRIBS_MIN_SIZE (8)
+#define CIP_IDENTITY_MAX_ATTRIBS (8)
+#define CIP_IDENTITY_VENDOR ((uint16_t)1)           /* Rockwell */
+#define CIP_IDENTITY_DEVICE_TYPE ((uint16_t)0x0E)   /* PLC */
+#define CIP_IDENTITY_PRODUCT_CODE ((uint16_t)0x37)
+
+/*
+ * Get Attribute List on the identity object.  We support the vendor (1),
+ * device type (2), product code (3) and serial number (6) attributes in
+ * any order.
+ */
+
+slice_s handle_identity_attribs(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t cmd = slice_get_uint8(input, 0);
+    uint16_t num_attribs = 0;
+    uint16_t attribs[CIP_IDENTITY_MAX_ATTRIBS];
+    size_t in_offset = 0;
+    size_t out_offset = 0;
+
+    if(slice_len(input) < CIP_IDENTITY_ATTRIBS_MIN_SIZE) {
+        info("Insufficient data in the identity attribute request!");
+        return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    num_attribs = slice_get_uint16_le(input, 6);
+    in_offset = 8;
+
+    if(num_attribs > CIP_IDENTITY_MAX_ATTRIBS || slice_len(input) != in_offset + (size_t)(num_attribs * 2)) {
+        info("Attribute list size does not match the request!");
+        return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    /* the reply overwrites the request, get the attribute list first. */
+    for(uint16_t i=0; i < num_attribs; i++) {
+        attribs[i] = slice_get_uint16_le(input, in_offset); in_offset += 2;
+    }
+
+    info("Getting %d identity attributes.", num_attribs);
+
+    out_offset = 4;
+    slice_set_uint16_le(output, out_offset, num_attribs); out_offset += 2;
+
+    for(uint16_t i=0; i < num_attribs; i++) {
+        uint16_t attrib = attribs[i];
+
+        slice_set_uint16_le(output, out_offset, attrib); out_offset += 2;
+        slice_set_uint16_le(output, out_offset, 0); out_offset += 2; /* status */
+
+        switch(attrib) {
+            case 1:
+                slice_set_uint16_le(output, out_offset, CIP_IDENTITY_VENDOR); out_offset += 2;
+                break;
+
+            case 2:
+                slice_set_uint16_le(output, out_offset, CIP_IDENTITY_DEVICE_TYPE); out_offset += 2;
+                break;
+
+            case 3:
+                slice_set_uint16_le(output, out_offset, CIP_IDENTITY_PRODUCT_CODE); out_offset += 2;
+                break;
+
+            case 6:
+                slice_set_uint32_le(output, out_offset, plc->serial_number); out_offset += 4;
+                break;
+
+            default:
+                info("Unsupported identity attribute %d!", attrib);
+                return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+        }
+    }
+
+    slice_set_uint8(output, 0, cmd | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* padding/reserved. */
+    slice_set_uint8(output, 2, CIP_OK);
+    slice_set_uint8(output, 3, 0); /* no extra error fields. */
+
+    return slice_from_slice(output, 0, out_offset);
+}
+
+
+
+
 /*
  * we should see:
  *  0x91 <name len> <name bytes> (<numeric segment>){0-3}
+ * or the symbol instance form:
+ *  0x20 0x6B <instance segment> (<numeric segment>){0-3}
  *
  * find the tag name, then check the numeric segments, if any, against the
  * tag dimensions.
@@ -609,32 +1223,50 @@ bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *sta
     size_t dimensions[3] = { 0, 0, 0};
     size_t dimension_index = 0;
 
-    if(symbolic_marker != CIP_SYMBOLIC_SEGMENT_MARKER)  {
+    if(symbolic_marker == CIP_CLASS_SEGMENT_MARKER) {
+        uint32_t instance = 0;
+
+        offset = 0;
+
+        if(!process_symbol_instance(input, &offset, &instance)) {
+            return false;
+        }
+
+        *tag = find_tag_by_instance(plc, instance);
+        if(!*tag) {
+            info("Symbol instance %u not found!", (unsigned int)instance);
+            return false;
+        }
+
+        info("Found tag %s by instance %u", (*tag)->name, (unsigned int)instance);
+
+        tag_name = slice_make((uint8_t *)(*tag)->name, (ssize_t)strlen((*tag)->name));
+    } else if(symbolic_marker != CIP_SYMBOLIC_SEGMENT_MARKER)  {
         info("Expected symbolic segment but found %x!", symbolic_marker);
         return false;
-    }
+    } else {
+        /* get and check the length of the symbolic name part. */
+        name_len = slice_get_uint8(input, offset); offset++;
+        if(name_len >= slice_len(input)) {
+            info("Insufficient space in symbolic segment for name.   Needed %d bytes but only had %d bytes!", name_len, slice_len(input)-1);
+            return false;
+        }
 
-    /* get and check the length of the symbolic name part. */
-    name_len = slice_get_uint8(input, offset); offset++;
-    if(name_len >= slice_len(input)) {
-        info("Insufficient space in symbolic segment for name.   Needed %d bytes but only had %d bytes!", name_len, slice_len(input)-1);
-        return false;
-    }
+        /* bump the offset.   Must be 16-bit aligned, so pad if needed. */
+        offset += (size_t)(name_len + ((name_len & 0x01) ? 1 : 0));
 
-    /* bump the offset.   Must be 16-bit aligned, so pad if needed. */
-    offset += (size_t)(name_len + ((name_len & 0x01) ? 1 : 0));
+        /* try to find the tag. */
+        tag_name = slice_from_slice(input, 2, name_len);
+        *tag = plc->tags;
 
-    /* try to find the tag. */
-    tag_name = slice_from_slice(input, 2, name_len);
-    *tag = plc->tags;
+        while(*tag) {
+            if(slice_match_string(tag_name, (*tag)->name)) {
+                info("Found tag %s", (*tag)->name);
+                break;
+            }
 
-    while(*tag) {
-        if(slice_match_string(tag_name, (*tag)->name)) {
-            info("Found tag %s", (*tag)->name);
-            break;
+            (*tag) = (*tag)->next_tag;
         }
-
-        (*tag) = (*tag)->next_tag;
     }
 
     if(*tag) {
@@ -716,6 +1348,68 @@ bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *sta
     return true;
 }
 
+/*
+ * Match 0x20 0x6B followed by an 8, 16 or 32-bit instance segment.  The
+ * offset is moved past the segments.
+ */
+
+bool process_symbol_instance(slice_s input, size_t *offset, uint32_t *instance)
+{
+    size_t index = *offset;
+
+    if(slice_get_uint8(input, index) != CIP_CLASS_SEGMENT_MARKER || slice_get_uint8(input, index + 1) != CIP_SYMBOL_CLASS) {
+        info("Expected the symbol class segment!");
+        return false;
+    }
+
+    index += 2;
+
+    switch(slice_get_uint8(input, index)) {
+        case 0x24:
+            *instance = slice_get_uint8(input, index + 1);
+            index += 2;
+            break;
+
+        case 0x25:
+            *instance = slice_get_uint16_le(input, index + 2);
+            index += 4;
+            break;
+
+        case 0x26:
+            *instance = slice_get_uint32_le(input, index + 2);
+            index += 6;
+            break;
+
+        default:
+            info("Unexpected instance segment marker %x!", slice_get_uint8(input, index));
+            return false;
+    }
+
+    if(index > slice_len(input)) {
+        info("Instance segment is truncated!");
+        return false;
+    }
+
+    *offset = index;
+
+    return true;
+}
+
+
+
+tag_def_s *find_tag_by_instance(plc_s *plc, uint32_t instance)
+{
+    tag_def_s *tag = plc->tags;
+
+    for(uint32_t i = 1; tag && i < instance; i++) {
+        tag = tag->next_tag;
+    }
+
+    return (instance > 0 ? tag : NULL);
+}
+
+
+
 /* match a path.   This is tricky, thanks, Rockwell. */
 bool match_path(slice_s input, bool need_pad, uint8_t *path, uint8_t path_len)
 {
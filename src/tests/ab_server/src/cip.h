@@ -37,3 +37,4 @@
 #include "slice.h"
 
 extern slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *context);
+extern size_t cip_template_instance_size(uint16_t template_id);
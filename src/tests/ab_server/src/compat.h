@@ -49,10 +49,12 @@
 
 #ifdef IS_MSVC
     #define str_cmp_i(first, second) _stricmp(first, second)
+    #define str_cmp_i_n(first, second, num_chars) _strnicmp(first, second, num_chars)
     #define strdup _strdup
     #define str_scanf sscanf_s
 #else
     #define str_cmp_i(first, second) strcasecmp(first, second)
+    #define str_cmp_i_n(first, second, num_chars) strncasecmp(first, second, num_chars)
     #define str_scanf sscanf
 #endif
 
@@ -48,18 +48,22 @@
 #include <strings.h>
 #endif
 
+#include "cip.h"
 #include "eip.h"
 #include "plc.h"
 #include "slice.h"
 #include "tcp_server.h"
 #include "utils.h"
 
+#define DEFAULT_SERIAL_NUMBER ((uint32_t)0x00C0FFEE)
+
 static void usage(void);
 static void process_args(int argc, const char **argv, plc_s *plc);
 static void parse_path(const char *path, plc_s *plc);
 static void parse_pccc_tag(const char *tag, plc_s *plc);
 static void parse_cip_tag(const char *tag, plc_s *plc);
 static slice_s request_handler(slice_s input, slice_s output, void *plc);
+static void rotate_tags(plc_s *plc);
 
 
 #ifdef IS_WINDOWS
@@ -68,6 +72,10 @@ typedef volatile int sig_flag_t;
 
 sig_flag_t done = 0;
 
+/* there are no user signals on Windows, these are never set. */
+sig_flag_t download = 0;
+sig_flag_t drop_client = 0;
+
 /* straight from MS' web site :-) */
 int WINAPI CtrlHandler(DWORD fdwCtrlType)
 {
@@ -122,6 +130,8 @@ void setup_break_handler(void)
 typedef volatile sig_atomic_t sig_flag_t;
 
 sig_flag_t done = 0;
+sig_flag_t download = 0;
+sig_flag_t drop_client = 0;
 
 void SIGINT_handler(int not_used)
 {
@@ -130,6 +140,16 @@ void SIGINT_handler(int not_used)
     done = 1;
 }
 
+/* tests send SIGUSR1 to simulate a program download and SIGUSR2 to drop the client. */
+void SIGUSR_handler(int sig)
+{
+    if(sig == SIGUSR1) {
+        download = 1;
+    } else {
+        drop_client = 1;
+    }
+}
+
 void setup_break_handler(void)
 {
     struct sigaction act;
@@ -138,6 +158,12 @@ void setup_break_handler(void)
     memset(&act, 0, sizeof(act));
     act.sa_handler = SIGINT_handler;
     sigaction(SIGINT, &act, NULL);
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIGUSR_handler;
+    act.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &act, NULL);
+    sigaction(SIGUSR2, &act, NULL);
 }
 
 #endif
@@ -196,6 +222,7 @@ void usage(void)
                     "\n"
                     "    CIP-based PLC tags are in the format: <name>:<type>[<sizes>] where:\n"
                     "        <name> is alphanumeric, starting with an alpha character.\n"
+                    "               Program tags are named Program:<program>.<name>.\n"
                     "        <type> is one of:\n"
                     "            INT    - 2-byte signed integer.  Requires array size(s).\n"
                     "            DINT   - 4-byte signed integer.  Requires array size(s).\n"
@@ -203,9 +230,20 @@ void usage(void)
                     "            REAL   - 4-byte floating point number.  Requires array size(s).\n"
                     "            LREAL  - 8-byte floating point number.  Requires array size(s).\n"
                     "            STRING - 82-byte string.  Requires array size(s).\n"
+                    "            UDT<n> - ControlLogix only, structure using template <n>.  Requires array size(s).\n"
                     "\n"
                     "        <sizes>> field is one or more (up to 3) numbers separated by commas.\n"
                     "\n"
+                    "    ControlLogix PLCs also serve a synthetic UDT template for every template ID.\n"
+                    "    Passing --udt_revision=<n> changes the structure handle of all of them.\n"
+                    "\n"
+                    "    --serial=<n> sets the serial number in the identity object so that tests\n"
+                    "    can tell two emulated controllers apart.\n"
+                    "\n"
+                    "    On POSIX systems SIGUSR1 simulates a program download by renumbering the\n"
+                    "    symbol instances of the tags and SIGUSR2 drops the client connection.\n"
+                    "    Both take effect when the next request comes in.\n"
+                    "\n"
                     "Example: ab_server --plc=ControlLogix --path=1,0 --tag=MyTag:DINT[10,10]\n");
 
     exit(1);
@@ -222,6 +260,8 @@ void process_args(int argc, const char **argv, plc_s *plc)
     /* make sure that the reject FO count is zero. */
     plc->reject_fo_count = 0;
 
+    plc->serial_number = DEFAULT_SERIAL_NUMBER;
+
     for(int i=0; i < argc; i++) {
         if(strncmp(argv[i],"--plc=",6) == 0) {
             if(has_plc) {
@@ -356,6 +396,20 @@ void process_args(int argc, const char **argv, plc_s *plc)
                 plc->response_delay = atoi(&argv[i][8]);
             }
         }
+
+        if(strncmp(argv[i],"--udt_revision=", 15) == 0) {
+            if(plc) {
+                info("Setting UDT template revision to %d.", atoi(&argv[i][15]));
+                plc->udt_revision = atoi(&argv[i][15]);
+            }
+        }
+
+        if(strncmp(argv[i],"--serial=", 9) == 0) {
+            if(plc) {
+                info("Setting serial number to %s.", &argv[i][9]);
+                plc->serial_number = (uint32_t)strtoul(&argv[i][9], NULL, 0);
+            }
+        }
     }
 
     if(needs_path && !has_path) {
@@ -572,19 +626,34 @@ void parse_cip_tag(const char *tag_str, plc_s *plc)
 
     /* try to match the three parts of a tag definition string. */
 
-    /* first match the name. */
+    /* program tags start with Program:<program name>. */
     start = 0;
+    if(str_cmp_i_n(tag_str, "Program:", strlen("Program:")) == 0) {
+        start = strlen("Program:");
+        start += strspn(tag_str + start, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+
+        if(start == strlen("Program:") || tag_str[start] != '.') {
+            fprintf(stderr, "Unable to parse tag definition string, cannot find program name in \"%s\"!\n", tag_str);
+            usage();
+        }
+
+        start++;
+    }
+
+    /* first match the name. */
     len = strspn(tag_str + start, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
     if (!len) {
         fprintf(stderr, "Unable to parse tag definition string, cannot find tag name in \"%s\"!\n", tag_str);
         usage();
     } else {
-        /* copy the string. */
+        /* copy the string, with the program part. */
+        len += start;
+
         for (size_t i = 0; i < len && i < (size_t)200; i++) {
-            tag_name[i] = tag_str[start + i];
+            tag_name[i] = tag_str[i];
         }
 
-        start += len;
+        start = len;
     }
 
     if(tag_str[start] != ':') {
@@ -594,8 +663,8 @@ void parse_cip_tag(const char *tag_str, plc_s *plc)
         start++;
     }
 
-    /* get the type field */
-    len = strspn(tag_str + start, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    /* get the type field, UDT types have the template ID after them. */
+    len = strspn(tag_str + start, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
     if (!len) {
         fprintf(stderr, "Unable to parse tag definition string, cannot match tag type in \"%s\"!\n", tag_str);
         usage();
@@ -656,6 +725,11 @@ void parse_cip_tag(const char *tag_str, plc_s *plc)
     } else if(str_cmp_i(type_str, "STRING") == 0) {
         tag->tag_type = TAG_CIP_TYPE_STRING;
         tag->elem_size = 88;
+    } else if(plc->plc_type == PLC_CONTROL_LOGIX && str_cmp_i_n(type_str, "UDT", 3) == 0 && strlen(type_str) > 3 && strspn(type_str + 3, "0123456789") == strlen(type_str + 3) && atoi(type_str + 3) <= TAG_CIP_TYPE_UDT_ID_MASK) {
+        uint16_t template_id = (uint16_t)atoi(type_str + 3);
+
+        tag->tag_type = (tag_type_t)(TAG_CIP_TYPE_STRUCT | template_id);
+        tag->elem_size = cip_template_instance_size(template_id);
     } else {
         fprintf(stderr, "Unsupported tag type \"%s\"!", type_str);
         usage();
@@ -727,6 +801,17 @@ slice_s request_handler(slice_s input, slice_s output, void *plc_arg)
 {
     plc_s *plc = (plc_s*)plc_arg;
 
+    if(download) {
+        download = 0;
+        rotate_tags(plc);
+    }
+
+    if(drop_client) {
+        drop_client = 0;
+        info("Dropping the client connection.");
+        return slice_make_err(TCP_SERVER_DROP);
+    }
+
     /* check to see if we have a full packet. */
     if(slice_len(input) >= EIP_HEADER_SIZE) {
         uint16_t eip_len = slice_get_uint16_le(input, 2);
@@ -746,3 +831,31 @@ slice_s request_handler(slice_s input, slice_s output, void *plc_arg)
     /* we do not have a complete packet, get more data. */
     return slice_make_err(TCP_SERVER_INCOMPLETE);
 }
+
+
+
+/*
+ * Move the first tag to the end of the list.  Tags are numbered as symbol
+ * instances in list order, so every tag gets a new instance ID as if the
+ * program had been downloaded again.
+ */
+
+void rotate_tags(plc_s *plc)
+{
+    tag_def_s *first = plc->tags;
+    tag_def_s *last = first;
+
+    if(!first || !first->next_tag) {
+        return;
+    }
+
+    while(last->next_tag) {
+        last = last->next_tag;
+    }
+
+    plc->tags = first->next_tag;
+    first->next_tag = NULL;
+    last->next_tag = first;
+
+    info("Simulated a program download, tag %s is now the last symbol instance.", first->name);
+}
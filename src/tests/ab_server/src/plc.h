@@ -51,6 +51,8 @@ typedef uint16_t tag_type_t;
 #define TAG_CIP_TYPE_REAL        ((tag_type_t)0x00CA) /* 32–bit floating point value, IEEE format */
 #define TAG_CIP_TYPE_LREAL       ((tag_type_t)0x00CB) /* 64–bit floating point value, IEEE format */
 #define TAG_CIP_TYPE_STRING      ((tag_type_t)0x00D0) /* 88-byte string, with 82 bytes of data, 4-byte count and 2 bytes of padding */
+#define TAG_CIP_TYPE_STRUCT      ((tag_type_t)0x8000) /* structure, the low 12 bits are the template ID */
+#define TAG_CIP_TYPE_UDT_ID_MASK ((tag_type_t)0x0FFF)
 
 /* PCCC data types.   FIXME */
 #define TAG_PCCC_TYPE_INT         ((uint8_t)0x89) /* Signed 16–bit integer value */
@@ -113,6 +115,12 @@ typedef struct {
     /* response delay */
     int response_delay;
 
+    /* changes the structure handle of the synthetic UDT templates. */
+    int udt_revision;
+
+    /* serial number in the identity object. */
+    uint32_t serial_number;
+
     /* list of tags served by this "PLC" */
     struct tag_def_s *tags;
 } plc_s;
@@ -99,6 +99,12 @@ void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate)
                 /* try to process the packet. */
                 tmp_output = server->handler(tmp_input, server->buffer, server->context);
 
+                /* the handler wants this client gone. */
+                if(slice_has_err(tmp_output) && slice_get_err(tmp_output) == TCP_SERVER_DROP) {
+                    rc = TCP_SERVER_DONE;
+                    break;
+                }
+
                 /* check the response. */
                 if(!slice_has_err(tmp_output)) {
                     /* FIXME - this should be in a loop to make sure all data is pushed. */
@@ -42,7 +42,8 @@ typedef enum {
     TCP_SERVER_PROCESSED = 100002,
     TCP_SERVER_DONE = 100003,
     TCP_SERVER_BAD_REQUEST = 100004,
-    TCP_SERVER_UNSUPPORTED = 100005
+    TCP_SERVER_UNSUPPORTED = 100005,
+    TCP_SERVER_DROP = 100006
 } tcp_server_status_t;
 
 typedef struct tcp_server *tcp_server_p;
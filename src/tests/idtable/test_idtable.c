@@ -0,0 +1,143 @@
+/***************************************************************************
+ *   Copyright (C) 2023 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Check that ID table slots keep being reused after the generation in
+ * the ID wraps, and that a stale ID does not match before it does.
+ *
+ * One segment worth of slots is cycled through the free list until each
+ * slot has been used more than twice the generation range.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../../lib/libplctag.h"
+#include "../../util/idtable.h"
+#include "../../util/debug.h"
+
+/* must match the generation range in idtable.c. */
+#define GENERATIONS ((1 << (31 - IDTABLE_INDEX_BITS)) - 1)
+#define LIVE_ENTRIES (16)
+#define WRAP_LAPS (2)
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+int main(int argc, const char **argv)
+{
+    idtable_p table = NULL;
+    int32_t live[LIVE_ENTRIES] = {0};
+    int32_t stale_id = 0;
+    int capacity = 0;
+    int64_t cycles = 0;
+    int64_t first_stale_match = -1;
+
+    (void)argc;
+    (void)argv;
+
+    table = idtable_create();
+    if(!table) {
+        fprintf(stderr, "Unable to create ID table!\n");
+        return 1;
+    }
+
+    capacity = idtable_capacity(table);
+
+    for(int i=0; i < LIVE_ENTRIES; i++) {
+        live[i] = idtable_put(table, (void *)(intptr_t)(i + 1));
+        check(live[i] > 0, "initial put failed");
+    }
+
+    stale_id = idtable_put(table, (void *)(intptr_t)1000);
+    check(idtable_remove(table, stale_id) == (void *)(intptr_t)1000, "remove of a live ID failed");
+
+    /* every pass through the free list uses each free slot once. */
+    cycles = (int64_t)capacity * GENERATIONS * WRAP_LAPS;
+
+    for(int64_t cycle = 0; cycle < cycles && !failures; cycle++) {
+        int slot = (int)(cycle % LIVE_ENTRIES);
+        void *data = (void *)(intptr_t)(slot + 1);
+        int32_t id = idtable_put(table, data);
+
+        if(id <= 0) {
+            fprintf(stderr, "Put failed with %s after %" PRId64 " cycles!\n", plc_tag_decode_error(id), cycle);
+            failures++;
+            break;
+        }
+
+        check(idtable_remove(table, live[slot]) == data, "remove returned the wrong data");
+        check(idtable_get(table, live[slot]) == NULL, "removed ID still found");
+        check(idtable_get(table, id) == data, "new ID not found");
+
+        live[slot] = id;
+
+        if(first_stale_match < 0 && idtable_get(table, stale_id)) {
+            first_stale_match = cycle;
+        }
+    }
+
+    check(idtable_capacity(table) == capacity, "table grew instead of reusing slots");
+    check(idtable_entries(table) == LIVE_ENTRIES, "wrong number of entries");
+
+    /* the stale ID can only match again once its slot went all the way around. */
+    check(first_stale_match < 0 || first_stale_match >= (int64_t)(capacity - LIVE_ENTRIES - 1) * (GENERATIONS - 1), "stale ID matched before the generation wrapped");
+
+    for(int i=0; i < LIVE_ENTRIES; i++) {
+        check(idtable_remove(table, live[i]) == (void *)(intptr_t)(i + 1), "final remove failed");
+    }
+
+    check(idtable_entries(table) == 0, "table not empty");
+
+    idtable_destroy(table);
+
+    fprintf(stderr, "%" PRId64 " put/remove cycles over %d slots, stale ID first matched at cycle %" PRId64 ".\n", cycles, capacity, first_stale_match);
+
+    if(failures) {
+        fprintf(stderr, "FAILED with %d errors.\n", failures);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
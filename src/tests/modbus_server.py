@@ -11,20 +11,27 @@ twisted is just not feasible. What follows is an example of its use:
 # --------------------------------------------------------------------------- #
 # import the various server implementations
 # --------------------------------------------------------------------------- #
-from pymodbus.server import StartTcpServer
-#from pymodbus.server.sync import StartTlsServer
-#from pymodbus.server.sync import StartUdpServer
-#from pymodbus.server.sync import StartSerialServer
-
-from pymodbus.device import ModbusDeviceIdentification
-from pymodbus.datastore import ModbusSequentialDataBlock, ModbusSparseDataBlock
-from pymodbus.datastore import ModbusSlaveContext, ModbusServerContext
-
-from pymodbus.transaction import ModbusRtuFramer, ModbusBinaryFramer
+# the --busy server below does not need pymodbus.
+try:
+    from pymodbus.server import StartTcpServer
+    #from pymodbus.server.sync import StartTlsServer
+    from pymodbus.server import StartUdpServer
+    #from pymodbus.server.sync import StartSerialServer
+
+    from pymodbus.device import ModbusDeviceIdentification
+    from pymodbus.datastore import ModbusSequentialDataBlock, ModbusSparseDataBlock
+    from pymodbus.datastore import ModbusSlaveContext, ModbusServerContext
+
+    from pymodbus.transaction import ModbusRtuFramer, ModbusBinaryFramer
+except ImportError:
+    StartTcpServer = None
 # --------------------------------------------------------------------------- #
 # configure the service logging
 # --------------------------------------------------------------------------- #
+import asyncio
 import logging
+import struct
+import sys
 FORMAT = ('%(asctime)-15s %(threadName)-15s'
           ' %(levelname)-8s %(module)-15s:%(lineno)-8s %(message)s')
 logging.basicConfig(format=FORMAT)
@@ -32,7 +39,88 @@ log = logging.getLogger()
 log.setLevel(logging.DEBUG)
 
 
-def run_server():
+# --------------------------------------------------------------------------- #
+# a server with a limited number of requests in flight
+# --------------------------------------------------------------------------- #
+# pymodbus answers the requests of a connection one at a time, so it never
+# has more than one in flight.  This small server answers each request after
+# a fixed delay and answers any request past the limit at once with
+# exception 0x06, server busy, like a gateway with a small request queue.
+# It only knows the holding and input registers.
+# --------------------------------------------------------------------------- #
+class BusyServer:
+    def __init__(self, max_in_flight, delay_ms):
+        self.max_in_flight = max_in_flight
+        self.delay = delay_ms / 1000.0
+        self.registers = [17] * 1000
+
+    def execute(self, function, data):
+        if function in (0x03, 0x04) and len(data) == 4:
+            start, count = struct.unpack(">HH", data)
+            if count < 1 or count > 125 or start + count > len(self.registers):
+                return None, 0x02
+            values = self.registers[start:start + count]
+            return struct.pack(">B%dH" % count, count * 2, *values), 0
+        if function == 0x06 and len(data) == 4:
+            start, value = struct.unpack(">HH", data)
+            if start >= len(self.registers):
+                return None, 0x02
+            self.registers[start] = value
+            return data, 0
+        if function == 0x10 and len(data) >= 5:
+            start, count, size = struct.unpack(">HHB", data[:5])
+            if count < 1 or count > 123 or size != count * 2 or len(data) != 5 + size:
+                return None, 0x03
+            if start + count > len(self.registers):
+                return None, 0x02
+            self.registers[start:start + count] = struct.unpack(">%dH" % count, data[5:])
+            return data[:4], 0
+        return None, 0x01
+
+    async def respond(self, writer, header, function, data, delay):
+        if delay:
+            await asyncio.sleep(delay)
+        body, error = self.execute(function, data)
+        if error:
+            pdu = struct.pack(">BB", function | 0x80, error)
+        else:
+            pdu = struct.pack(">B", function) + body
+        transaction, protocol, _, unit = header
+        writer.write(struct.pack(">HHHB", transaction, protocol, len(pdu) + 1, unit) + pdu)
+        await writer.drain()
+
+    async def handle(self, reader, writer):
+        in_flight = set()
+        try:
+            while True:
+                header = struct.unpack(">HHHB", await reader.readexactly(7))
+                pdu = await reader.readexactly(header[2] - 1)
+                function, data = pdu[0], pdu[1:]
+                if len(in_flight) >= self.max_in_flight:
+                    log.debug("%d requests in flight, busy." % len(in_flight))
+                    writer.write(struct.pack(">HHHBBB", header[0], header[1], 3, header[3], function | 0x80, 0x06))
+                    await writer.drain()
+                    continue
+                task = asyncio.ensure_future(self.respond(writer, header, function, data, self.delay))
+                in_flight.add(task)
+                task.add_done_callback(in_flight.discard)
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        for task in in_flight:
+            task.cancel()
+        writer.close()
+
+    async def serve(self):
+        server = await asyncio.start_server(self.handle, "0.0.0.0", 5020)
+        async with server:
+            await server.serve_forever()
+
+
+def run_server(udp=False):
+    if StartTcpServer is None:
+        print("pymodbus is not installed!")
+        sys.exit(1)
+
     # ----------------------------------------------------------------------- #
     # initialize your data store
     # ----------------------------------------------------------------------- #
@@ -111,6 +199,11 @@ def run_server():
     # ----------------------------------------------------------------------- #
     # run the server you want
     # ----------------------------------------------------------------------- #
+    # Udp on the same port number for the Modbus/UDP tests:
+    if udp:
+        StartUdpServer(context=context, identity=identity, address=("0.0.0.0", 5020))
+        return
+
     # Tcp:
     StartTcpServer(context=context, identity=identity, address=("0.0.0.0", 5020))
 
@@ -121,9 +214,6 @@ def run_server():
     # StartTlsServer(context, identity=identity, certfile="server.crt",
     #                keyfile="server.key", address=("0.0.0.0", 8020))
 
-    # Udp:
-    # StartUdpServer(context, identity=identity, address=("0.0.0.0", 5020))
-
     # Ascii:
     # StartSerialServer(context, identity=identity,
     #                    port='/dev/ttyp0', timeout=1)
@@ -141,5 +231,14 @@ def run_server():
 
 
 if __name__ == "__main__":
-    print("Starting server on port 5020.");
-    run_server()
+    busy = [arg for arg in sys.argv[1:] if arg.startswith("--busy=")]
+    delay = [arg for arg in sys.argv[1:] if arg.startswith("--delay=")]
+    if busy:
+        max_in_flight = int(busy[0][len("--busy="):])
+        delay_ms = int(delay[0][len("--delay="):]) if delay else 20
+        print("Starting TCP server on port 5020 with at most %d requests in flight." % max_in_flight)
+        asyncio.run(BusyServer(max_in_flight, delay_ms).serve())
+        sys.exit(0)
+    udp = "--udp" in sys.argv[1:]
+    print("Starting %s server on port 5020." % ("UDP" if udp else "TCP"));
+    run_server(udp)
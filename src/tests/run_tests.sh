@@ -9,6 +9,20 @@ TEST=0
 SUCCESSES=0
 FAILURES=0
 
+# wait until an emulator started in the background accepts connections on the port.
+wait_for_port() {
+    for i in {1..50}; do
+        if (echo > /dev/tcp/127.0.0.1/$1) > /dev/null 2>&1; then
+            return 0
+        fi
+
+        sleep 0.1
+    done
+
+    echo "Nothing is listening on port $1!"
+    return 1
+}
+
 if [[ ! -d $TEST_DIR ]]; then
     # echo "Using $TEST_DIR for test executables."
 # else
@@ -17,7 +31,7 @@ if [[ ! -d $TEST_DIR ]]; then
 fi
 
 # test for the executables.
-EXECUTABLES="ab_server string_non_standard_udt string_standard tag_rw2 list_tags_logix test_auto_sync test_callback test_callback_ex test_callback_ex_logix test_callback_ex_modbus test_many_tag_perf test_raw_cip test_reconnect test_shutdown test_special test_string test_tag_attributes thread_stress"
+EXECUTABLES="ab_server string_non_standard_udt string_standard tag_rw2 list_tags_logix test_adaptive_read test_auto_sync test_callback test_callback_ex test_callback_ex_logix test_callback_ex_modbus test_debug_async test_discover test_idtable test_listing_stream test_lock_profile test_many_tag_perf test_mem_track test_modbus_requests test_parallel_fragments test_pccc_merge test_rate_group test_raw_cip test_reconnect test_shutdown test_special test_stats test_string test_symbol_instance test_tag_attributes test_tag_churn test_tag_memory test_trace test_udt_cache thread_stress"
 # echo -n "  Checking for executables..."
 for EXECUTABLE in $EXECUTABLES
 do
@@ -52,6 +66,39 @@ else
     let SUCCESSES++
 fi
 
+let TEST++
+echo -n "Test $TEST: asynchronous debug logging... "
+$TEST_DIR/test_debug_async 20000 > "${TEST}_debug_async_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: tag ID churn... "
+$TEST_DIR/test_tag_churn 100000 200000 > "${TEST}_tag_churn_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: tag ID generation wrap... "
+$TEST_DIR/test_idtable > "${TEST}_idtable_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
 let TEST++
 echo -n "Test $TEST: basic large tag read/write... "
 $TEST_DIR/tag_rw2 --type=sint32 '--tag=protocol=ab-eip&gateway=10.206.1.40&path=1,4&plc=ControlLogix&elem_count=1000&name=TestBigArray' --debug=4 --write=1,2,3,4,5,6,7,8,9 > "${TEST}_big_tag_test.log" 2>&1
@@ -221,6 +268,253 @@ fi
 killall -TERM ab_server > /dev/null 2>&1
 
 
+# echo -n "  Starting AB emulator for ControlLogix memory tests... "
+$TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --tag=TestBigArray:DINT[2000] > ab_memory_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/ControlLogix emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+let TEST++
+echo -n "Test $TEST: memory used per tag... "
+$TEST_DIR/test_tag_memory 2000 > "${TEST}_tag_memory_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+killall -TERM ab_server > /dev/null 2>&1
+
+
+# echo -n "  Starting AB emulator for ControlLogix parallel fragment tests... "
+$TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --delay=10 --tag=TestBigArray:DINT[2000] --tag=TestDINT:DINT[1] > ab_parallel_fragments_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/ControlLogix emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+let TEST++
+echo -n "Test $TEST: parallel fragments of a large tag... "
+$TEST_DIR/test_parallel_fragments > "${TEST}_parallel_fragments_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+killall -TERM ab_server > /dev/null 2>&1
+
+
+# echo -n "  Starting AB emulator for ControlLogix UDT cache tests... "
+$TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --delay=10 --tag=TestDINTArray:DINT[10] > ab_udt_cache_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/ControlLogix emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+let TEST++
+echo -n "Test $TEST: UDT cache fresh start... "
+$TEST_DIR/test_udt_cache fresh udt_cache_test.bin > "${TEST}_udt_cache_fresh_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: UDT cache loaded from file... "
+$TEST_DIR/test_udt_cache file udt_cache_test.bin > "${TEST}_udt_cache_file_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+killall -TERM ab_server > /dev/null 2>&1
+
+
+# echo -n "  Starting AB emulator for ControlLogix UDT cache tests against another controller... "
+$TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --serial=0x1234 --tag=TestDINTArray:DINT[10] > ab_udt_cache_other_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/ControlLogix emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+let TEST++
+echo -n "Test $TEST: UDT cache shared with another controller... "
+$TEST_DIR/test_udt_cache other udt_cache_test.bin > "${TEST}_udt_cache_other_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+killall -TERM ab_server > /dev/null 2>&1
+
+
+# echo -n "  Starting AB emulator for ControlLogix adaptive read tests... "
+$TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --tag=TestDINT:DINT[1] > ab_adaptive_read_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/ControlLogix emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+let TEST++
+echo -n "Test $TEST: adaptive automatic reads... "
+$TEST_DIR/test_adaptive_read > "${TEST}_adaptive_read_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+killall -TERM ab_server > /dev/null 2>&1
+
+
+# echo -n "  Starting AB emulator for ControlLogix rate group tests... "
+$TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --delay=10 --tag=RateDINT:DINT[20] > ab_rate_group_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/ControlLogix emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+let TEST++
+echo -n "Test $TEST: automatic reads in one rate group... "
+$TEST_DIR/test_rate_group > "${TEST}_rate_group_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+killall -TERM ab_server > /dev/null 2>&1
+
+
+# echo -n "  Starting AB emulator for ControlLogix symbol instance tests... "
+$TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --tag=SymC:DINT[10] --tag=SymB:REAL[10] --tag=SymA:DINT[10] > ab_symbol_instance_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/ControlLogix emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+let TEST++
+echo -n "Test $TEST: reads by symbol instance... "
+$TEST_DIR/test_symbol_instance $EMULATOR_PID > "${TEST}_symbol_instance_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+killall -TERM ab_server > /dev/null 2>&1
+
+
+# echo -n "  Starting AB emulator for ControlLogix discovery tests... "
+$TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --tag=Ctl:DINT[1] --tag=Motor:UDT12[2] --tag=Program:Main.Speed:UDT20[1] --tag=Program:Aux.Count:DINT[4] --tag=Program:Aux.Pump:UDT12[1] > ab_discover_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/ControlLogix emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+let TEST++
+echo -n "Test $TEST: discovery of program scopes and UDTs... "
+$TEST_DIR/test_discover > "${TEST}_discover_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+killall -TERM ab_server > /dev/null 2>&1
+
+# the old emulator must let go of the port before the new one can take it.
+wait $EMULATOR_PID > /dev/null 2>&1
+
+
+# echo -n "  Starting AB emulator for ControlLogix tag listing tests... "
+LISTING_TAGS=""
+for i in $(seq 1 300); do
+    LISTING_TAGS="$LISTING_TAGS --tag=Tag$i:DINT[1]"
+done
+$TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --delay=50 --tag=Grid:DINT[4,5] --tag=Program:Main.Speed:REAL[3] $LISTING_TAGS > ab_listing_stream_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/ControlLogix emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+# 300 tags take a while to set up.
+wait_for_port 44818
+
+let TEST++
+echo -n "Test $TEST: streamed tag listing... "
+$TEST_DIR/test_listing_stream 300 > "${TEST}_listing_stream_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+killall -TERM ab_server > /dev/null 2>&1
+wait $EMULATOR_PID > /dev/null 2>&1
+
+
 # echo -n "  Starting AB emulator for ControlLogix tests... "
 $TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --tag=TestBigArray:DINT[2000] --delay=5  > ab_emulator.log 2>&1 &
 EMULATOR_PID=$!
@@ -269,6 +563,54 @@ else
 fi
 
 
+let TEST++
+echo -n "Test $TEST: memory accounting... "
+PLCTAG_MEM_TRACK_FILE="${TEST}_mem_track.txt" $TEST_DIR/test_mem_track 'protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_count=1&allow_packing=0&name=TestBigArray[0]' 20 > "${TEST}_mem_track_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+
+let TEST++
+echo -n "Test $TEST: performance counters... "
+$TEST_DIR/test_stats 'protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_count=1&allow_packing=0&name=TestBigArray[0]' 20 > "${TEST}_stats_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+
+let TEST++
+echo -n "Test $TEST: request lifecycle trace... "
+PLCTAG_TRACE_FILE="${TEST}_trace.json" $TEST_DIR/test_trace 'protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_count=1&allow_packing=0&name=TestBigArray[0]' 5 20 > "${TEST}_trace_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+
+let TEST++
+echo -n "Test $TEST: threads sharing library locks... "
+PLCTAG_LOCK_PROFILE_FILE="${TEST}_lock_profile.txt" $TEST_DIR/test_lock_profile 'protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_count=1&allow_packing=0&name=TestBigArray[0]' 8 20 > "${TEST}_lock_profile_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+
 let TEST++
 echo -n "Test $TEST: hard library shutdown... "
 $TEST_DIR/test_shutdown > "${TEST}_shutdown.log" 2>&1
@@ -313,6 +655,63 @@ fi
 # echo "  Killing Omron emulator."
 killall -TERM ab_server > /dev/null 2>&1
 
+
+# echo -n "  Starting AB emulator for SLC tests... "
+$TEST_DIR/ab_server --plc=SLC500 --tag=N7[100] > slc_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/SLC emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+
+let TEST++
+echo -n "Test $TEST: thread stress SLC... "
+$TEST_DIR/thread_stress 10 'protocol=ab-eip&gateway=127.0.0.1&plc=slc500&name=N7:10' > "${TEST}_slc_stress_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+# echo "  Killing SLC emulator."
+killall -TERM ab_server > /dev/null 2>&1
+
+# the old emulator must let go of the port before the new one can take it.
+wait $EMULATOR_PID > /dev/null 2>&1
+
+# echo -n "  Starting AB emulator for SLC merged read tests... "
+$TEST_DIR/ab_server --plc=SLC500 --tag=N7[10] > slc_merge_emulator.log 2>&1 &
+EMULATOR_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start AB/SLC emulator!"
+    exit 1
+# else
+    # echo "OK"
+fi
+
+wait_for_port 44818
+
+let TEST++
+echo -n "Test $TEST: merged reads with a bad address SLC... "
+$TEST_DIR/test_pccc_merge > "${TEST}_slc_pccc_merge_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+# echo "  Killing SLC emulator."
+killall -TERM ab_server > /dev/null 2>&1
+
 # echo -n "  Starting Modbus emulator... "
 $SCRIPT_DIR/modbus_server.py > modbus_emulator.log 2>&1 &
 MODBUS_PID=$!
@@ -373,9 +772,154 @@ else
     let SUCCESSES++
 fi
 
+let TEST++
+echo -n "Test $TEST: auto sync turned on after create Modbus... "
+$TEST_DIR/test_auto_sync --set-after-create 'protocol=modbus-tcp&gateway=127.0.0.1:5020&path=0&elem_count=2&name=hr10' > "${TEST}_modbus_late_auto_sync_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: coalesced reads Modbus... "
+$TEST_DIR/test_modbus_requests reads > "${TEST}_modbus_reads_requests_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: merged and combined writes Modbus... "
+$TEST_DIR/test_modbus_requests writes > "${TEST}_modbus_writes_requests_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: adaptive request window Modbus... "
+$TEST_DIR/test_modbus_requests window > "${TEST}_modbus_window_requests_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: idle tags send nothing Modbus... "
+$TEST_DIR/test_modbus_requests idle > "${TEST}_modbus_idle_requests_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: parallel large read Modbus... "
+$TEST_DIR/test_modbus_requests large > "${TEST}_modbus_large_requests_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: shared unit ID connection Modbus... "
+$TEST_DIR/test_modbus_requests units > "${TEST}_modbus_units_requests_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
 # echo "  Killing Modbus emulator."
 kill -TERM $MODBUS_PID > /dev/null 2>&1
 
+# the next emulator needs the same port.
+wait $MODBUS_PID > /dev/null 2>&1
+
+# echo -n "  Starting busy Modbus emulator... "
+$SCRIPT_DIR/modbus_server.py --busy=4 > modbus_busy_emulator.log 2>&1 &
+MODBUS_BUSY_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start busy Modbus emulator!"
+    exit 1
+else
+    # sleep to let the emulator start up all the way
+    sleep 2
+    # echo "OK"
+fi
+
+let TEST++
+echo -n "Test $TEST: adaptive request window with a busy server Modbus... "
+$TEST_DIR/test_modbus_requests busy > "${TEST}_modbus_busy_requests_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+# echo "  Killing busy Modbus emulator."
+kill -TERM $MODBUS_BUSY_PID > /dev/null 2>&1
+
+# echo -n "  Starting Modbus/UDP emulator... "
+$SCRIPT_DIR/modbus_server.py --udp > modbus_udp_emulator.log 2>&1 &
+MODBUS_UDP_PID=$!
+if [ $? != 0 ]; then
+    # echo "FAILURE"
+    echo "Unable to start Modbus/UDP emulator!"
+    exit 1
+else
+    # sleep to let the emulator start up all the way
+    sleep 2
+    # echo "OK"
+fi
+
+let TEST++
+echo -n "Test $TEST: thread stress Modbus/UDP... "
+$TEST_DIR/thread_stress 10 'protocol=modbus-udp&gateway=127.0.0.1:5020&path=0&elem_count=2&name=hr10' > "${TEST}_modbus_udp_stress_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: large tag Modbus/UDP... "
+$TEST_DIR/tag_rw2 --type=uint16 '--tag=protocol=modbus-udp&gateway=127.0.0.1:5020&path=0&elem_count=500&name=hr100&max_requests_in_flight=4' > "${TEST}_modbus_udp_big_tag_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+# echo "  Killing Modbus/UDP emulator."
+kill -TERM $MODBUS_UDP_PID > /dev/null 2>&1
+
 echo ""
 echo "$TEST tests."
 echo "$SUCCESSES successes."
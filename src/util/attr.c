@@ -38,27 +38,82 @@
  *      Author: Kyle Hayes
  */
 
+#include <lib/libplctag.h>
 #include <util/attr.h>
 #include <platform.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <util/debug.h>
+#include <util/hash.h>
+#include <util/intern.h>
+#include <util/mem_track.h>
 
 
 
+/*
+ * Attribute lists are flat.  The header, the entry array and a string arena
+ * for the keys and values are all allocated in a single block sized from the
+ * attribute string.  Each key carries its hash so that lookups only fall back
+ * to a string compare when the hashes match.
+ *
+ * Values for connection-level keys (gateway, path, PLC type) are interned in
+ * the library-wide pool, see intern_str().  Tags created with the same
+ * connection parameters then share the same value pointers and can be
+ * matched to an existing session with a pointer compare.  Interned strings
+ * are reference counted and freed when the last attribute list, session or
+ * tag using them lets go.
+ *
+ * If later calls to attr_set_str() run out of space in the block, the entry
+ * array or the strings spill over to separate heap allocations.
+ */
+
+#define ATTR_DEFAULT_ENTRIES (8)
+#define ATTR_EXTRA_ENTRIES (4)
+#define ATTR_EXTRA_STR_BYTES (64)
+#define ATTR_HASH_SEED (0x4A7B1C3D)
+
+#define ATTR_ENTRY_NAME_ON_HEAP (1)
+#define ATTR_ENTRY_VAL_ON_HEAP (2)
+#define ATTR_ENTRY_VAL_INTERNED (4)
 
 struct attr_entry_t {
-    attr_entry next;
-    char *name;
-    char *val;
+    uint32_t hash;
+    int flags;
+    const char *name;
+    const char *val;
 };
 
 struct attr_t {
-    attr_entry head;
+    int num_entries;
+    int max_entries;
+    struct attr_entry_t *entries;
+
+    int str_used;
+    int str_capacity;
+    char *str_data;
+
+    /* bytes counted by memory accounting, zero if not counted. */
+    int tracked_size;
+
+    /* the entries and string arena follow the header in the same allocation. */
+    union {
+        struct attr_entry_t entry;
+        char c;
+    } inline_data[];
 };
 
+/* the keys whose values are interned. */
+static const char *intern_keys[] = { "gateway", "path", "plc", "cpu", NULL };
 
 
+static attr attr_alloc(int max_entries, int str_capacity);
+static uint32_t attr_hash_str(const char *str, int len);
+static int attr_key_is_interned(const char *name);
+static const char *attr_store_str(attr attrs, const char *str, int *on_heap);
+static int attr_add_entry(attr attrs, const char *name, uint32_t name_hash, int name_on_heap, const char *val, int val_on_heap);
+static void attr_free_entry_val(attr_entry e);
+
 
 
 /*
@@ -70,22 +125,19 @@ struct attr_t {
 
 attr_entry find_entry(attr a, const char *name)
 {
-    attr_entry e;
+    uint32_t name_hash;
 
-    if(!a)
+    if(!a || !name)
         return NULL;
 
-    e = a->head;
+    name_hash = attr_hash_str(name, str_length(name));
 
-    if(!e)
-        return NULL;
+    for(int i=0; i < a->num_entries; i++) {
+        attr_entry e = &(a->entries[i]);
 
-    while(e) {
-        if(str_cmp(e->name, name) == 0) {
+        if(e->hash == name_hash && str_cmp(e->name, name) == 0) {
             return e;
         }
-
-        e = e->next;
     }
 
     return NULL;
@@ -99,73 +151,89 @@ attr_entry find_entry(attr a, const char *name)
  */
 extern attr attr_create()
 {
-    return (attr)mem_alloc(sizeof(struct attr_t));
+    return attr_alloc(ATTR_DEFAULT_ENTRIES, ATTR_EXTRA_STR_BYTES);
 }
 
 
 
-
-
-
-
-
-
 /*
  * attr_create_from_str
  *
- * Parse the passed string into an attr structure and return a pointer to a list of
- * attr_entry structs.
+ * Parse the passed string into an attr structure and return a pointer to it.
  *
  * Attribute strings are formatted much like URL arguments:
  * foo=bar&blah=humbug&blorg=42&test=one
  * You cannot, currently, have an "=" or "&" character in the value for an
  * attribute.
+ *
+ * The string is copied once into the arena of the new attribute list and
+ * split in place.  Empty key-value pairs (i.e. "&&") are skipped.
  */
 extern attr attr_create_from_str(const char *attr_str)
 {
     attr res = NULL;
-    char **kv_pairs = NULL;
+    int attr_str_len = str_length(attr_str);
+    int num_pairs = 1;
+    char *kv_pair = NULL;
+    char *next_pair = NULL;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
-    if(!str_length(attr_str)) {
+    if(!attr_str_len) {
         pdebug(DEBUG_WARN, "Attribute string needs to be longer than zero characters!");
         return NULL;
     }
 
-    /* split the string on "&" */
-    kv_pairs = str_split(attr_str, "&");
-    if(!kv_pairs) {
-        pdebug(DEBUG_WARN, "No key-value pairs!");
-        return NULL;
+    /* count the upper bound on the number of key-value pairs */
+    for(int i=0; i < attr_str_len; i++) {
+        if(attr_str[i] == '&') {
+            num_pairs++;
+        }
     }
 
-    /* set up the attribute list head */
-    res = attr_create();
+    /* set up the attribute list with room for the parsed string and a few more entries */
+    res = attr_alloc(num_pairs + ATTR_EXTRA_ENTRIES, attr_str_len + 1 + ATTR_EXTRA_STR_BYTES);
     if(!res) {
         pdebug(DEBUG_ERROR, "Unable to allocate memory for attribute list!");
-        mem_free(kv_pairs);
         return NULL;
     }
 
+    /* copy the string into the arena.  Keys and values point into this copy. */
+    str_copy(res->str_data, res->str_capacity, attr_str);
+    res->str_used = attr_str_len + 1;
+
     /* loop over each key-value pair */
-    for(char **kv_pair = kv_pairs; *kv_pair; kv_pair++) {
-        /* find the position of the '=' character */
-        char *separator = strchr(*kv_pair, '=');
-        char *key = *kv_pair;
-        char *value = separator;
+    for(kv_pair = res->str_data; kv_pair; kv_pair = next_pair) {
+        char *separator = NULL;
+        char *key = kv_pair;
+        char *value = NULL;
+        const char *interned_value = NULL;
+        int key_len = 0;
+
+        /* cut the string at the next "&" */
+        next_pair = strchr(kv_pair, '&');
+        if(next_pair) {
+            *next_pair = (char)0;
+            next_pair++;
+        }
 
-        pdebug(DEBUG_DETAIL, "Key-value pair \"%s\".", *kv_pair);
+        /* skip empty pairs. */
+        if(*kv_pair == (char)0) {
+            continue;
+        }
+
+        pdebug(DEBUG_DETAIL, "Key-value pair \"%s\".", kv_pair);
 
+        /* find the position of the '=' character */
+        separator = strchr(kv_pair, '=');
         if(separator == NULL) {
-            pdebug(DEBUG_WARN, "Attribute string \"%s\" has invalid key-value pair near \"%s\"!", attr_str, *kv_pair);
-            mem_free(kv_pairs);
+            pdebug(DEBUG_WARN, "Attribute string \"%s\" has invalid key-value pair near \"%s\"!", attr_str, kv_pair);
             attr_destroy(res);
             return NULL;
         }
 
         /* value points to the '=' character.  Step past that for the value. */
-        value++;
+        value = separator + 1;
 
         /* cut the string at the separator. */
         *separator = (char)0;
@@ -178,39 +246,53 @@ extern attr attr_create_from_str(const char *attr_str)
         }
 
         /* zero out all trailing spaces in the key */
-        for(int i=str_length(key) - 1; i > 0 && key[i] == ' '; i--) {
-            key[i] = (char)0;
+        key_len = str_length(key);
+        while(key_len > 1 && key[key_len - 1] == ' ') {
+            key_len--;
+            key[key_len] = (char)0;
         }
 
         pdebug(DEBUG_DETAIL, "Key-value pair after trimming \"%s\":\"%s\".", key, value);
 
         /* check the string lengths */
 
-        if(str_length(key) <= 0) {
-            pdebug(DEBUG_WARN, "Attribute string \"%s\" has invalid key-value pair near \"%s\"!  Key must not be zero length!", attr_str, *kv_pair);
-            mem_free(kv_pairs);
+        if(key_len <= 0) {
+            pdebug(DEBUG_WARN, "Attribute string \"%s\" has invalid key-value pair near \"%s\"!  Key must not be zero length!", attr_str, kv_pair);
             attr_destroy(res);
             return NULL;
         }
 
         if(str_length(value) <= 0) {
-            pdebug(DEBUG_WARN, "Attribute string \"%s\" has invalid key-value pair near \"%s\"!  Value must not be zero length!", attr_str, *kv_pair);
-            mem_free(kv_pairs);
+            pdebug(DEBUG_WARN, "Attribute string \"%s\" has invalid key-value pair near \"%s\"!  Value must not be zero length!", attr_str, kv_pair);
             attr_destroy(res);
             return NULL;
         }
 
-        /* add the key-value pair to the attribute list */
-        if(attr_set_str(res, key, value)) {
+        /* connection parameters are shared across tags. */
+        if(attr_key_is_interned(key)) {
+            interned_value = intern_str(value);
+            if(!interned_value) {
+                pdebug(DEBUG_WARN, "Unable to intern value \"%s\" for key \"%s\"!", value, key);
+                attr_destroy(res);
+                return NULL;
+            }
+        }
+
+        /* add the key-value pair to the attribute list, later duplicates replace earlier ones. */
+        if(attr_add_entry(res, key, attr_hash_str(key, key_len), 0, (interned_value ? interned_value : value), 0) != PLCTAG_STATUS_OK) {
             pdebug(DEBUG_WARN, "Unable to add key-value pair \"%s\":\"%s\" to attribute list!", key, value);
-            mem_free(kv_pairs);
+            intern_release(interned_value);
             attr_destroy(res);
             return NULL;
         }
-    }
 
-    if(kv_pairs) {
-        mem_free(kv_pairs);
+        if(interned_value) {
+            attr_entry e = find_entry(res, key);
+
+            if(e) {
+                e->flags |= ATTR_ENTRY_VAL_INTERNED;
+            }
+        }
     }
 
     pdebug(DEBUG_DETAIL, "Done.");
@@ -229,58 +311,79 @@ extern attr attr_create_from_str(const char *attr_str)
  */
 extern int attr_set_str(attr attrs, const char *name, const char *val)
 {
-    attr_entry e;
+    const char *new_name = NULL;
+    const char *new_val = NULL;
+    int name_on_heap = 0;
+    int val_on_heap = 0;
+    int val_interned = 0;
+    attr_entry e = NULL;
+
+    if(!attrs || !name || !val) {
+        return 1;
+    }
 
-    if(!attrs) {
+    /* store the value first, the entry may already exist. */
+    if(attr_key_is_interned(name)) {
+        new_val = intern_str(val);
+        val_interned = 1;
+    } else {
+        new_val = attr_store_str(attrs, val, &val_on_heap);
+    }
+
+    if(!new_val) {
+        /* oops! */
         return 1;
     }
 
     /* does the entry exist? */
     e = find_entry(attrs, name);
-
-    /* if we had a match, then delete the existing value and add in the
-     * new one.
-     *
-     * If we had no match, then e is NULL and we need to create a new one.
-     */
     if(e) {
         /* we had a match, free any existing value */
-        if(e->val) {
-            mem_free(e->val);
+        attr_free_entry_val(e);
+
+        e->val = new_val;
+        e->flags = (e->flags & ATTR_ENTRY_NAME_ON_HEAP)
+                 | (val_on_heap ? ATTR_ENTRY_VAL_ON_HEAP : 0)
+                 | (val_interned ? ATTR_ENTRY_VAL_INTERNED : 0);
+
+        return 0;
+    }
+
+    /* no match, need a new entry */
+    new_name = attr_store_str(attrs, name, &name_on_heap);
+    if(!new_name) {
+        if(val_on_heap) {
+            mem_free((void *)new_val);
         }
 
-        /* set up the new value */
-        e->val = str_dup(val);
-        if(!e->val) {
-            /* oops! */
-            return 1;
+        if(val_interned) {
+            intern_release(new_val);
         }
-    } else {
-        /* no match, need a new entry */
-        e = (attr_entry)mem_alloc(sizeof(struct attr_entry_t));
 
-        if(e) {
-            e->name = str_dup(name);
+        return 1;
+    }
 
-            if(!e->name) {
-                mem_free(e);
-                return 1;
-            }
+    if(attr_add_entry(attrs, new_name, attr_hash_str(new_name, str_length(new_name)), name_on_heap, new_val, val_on_heap) != PLCTAG_STATUS_OK) {
+        if(name_on_heap) {
+            mem_free((void *)new_name);
+        }
 
-            e->val = str_dup(val);
+        if(val_on_heap) {
+            mem_free((void *)new_val);
+        }
 
-            if(!e->val) {
-                mem_free(e->name);
-                mem_free(e);
-                return 1;
-            }
+        if(val_interned) {
+            intern_release(new_val);
+        }
 
-            /* link it in the list */
-            e->next = attrs->head;
-            attrs->head = e;
-        } else {
-            /* allocation failed */
-            return 1;
+        return 1;
+    }
+
+    if(val_interned) {
+        e = find_entry(attrs, new_name);
+
+        if(e) {
+            e->flags |= ATTR_ENTRY_VAL_INTERNED;
         }
     }
 
@@ -316,7 +419,7 @@ extern int attr_set_float(attr attrs, const char *name, float val)
 /*
  * attr_get
  *
- * Walk the list of attrs and return the value found with the passed name.
+ * Find the entry with the passed name and return its value.
  * If the name is not found, return the passed default value.
  */
 extern const char *attr_get_str(attr attrs, const char *name, const char *def)
@@ -384,47 +487,31 @@ extern float attr_get_float(attr attrs, const char *name, float def)
 
 extern int attr_remove(attr attrs, const char *name)
 {
-    attr_entry e, p;
+    attr_entry e;
+    int index;
 
     if(!attrs)
         return 0;
 
-    e = attrs->head;
+    e = find_entry(attrs, name);
 
     /* no such entry, return */
     if(!e)
         return 0;
 
-    /* loop to find the entry */
-    p = NULL;
-
-    while(e) {
-        if(str_cmp(e->name, name) == 0) {
-            break;
-        }
-
-        p = e;
-        e = e->next;
+    if(e->flags & ATTR_ENTRY_NAME_ON_HEAP) {
+        mem_free((void *)e->name);
     }
 
-    if(e) {
-        /* unlink the node */
-        if(!p) {
-            attrs->head = e->next;
-        } else {
-            p->next = e->next;
-        }
+    attr_free_entry_val(e);
 
-        if(e->name) {
-            mem_free(e->name);
-        }
-
-        if(e->val) {
-            mem_free(e->val);
-        }
+    /* close the gap.  Order does not matter, so move the last entry down. */
+    index = (int)(e - attrs->entries);
+    attrs->num_entries--;
 
-        mem_free(e);
-    } /* else not found */
+    if(index != attrs->num_entries) {
+        attrs->entries[index] = attrs->entries[attrs->num_entries];
+    }
 
     return 0;
 }
@@ -437,28 +524,194 @@ extern int attr_remove(attr attrs, const char *name)
  */
 extern void attr_destroy(attr a)
 {
-    attr_entry e, p;
-
     if(!a)
         return;
 
-    e = a->head;
+    /* free anything that spilled out of the main block. */
+    for(int i=0; i < a->num_entries; i++) {
+        attr_entry e = &(a->entries[i]);
 
-    /* walk down the entry list and free as we go. */
-    while(e) {
-        if(e->name) {
-            mem_free(e->name);
+        if(e->flags & ATTR_ENTRY_NAME_ON_HEAP) {
+            mem_free((void *)e->name);
         }
 
-        if(e->val) {
-            mem_free(e->val);
-        }
+        attr_free_entry_val(e);
+    }
 
-        p = e;
-        e = e->next;
+    if(a->entries != &(a->inline_data[0].entry)) {
+        mem_free(a->entries);
+    }
 
-        mem_free(p);
+    if(a->tracked_size > 0) {
+        mem_track_update(MEM_SUB_ATTRS, NULL, 0, -(int64_t)a->tracked_size, -1);
     }
 
     mem_free(a);
 }
+
+
+
+/***********************************************************************
+ ************************* Helper Functions ****************************
+ ***********************************************************************/
+
+
+attr attr_alloc(int max_entries, int str_capacity)
+{
+    attr res = NULL;
+    int entries_size = (int)sizeof(struct attr_entry_t) * max_entries;
+
+    res = (attr)mem_alloc((int)sizeof(struct attr_t) + entries_size + str_capacity);
+    if(!res) {
+        return NULL;
+    }
+
+    res->num_entries = 0;
+    res->max_entries = max_entries;
+    res->entries = &(res->inline_data[0].entry);
+
+    res->str_used = 0;
+    res->str_capacity = str_capacity;
+    res->str_data = (char *)(res->entries) + entries_size;
+
+    if(mem_track_active) {
+        res->tracked_size = (int)sizeof(struct attr_t) + entries_size + str_capacity;
+        mem_track_update(MEM_SUB_ATTRS, NULL, 0, res->tracked_size, 1);
+    }
+
+    return res;
+}
+
+
+
+uint32_t attr_hash_str(const char *str, int len)
+{
+    return hash((uint8_t *)(uintptr_t)str, (size_t)(unsigned int)len, ATTR_HASH_SEED);
+}
+
+
+
+/*
+ * Free the value of an entry or give back its reference to an interned
+ * string.
+ */
+
+void attr_free_entry_val(attr_entry e)
+{
+    if(e->flags & ATTR_ENTRY_VAL_ON_HEAP) {
+        mem_free((void *)e->val);
+    } else if(e->flags & ATTR_ENTRY_VAL_INTERNED) {
+        intern_release(e->val);
+    }
+
+    e->flags &= ~(ATTR_ENTRY_VAL_ON_HEAP | ATTR_ENTRY_VAL_INTERNED);
+}
+
+
+
+int attr_key_is_interned(const char *name)
+{
+    for(int i=0; intern_keys[i]; i++) {
+        if(str_cmp(intern_keys[i], name) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Copy the string into the arena if it fits, otherwise into its own heap
+ * allocation.  Arena space is not reclaimed when a value is replaced.
+ */
+
+const char *attr_store_str(attr attrs, const char *str, int *on_heap)
+{
+    int len = str_length(str);
+    char *res = NULL;
+
+    *on_heap = 0;
+
+    if(attrs->str_capacity - attrs->str_used >= len + 1) {
+        res = attrs->str_data + attrs->str_used;
+        str_copy(res, len + 1, str);
+        attrs->str_used += len + 1;
+    } else {
+        res = str_dup(str);
+        if(res) {
+            *on_heap = 1;
+        }
+    }
+
+    return res;
+}
+
+
+
+int attr_add_entry(attr attrs, const char *name, uint32_t name_hash, int name_on_heap, const char *val, int val_on_heap)
+{
+    attr_entry e = NULL;
+
+    /* replace the value if the key is already there. */
+    for(int i=0; i < attrs->num_entries; i++) {
+        if(attrs->entries[i].hash == name_hash && str_cmp(attrs->entries[i].name, name) == 0) {
+            e = &(attrs->entries[i]);
+            break;
+        }
+    }
+
+    if(e) {
+        attr_free_entry_val(e);
+
+        e->val = val;
+        e->flags |= (val_on_heap ? ATTR_ENTRY_VAL_ON_HEAP : 0);
+
+        /* the name is not needed. */
+        if(name_on_heap) {
+            mem_free((void *)name);
+        }
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* make room if needed. */
+    if(attrs->num_entries >= attrs->max_entries) {
+        int new_max = attrs->max_entries * 2;
+        struct attr_entry_t *new_entries = mem_alloc((int)sizeof(struct attr_entry_t) * new_max);
+
+        if(!new_entries) {
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        mem_copy(new_entries, attrs->entries, (int)sizeof(struct attr_entry_t) * attrs->num_entries);
+
+        if(attrs->entries != &(attrs->inline_data[0].entry)) {
+            mem_free(attrs->entries);
+
+            if(attrs->tracked_size > 0) {
+                attrs->tracked_size -= (int)sizeof(struct attr_entry_t) * attrs->max_entries;
+                mem_track_update(MEM_SUB_ATTRS, NULL, 0, -(int64_t)sizeof(struct attr_entry_t) * attrs->max_entries, 0);
+            }
+        }
+
+        if(attrs->tracked_size > 0) {
+            attrs->tracked_size += (int)sizeof(struct attr_entry_t) * new_max;
+            mem_track_update(MEM_SUB_ATTRS, NULL, 0, (int64_t)sizeof(struct attr_entry_t) * new_max, 0);
+        }
+
+        attrs->entries = new_entries;
+        attrs->max_entries = new_max;
+    }
+
+    e = &(attrs->entries[attrs->num_entries]);
+    attrs->num_entries++;
+
+    e->hash = name_hash;
+    e->flags = (name_on_heap ? ATTR_ENTRY_NAME_ON_HEAP : 0) | (val_on_heap ? ATTR_ENTRY_VAL_ON_HEAP : 0);
+    e->name = name;
+    e->val = val;
+
+    return PLCTAG_STATUS_OK;
+}
@@ -33,6 +33,7 @@
 
 #include <inttypes.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -65,6 +66,122 @@ static THREAD_LOCAL uint32_t this_thread_num = 0;
 static THREAD_LOCAL int32_t tag_id = 0;
 
 
+/*
+ * Asynchronous logging.
+ *
+ * When turned on, pdebug_impl() does not format anything.  It copies the
+ * time, thread, tag ID, call site, template and the raw arguments into a
+ * fixed size record in a ring buffer.  There are at most
+ * DEBUG_ASYNC_MAX_RINGS rings, so the memory used stays bounded however
+ * many threads come and go.  A thread claims a ring with a single
+ * test-and-set, starting with the one picked by its thread number, and
+ * writes to it alone, so each ring has one producer and one consumer at a
+ * time.  Nobody waits for a claim: if every ring is claimed the record is
+ * formatted and written synchronously instead.  The only consumer is the
+ * debug thread, which formats the records and sends them to the logger
+ * callback or stderr.
+ *
+ * Turning asynchronous logging off takes every claim, which waits for the
+ * producers still writing.  Producers check that asynchronous logging is
+ * still on after they claim a ring, and fall back to synchronous output if
+ * it is not.  Once all claims are held no record can be added, so the
+ * debug thread drains everything before it stops and the rings can be
+ * freed safely.
+ *
+ * When a ring is full the record is dropped and counted.  The debug
+ * thread reports drops in the output and the total is available as the
+ * "debug_dropped" library attribute.
+ *
+ * Templates and function names must be string literals since only the
+ * pointers are kept.  String arguments are copied into the record.
+ */
+
+#define DEBUG_ASYNC_MAX_ARGS (8)
+#define DEBUG_ASYNC_STR_SPACE (128)
+#define DEBUG_ASYNC_RING_SIZE (1024) /* must be a power of two */
+#define DEBUG_ASYNC_MAX_RINGS (8)
+#define DEBUG_ASYNC_IDLE_WAIT_MS (1)
+#define DEBUG_ASYNC_MAX_SPEC (32)
+
+typedef union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const void *p;
+} debug_arg_t;
+
+typedef struct {
+    int64_t epoch_ms;
+    uint32_t thread_id;
+    int32_t tag_id;
+    int line_num;
+    int debug_level;
+    int num_args;
+    const char *func;
+    const char *templ; /* NULL if the message was formatted into str_data already. */
+    debug_arg_t args[DEBUG_ASYNC_MAX_ARGS];
+    char str_data[DEBUG_ASYNC_STR_SPACE];
+} debug_record_t;
+
+typedef struct debug_ring_t *debug_ring_p;
+
+struct debug_ring_t {
+    /* head is only written by the producer, tail only by the consumer. */
+    volatile uint32_t head;
+    volatile uint32_t tail;
+
+    volatile uint32_t dropped;
+    uint32_t dropped_reported;
+
+    debug_record_t records[DEBUG_ASYNC_RING_SIZE];
+};
+
+static lw_mutex_t async_mutex = LW_MUTEX_INIT;
+static volatile int async_enabled = 0;
+static volatile int async_terminate = 0;
+static thread_p async_thread = NULL;
+
+/* a thread holds the claim of a ring while it adds a record.  Claims are never freed. */
+static lock_t ring_claims[DEBUG_ASYNC_MAX_RINGS] = {LOCK_INIT};
+
+/* protects the ring pointers against readers outside the claims. */
+static lock_t ring_lock = LOCK_INIT;
+static debug_ring_p volatile rings[DEBUG_ASYNC_MAX_RINGS] = {NULL};
+
+typedef enum {
+    DEBUG_ARG_NONE,
+    DEBUG_ARG_INT,
+    DEBUG_ARG_UINT,
+    DEBUG_ARG_DOUBLE,
+    DEBUG_ARG_STR,
+    DEBUG_ARG_PTR,
+    DEBUG_ARG_UNSUPPORTED
+} debug_arg_class_t;
+
+typedef enum {
+    DEBUG_LEN_NONE,
+    DEBUG_LEN_L,
+    DEBUG_LEN_LL,
+    DEBUG_LEN_Z,
+    DEBUG_LEN_J,
+    DEBUG_LEN_T
+} debug_arg_len_t;
+
+typedef struct {
+    const char *start;
+    int length;
+    int stars;
+    debug_arg_class_t arg_class;
+    debug_arg_len_t arg_len;
+} debug_format_spec_t;
+
+static uint32_t get_thread_id();
+static debug_ring_p get_ring(int index);
+static int push_async_record(const char *func, int line_num, int debug_level, const char *templ, va_list va);
+static void claim_all_rings(void);
+static void release_all_rings(void);
+
+
 // /* only output the version once */
 // static lock_t printed_version = LOCK_INIT;
 
@@ -146,6 +263,701 @@ static uint32_t get_thread_id()
 
 static const char *debug_level_name[DEBUG_END] = {"NONE", "ERROR", "WARN", "INFO", "DETAIL", "SPEW"};
 
+
+/*
+ * parse_format_spec
+ *
+ * Parse one printf conversion starting at the '%'.  Only what pdebug
+ * callers use is understood: flags, width, precision, the h/hh/l/ll/z/j/t
+ * length modifiers and the d i u o x X c f F e E g G a A s p conversions.
+ * Anything else makes the caller fall back to formatting in place.
+ */
+static const char *parse_format_spec(const char *p, debug_format_spec_t *spec)
+{
+    spec->start = p;
+    spec->stars = 0;
+    spec->arg_class = DEBUG_ARG_UNSUPPORTED;
+    spec->arg_len = DEBUG_LEN_NONE;
+
+    /* skip the '%' */
+    p++;
+
+    if(*p == '%') {
+        p++;
+        spec->arg_class = DEBUG_ARG_NONE;
+        spec->length = (int)(p - spec->start);
+        return p;
+    }
+
+    /* flags */
+    while(*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+        p++;
+    }
+
+    /* width */
+    if(*p == '*') {
+        spec->stars++;
+        p++;
+    } else {
+        while(*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    /* precision */
+    if(*p == '.') {
+        p++;
+
+        if(*p == '*') {
+            spec->stars++;
+            p++;
+        } else {
+            while(*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+    }
+
+    /* length, h and hh are promoted to int anyway. */
+    switch(*p) {
+        case 'h':
+            p++;
+            if(*p == 'h') {
+                p++;
+            }
+            break;
+
+        case 'l':
+            p++;
+            if(*p == 'l') {
+                p++;
+                spec->arg_len = DEBUG_LEN_LL;
+            } else {
+                spec->arg_len = DEBUG_LEN_L;
+            }
+            break;
+
+        case 'z': p++; spec->arg_len = DEBUG_LEN_Z; break;
+        case 'j': p++; spec->arg_len = DEBUG_LEN_J; break;
+        case 't': p++; spec->arg_len = DEBUG_LEN_T; break;
+
+        default:
+            break;
+    }
+
+    switch(*p) {
+        case 'd':
+        case 'i':
+            spec->arg_class = DEBUG_ARG_INT;
+            p++;
+            break;
+
+        case 'c':
+            if(spec->arg_len == DEBUG_LEN_NONE) {
+                spec->arg_class = DEBUG_ARG_INT;
+            }
+            p++;
+            break;
+
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            spec->arg_class = DEBUG_ARG_UINT;
+            p++;
+            break;
+
+        case 'f': case 'F':
+        case 'e': case 'E':
+        case 'g': case 'G':
+        case 'a': case 'A':
+            spec->arg_class = DEBUG_ARG_DOUBLE;
+            p++;
+            break;
+
+        case 's':
+            if(spec->arg_len == DEBUG_LEN_NONE) {
+                spec->arg_class = DEBUG_ARG_STR;
+            }
+            p++;
+            break;
+
+        case 'p':
+            spec->arg_class = DEBUG_ARG_PTR;
+            p++;
+            break;
+
+        default:
+            /* includes the end of the string. */
+            break;
+    }
+
+    spec->length = (int)(p - spec->start);
+
+    if(spec->length >= DEBUG_ASYNC_MAX_SPEC) {
+        spec->arg_class = DEBUG_ARG_UNSUPPORTED;
+    }
+
+    return p;
+}
+
+
+
+/*
+ * capture_args
+ *
+ * Copy the arguments of the template into the record.  Returns non-zero if
+ * the template cannot be captured and needs to be formatted in place.
+ */
+static int capture_args(debug_record_t *record, const char *templ, va_list *va)
+{
+    const char *p = templ;
+    int str_used = 0;
+
+    record->num_args = 0;
+
+    while(*p) {
+        debug_format_spec_t spec;
+        debug_arg_t *arg = NULL;
+
+        if(*p != '%') {
+            p++;
+            continue;
+        }
+
+        p = parse_format_spec(p, &spec);
+
+        if(spec.arg_class == DEBUG_ARG_UNSUPPORTED) {
+            return 1;
+        }
+
+        if(spec.arg_class == DEBUG_ARG_NONE) {
+            continue;
+        }
+
+        if(record->num_args + spec.stars + 1 > DEBUG_ASYNC_MAX_ARGS) {
+            return 1;
+        }
+
+        for(int i=0; i < spec.stars; i++) {
+            record->args[record->num_args++].i = va_arg(*va, int);
+        }
+
+        arg = &(record->args[record->num_args++]);
+
+        switch(spec.arg_class) {
+            case DEBUG_ARG_INT:
+                switch(spec.arg_len) {
+                    case DEBUG_LEN_L: arg->i = (int64_t)va_arg(*va, long); break;
+                    case DEBUG_LEN_LL: arg->i = (int64_t)va_arg(*va, long long); break;
+                    case DEBUG_LEN_Z: arg->i = (int64_t)va_arg(*va, size_t); break;
+                    case DEBUG_LEN_J: arg->i = (int64_t)va_arg(*va, intmax_t); break;
+                    case DEBUG_LEN_T: arg->i = (int64_t)va_arg(*va, ptrdiff_t); break;
+                    default: arg->i = (int64_t)va_arg(*va, int); break;
+                }
+                break;
+
+            case DEBUG_ARG_UINT:
+                switch(spec.arg_len) {
+                    case DEBUG_LEN_L: arg->u = (uint64_t)va_arg(*va, unsigned long); break;
+                    case DEBUG_LEN_LL: arg->u = (uint64_t)va_arg(*va, unsigned long long); break;
+                    case DEBUG_LEN_Z: arg->u = (uint64_t)va_arg(*va, size_t); break;
+                    case DEBUG_LEN_J: arg->u = (uint64_t)va_arg(*va, uintmax_t); break;
+                    case DEBUG_LEN_T: arg->u = (uint64_t)va_arg(*va, ptrdiff_t); break;
+                    default: arg->u = (uint64_t)va_arg(*va, unsigned int); break;
+                }
+                break;
+
+            case DEBUG_ARG_DOUBLE:
+                arg->d = va_arg(*va, double);
+                break;
+
+            case DEBUG_ARG_PTR:
+                arg->p = va_arg(*va, void *);
+                break;
+
+            case DEBUG_ARG_STR: {
+                    const char *str = va_arg(*va, const char *);
+                    int str_len = 0;
+
+                    if(!str) {
+                        str = "(null)";
+                    }
+
+                    /* truncate to whatever room is left, strings are stored as offsets. */
+                    str_len = (int)strlen(str);
+                    if(str_len > DEBUG_ASYNC_STR_SPACE - str_used - 1) {
+                        str_len = DEBUG_ASYNC_STR_SPACE - str_used - 1;
+                    }
+
+                    if(str_len < 0) {
+                        arg->i = -1;
+                    } else {
+                        memcpy(&(record->str_data[str_used]), str, (size_t)(unsigned int)str_len);
+                        record->str_data[str_used + str_len] = 0;
+                        arg->i = str_used;
+                        str_used += str_len + 1;
+                    }
+                }
+                break;
+
+            default:
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * get_ring
+ *
+ * Find the ring at the index, creating it the first time it is used.  The
+ * caller must hold the claim for the index.
+ */
+
+static debug_ring_p get_ring(int index)
+{
+    debug_ring_p ring = rings[index];
+
+    if(ring) {
+        return ring;
+    }
+
+    ring = (debug_ring_p)mem_alloc((int)(unsigned int)sizeof(*ring));
+
+    if(ring) {
+        /* the ring must be set up before the debug thread can see it. */
+        memory_barrier();
+
+        spin_block(&ring_lock) {
+            rings[index] = ring;
+        }
+    }
+
+    return ring;
+}
+
+
+
+/*
+ * push_async_record
+ *
+ * Add a record to the first ring this thread can claim.  Returns zero if
+ * the caller must write the message synchronously.
+ */
+
+static int push_async_record(const char *func, int line_num, int debug_level, const char *templ, va_list va)
+{
+    uint32_t thread_id = get_thread_id();
+    int index = -1;
+    debug_ring_p ring = NULL;
+    debug_record_t *record = NULL;
+    uint32_t head = 0;
+    va_list va_capture;
+
+    for(int i=0; i < DEBUG_ASYNC_MAX_RINGS; i++) {
+        int candidate = (int)((thread_id + (uint32_t)i) % DEBUG_ASYNC_MAX_RINGS);
+
+        if(lock_acquire_try(&ring_claims[candidate])) {
+            index = candidate;
+            break;
+        }
+    }
+
+    /* all rings busy or being shut down. */
+    if(index < 0) {
+        return 0;
+    }
+
+    /* asynchronous logging may have been turned off before we got the claim. */
+    if(!async_enabled || !(ring = get_ring(index))) {
+        lock_release(&ring_claims[index]);
+        return 0;
+    }
+
+    head = ring->head;
+
+    if(head - ring->tail >= DEBUG_ASYNC_RING_SIZE) {
+        ring->dropped++;
+        lock_release(&ring_claims[index]);
+        return 1;
+    }
+
+    record = &(ring->records[head & (DEBUG_ASYNC_RING_SIZE - 1)]);
+
+    record->epoch_ms = time_epoch_ms();
+    record->thread_id = thread_id;
+    record->tag_id = tag_id;
+    record->line_num = line_num;
+    record->debug_level = debug_level;
+    record->func = func;
+    record->templ = templ;
+
+    va_copy(va_capture, va);
+
+    if(capture_args(record, templ, &va_capture)) {
+        /* cannot capture it, pay for formatting here. */
+        vsnprintf(record->str_data, sizeof(record->str_data), templ, va);
+        record->templ = NULL;
+        record->num_args = 0;
+    }
+
+    va_end(va_capture);
+
+    /* make sure the record is visible before the consumer sees the new head. */
+    memory_barrier();
+
+    ring->head = head + 1;
+
+    lock_release(&ring_claims[index]);
+
+    return 1;
+}
+
+
+
+/*
+ * claim_all_rings
+ *
+ * Take every ring claim, waiting for producers that are still writing.
+ * After this no record can be added until the claims are released.
+ */
+
+static void claim_all_rings(void)
+{
+    for(int index=0; index < DEBUG_ASYNC_MAX_RINGS; index++) {
+        lock_acquire(&ring_claims[index]);
+    }
+}
+
+
+
+static void release_all_rings(void)
+{
+    for(int index=0; index < DEBUG_ASYNC_MAX_RINGS; index++) {
+        lock_release(&ring_claims[index]);
+    }
+}
+
+
+
+/* only called from the debug thread, so the last converted time can be cached. */
+static int format_prefix(char *buf, int buf_size, int64_t epoch_ms, uint32_t thread_id, int32_t rec_tag_id, int debug_level, const char *func, int line_num)
+{
+    static time_t last_epoch = 0;
+    static struct tm t;
+    time_t epoch = (time_t)(epoch_ms/1000);
+    int remainder_ms = (int)(epoch_ms % 1000);
+    int rc = 0;
+
+    if(epoch != last_epoch) {
+        localtime_r(&epoch, &t);
+        last_epoch = epoch;
+    }
+
+    rc = snprintf(buf, (size_t)(unsigned int)buf_size, "%04d-%02d-%02d %02d:%02d:%02d.%03d thread(%u) tag(%" PRId32 ") %s %s:%d ",
+                                                       t.tm_year+1900,
+                                                       t.tm_mon + 1,
+                                                       t.tm_mday,
+                                                       t.tm_hour,
+                                                       t.tm_min,
+                                                       t.tm_sec,
+                                                       remainder_ms,
+                                                       thread_id,
+                                                       rec_tag_id,
+                                                       debug_level_name[debug_level],
+                                                       func,
+                                                       line_num);
+
+    if(rc < 0) {
+        rc = 0;
+    } else if(rc >= buf_size) {
+        rc = buf_size - 1;
+    }
+
+    return rc;
+}
+
+
+
+#define FORMAT_WITH_STARS(value) \
+    (spec.stars == 0 ? snprintf(out, out_size, fmt, value) : \
+     (spec.stars == 1 ? snprintf(out, out_size, fmt, star[0], value) : \
+                        snprintf(out, out_size, fmt, star[0], star[1], value)))
+
+static int format_record_message(debug_record_t *record, char *buf, int buf_size)
+{
+    const char *p = record->templ;
+    int used = 0;
+    int arg_index = 0;
+
+    if(!p) {
+        return snprintf(buf, (size_t)(unsigned int)buf_size, "%s", record->str_data);
+    }
+
+    while(*p && used < buf_size - 1) {
+        debug_format_spec_t spec;
+        char fmt[DEBUG_ASYNC_MAX_SPEC];
+        int star[2] = {0, 0};
+        char *out = &(buf[used]);
+        size_t out_size = (size_t)(unsigned int)(buf_size - used);
+        debug_arg_t *arg = NULL;
+        int rc = 0;
+
+        if(*p != '%') {
+            buf[used++] = *p++;
+            continue;
+        }
+
+        p = parse_format_spec(p, &spec);
+
+        if(spec.arg_class == DEBUG_ARG_NONE) {
+            buf[used++] = '%';
+            continue;
+        }
+
+        memcpy(fmt, spec.start, (size_t)(unsigned int)spec.length);
+        fmt[spec.length] = 0;
+
+        for(int i=0; i < spec.stars; i++) {
+            star[i] = (int)record->args[arg_index++].i;
+        }
+
+        arg = &(record->args[arg_index++]);
+
+        switch(spec.arg_class) {
+            case DEBUG_ARG_INT:
+                switch(spec.arg_len) {
+                    case DEBUG_LEN_L: rc = FORMAT_WITH_STARS((long)arg->i); break;
+                    case DEBUG_LEN_LL: rc = FORMAT_WITH_STARS((long long)arg->i); break;
+                    case DEBUG_LEN_Z: rc = FORMAT_WITH_STARS((size_t)arg->i); break;
+                    case DEBUG_LEN_J: rc = FORMAT_WITH_STARS((intmax_t)arg->i); break;
+                    case DEBUG_LEN_T: rc = FORMAT_WITH_STARS((ptrdiff_t)arg->i); break;
+                    default: rc = FORMAT_WITH_STARS((int)arg->i); break;
+                }
+                break;
+
+            case DEBUG_ARG_UINT:
+                switch(spec.arg_len) {
+                    case DEBUG_LEN_L: rc = FORMAT_WITH_STARS((unsigned long)arg->u); break;
+                    case DEBUG_LEN_LL: rc = FORMAT_WITH_STARS((unsigned long long)arg->u); break;
+                    case DEBUG_LEN_Z: rc = FORMAT_WITH_STARS((size_t)arg->u); break;
+                    case DEBUG_LEN_J: rc = FORMAT_WITH_STARS((uintmax_t)arg->u); break;
+                    case DEBUG_LEN_T: rc = FORMAT_WITH_STARS((ptrdiff_t)arg->u); break;
+                    default: rc = FORMAT_WITH_STARS((unsigned int)arg->u); break;
+                }
+                break;
+
+            case DEBUG_ARG_DOUBLE:
+                rc = FORMAT_WITH_STARS(arg->d);
+                break;
+
+            case DEBUG_ARG_PTR:
+                rc = FORMAT_WITH_STARS(arg->p);
+                break;
+
+            case DEBUG_ARG_STR:
+                rc = FORMAT_WITH_STARS((arg->i >= 0 ? &(record->str_data[arg->i]) : ""));
+                break;
+
+            default:
+                /* not reachable, the record was captured with the same parser. */
+                rc = 0;
+                break;
+        }
+
+        if(rc > 0) {
+            used += rc;
+        }
+
+        if(used >= buf_size) {
+            used = buf_size - 1;
+        }
+    }
+
+    buf[used] = 0;
+
+    return used;
+}
+
+
+
+static void emit_output(int32_t out_tag_id, int debug_level, const char *output)
+{
+    if(log_callback_func) {
+        log_callback_func(out_tag_id, debug_level, output);
+    } else {
+        fputs(output, stderr);
+    }
+}
+
+
+
+static int drain_rings(void)
+{
+    int count = 0;
+
+    /* rings are only freed after this thread stops, so no lock is needed to read them. */
+    for(int index=0; index < DEBUG_ASYNC_MAX_RINGS; index++) {
+        debug_ring_p ring = rings[index];
+        char output[1000]; /* MAGIC, same as the synchronous output. */
+        uint32_t dropped = 0;
+
+        if(!ring) {
+            continue;
+        }
+
+        while(ring->tail != ring->head) {
+            debug_record_t *record = NULL;
+            int used = 0;
+
+            /* make sure we see the record contents written before the head moved. */
+            memory_barrier();
+
+            record = &(ring->records[ring->tail & (DEBUG_ASYNC_RING_SIZE - 1)]);
+
+            used = format_prefix(output, (int)sizeof(output) - 1, record->epoch_ms, record->thread_id, record->tag_id, record->debug_level, record->func, record->line_num);
+            used += format_record_message(record, &(output[used]), (int)sizeof(output) - 1 - used);
+            output[used++] = '\n';
+            output[used] = 0;
+
+            emit_output(record->tag_id, record->debug_level, output);
+
+            /* done with the record, let the producer have it. */
+            memory_barrier();
+
+            ring->tail++;
+            count++;
+        }
+
+        dropped = ring->dropped;
+        if(dropped != ring->dropped_reported) {
+            int used = format_prefix(output, (int)sizeof(output), time_epoch_ms(), 0, 0, DEBUG_WARN, __func__, __LINE__);
+
+            snprintf(&(output[used]), sizeof(output) - (size_t)(unsigned int)used, "%u debug records dropped.\n", dropped - ring->dropped_reported);
+            output[sizeof(output) - 1] = 0;
+
+            emit_output(0, DEBUG_WARN, output);
+
+            ring->dropped_reported = dropped;
+        }
+    }
+
+    return count;
+}
+
+
+
+static THREAD_FUNC(debug_async_handler)
+{
+    (void)arg;
+
+    while(!async_terminate) {
+        if(!drain_rings()) {
+            sleep_ms(DEBUG_ASYNC_IDLE_WAIT_MS);
+        }
+    }
+
+    /* get anything that came in while we were stopping. */
+    drain_rings();
+
+    THREAD_RETURN(0);
+}
+
+
+
+int debug_set_async(int enable)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    critical_block(&async_mutex) {
+        if(enable && !async_thread) {
+            async_terminate = 0;
+
+            rc = thread_create(&async_thread, debug_async_handler, 32*1024, NULL);
+            if(rc != PLCTAG_STATUS_OK) {
+                async_thread = NULL;
+                break;
+            }
+
+            async_enabled = 1;
+        } else if(!enable && async_thread) {
+            async_enabled = 0;
+
+            /* wait for the producers to leave, the debug thread then gets every record. */
+            claim_all_rings();
+
+            async_terminate = 1;
+
+            thread_join(async_thread);
+            thread_destroy(&async_thread);
+            async_thread = NULL;
+
+            release_all_rings();
+        }
+    }
+
+    return rc;
+}
+
+
+int debug_get_async(void)
+{
+    return async_enabled;
+}
+
+
+int debug_get_dropped_records(void)
+{
+    uint32_t total = 0;
+
+    spin_block(&ring_lock) {
+        for(int index=0; index < DEBUG_ASYNC_MAX_RINGS; index++) {
+            if(rings[index]) {
+                total += rings[index]->dropped;
+            }
+        }
+    }
+
+    return (int)(total & (uint32_t)INT32_MAX);
+}
+
+
+/*
+ * debug_teardown
+ *
+ * Stop asynchronous logging, flush what is left and free the rings.  They
+ * are created again if asynchronous logging is turned back on.
+ */
+void debug_teardown(void)
+{
+    debug_ring_p old_rings[DEBUG_ASYNC_MAX_RINGS];
+
+    debug_set_async(0);
+
+    /* a late producer could still be checking the ring, hold the claims while we free them. */
+    claim_all_rings();
+
+    spin_block(&ring_lock) {
+        for(int index=0; index < DEBUG_ASYNC_MAX_RINGS; index++) {
+            old_rings[index] = rings[index];
+            rings[index] = NULL;
+        }
+    }
+
+    for(int index=0; index < DEBUG_ASYNC_MAX_RINGS; index++) {
+        if(old_rings[index]) {
+            mem_free(old_rings[index]);
+        }
+    }
+
+    release_all_rings();
+}
+
+
 extern void pdebug_impl(const char *func, int line_num, int debug_level, const char *templ, ...)
 {
     va_list va;
@@ -158,6 +970,18 @@ extern void pdebug_impl(const char *func, int line_num, int debug_level, const c
     char output[1000];
     //int output_size = 0;
 
+    if(async_enabled) {
+        int pushed = 0;
+
+        va_start(va,templ);
+        pushed = push_async_record(func, line_num, debug_level, templ, va);
+        va_end(va);
+
+        if(pushed) {
+            return;
+        }
+    }
+
     /* build the prefix */
     // prefix_size = make_prefix(prefix,(int)sizeof(prefix));  /* don't exceed a size that int can express! */
     // if(prefix_size <= 0) {
@@ -165,7 +989,7 @@ extern void pdebug_impl(const char *func, int line_num, int debug_level, const c
     // }
 
     /* get the time parts */
-    epoch_ms = time_ms();
+    epoch_ms = time_epoch_ms();
     epoch = (time_t)(epoch_ms/1000);
     remainder_ms = (int)(epoch_ms % 1000);
 
@@ -242,8 +1066,8 @@ void pdebug_dump_bytes_impl(const char *func, int line_num, int debug_level, uin
         /* terminate the row string*/
         row_buf[sizeof(row_buf)-1] = 0; /* just in case */
 
-        /* output it, finally */
-        pdebug_impl(func, line_num, debug_level, row_buf);
+        /* output it, finally.  The row is not a template and is on the stack. */
+        pdebug_impl(func, line_num, debug_level, "%s", row_buf);
     }
 }
 
@@ -68,3 +68,9 @@ extern void pdebug_dump_bytes_impl(const char *func, int line_num, int debug_lev
 
 extern int debug_register_logger(void (*log_callback_func)(int32_t tag_id, int debug_level, const char *message));
 extern int debug_unregister_logger(void);
+
+/* asynchronous logging, see debug.c */
+extern int debug_set_async(int enable);
+extern int debug_get_async(void);
+extern int debug_get_dropped_records(void);
+extern void debug_teardown(void);
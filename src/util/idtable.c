@@ -0,0 +1,373 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <lib/libplctag.h>
+#include <platform.h>
+#include <util/debug.h>
+#include <util/idtable.h>
+
+/*
+ * The ID is (generation << IDTABLE_INDEX_BITS) | index.  With 20 bits of
+ * index and 11 of generation, IDs use all of the positive int32 range.
+ *
+ * Each slot keeps a 32-bit use count.  The ID generation is that count
+ * folded into 1..2047 so that no valid ID is ever zero.  It wraps after
+ * 2047 uses of a slot, and the FIFO free list means every other free slot
+ * is used before a slot comes around again.  A stale ID only matches a
+ * new occupant after 2047 full trips through the free list.
+ */
+
+#define IDTABLE_GENERATION_BITS (31 - IDTABLE_INDEX_BITS)
+#define IDTABLE_GENERATION_MASK ((1 << IDTABLE_GENERATION_BITS) - 1)
+#define IDTABLE_INDEX_MASK (IDTABLE_MAX_ENTRIES - 1)
+
+#define IDTABLE_SEGMENT_BITS (12)
+#define IDTABLE_SEGMENT_SIZE (1 << IDTABLE_SEGMENT_BITS)
+#define IDTABLE_MAX_SEGMENTS (IDTABLE_MAX_ENTRIES / IDTABLE_SEGMENT_SIZE)
+
+#define IDTABLE_NO_SLOT (-1)
+
+struct idtable_slot_t {
+    void *data;
+    uint32_t generation;
+    int32_t next_free;
+};
+
+struct idtable_t {
+    int num_segments;
+    int used_entries;
+
+    /* FIFO free list to delay reuse of a slot as long as possible. */
+    int32_t free_head;
+    int32_t free_tail;
+
+    struct idtable_slot_t *segments[IDTABLE_MAX_SEGMENTS];
+};
+
+typedef struct idtable_slot_t *idtable_slot_p;
+
+static idtable_slot_p get_slot(idtable_p table, int index);
+static int add_segment(idtable_p table);
+static int id_to_index(int32_t id);
+static int32_t id_generation(idtable_slot_p slot);
+
+
+
+idtable_p idtable_create(void)
+{
+    idtable_p table = NULL;
+
+    pdebug(DEBUG_INFO,"Starting");
+
+    table = mem_alloc((int)sizeof(struct idtable_t));
+    if(!table) {
+        pdebug(DEBUG_ERROR,"Unable to allocate memory for ID table!");
+        return NULL;
+    }
+
+    table->free_head = IDTABLE_NO_SLOT;
+    table->free_tail = IDTABLE_NO_SLOT;
+
+    if(add_segment(table) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to allocate first ID table segment!");
+        idtable_destroy(table);
+        return NULL;
+    }
+
+    pdebug(DEBUG_INFO,"Done");
+
+    return table;
+}
+
+
+
+int32_t idtable_put(idtable_p table, void *data)
+{
+    int index = 0;
+    idtable_slot_p slot = NULL;
+
+    pdebug(DEBUG_SPEW,"Starting");
+
+    if(!table) {
+        pdebug(DEBUG_WARN,"ID table pointer null or invalid.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!data) {
+        pdebug(DEBUG_WARN,"Data pointer must not be null.");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(table->free_head == IDTABLE_NO_SLOT) {
+        int rc = add_segment(table);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN,"Unable to grow ID table, error %s!", plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+
+    /* pop the oldest free slot. */
+    index = table->free_head;
+    slot = get_slot(table, index);
+
+    table->free_head = slot->next_free;
+    if(table->free_head == IDTABLE_NO_SLOT) {
+        table->free_tail = IDTABLE_NO_SLOT;
+    }
+
+    slot->next_free = IDTABLE_NO_SLOT;
+    slot->data = data;
+
+    table->used_entries++;
+
+    pdebug(DEBUG_SPEW,"Done");
+
+    return (int32_t)((id_generation(slot) << IDTABLE_INDEX_BITS) | index);
+}
+
+
+
+void *idtable_get(idtable_p table, int32_t id)
+{
+    int index = id_to_index(id);
+    idtable_slot_p slot = NULL;
+
+    if(!table || index < 0) {
+        return NULL;
+    }
+
+    slot = get_slot(table, index);
+    if(!slot || id_generation(slot) != ((id >> IDTABLE_INDEX_BITS) & IDTABLE_GENERATION_MASK)) {
+        return NULL;
+    }
+
+    return slot->data;
+}
+
+
+
+void *idtable_remove(idtable_p table, int32_t id)
+{
+    int index = id_to_index(id);
+    idtable_slot_p slot = NULL;
+    void *result = NULL;
+
+    pdebug(DEBUG_SPEW,"Starting");
+
+    if(!table || index < 0) {
+        pdebug(DEBUG_WARN,"ID table pointer null or invalid ID %d.", id);
+        return NULL;
+    }
+
+    slot = get_slot(table, index);
+    if(!slot || !slot->data || id_generation(slot) != ((id >> IDTABLE_INDEX_BITS) & IDTABLE_GENERATION_MASK)) {
+        pdebug(DEBUG_SPEW,"ID %d not found.", id);
+        return NULL;
+    }
+
+    result = slot->data;
+
+    slot->data = NULL;
+
+    table->used_entries--;
+
+    slot->generation++;
+
+    /* put the slot at the end of the free list. */
+    slot->next_free = IDTABLE_NO_SLOT;
+
+    if(table->free_tail == IDTABLE_NO_SLOT) {
+        table->free_head = index;
+    } else {
+        get_slot(table, table->free_tail)->next_free = index;
+    }
+
+    table->free_tail = index;
+
+    pdebug(DEBUG_SPEW,"Done");
+
+    return result;
+}
+
+
+
+void *idtable_get_index(idtable_p table, int index)
+{
+    idtable_slot_p slot = NULL;
+
+    if(!table) {
+        pdebug(DEBUG_WARN,"ID table pointer null or invalid");
+        return NULL;
+    }
+
+    slot = get_slot(table, index);
+    if(!slot) {
+        return NULL;
+    }
+
+    return slot->data;
+}
+
+
+
+int idtable_capacity(idtable_p table)
+{
+    if(!table) {
+        pdebug(DEBUG_WARN,"ID table pointer null or invalid");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    return table->num_segments * IDTABLE_SEGMENT_SIZE;
+}
+
+
+
+int idtable_entries(idtable_p table)
+{
+    if(!table) {
+        pdebug(DEBUG_WARN,"ID table pointer null or invalid");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    return table->used_entries;
+}
+
+
+
+int idtable_destroy(idtable_p table)
+{
+    pdebug(DEBUG_INFO,"Starting");
+
+    if(!table) {
+        pdebug(DEBUG_WARN,"Called with null pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    for(int i=0; i < table->num_segments; i++) {
+        mem_free(table->segments[i]);
+        table->segments[i] = NULL;
+    }
+
+    mem_free(table);
+
+    pdebug(DEBUG_INFO,"Done");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/***********************************************************************
+ *************************** Helper Functions **************************
+ **********************************************************************/
+
+
+idtable_slot_p get_slot(idtable_p table, int index)
+{
+    int segment = index >> IDTABLE_SEGMENT_BITS;
+
+    if(index < 0 || segment >= table->num_segments) {
+        return NULL;
+    }
+
+    return &(table->segments[segment][index & (IDTABLE_SEGMENT_SIZE - 1)]);
+}
+
+
+
+/*
+ * Add a new segment and put all its slots on the free list.  Existing
+ * segments are not touched, so this costs the same at any table size.
+ */
+
+int add_segment(idtable_p table)
+{
+    idtable_slot_p segment = NULL;
+    int first_index = 0;
+
+    if(table->num_segments >= IDTABLE_MAX_SEGMENTS) {
+        pdebug(DEBUG_WARN,"ID table is full with %d entries!", table->used_entries);
+        return PLCTAG_ERR_NO_RESOURCES;
+    }
+
+    segment = mem_alloc((int)sizeof(struct idtable_slot_t) * IDTABLE_SEGMENT_SIZE);
+    if(!segment) {
+        pdebug(DEBUG_ERROR,"Unable to allocate ID table segment!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    first_index = table->num_segments * IDTABLE_SEGMENT_SIZE;
+
+    for(int i=0; i < IDTABLE_SEGMENT_SIZE; i++) {
+        segment[i].data = NULL;
+        segment[i].generation = 0;
+        segment[i].next_free = (i + 1 < IDTABLE_SEGMENT_SIZE ? first_index + i + 1 : IDTABLE_NO_SLOT);
+    }
+
+    table->segments[table->num_segments] = segment;
+    table->num_segments++;
+
+    /* append the new slots to the free list. */
+    if(table->free_tail == IDTABLE_NO_SLOT) {
+        table->free_head = first_index;
+    } else {
+        get_slot(table, table->free_tail)->next_free = first_index;
+    }
+
+    table->free_tail = first_index + IDTABLE_SEGMENT_SIZE - 1;
+
+    pdebug(DEBUG_DETAIL,"ID table grew to %d slots.", table->num_segments * IDTABLE_SEGMENT_SIZE);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int id_to_index(int32_t id)
+{
+    /* generation zero is never handed out. */
+    if(id <= 0 || (id >> IDTABLE_INDEX_BITS) == 0) {
+        return -1;
+    }
+
+    return (int)(id & IDTABLE_INDEX_MASK);
+}
+
+
+
+int32_t id_generation(idtable_slot_p slot)
+{
+    return (int32_t)(slot->generation % (uint32_t)IDTABLE_GENERATION_MASK) + 1;
+}
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __UTIL_IDTABLE_H__
+#define __UTIL_IDTABLE_H__ 1
+
+#include <stdint.h>
+
+/*
+ * An ID table hands out small positive integer IDs for pointers.
+ *
+ * IDs are made of a slot index and a generation count.  Freed slots go
+ * on a FIFO free list and their generation is bumped, so a stale ID
+ * does not find the new occupant of a reused slot.  The generation in
+ * the ID wraps, but only after a slot has been reused many times.
+ *
+ * Slots are stored in fixed size segments that are never moved, so
+ * growing the table only allocates one new segment.
+ *
+ * The table is not thread safe.  Callers must provide locking.
+ */
+
+#define IDTABLE_INDEX_BITS (20)
+#define IDTABLE_MAX_ENTRIES (1 << IDTABLE_INDEX_BITS)
+
+typedef struct idtable_t *idtable_p;
+
+extern idtable_p idtable_create(void);
+extern int32_t idtable_put(idtable_p table, void *data);
+extern void *idtable_get(idtable_p table, int32_t id);
+extern void *idtable_remove(idtable_p table, int32_t id);
+extern void *idtable_get_index(idtable_p table, int index);
+extern int idtable_capacity(idtable_p table);
+extern int idtable_entries(idtable_p table);
+extern int idtable_destroy(idtable_p table);
+
+
+#endif
@@ -0,0 +1,166 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stddef.h>
+#include <lib/libplctag.h>
+#include <platform.h>
+#include <util/debug.h>
+#include <util/hash.h>
+#include <util/intern.h>
+#include <util/rc.h>
+
+
+#define INTERN_BUCKETS (4096)
+#define INTERN_HASH_SEED (0x1E2D3C4B)
+
+struct intern_entry_t {
+    struct intern_entry_t *next;
+    uint32_t hash;
+    int size;
+    uint8_t data[];
+};
+
+typedef struct intern_entry_t *intern_entry_p;
+
+static lock_t intern_lock = LOCK_INIT;
+static intern_entry_p intern_buckets[INTERN_BUCKETS] = {0};
+
+static void intern_entry_destroy(void *entry_arg);
+
+
+
+const uint8_t *intern_bytes(const uint8_t *data, int size)
+{
+    uint32_t data_hash = 0;
+    int bucket = 0;
+    intern_entry_p entry = NULL;
+    intern_entry_p new_entry = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!data || size <= 0) {
+        pdebug(DEBUG_WARN, "Null or empty data passed!");
+        return NULL;
+    }
+
+    data_hash = hash((uint8_t *)(uintptr_t)data, (size_t)(unsigned int)size, INTERN_HASH_SEED);
+    bucket = (int)(data_hash % INTERN_BUCKETS);
+
+    /* allocate outside the lock, we usually need it. */
+    new_entry = (intern_entry_p)rc_alloc((int)sizeof(struct intern_entry_t) + size, intern_entry_destroy, MEM_SUB_INTERN);
+    if(!new_entry) {
+        pdebug(DEBUG_ERROR, "Unable to allocate interned data!");
+        return NULL;
+    }
+
+    new_entry->hash = data_hash;
+    new_entry->size = size;
+    mem_copy(&(new_entry->data[0]), data, size);
+
+    spin_block(&intern_lock) {
+        for(entry = intern_buckets[bucket]; entry; entry = entry->next) {
+            if(entry->hash == data_hash && entry->size == size && mem_cmp(&(entry->data[0]), size, data, size) == 0) {
+                /* this fails if the entry is being destroyed. */
+                entry = rc_inc(entry);
+
+                if(entry) {
+                    break;
+                }
+            }
+        }
+
+        if(!entry) {
+            new_entry->next = intern_buckets[bucket];
+            intern_buckets[bucket] = new_entry;
+            entry = new_entry;
+            new_entry = NULL;
+        }
+    }
+
+    if(new_entry) {
+        /* not linked in, so no need to unlink. */
+        new_entry->size = 0;
+        rc_dec(new_entry);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return &(entry->data[0]);
+}
+
+
+
+const char *intern_str(const char *str)
+{
+    if(!str) {
+        return NULL;
+    }
+
+    return (const char *)intern_bytes((const uint8_t *)str, str_length(str) + 1);
+}
+
+
+
+void intern_release(const void *ref)
+{
+    if(!ref) {
+        return;
+    }
+
+    rc_dec((void *)((uintptr_t)ref - offsetof(struct intern_entry_t, data)));
+}
+
+
+
+void intern_entry_destroy(void *entry_arg)
+{
+    intern_entry_p entry = (intern_entry_p)entry_arg;
+    int bucket = (int)(entry->hash % INTERN_BUCKETS);
+
+    /* entries that were never linked in have zero size. */
+    if(entry->size == 0) {
+        return;
+    }
+
+    spin_block(&intern_lock) {
+        intern_entry_p *walker = &(intern_buckets[bucket]);
+
+        while(*walker && *walker != entry) {
+            walker = &((*walker)->next);
+        }
+
+        if(*walker) {
+            *walker = entry->next;
+        }
+    }
+}
@@ -0,0 +1,523 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lib/libplctag.h>
+#include <platform.h>
+#include <util/debug.h>
+#include <util/lock_profile.h>
+
+
+/* must be a power of two. */
+#define LOCK_PROFILE_SITES (512)
+#define LOCK_PROFILE_MAX_HELD (16)
+
+struct lock_site_t {
+    const char *func;
+    const char *name;
+    int line_num;
+
+    int64_t acquisitions;
+    int64_t contended;
+    int64_t failed_tries;
+    int64_t wait_total_ns;
+    int64_t wait_max_ns;
+    int64_t hold_total_ns;
+    int64_t hold_max_ns;
+};
+
+typedef struct lock_site_t *lock_site_p;
+
+struct held_lock_t {
+    void *mutex;
+    lock_site_p site;
+    int64_t acquire_time;
+};
+
+struct profile_block_t {
+    struct profile_block_t *next;
+
+    /* the counts are for this profiler generation. */
+    uint32_t generation;
+
+    /* locks this thread holds, innermost last. */
+    int num_held;
+    struct held_lock_t held[LOCK_PROFILE_MAX_HELD];
+
+    struct lock_site_t sites[LOCK_PROFILE_SITES];
+};
+
+typedef struct profile_block_t *profile_block_p;
+
+volatile int lock_profile_active = 0;
+
+static lock_t block_list_lock = LOCK_INIT;
+static profile_block_p block_list = NULL;
+static volatile uint32_t block_generation = 1;
+
+/* bumped when the blocks are freed, so threads drop their cached block. */
+static volatile uint32_t block_list_epoch = 1;
+
+static THREAD_LOCAL profile_block_p this_thread_block = NULL;
+static THREAD_LOCAL uint32_t this_thread_block_epoch = 0;
+
+static profile_block_p get_thread_block(void);
+static lock_site_p find_site(profile_block_p block, const char *func, int line_num, const char *name);
+static void merge_site(lock_site_p dest, lock_site_p src);
+static int compare_sites(const void *a, const void *b);
+static void write_site_line(FILE *out, const char *label, lock_site_p site);
+static void free_blocks(profile_block_p blocks);
+
+
+/*
+ * lock_profile_set_enabled
+ *
+ * Turning the profiler on starts a fresh set of counts.  The per-thread
+ * blocks may still be in use by their threads, so they are not touched
+ * here.  Each thread clears its own block in place the next time it
+ * records a lock, and the dump skips blocks from an older generation.
+ */
+
+int lock_profile_set_enabled(int enable)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    spin_block(&block_list_lock) {
+        if(enable && !lock_profile_active) {
+            block_generation++;
+        }
+
+        lock_profile_active = (enable ? 1 : 0);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void lock_profile_acquired(const char *func, int line_num, const char *name, void *mutex, int contended, int64_t wait_ns)
+{
+    profile_block_p block = get_thread_block();
+    lock_site_p site = NULL;
+
+    if(!block) {
+        return;
+    }
+
+    site = find_site(block, func, line_num, name);
+    if(!site) {
+        return;
+    }
+
+    site->acquisitions++;
+
+    if(contended) {
+        site->contended++;
+    }
+
+    site->wait_total_ns += wait_ns;
+
+    if(wait_ns > site->wait_max_ns) {
+        site->wait_max_ns = wait_ns;
+    }
+
+    if(block->num_held < LOCK_PROFILE_MAX_HELD) {
+        block->held[block->num_held].mutex = mutex;
+        block->held[block->num_held].site = site;
+        block->held[block->num_held].acquire_time = time_ns();
+        block->num_held++;
+    }
+}
+
+
+void lock_profile_try_failed(const char *func, int line_num, const char *name)
+{
+    profile_block_p block = get_thread_block();
+    lock_site_p site = NULL;
+
+    if(!block) {
+        return;
+    }
+
+    site = find_site(block, func, line_num, name);
+    if(site) {
+        site->failed_tries++;
+    }
+}
+
+
+void lock_profile_released(void *mutex)
+{
+    profile_block_p block = this_thread_block;
+
+    /* locks taken before the profiler was (re)started are not tracked. */
+    if(!block || this_thread_block_epoch != block_list_epoch || block->generation != block_generation) {
+        return;
+    }
+
+    /* usually the innermost lock. */
+    for(int i = block->num_held - 1; i >= 0; i--) {
+        if(block->held[i].mutex == mutex) {
+            lock_site_p site = block->held[i].site;
+            int64_t hold_ns = time_ns() - block->held[i].acquire_time;
+
+            site->hold_total_ns += hold_ns;
+
+            if(hold_ns > site->hold_max_ns) {
+                site->hold_max_ns = hold_ns;
+            }
+
+            for(int j = i; j < block->num_held - 1; j++) {
+                block->held[j] = block->held[j + 1];
+            }
+
+            block->num_held--;
+
+            break;
+        }
+    }
+}
+
+
+
+/*
+ * lock_profile_dump
+ *
+ * Merge the per-thread counts and write the ranked report.  If file_name
+ * is NULL, the file is taken from the PLCTAG_LOCK_PROFILE_FILE
+ * environment variable.  Without either, the report goes to stderr.
+ */
+
+int lock_profile_dump(const char *file_name)
+{
+    lock_site_p sites = NULL;
+    lock_site_p mutexes = NULL;
+    int num_sites = 0;
+    int num_mutexes = 0;
+    FILE *out = stderr;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    sites = mem_alloc((int)(sizeof(struct lock_site_t) * LOCK_PROFILE_SITES));
+    mutexes = mem_alloc((int)(sizeof(struct lock_site_t) * LOCK_PROFILE_SITES));
+
+    if(!sites || !mutexes) {
+        pdebug(DEBUG_WARN, "Unable to allocate memory for the lock profile report!");
+
+        if(sites) {
+            mem_free(sites);
+        }
+
+        if(mutexes) {
+            mem_free(mutexes);
+        }
+
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    /* merge all threads' sites by call site. */
+    spin_block(&block_list_lock) {
+        for(profile_block_p block = block_list; block; block = block->next) {
+            /* not used since the profiler was last turned on. */
+            if(block->generation != block_generation) {
+                continue;
+            }
+
+            for(int i=0; i < LOCK_PROFILE_SITES; i++) {
+                lock_site_p src = &(block->sites[i]);
+                int index = 0;
+
+                if(!src->func) {
+                    continue;
+                }
+
+                for(index = 0; index < num_sites; index++) {
+                    if(sites[index].line_num == src->line_num && strcmp(sites[index].func, src->func) == 0) {
+                        break;
+                    }
+                }
+
+                if(index == num_sites) {
+                    if(num_sites >= LOCK_PROFILE_SITES) {
+                        continue;
+                    }
+
+                    sites[index].func = src->func;
+                    sites[index].name = src->name;
+                    sites[index].line_num = src->line_num;
+                    num_sites++;
+                }
+
+                merge_site(&(sites[index]), src);
+            }
+        }
+    }
+
+    /* then roll the call sites up by mutex. */
+    for(int i=0; i < num_sites; i++) {
+        int index = 0;
+
+        for(index = 0; index < num_mutexes; index++) {
+            if(strcmp(mutexes[index].name, sites[i].name) == 0) {
+                break;
+            }
+        }
+
+        if(index == num_mutexes) {
+            mutexes[index].name = sites[i].name;
+            num_mutexes++;
+        }
+
+        merge_site(&(mutexes[index]), &(sites[i]));
+    }
+
+    qsort(sites, (size_t)(unsigned int)num_sites, sizeof(struct lock_site_t), compare_sites);
+    qsort(mutexes, (size_t)(unsigned int)num_mutexes, sizeof(struct lock_site_t), compare_sites);
+
+    if(!file_name) {
+        file_name = getenv(LOCK_PROFILE_FILE_ENV_VAR);
+    }
+
+    if(file_name && *file_name) {
+        out = fopen(file_name, "w");
+        if(!out) {
+            pdebug(DEBUG_WARN, "Unable to open lock profile file \"%s\"!", file_name);
+            mem_free(sites);
+            mem_free(mutexes);
+            return PLCTAG_ERR_OPEN;
+        }
+    }
+
+    fprintf(out, "Lock profile, %d mutexes and %d call sites, ranked by total wait time.  Times are in nanoseconds.\n\n", num_mutexes, num_sites);
+
+    fprintf(out, "%-60s %12s %12s %10s %14s %12s %14s %12s\n", "mutex", "acquired", "contended", "try fails", "wait total", "wait max", "hold total", "hold max");
+    for(int i=0; i < num_mutexes; i++) {
+        write_site_line(out, mutexes[i].name, &(mutexes[i]));
+    }
+
+    fprintf(out, "\n%-60s %12s %12s %10s %14s %12s %14s %12s\n", "call site (mutex)", "acquired", "contended", "try fails", "wait total", "wait max", "hold total", "hold max");
+    for(int i=0; i < num_sites; i++) {
+        char label[128];
+
+        snprintf(label, sizeof(label), "%s:%d (%s)", sites[i].func, sites[i].line_num, sites[i].name);
+
+        write_site_line(out, label, &(sites[i]));
+    }
+
+    if(out != stderr) {
+        fclose(out);
+    } else {
+        fflush(out);
+    }
+
+    mem_free(sites);
+    mem_free(mutexes);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * lock_profile_teardown
+ *
+ * Write the report if the profiler is still on and free all the blocks.
+ */
+
+void lock_profile_teardown(void)
+{
+    profile_block_p blocks = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(lock_profile_active) {
+        lock_profile_dump(NULL);
+    }
+
+    spin_block(&block_list_lock) {
+        lock_profile_active = 0;
+
+        blocks = block_list;
+        block_list = NULL;
+
+        block_generation++;
+        block_list_epoch++;
+    }
+
+    free_blocks(blocks);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+
+/***********************************************************************
+ *********************** Implementation Functions **********************
+ **********************************************************************/
+
+
+profile_block_p get_thread_block(void)
+{
+    profile_block_p block = (this_thread_block_epoch == block_list_epoch ? this_thread_block : NULL);
+
+    if(block && block->generation == block_generation) {
+        return block;
+    }
+
+    /*
+     * the profiler was restarted, clear the counts in place.  This is done
+     * under the list lock so that a dump never sees a half cleared block.
+     */
+    if(block) {
+        spin_block(&block_list_lock) {
+            mem_set(block->sites, 0, (int)sizeof(block->sites));
+            block->num_held = 0;
+            block->generation = block_generation;
+        }
+
+        return block;
+    }
+
+    block = mem_alloc((int)sizeof(*block));
+    if(!block) {
+        return NULL;
+    }
+
+    spin_block(&block_list_lock) {
+        block->generation = block_generation;
+        block->next = block_list;
+        block_list = block;
+        this_thread_block_epoch = block_list_epoch;
+    }
+
+    this_thread_block = block;
+
+    return block;
+}
+
+
+lock_site_p find_site(profile_block_p block, const char *func, int line_num, const char *name)
+{
+    uint32_t hash = ((uint32_t)((uintptr_t)func >> 3) ^ ((uint32_t)line_num * 2654435761u));
+
+    for(int i=0; i < LOCK_PROFILE_SITES; i++) {
+        lock_site_p site = &(block->sites[(hash + (uint32_t)i) & (LOCK_PROFILE_SITES - 1)]);
+
+        if(site->func == func && site->line_num == line_num) {
+            return site;
+        }
+
+        if(!site->func) {
+            /* set func last, the dump skips entries without it. */
+            site->name = name;
+            site->line_num = line_num;
+            site->func = func;
+
+            return site;
+        }
+    }
+
+    /* table is full. */
+    return NULL;
+}
+
+
+void merge_site(lock_site_p dest, lock_site_p src)
+{
+    dest->acquisitions += src->acquisitions;
+    dest->contended += src->contended;
+    dest->failed_tries += src->failed_tries;
+    dest->wait_total_ns += src->wait_total_ns;
+    dest->hold_total_ns += src->hold_total_ns;
+
+    if(src->wait_max_ns > dest->wait_max_ns) {
+        dest->wait_max_ns = src->wait_max_ns;
+    }
+
+    if(src->hold_max_ns > dest->hold_max_ns) {
+        dest->hold_max_ns = src->hold_max_ns;
+    }
+}
+
+
+int compare_sites(const void *a, const void *b)
+{
+    const struct lock_site_t *site_a = a;
+    const struct lock_site_t *site_b = b;
+
+    /* most total wait first, then most acquisitions. */
+    if(site_a->wait_total_ns != site_b->wait_total_ns) {
+        return (site_a->wait_total_ns < site_b->wait_total_ns ? 1 : -1);
+    }
+
+    if(site_a->acquisitions != site_b->acquisitions) {
+        return (site_a->acquisitions < site_b->acquisitions ? 1 : -1);
+    }
+
+    return 0;
+}
+
+
+void write_site_line(FILE *out, const char *label, lock_site_p site)
+{
+    fprintf(out, "%-60s %12" PRId64 " %12" PRId64 " %10" PRId64 " %14" PRId64 " %12" PRId64 " %14" PRId64 " %12" PRId64 "\n",
+                 label,
+                 site->acquisitions,
+                 site->contended,
+                 site->failed_tries,
+                 site->wait_total_ns,
+                 site->wait_max_ns,
+                 site->hold_total_ns,
+                 site->hold_max_ns);
+}
+
+
+void free_blocks(profile_block_p blocks)
+{
+    while(blocks) {
+        profile_block_p next = blocks->next;
+
+        mem_free(blocks);
+
+        blocks = next;
+    }
+}
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Lock contention profiler.
+ *
+ * When turned on, every lw_mutex_t acquisition is recorded against its
+ * call site and the text of the mutex expression, for instance
+ * "&session->mutex".  For each site this counts acquisitions, contended
+ * acquisitions (the lock was held when first tried) and failed try
+ * locks, and sums up wait and hold times in nanoseconds along with the
+ * maximum of each.
+ *
+ * The counts are kept per thread so the profiler does not add a shared
+ * lock of its own.  lock_profile_dump() merges them and writes a report
+ * ranked by total wait time, first per mutex and then per call site.
+ *
+ * Turning the profiler on again starts a fresh set of counts.  If it is
+ * still on at library shutdown, the report is written then.
+ */
+
+#define LOCK_PROFILE_FILE_ENV_VAR "PLCTAG_LOCK_PROFILE_FILE"
+
+extern volatile int lock_profile_active;
+
+extern int lock_profile_set_enabled(int enable);
+extern int lock_profile_dump(const char *file_name);
+extern void lock_profile_teardown(void);
+
+/* called from the platform mutex code. */
+extern void lock_profile_acquired(const char *func, int line_num, const char *name, void *mutex, int contended, int64_t wait_ns);
+extern void lock_profile_try_failed(const char *func, int line_num, const char *name);
+extern void lock_profile_released(void *mutex);
@@ -0,0 +1,291 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lib/libplctag.h>
+#include <platform.h>
+#include <util/debug.h>
+#include <util/mem_track.h>
+
+
+/* must be a power of two. */
+#define MEM_TRACK_SITES (128)
+
+struct mem_counts_t {
+    int64_t values[MEM_STAT_COUNT];
+};
+
+struct mem_site_t {
+    const char *func;
+    int line_num;
+    mem_subsystem_t subsystem;
+    struct mem_counts_t counts;
+};
+
+typedef struct mem_site_t *mem_site_p;
+
+volatile int mem_track_active = 0;
+
+static lock_t mem_track_lock = LOCK_INIT;
+static struct mem_counts_t subsystem_counts[MEM_SUB_COUNT];
+static struct mem_site_t sites[MEM_TRACK_SITES];
+
+static const char *subsystem_names[MEM_SUB_COUNT] = { "other", "tags", "sessions", "requests", "attrs", "modbus plcs", "intern" };
+
+static void update_counts(struct mem_counts_t *counts, int64_t bytes, int objects);
+static mem_site_p find_site_unsafe(const char *func, int line_num, mem_subsystem_t subsystem);
+static int compare_sites(const void *a, const void *b);
+
+
+/*
+ * mem_track_set_enabled
+ *
+ * Only controls whether new allocations are counted.  Objects that were
+ * counted are still taken off when they are freed, so the figures stay
+ * consistent when accounting is turned off and on again.
+ */
+
+int mem_track_set_enabled(int enable)
+{
+    mem_track_active = (enable ? 1 : 0);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * mem_track_update
+ *
+ * Add (or with negative values, remove) bytes and objects for a subsystem
+ * and call site.  func may be NULL for memory that is only counted by
+ * subsystem.  Only counts objects that are allocations, objects is zero
+ * when an owner grows or shrinks a buffer.
+ */
+
+void mem_track_update(mem_subsystem_t subsystem, const char *func, int line_num, int64_t bytes, int objects)
+{
+    if(subsystem < MEM_SUB_OTHER || subsystem >= MEM_SUB_COUNT) {
+        subsystem = MEM_SUB_OTHER;
+    }
+
+    spin_block(&mem_track_lock) {
+        update_counts(&(subsystem_counts[subsystem]), bytes, objects);
+
+        if(func) {
+            mem_site_p site = find_site_unsafe(func, line_num, subsystem);
+
+            if(site) {
+                update_counts(&(site->counts), bytes, objects);
+            }
+        }
+    }
+}
+
+
+
+/*
+ * mem_track_snapshot
+ *
+ * Copy out the per-subsystem figures in the layout returned by the
+ * "memory" system tag.
+ */
+
+int mem_track_snapshot(int64_t *values, int num_values)
+{
+    if(!values || num_values < MEM_TRACK_SNAPSHOT_SIZE) {
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    values[0] = MEM_SUB_COUNT;
+    values[1] = MEM_STAT_COUNT;
+
+    spin_block(&mem_track_lock) {
+        for(int sub=0; sub < MEM_SUB_COUNT; sub++) {
+            for(int stat=0; stat < MEM_STAT_COUNT; stat++) {
+                values[2 + (sub * MEM_STAT_COUNT) + stat] = subsystem_counts[sub].values[stat];
+            }
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * mem_track_dump
+ *
+ * Write a report of the subsystems and the call sites ranked by live
+ * bytes.  If file_name is NULL, the file is taken from the
+ * PLCTAG_MEM_TRACK_FILE environment variable, otherwise it goes to stderr.
+ */
+
+int mem_track_dump(const char *file_name)
+{
+    struct mem_counts_t sub_copy[MEM_SUB_COUNT];
+    struct mem_site_t site_copy[MEM_TRACK_SITES];
+    int num_sites = 0;
+    FILE *out = stderr;
+
+    spin_block(&mem_track_lock) {
+        mem_copy(sub_copy, subsystem_counts, (int)sizeof(sub_copy));
+
+        for(int i=0; i < MEM_TRACK_SITES; i++) {
+            if(sites[i].func) {
+                site_copy[num_sites] = sites[i];
+                num_sites++;
+            }
+        }
+    }
+
+    qsort(site_copy, (size_t)(unsigned int)num_sites, sizeof(struct mem_site_t), compare_sites);
+
+    if(!file_name) {
+        file_name = getenv(MEM_TRACK_FILE_ENV_VAR);
+    }
+
+    if(file_name && *file_name) {
+        out = fopen(file_name, "w");
+        if(!out) {
+            pdebug(DEBUG_WARN, "Unable to open memory report file \"%s\"!", file_name);
+            return PLCTAG_ERR_OPEN;
+        }
+    }
+
+    fprintf(out, "Memory accounting%s.\n\n", (mem_track_active ? "" : " (currently off)"));
+
+    fprintf(out, "%-40s %14s %12s %14s %12s %12s\n", "subsystem", "live bytes", "live objs", "peak bytes", "peak objs", "allocs");
+    for(int sub=0; sub < MEM_SUB_COUNT; sub++) {
+        fprintf(out, "%-40s %14" PRId64 " %12" PRId64 " %14" PRId64 " %12" PRId64 " %12" PRId64 "\n",
+                     subsystem_names[sub],
+                     sub_copy[sub].values[MEM_STAT_LIVE_BYTES],
+                     sub_copy[sub].values[MEM_STAT_LIVE_OBJECTS],
+                     sub_copy[sub].values[MEM_STAT_PEAK_BYTES],
+                     sub_copy[sub].values[MEM_STAT_PEAK_OBJECTS],
+                     sub_copy[sub].values[MEM_STAT_TOTAL_ALLOCS]);
+    }
+
+    fprintf(out, "\n%-40s %14s %12s %14s %12s %12s\n", "call site (subsystem)", "live bytes", "live objs", "peak bytes", "peak objs", "allocs");
+    for(int i=0; i < num_sites; i++) {
+        char label[128];
+
+        snprintf(label, sizeof(label), "%s:%d (%s)", site_copy[i].func, site_copy[i].line_num, subsystem_names[site_copy[i].subsystem]);
+
+        fprintf(out, "%-40s %14" PRId64 " %12" PRId64 " %14" PRId64 " %12" PRId64 " %12" PRId64 "\n",
+                     label,
+                     site_copy[i].counts.values[MEM_STAT_LIVE_BYTES],
+                     site_copy[i].counts.values[MEM_STAT_LIVE_OBJECTS],
+                     site_copy[i].counts.values[MEM_STAT_PEAK_BYTES],
+                     site_copy[i].counts.values[MEM_STAT_PEAK_OBJECTS],
+                     site_copy[i].counts.values[MEM_STAT_TOTAL_ALLOCS]);
+    }
+
+    if(out != stderr) {
+        fclose(out);
+    } else {
+        fflush(out);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/***********************************************************************
+ *********************** Implementation Functions **********************
+ **********************************************************************/
+
+
+void update_counts(struct mem_counts_t *counts, int64_t bytes, int objects)
+{
+    counts->values[MEM_STAT_LIVE_BYTES] += bytes;
+    counts->values[MEM_STAT_LIVE_OBJECTS] += objects;
+
+    if(objects > 0) {
+        counts->values[MEM_STAT_TOTAL_ALLOCS] += objects;
+    }
+
+    if(counts->values[MEM_STAT_LIVE_BYTES] > counts->values[MEM_STAT_PEAK_BYTES]) {
+        counts->values[MEM_STAT_PEAK_BYTES] = counts->values[MEM_STAT_LIVE_BYTES];
+    }
+
+    if(counts->values[MEM_STAT_LIVE_OBJECTS] > counts->values[MEM_STAT_PEAK_OBJECTS]) {
+        counts->values[MEM_STAT_PEAK_OBJECTS] = counts->values[MEM_STAT_LIVE_OBJECTS];
+    }
+}
+
+
+mem_site_p find_site_unsafe(const char *func, int line_num, mem_subsystem_t subsystem)
+{
+    uint32_t hash = ((uint32_t)((uintptr_t)func >> 3) ^ ((uint32_t)line_num * 2654435761u));
+
+    for(int i=0; i < MEM_TRACK_SITES; i++) {
+        mem_site_p site = &(sites[(hash + (uint32_t)i) & (MEM_TRACK_SITES - 1)]);
+
+        if(site->func == func && site->line_num == line_num) {
+            return site;
+        }
+
+        if(!site->func) {
+            site->func = func;
+            site->line_num = line_num;
+            site->subsystem = subsystem;
+
+            return site;
+        }
+    }
+
+    /* table is full. */
+    return NULL;
+}
+
+
+int compare_sites(const void *a, const void *b)
+{
+    const struct mem_site_t *site_a = a;
+    const struct mem_site_t *site_b = b;
+    int64_t live_a = site_a->counts.values[MEM_STAT_LIVE_BYTES];
+    int64_t live_b = site_b->counts.values[MEM_STAT_LIVE_BYTES];
+
+    if(live_a != live_b) {
+        return (live_a < live_b ? 1 : -1);
+    }
+
+    return 0;
+}
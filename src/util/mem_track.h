@@ -0,0 +1,89 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Memory accounting.
+ *
+ * When turned on, reference counted objects allocated with rc_alloc() are
+ * counted against their rc_alloc() call site and against a subsystem.
+ * Buffers owned by those objects, such as tag data and request buffers,
+ * are added to the owner with rc_track_extra() so they are counted in the
+ * same places.  Attribute lists are counted directly.
+ *
+ * For each call site and subsystem this keeps live bytes and objects,
+ * their peaks and the total number of allocations.  Objects allocated
+ * while accounting was off are never counted, so turning it on part way
+ * through only shows memory allocated from then on.
+ *
+ * The system tag "memory" returns the subsystem figures as little endian
+ * int64 values: the number of subsystems, the number of values per
+ * subsystem and then one block per subsystem in the order below.
+ */
+
+typedef enum {
+    MEM_SUB_OTHER = 0,
+    MEM_SUB_TAGS,
+    MEM_SUB_SESSIONS,
+    MEM_SUB_REQUESTS,
+    MEM_SUB_ATTRS,
+    MEM_SUB_MODBUS_PLCS,
+    MEM_SUB_INTERN,
+
+    MEM_SUB_COUNT
+} mem_subsystem_t;
+
+typedef enum {
+    MEM_STAT_LIVE_BYTES = 0,
+    MEM_STAT_LIVE_OBJECTS,
+    MEM_STAT_PEAK_BYTES,
+    MEM_STAT_PEAK_OBJECTS,
+    MEM_STAT_TOTAL_ALLOCS,
+
+    MEM_STAT_COUNT
+} mem_stat_t;
+
+#define MEM_TRACK_SNAPSHOT_SIZE (2 + (MEM_SUB_COUNT * MEM_STAT_COUNT))
+
+#define MEM_TRACK_FILE_ENV_VAR "PLCTAG_MEM_TRACK_FILE"
+
+extern volatile int mem_track_active;
+
+extern int mem_track_set_enabled(int enable);
+extern void mem_track_update(mem_subsystem_t subsystem, const char *func, int line_num, int64_t bytes, int objects);
+extern int mem_track_snapshot(int64_t *values, int num_values);
+extern int mem_track_dump(const char *file_name);
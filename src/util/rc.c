@@ -71,6 +71,8 @@ struct refcount_t {
     int count;
     const char *function_name;
     int line_num;
+    mem_subsystem_t subsystem;
+    int tracked_size; /* zero if not counted by memory accounting. */
     //cleanup_p cleaners;
     rc_cleanup_func cleanup_func;
 
@@ -102,7 +104,7 @@ static void refcount_cleanup(refcount_p rc);
  * reference to the data.
  */
 //void *rc_alloc_impl(const char *func, int line_num, int data_size, int extra_arg_count, rc_cleanup_func cleaner_func, ...)
-void *rc_alloc_impl(const char *func, int line_num, int data_size, rc_cleanup_func cleaner_func)
+void *rc_alloc_impl(const char *func, int line_num, int data_size, rc_cleanup_func cleaner_func, mem_subsystem_t subsystem)
 {
     refcount_p rc = NULL;
     //cleanup_p cleanup = NULL;
@@ -127,6 +129,13 @@ void *rc_alloc_impl(const char *func, int line_num, int data_size, rc_cleanup_fu
     rc->function_name = func;
     rc->line_num = line_num;
 
+    rc->subsystem = subsystem;
+
+    if(mem_track_active) {
+        rc->tracked_size = (int)sizeof(struct refcount_t) + data_size;
+        mem_track_update(subsystem, func, line_num, rc->tracked_size, 1);
+    }
+
     pdebug(DEBUG_INFO, "Done");
 
     /* return the original address if successful otherwise NULL. */
@@ -143,6 +152,43 @@ void *rc_alloc_impl(const char *func, int line_num, int data_size, rc_cleanup_fu
 
 
 
+/*
+ * rc_track_extra
+ *
+ * Count memory that is owned by the referenced object, such as a data
+ * buffer, against the object's allocation site and subsystem.  Call it
+ * with a negative delta when the memory shrinks.  It does nothing if the
+ * object was allocated while memory accounting was off.
+ *
+ * The total is removed when the object is freed so the clean up function
+ * does not need to call this.
+ */
+
+void rc_track_extra(void *ref, int delta)
+{
+    refcount_p rc = NULL;
+    int tracked = 0;
+
+    if(!ref || !delta) {
+        return;
+    }
+
+    rc = ((refcount_p)ref) - 1;
+
+    spin_block(&rc->lock) {
+        if(rc->tracked_size > 0) {
+            rc->tracked_size += delta;
+            tracked = 1;
+        }
+    }
+
+    if(tracked) {
+        mem_track_update(rc->subsystem, rc->function_name, rc->line_num, delta, 0);
+    }
+}
+
+
+
 
 /*
  * Increments the ref count if the reference is valid.
@@ -262,6 +308,10 @@ void refcount_cleanup(refcount_p rc)
     /* call the clean up function */
     rc->cleanup_func((void *)(rc+1));
 
+    if(rc->tracked_size > 0) {
+        mem_track_update(rc->subsystem, rc->function_name, rc->line_num, -(int64_t)rc->tracked_size, -1);
+    }
+
     /* finally done. */
     mem_free(rc);
 
@@ -34,11 +34,15 @@
 #pragma once
 
 #include <platform.h>
+#include <util/mem_track.h>
 
 typedef void (*rc_cleanup_func)(void *);
 
-#define rc_alloc(size, cleaner) rc_alloc_impl(__func__, __LINE__, size, cleaner)
-extern void *rc_alloc_impl(const char *func, int line_num, int size, rc_cleanup_func cleaner);
+#define rc_alloc(size, cleaner, subsystem) rc_alloc_impl(__func__, __LINE__, size, cleaner, subsystem)
+extern void *rc_alloc_impl(const char *func, int line_num, int size, rc_cleanup_func cleaner, mem_subsystem_t subsystem);
+
+/* count memory owned by ref against its allocation, see util/mem_track.h */
+extern void rc_track_extra(void *ref, int delta);
 
 #define rc_inc(ref) rc_inc_impl(__func__, __LINE__, ref)
 extern void *rc_inc_impl(const char *func, int line_num, void *ref);
@@ -0,0 +1,287 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <lib/libplctag.h>
+#include <platform.h>
+#include <util/debug.h>
+#include <util/stats.h>
+
+
+struct stats_block_t {
+    struct stats_block_t *next;
+
+    /* the values only count if this matches stats_generation. */
+    volatile uint32_t generation;
+
+    volatile int64_t values[STATS_NUM_FIELDS];
+};
+
+typedef struct stats_block_t *stats_block_p;
+
+static lock_t block_list_lock = LOCK_INIT;
+
+/* one block per live thread that has updated a counter. */
+static stats_block_p block_list = NULL;
+
+/* the counters of threads that have exited. */
+static int64_t exited_values[STATS_NUM_FIELDS] = {0};
+
+/* bumped by stats_teardown() to reset all counters. */
+static volatile uint32_t stats_generation = 1;
+
+/* created once and never destroyed, threads can exit at any time. */
+static thread_exit_hook_p exit_hook = NULL;
+
+static THREAD_LOCAL stats_block_p this_thread_block = NULL;
+
+static stats_block_p get_thread_block(void);
+static void reset_block(stats_block_p block);
+static void add_values(int64_t *totals, volatile int64_t *values);
+static THREAD_EXIT_FUNC(stats_thread_exit);
+
+/* upper bounds of the RTT buckets in microseconds. */
+static const int64_t rtt_bucket_limits_us[] = { 1000, 2000, 5000, 10000, 20000, 50000, 100000, 250000, 1000000 };
+
+
+
+void stats_add(stats_field_t field, int64_t amount)
+{
+    stats_block_p block = get_thread_block();
+
+    if(block) {
+        block->values[field] += amount;
+    }
+}
+
+
+void stats_max(stats_field_t field, int64_t value)
+{
+    stats_block_p block = get_thread_block();
+
+    if(block && value > block->values[field]) {
+        block->values[field] = value;
+    }
+}
+
+
+void stats_record_rtt(int64_t rtt_us)
+{
+    int bucket = 0;
+    int num_limits = (int)(sizeof(rtt_bucket_limits_us)/sizeof(rtt_bucket_limits_us[0]));
+
+    while(bucket < num_limits && rtt_us >= rtt_bucket_limits_us[bucket]) {
+        bucket++;
+    }
+
+    stats_add((stats_field_t)(STATS_RTT_UNDER_1MS + bucket), 1);
+}
+
+
+
+/*
+ * stats_snapshot
+ *
+ * Add up the counters from all threads, live and exited.  The per-thread
+ * values are read without stopping their owners, so the result is a close
+ * approximation rather than an atomic snapshot.
+ */
+
+int stats_snapshot(int64_t *values, int num_values)
+{
+    if(!values || num_values < STATS_NUM_FIELDS) {
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    for(int i=0; i < STATS_NUM_FIELDS; i++) {
+        values[i] = 0;
+    }
+
+    spin_block(&block_list_lock) {
+        add_values(values, exited_values);
+
+        for(stats_block_p block = block_list; block; block = block->next) {
+            /* not reset by its owner yet, so it counts as zero. */
+            if(block->generation == stats_generation) {
+                add_values(values, block->values);
+            }
+        }
+    }
+
+    values[STATS_NUM_ENTRIES] = STATS_NUM_FIELDS;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * stats_teardown
+ *
+ * Reset all the counters.  Blocks belong to their threads and are only
+ * freed when the thread exits, so nothing is freed here.  Each thread
+ * clears its own block on its next update.
+ */
+
+void stats_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    spin_block(&block_list_lock) {
+        stats_generation++;
+
+        for(int i=0; i < STATS_NUM_FIELDS; i++) {
+            exited_values[i] = 0;
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+
+/***********************************************************************
+ *********************** Implementation Functions **********************
+ **********************************************************************/
+
+
+stats_block_p get_thread_block(void)
+{
+    stats_block_p block = this_thread_block;
+
+    if(block) {
+        if(block->generation != stats_generation) {
+            reset_block(block);
+        }
+
+        return block;
+    }
+
+    block = mem_alloc((int)sizeof(*block));
+    if(!block) {
+        return NULL;
+    }
+
+    spin_block(&block_list_lock) {
+        if(!exit_hook && thread_exit_hook_create(&exit_hook, stats_thread_exit) != PLCTAG_STATUS_OK) {
+            exit_hook = NULL;
+        }
+
+        block->generation = stats_generation;
+        block->next = block_list;
+        block_list = block;
+    }
+
+    if(!exit_hook || thread_exit_hook_set(exit_hook, block) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to register for thread exit, the counter block is kept until the process exits.");
+    }
+
+    this_thread_block = block;
+
+    return block;
+}
+
+
+
+/* only called by the thread that owns the block. */
+void reset_block(stats_block_p block)
+{
+    uint32_t generation = stats_generation;
+
+    for(int i=0; i < STATS_NUM_FIELDS; i++) {
+        block->values[i] = 0;
+    }
+
+    /* snapshots must not see the new generation before the values are cleared. */
+    memory_barrier();
+
+    block->generation = generation;
+}
+
+
+
+void add_values(int64_t *totals, volatile int64_t *values)
+{
+    for(int i=0; i < STATS_NUM_FIELDS; i++) {
+        int64_t val = values[i];
+
+        if(i == STATS_MAX_QUEUE_DEPTH || i == STATS_MAX_TICKLER_PASS_US) {
+            if(val > totals[i]) {
+                totals[i] = val;
+            }
+        } else {
+            totals[i] += val;
+        }
+    }
+}
+
+
+
+/*
+ * stats_thread_exit
+ *
+ * Fold the counters of an exiting thread into the totals for exited
+ * threads and free its block.
+ */
+
+THREAD_EXIT_FUNC(stats_thread_exit)
+{
+    stats_block_p block = (stats_block_p)data;
+
+    if(!block) {
+        return;
+    }
+
+    spin_block(&block_list_lock) {
+        stats_block_p *walker = &block_list;
+
+        while(*walker && *walker != block) {
+            walker = &((*walker)->next);
+        }
+
+        if(*walker) {
+            *walker = block->next;
+        }
+
+        if(block->generation == stats_generation) {
+            add_values(exited_values, block->values);
+        }
+    }
+
+    if(this_thread_block == block) {
+        this_thread_block = NULL;
+    }
+
+    mem_free(block);
+}
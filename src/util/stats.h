@@ -0,0 +1,102 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Library-wide performance counters.
+ *
+ * Each thread updates its own block of counters so the hot paths do not
+ * share cache lines or take locks.  stats_snapshot() adds up the blocks
+ * from all threads.  Gauges such as the number of live tags are kept as
+ * signed deltas, so an increment in one thread and the matching
+ * decrement in another still sum to the right value.  The STATS_MAX_*
+ * entries are high water marks and are combined with max() instead.
+ * When a thread exits, its counters are folded into a total for exited
+ * threads and its block is freed.
+ *
+ * The snapshot is what the system tag "stats" returns: an array of
+ * STATS_NUM_FIELDS little endian 64-bit integers in the order below.
+ * Entry 0 is the number of entries so readers can detect new fields,
+ * which are only ever added at the end.
+ */
+
+typedef enum {
+    STATS_NUM_ENTRIES = 0,      /* filled in by stats_snapshot(). */
+
+    STATS_LIVE_TAGS,
+    STATS_LIVE_SESSIONS,        /* AB sessions plus Modbus PLC connections. */
+    STATS_QUEUED_REQUESTS,      /* requests waiting in all AB session queues. */
+    STATS_MAX_QUEUE_DEPTH,      /* deepest single session queue seen, see also the AB session_*queue_depth tag attributes. */
+
+    STATS_PACKETS_SENT,
+    STATS_PACKETS_RECEIVED,
+    STATS_REQUESTS_SENT,        /* divide by packets sent for requests per packet. */
+    STATS_BYTES_SENT,
+    STATS_BYTES_RECEIVED,
+    STATS_RECONNECTS,
+
+    /* AB request/response round trip time histogram. */
+    STATS_RTT_UNDER_1MS,
+    STATS_RTT_UNDER_2MS,
+    STATS_RTT_UNDER_5MS,
+    STATS_RTT_UNDER_10MS,
+    STATS_RTT_UNDER_20MS,
+    STATS_RTT_UNDER_50MS,
+    STATS_RTT_UNDER_100MS,
+    STATS_RTT_UNDER_250MS,
+    STATS_RTT_UNDER_1000MS,
+    STATS_RTT_OVER_1000MS,
+
+    STATS_TICKLER_PASSES,
+    STATS_TICKLER_TOTAL_US,
+    STATS_MAX_TICKLER_PASS_US,
+
+    STATS_MB_SLOTS_IN_USE,      /* Modbus requests in flight. */
+    STATS_MB_SLOTS_TOTAL,       /* sum of max_requests_in_flight over live PLCs. */
+    STATS_MB_COALESCED_READS,   /* Modbus tag reads served by another tag's request. */
+    STATS_MB_COALESCED_WRITES,  /* Modbus tag writes sent in another tag's request. */
+    STATS_MB_RETRANSMITS,       /* Modbus requests sent again after no response. */
+    STATS_PCCC_MERGED_READS,    /* PCCC tag reads merged into another tag's read. */
+
+    STATS_NUM_FIELDS
+} stats_field_t;
+
+extern void stats_add(stats_field_t field, int64_t amount);
+extern void stats_max(stats_field_t field, int64_t value);
+extern void stats_record_rtt(int64_t rtt_us);
+extern int stats_snapshot(int64_t *values, int num_values);
+extern void stats_teardown(void);
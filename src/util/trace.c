@@ -0,0 +1,299 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <lib/libplctag.h>
+#include <platform.h>
+#include <util/debug.h>
+#include <util/trace.h>
+
+
+/* 64K spans at 48 bytes each, about 3MB while tracing is on. */
+#define TRACE_MAX_SPANS (65536)
+
+struct trace_span_t {
+    const char *name;
+    const char *category;
+    int64_t id;
+    int64_t start_us;
+    int64_t duration_us;
+    int32_t tag_id;
+};
+
+typedef struct trace_span_t *trace_span_p;
+
+struct trace_buffer_t {
+    uint32_t next;
+    uint32_t count;
+    uint32_t overwritten;
+    struct trace_span_t spans[TRACE_MAX_SPANS];
+};
+
+typedef struct trace_buffer_t *trace_buffer_p;
+
+volatile int trace_active = 0;
+
+static lock_t trace_lock = LOCK_INIT;
+static trace_buffer_p trace_buffer = NULL;
+
+static int write_trace_file(const char *file_name, trace_buffer_p buffer);
+
+
+/*
+ * trace_set_enabled
+ *
+ * Turn span collection on or off.  Turning it on allocates the span ring,
+ * turning it off throws away anything not yet dumped.
+ */
+
+int trace_set_enabled(int enable)
+{
+    trace_buffer_p new_buffer = NULL;
+    trace_buffer_p old_buffer = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(enable) {
+        new_buffer = mem_alloc((int)sizeof(*new_buffer));
+        if(!new_buffer) {
+            pdebug(DEBUG_WARN, "Unable to allocate trace buffer!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+    }
+
+    spin_block(&trace_lock) {
+        if(enable) {
+            if(!trace_buffer) {
+                trace_buffer = new_buffer;
+                new_buffer = NULL;
+            }
+        } else {
+            old_buffer = trace_buffer;
+            trace_buffer = NULL;
+        }
+
+        trace_active = (trace_buffer ? 1 : 0);
+    }
+
+    /* one of these was not used. */
+    if(new_buffer) {
+        mem_free(new_buffer);
+    }
+
+    if(old_buffer) {
+        mem_free(old_buffer);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * trace_span
+ *
+ * Record one completed span.  Spans with missing or reversed time stamps
+ * are dropped.  This is cheap enough to call from the I/O threads.
+ */
+
+void trace_span(const char *name, const char *category, int32_t tag_id, int64_t id, int64_t start_us, int64_t end_us)
+{
+    if(!trace_active || start_us <= 0 || end_us < start_us) {
+        return;
+    }
+
+    spin_block(&trace_lock) {
+        trace_span_p span = NULL;
+
+        if(!trace_buffer) {
+            break;
+        }
+
+        span = &(trace_buffer->spans[trace_buffer->next]);
+
+        span->name = name;
+        span->category = category;
+        span->id = id;
+        span->start_us = start_us;
+        span->duration_us = end_us - start_us;
+        span->tag_id = tag_id;
+
+        trace_buffer->next = (trace_buffer->next + 1) % TRACE_MAX_SPANS;
+
+        if(trace_buffer->count < TRACE_MAX_SPANS) {
+            trace_buffer->count++;
+        } else {
+            trace_buffer->overwritten++;
+        }
+    }
+}
+
+
+
+/*
+ * trace_dump
+ *
+ * Write out everything collected so far and start a fresh ring.  If
+ * file_name is NULL, the file is taken from the PLCTAG_TRACE_FILE
+ * environment variable or falls back to the default name.
+ *
+ * The ring is swapped out under the lock and written without it so that
+ * the I/O threads are not held up by the file write.
+ */
+
+int trace_dump(const char *file_name)
+{
+    int rc = PLCTAG_STATUS_OK;
+    trace_buffer_p new_buffer = NULL;
+    trace_buffer_p old_buffer = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!file_name) {
+        file_name = getenv(TRACE_FILE_ENV_VAR);
+    }
+
+    if(!file_name || !*file_name) {
+        file_name = TRACE_DEFAULT_FILE;
+    }
+
+    new_buffer = mem_alloc((int)sizeof(*new_buffer));
+    if(!new_buffer) {
+        pdebug(DEBUG_WARN, "Unable to allocate replacement trace buffer!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    spin_block(&trace_lock) {
+        old_buffer = trace_buffer;
+
+        if(old_buffer) {
+            trace_buffer = new_buffer;
+            new_buffer = NULL;
+        }
+    }
+
+    if(new_buffer) {
+        mem_free(new_buffer);
+    }
+
+    if(!old_buffer) {
+        pdebug(DEBUG_WARN, "Tracing is not enabled, nothing to dump.");
+        return PLCTAG_ERR_NOT_ALLOWED;
+    }
+
+    rc = write_trace_file(file_name, old_buffer);
+
+    mem_free(old_buffer);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * trace_teardown
+ *
+ * Called at library shutdown.  Dump anything collected if tracing is
+ * still on and release the ring.
+ */
+
+void trace_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(trace_active) {
+        trace_dump(NULL);
+    }
+
+    trace_set_enabled(0);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+
+/***********************************************************************
+ *********************** Implementation Functions **********************
+ **********************************************************************/
+
+
+int write_trace_file(const char *file_name, trace_buffer_p buffer)
+{
+    FILE *out = NULL;
+    uint32_t first = 0;
+
+    out = fopen(file_name, "w");
+    if(!out) {
+        pdebug(DEBUG_WARN, "Unable to open trace file \"%s\"!", file_name);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"libplctag\"}}");
+
+    /* oldest span first. */
+    first = (buffer->count < TRACE_MAX_SPANS ? 0 : buffer->next);
+
+    for(uint32_t i = 0; i < buffer->count; i++) {
+        trace_span_p span = &(buffer->spans[(first + i) % TRACE_MAX_SPANS]);
+
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%" PRId64 ",\"dur\":%" PRId64 ",\"pid\":1,\"tid\":%" PRId32,
+                     span->name, span->category, span->start_us, span->duration_us, span->tag_id);
+
+        if(span->id) {
+            fprintf(out, ",\"args\":{\"id\":%" PRId64 "}", span->id);
+        }
+
+        fprintf(out, "}");
+    }
+
+    fprintf(out, "\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{\"spans\":%" PRIu32 ",\"overwritten\":%" PRIu32 "}}\n",
+                 buffer->count, buffer->overwritten);
+
+    if(fclose(out)) {
+        pdebug(DEBUG_WARN, "Error closing trace file \"%s\"!", file_name);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    pdebug(DEBUG_INFO, "Wrote %" PRIu32 " spans (%" PRIu32 " overwritten) to \"%s\".", buffer->count, buffer->overwritten, file_name);
+
+    return PLCTAG_STATUS_OK;
+}
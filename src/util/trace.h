@@ -0,0 +1,65 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Request lifecycle tracing.
+ *
+ * When enabled, the library records timed spans (request queued, sent,
+ * on the wire, unpacked, callback run etc.) into a fixed size in-memory
+ * ring.  The oldest spans are overwritten when the ring fills.
+ *
+ * trace_dump() writes the collected spans as Chrome trace event JSON,
+ * which can be loaded into chrome://tracing or ui.perfetto.dev.  Each
+ * tag gets its own track.  Collected spans are dumped automatically at
+ * library shutdown if tracing is still enabled.
+ *
+ * Span names and categories must be string literals or otherwise live
+ * for the life of the library as only the pointers are stored.
+ */
+
+#define TRACE_DEFAULT_FILE "libplctag_trace.json"
+#define TRACE_FILE_ENV_VAR "PLCTAG_TRACE_FILE"
+
+extern volatile int trace_active;
+
+#define trace_enabled() (trace_active)
+
+extern int trace_set_enabled(int enable);
+extern void trace_span(const char *name, const char *category, int32_t tag_id, int64_t id, int64_t start_us, int64_t end_us);
+extern int trace_dump(const char *file_name);
+extern void trace_teardown(void);